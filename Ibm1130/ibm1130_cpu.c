@@ -473,21 +473,18 @@ static const char *xio_funcs[] = {
     "func0?",  "write", "read",  "sense_irq",
     "control", "initw", "initr", "sense"
 };
-static int32 ibm1130_qcount ()
+static int32 ibm1130_qcount ()    /* count active units; the HEAP event queue can't be walked through next */
 {
     int32 i, cnt;
-    UNIT *uptr;
+    uint32 j;
     DEVICE *dptr;
 
     cnt = 0;
-    for (uptr = sim_clock_queue; uptr != QUEUE_LIST_END; uptr = uptr->next) {
-        dptr = find_dev_from_unit (uptr);
-        for (i=0; sim_devices[i]; i++)
-            if (dptr == sim_devices[i]) {
+    for (i=0; (dptr = sim_devices[i]) != NULL; i++)
+        for (j=0; j < dptr->numunits; j++)
+            if (sim_is_active(&dptr->units[j]))
                 cnt++;
-                break;
-            }
-    }
+
     return cnt;
 }
 
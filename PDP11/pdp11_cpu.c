@@ -267,6 +267,27 @@
 #define HIST_VLD        1                               /* make PC odd */
 #define HIST_ILNT       4                               /* max inst length */
 
+/* Table dispatch
+
+   With GCC or Clang, sim_instr can dispatch each instruction through a
+   table of 65536 label addresses, one per instruction word, instead of
+   decoding IR in the nested opcode switches.  The labels (DSP) sit on the
+   case labels of those switches, so both methods execute the same code.
+   Opcode 07 enters at its top level case, which adjusts srcspec before
+   decoding IR<11:9>.  Compile with PDP11_NO_DISPATCH_TABLE to omit it.
+*/
+
+#if defined (__GNUC__) && !defined (PDP11_NO_DISPATCH_TABLE)
+#define PDP11_DISPATCH_TABLE    1
+#define DSP(l)          dsp_##l:
+#else
+#define DSP(l)
+#endif
+#define DISP_SWITCH     0                               /* nested switches */
+#define DISP_TABLE      1                               /* label table */
+#define BENCH_PC        0001000                         /* benchmark start */
+#define BENCH_BUF       0001100                         /* benchmark data */
+
 typedef struct {
     uint16              pc;
     uint16              psw;
@@ -330,6 +351,9 @@ int16 reg_mods;                                         /* reg deltas */
 int32 last_pa;                                          /* pa from ReadMW/ReadMB */
 int32 saved_sim_interval;                               /* saved at inst start */
 t_stat reason;                                          /* stop reason */
+int32 cpu_dispatch = DISP_SWITCH;                       /* dispatch method */
+double cpu_run_inst = 0.0;                              /* last run: instructions */
+uint32 cpu_run_msec = 0;                                /* last run: host msec */
 
 extern int32 CPUERR, MAINT;
 extern CPUTAB cpu_tab[];
@@ -344,6 +368,9 @@ t_bool cpu_is_pc_a_subroutine_call (t_addr **ret_addrs);
 t_stat cpu_set_hist (UNIT *uptr, int32 val, CONST char *cptr, void *desc);
 t_stat cpu_show_hist (FILE *st, UNIT *uptr, int32 val, CONST void *desc);
 t_stat cpu_show_virt (FILE *st, UNIT *uptr, int32 val, CONST void *desc);
+t_stat cpu_set_dispatch (UNIT *uptr, int32 val, CONST char *cptr, void *desc);
+t_stat cpu_show_dispatch (FILE *st, UNIT *uptr, int32 val, CONST void *desc);
+t_stat cpu_set_bench (UNIT *uptr, int32 val, CONST char *cptr, void *desc);
 t_stat cpu_help (FILE *st, DEVICE *dptr, UNIT *uptr, int32 flag, const char *cptr);
 const char *cpu_description (DEVICE *dptr);
 int32 GeteaB (int32 spec);
@@ -694,6 +721,10 @@ MTAB cpu_mod[] = {
       &cpu_set_hist, &cpu_show_hist, NULL, "Enable/Display instruction history" },
     { MTAB_XTD|MTAB_VDV|MTAB_NMO|MTAB_SHP, 0, "VIRTUAL", NULL,
       NULL, &cpu_show_virt, NULL, "Display address translation" },
+    { MTAB_XTD|MTAB_VDV|MTAB_NMO, 0, "DISPATCH", "DISPATCH=SWITCH|TABLE",
+      &cpu_set_dispatch, &cpu_show_dispatch, NULL, "Set/Display instruction dispatch and last run speed" },
+    { MTAB_XTD|MTAB_VDV|MTAB_NMO, 0, NULL, "BENCHMARK{=n}",
+      &cpu_set_bench, NULL, NULL, "Load dispatch benchmark loop, n outer iterations" },
     { 0 }
     };
 
@@ -728,6 +759,65 @@ t_stat sim_instr (void)
 int abortval, i;
 volatile int32 trapea;                                  /* used by setjmp */
 InstHistory *hst_ent = NULL;
+uint32 start_msec = sim_os_msec ();                     /* for run speed */
+double start_inst = sim_gtime ();
+#if defined (PDP11_DISPATCH_TABLE)
+static void *dsp_tab[65536];                            /* label per IR */
+static t_bool dsp_init = FALSE;
+static void *const dsp_top[16] = {
+    NULL, &&dsp_01, &&dsp_02, &&dsp_03,
+    &&dsp_04, &&dsp_05, &&dsp_06, &&dsp_07,
+    NULL, &&dsp_11, &&dsp_12, &&dsp_13,
+    &&dsp_14, &&dsp_15, &&dsp_16, &&dsp_17
+    };
+static void *const dsp_op00[64] = {
+    &&dsp_00_000, &&dsp_00_001, &&dsp_00_002, &&dsp_00_003,
+    &&dsp_00_004, &&dsp_00_004, &&dsp_00_006, &&dsp_00_006,
+    &&dsp_00_010, &&dsp_00_010, &&dsp_00_012, &&dsp_00_012,
+    &&dsp_00_014, &&dsp_00_014, &&dsp_00_016, &&dsp_00_016,
+    &&dsp_00_020, &&dsp_00_020, &&dsp_00_022, &&dsp_00_022,
+    &&dsp_00_024, &&dsp_00_024, &&dsp_00_026, &&dsp_00_026,
+    &&dsp_00_030, &&dsp_00_030, &&dsp_00_032, &&dsp_00_032,
+    &&dsp_00_034, &&dsp_00_034, &&dsp_00_036, &&dsp_00_036,
+    &&dsp_00_040, &&dsp_00_040, &&dsp_00_040, &&dsp_00_040,
+    &&dsp_00_040, &&dsp_00_040, &&dsp_00_040, &&dsp_00_040,
+    &&dsp_00_050, &&dsp_00_051, &&dsp_00_052, &&dsp_00_053,
+    &&dsp_00_054, &&dsp_00_055, &&dsp_00_056, &&dsp_00_057,
+    &&dsp_00_060, &&dsp_00_061, &&dsp_00_062, &&dsp_00_063,
+    &&dsp_00_064, &&dsp_00_065, &&dsp_00_066, &&dsp_00_067,
+    &&dsp_00_070, &&dsp_00_dflt, &&dsp_00_072, &&dsp_00_073,
+    &&dsp_00_dflt, &&dsp_00_dflt, &&dsp_00_dflt, &&dsp_00_dflt
+    };
+static void *const dsp_op10[64] = {
+    &&dsp_10_000, &&dsp_10_000, &&dsp_10_002, &&dsp_10_002,
+    &&dsp_10_004, &&dsp_10_004, &&dsp_10_006, &&dsp_10_006,
+    &&dsp_10_010, &&dsp_10_010, &&dsp_10_012, &&dsp_10_012,
+    &&dsp_10_014, &&dsp_10_014, &&dsp_10_016, &&dsp_10_016,
+    &&dsp_10_020, &&dsp_10_020, &&dsp_10_022, &&dsp_10_022,
+    &&dsp_10_024, &&dsp_10_024, &&dsp_10_026, &&dsp_10_026,
+    &&dsp_10_030, &&dsp_10_030, &&dsp_10_032, &&dsp_10_032,
+    &&dsp_10_034, &&dsp_10_034, &&dsp_10_036, &&dsp_10_036,
+    &&dsp_10_040, &&dsp_10_040, &&dsp_10_040, &&dsp_10_040,
+    &&dsp_10_044, &&dsp_10_044, &&dsp_10_044, &&dsp_10_044,
+    &&dsp_10_050, &&dsp_10_051, &&dsp_10_052, &&dsp_10_053,
+    &&dsp_10_054, &&dsp_10_055, &&dsp_10_056, &&dsp_10_057,
+    &&dsp_10_060, &&dsp_10_061, &&dsp_10_062, &&dsp_10_063,
+    &&dsp_10_064, &&dsp_10_065, &&dsp_10_066, &&dsp_10_067,
+    &&dsp_10_dflt, &&dsp_10_dflt, &&dsp_10_dflt, &&dsp_10_dflt,
+    &&dsp_10_dflt, &&dsp_10_dflt, &&dsp_10_dflt, &&dsp_10_dflt
+    };
+
+if (!dsp_init) {                                        /* first time? */
+    for (i = 0; i < 65536; i++) {                       /* build table */
+        if ((i & 0170000) == 0000000)
+            dsp_tab[i] = dsp_op00[(i >> 6) & 077];
+        else if ((i & 0170000) == 0100000)
+            dsp_tab[i] = dsp_op10[(i >> 6) & 077];
+        else dsp_tab[i] = dsp_top[(i >> 12) & 017];
+        }
+    dsp_init = TRUE;
+    }
+#endif
 
 sim_vm_pc_value = &pdp11_pc_value;
 
@@ -1005,13 +1095,17 @@ while (reason == 0)  {
             hst_p = 0;
         }
     PC = (PC + 2) & 0177777;                            /* incr PC, mod 65k */
+#if defined (PDP11_DISPATCH_TABLE)
+    if (cpu_dispatch == DISP_TABLE)                     /* table dispatch? */
+        goto *dsp_tab[IR];
+#endif
     switch ((IR >> 12) & 017) {                         /* decode IR<15:12> */
 
 /* Opcode 0: no operands, specials, branches, JSR, SOPs */
 
     case 000:
         switch ((IR >> 6) & 077) {                      /* decode IR<11:6> */
-        case 000:                                       /* no operand */
+        case 000: DSP (00_000)                          /* no operand */
             if (IR >= 000010) {                         /* 000010 - 000077 */
                 setTRAP (TRAP_ILL);                     /* illegal */
                 break;
@@ -1084,7 +1178,7 @@ while (reason == 0)  {
                 }                                       /* end switch no ops */
             break;                                      /* end case no ops */
 
-        case 001:                                       /* JMP */
+        case 001: DSP (00_001)                          /* JMP */
             if (dstreg)
                 setTRAP (CPUT (HAS_JREG4)? TRAP_PRV: TRAP_ILL);
             else {
@@ -1098,7 +1192,7 @@ while (reason == 0)  {
                 }
             break;                                      /* end JMP */
 
-        case 002:                                       /* RTS et al*/
+        case 002: DSP (00_002)                          /* RTS et al*/
             if (IR < 000210) {                          /* RTS */
                 dstspec = dstspec & 07;
                 if (hst_ent)
@@ -1143,7 +1237,7 @@ while (reason == 0)  {
                 C = 1;
             break;                                      /* end case RTS et al */
 
-        case 003:                                       /* SWAB */
+        case 003: DSP (00_003)                          /* SWAB */
             dst = dstreg? R[dstspec]: ReadMW (GeteaW (dstspec));
             dst = ((dst & 0377) << 8) | ((dst >> 8) & 0377);
             N = GET_SIGN_B (dst & 0377);
@@ -1158,86 +1252,86 @@ while (reason == 0)  {
             else PWriteW (dst, last_pa);
             break;                                      /* end SWAB */
 
-        case 004: case 005:                             /* BR */
+        case 004: case 005: DSP (00_004)                /* BR */
             BRANCH_F (IR);
             break;
 
-        case 006: case 007:                             /* BR */
+        case 006: case 007: DSP (00_006)                /* BR */
             BRANCH_B (IR);
             break;
 
-        case 010: case 011:                             /* BNE */
+        case 010: case 011: DSP (00_010)                /* BNE */
             if (Z == 0) {
                 BRANCH_F (IR);
                 } 
             break;
 
-        case 012: case 013:                             /* BNE */
+        case 012: case 013: DSP (00_012)                /* BNE */
             if (Z == 0) {
                 BRANCH_B (IR);
                 }
             break;
 
-        case 014: case 015:                             /* BEQ */
+        case 014: case 015: DSP (00_014)                /* BEQ */
             if (Z) {
                 BRANCH_F (IR);
                 } 
             break;
 
-        case 016: case 017:                             /* BEQ */
+        case 016: case 017: DSP (00_016)                /* BEQ */
             if (Z) {
                 BRANCH_B (IR);
                 }
             break;
 
-        case 020: case 021:                             /* BGE */
+        case 020: case 021: DSP (00_020)                /* BGE */
             if ((N ^ V) == 0) {
                 BRANCH_F (IR);
                 } 
             break;
 
-        case 022: case 023:                             /* BGE */
+        case 022: case 023: DSP (00_022)                /* BGE */
             if ((N ^ V) == 0) {
                 BRANCH_B (IR);
                 }
             break;
 
-        case 024: case 025:                             /* BLT */
+        case 024: case 025: DSP (00_024)                /* BLT */
             if (N ^ V) {
                 BRANCH_F (IR);
                 }
             break;
 
-        case 026: case 027:                             /* BLT */
+        case 026: case 027: DSP (00_026)                /* BLT */
             if (N ^ V) {
                 BRANCH_B (IR);
                 }
             break;
 
-        case 030: case 031:                             /* BGT */
+        case 030: case 031: DSP (00_030)                /* BGT */
             if ((Z | (N ^ V)) == 0) {
                 BRANCH_F (IR);
                 } 
             break;
 
-        case 032: case 033:                             /* BGT */
+        case 032: case 033: DSP (00_032)                /* BGT */
             if ((Z | (N ^ V)) == 0) { BRANCH_B (IR); }
             break;
 
-        case 034: case 035:                             /* BLE */
+        case 034: case 035: DSP (00_034)                /* BLE */
             if (Z | (N ^ V)) {
                 BRANCH_F (IR);
                 } 
             break;
 
-        case 036: case 037:                             /* BLE */
+        case 036: case 037: DSP (00_036)                /* BLE */
             if (Z | (N ^ V)) {
                 BRANCH_B (IR);
                 }
             break;
 
         case 040: case 041: case 042: case 043:         /* JSR */
-        case 044: case 045: case 046: case 047:
+        case 044: case 045: case 046: case 047: DSP (00_040)
             if (dstreg)
                 setTRAP (CPUT (HAS_JREG4)? TRAP_PRV: TRAP_ILL);
             else {
@@ -1260,7 +1354,7 @@ while (reason == 0)  {
                 }
             break;                                      /* end JSR */
 
-        case 050:                                       /* CLR */
+        case 050: DSP (00_050)                          /* CLR */
             N = V = C = 0;
             Z = 1;
             if (hst_ent)
@@ -1270,7 +1364,7 @@ while (reason == 0)  {
             else WriteW (0, GeteaW (dstspec));
             break;
 
-        case 051:                                       /* COM */
+        case 051: DSP (00_051)                          /* COM */
             dst = dstreg? R[dstspec]: ReadMW (GeteaW (dstspec));
             dst = dst ^ 0177777;
             N = GET_SIGN_W (dst);
@@ -1284,7 +1378,7 @@ while (reason == 0)  {
             else PWriteW (dst, last_pa);
             break;
 
-        case 052:                                       /* INC */
+        case 052: DSP (00_052)                          /* INC */
             dst = dstreg? R[dstspec]: ReadMW (GeteaW (dstspec));
             dst = (dst + 1) & 0177777;
             N = GET_SIGN_W (dst);
@@ -1297,7 +1391,7 @@ while (reason == 0)  {
             else PWriteW (dst, last_pa);
             break;
 
-        case 053:                                       /* DEC */
+        case 053: DSP (00_053)                          /* DEC */
             dst = dstreg? R[dstspec]: ReadMW (GeteaW (dstspec));
             dst = (dst - 1) & 0177777;
             N = GET_SIGN_W (dst);
@@ -1310,7 +1404,7 @@ while (reason == 0)  {
             else PWriteW (dst, last_pa);
             break;
 
-        case 054:                                       /* NEG */
+        case 054: DSP (00_054)                          /* NEG */
             dst = dstreg? R[dstspec]: ReadMW (GeteaW (dstspec));
             dst = (-dst) & 0177777;
             N = GET_SIGN_W (dst);
@@ -1324,7 +1418,7 @@ while (reason == 0)  {
             else PWriteW (dst, last_pa);
             break;
 
-        case 055:                                       /* ADC */
+        case 055: DSP (00_055)                          /* ADC */
             dst = dstreg? R[dstspec]: ReadMW (GeteaW (dstspec));
             dst = (dst + C) & 0177777;
             N = GET_SIGN_W (dst);
@@ -1338,7 +1432,7 @@ while (reason == 0)  {
             else PWriteW (dst, last_pa);
             break;
 
-        case 056:                                       /* SBC */
+        case 056: DSP (00_056)                          /* SBC */
             dst = dstreg? R[dstspec]: ReadMW (GeteaW (dstspec));
             dst = (dst - C) & 0177777;
             N = GET_SIGN_W (dst);
@@ -1352,7 +1446,7 @@ while (reason == 0)  {
             else PWriteW (dst, last_pa);
             break;
 
-        case 057:                                       /* TST */
+        case 057: DSP (00_057)                          /* TST */
             dst = dstreg? R[dstspec]: ReadW (GeteaW (dstspec));
             if (hst_ent)
                 hst_ent->dst = dst;
@@ -1361,7 +1455,7 @@ while (reason == 0)  {
             V = C = 0;
             break;
 
-        case 060:                                       /* ROR */
+        case 060: DSP (00_060)                          /* ROR */
             src = dstreg? R[dstspec]: ReadMW (GeteaW (dstspec));
             dst = (src >> 1) | (C << 15);
             N = GET_SIGN_W (dst);
@@ -1375,7 +1469,7 @@ while (reason == 0)  {
             else PWriteW (dst, last_pa);
             break;
 
-        case 061:                                       /* ROL */
+        case 061: DSP (00_061)                          /* ROL */
             src = dstreg? R[dstspec]: ReadMW (GeteaW (dstspec));
             dst = ((src << 1) | C) & 0177777;
             N = GET_SIGN_W (dst);
@@ -1389,7 +1483,7 @@ while (reason == 0)  {
             else PWriteW (dst, last_pa);
             break;
 
-        case 062:                                       /* ASR */
+        case 062: DSP (00_062)                          /* ASR */
             src = dstreg? R[dstspec]: ReadMW (GeteaW (dstspec));
             dst = (src >> 1) | (src & 0100000);
             N = GET_SIGN_W (dst);
@@ -1403,7 +1497,7 @@ while (reason == 0)  {
             else PWriteW (dst, last_pa);
             break;
 
-        case 063:                                       /* ASL */
+        case 063: DSP (00_063)                          /* ASL */
             src = dstreg? R[dstspec]: ReadMW (GeteaW (dstspec));
             dst = (src << 1) & 0177777;
             N = GET_SIGN_W (dst);
@@ -1422,7 +1516,7 @@ while (reason == 0)  {
    - MxPI must set MMR1 for SP recovery in case of fault
 */
 
-        case 064:                                       /* MARK */
+        case 064: DSP (00_064)                          /* MARK */
             if (CPUT (HAS_MARK)) {
                 i = (PC + dstspec + dstspec) & 0177777;
                 JMP_PC (R[5]);
@@ -1432,7 +1526,7 @@ while (reason == 0)  {
             else setTRAP (TRAP_ILL);
             break;
 
-        case 065:                                       /* MFPI */
+        case 065: DSP (00_065)                          /* MFPI */
             if (CPUT (HAS_MXPY)) {
                 if (dstreg) {
                     if ((dstspec == 6) && (cm != pm))
@@ -1459,7 +1553,7 @@ while (reason == 0)  {
             else setTRAP (TRAP_ILL);
             break;
 
-        case 066:                                       /* MTPI */
+        case 066: DSP (00_066)                          /* MTPI */
             if (CPUT (HAS_MXPY)) {
                 dst = ReadW (SP | dsenable);
                 N = GET_SIGN_W (dst);
@@ -1480,7 +1574,7 @@ while (reason == 0)  {
             else setTRAP (TRAP_ILL);
             break;
 
-        case 067:                                       /* SXT */
+        case 067: DSP (00_067)                          /* SXT */
             if (CPUT (HAS_SXS)) {
                 dst = N? 0177777: 0;
                 Z = N ^ 1;
@@ -1494,7 +1588,7 @@ while (reason == 0)  {
             else setTRAP (TRAP_ILL);
             break;
 
-        case 070:                                       /* CSM */
+        case 070: DSP (00_070)                          /* CSM */
             if (CPUT (HAS_CSM) && (MMR3 & MMR3_CSM) && (cm != MD_KER)) {
                 dst = dstreg? R[dstspec]: ReadW (GeteaW (dstspec));
                 PSW = get_PSW () & ~PSW_CC;             /* PSW, cc = 0 */
@@ -1513,7 +1607,7 @@ while (reason == 0)  {
             else setTRAP (TRAP_ILL);
             break;
 
-        case 072:                                       /* TSTSET */
+        case 072: DSP (00_072)                          /* TSTSET */
             if (CPUT (HAS_TSWLK) && !dstreg) {
                 dst = ReadMW (GeteaW (dstspec));
                 N = GET_SIGN_W (dst);
@@ -1528,7 +1622,7 @@ while (reason == 0)  {
             else setTRAP (TRAP_ILL);
             break;
 
-        case 073:                                       /* WRTLCK */
+        case 073: DSP (00_073)                          /* WRTLCK */
             if (CPUT (HAS_TSWLK) && !dstreg) {
                 N = GET_SIGN_W (R[0]);
                 Z = GET_Z (R[0]);
@@ -1540,7 +1634,7 @@ while (reason == 0)  {
             else setTRAP (TRAP_ILL);
             break;
 
-        default:
+        default: DSP (00_dflt)
             setTRAP (TRAP_ILL);
             break;
             }                                           /* end switch SOPs */
@@ -1557,7 +1651,7 @@ while (reason == 0)  {
    Cmp: v = [sign (src) != sign (src2)] and [sign (src2) = sign (result)]
 */
 
-    case 001:                                           /* MOV */
+    case 001: DSP (01)                                  /* MOV */
         if (CPUT (IS_SDSD) && srcreg && !dstreg) {      /* R,not R */
             ea = GeteaW (dstspec);
             dst = R[srcspec];
@@ -1579,7 +1673,7 @@ while (reason == 0)  {
         else WriteW (dst, ea);
         break;
 
-    case 002:                                           /* CMP */
+    case 002: DSP (02)                                  /* CMP */
         if (CPUT (IS_SDSD) && srcreg && !dstreg) {      /* R,not R */
             src2 = ReadW (GeteaW (dstspec));
             src = R[srcspec];
@@ -1599,7 +1693,7 @@ while (reason == 0)  {
         C = (src < src2);
         break;
 
-    case 003:                                           /* BIT */
+    case 003: DSP (03)                                  /* BIT */
         if (CPUT (IS_SDSD) && srcreg && !dstreg) {      /* R,not R */
             src2 = ReadW (GeteaW (dstspec));
             src = R[srcspec];
@@ -1618,7 +1712,7 @@ while (reason == 0)  {
         V = 0;
         break;
 
-    case 004:                                           /* BIC */
+    case 004: DSP (04)                                  /* BIC */
         if (CPUT (IS_SDSD) && srcreg && !dstreg) {      /* R,not R */
             src2 = ReadMW (GeteaW (dstspec));
             src = R[srcspec];
@@ -1640,7 +1734,7 @@ while (reason == 0)  {
         else PWriteW (dst, last_pa);
         break;
 
-    case 005:                                           /* BIS */
+    case 005: DSP (05)                                  /* BIS */
         if (CPUT (IS_SDSD) && srcreg && !dstreg) {      /* R,not R */
             src2 = ReadMW (GeteaW (dstspec));
             src = R[srcspec];
@@ -1662,7 +1756,7 @@ while (reason == 0)  {
         else PWriteW (dst, last_pa);
         break;
 
-    case 006:                                           /* ADD */
+    case 006: DSP (06)                                  /* ADD */
         if (CPUT (IS_SDSD) && srcreg && !dstreg) {      /* R,not R */
             src2 = ReadMW (GeteaW (dstspec));
             src = R[srcspec];
@@ -1702,7 +1796,7 @@ while (reason == 0)  {
      extends, then the shift and conditional or does sign extension.
 */
 
-    case 007:
+    case 007: DSP (07)
         srcspec = srcspec & 07;
         switch ((IR >> 9) & 07)  {                      /* decode IR<11:9> */
 
@@ -1911,111 +2005,111 @@ while (reason == 0)  {
     case 010:
         switch ((IR >> 6) & 077) {                      /* decode IR<11:6> */
 
-        case 000: case 001:                             /* BPL */
+        case 000: case 001: DSP (10_000)                /* BPL */
             if (N == 0) {
                 BRANCH_F (IR);
                 } 
             break;
 
-        case 002: case 003:                             /* BPL */
+        case 002: case 003: DSP (10_002)                /* BPL */
             if (N == 0) {
                 BRANCH_B (IR);
                 }
             break;
 
-        case 004: case 005:                             /* BMI */
+        case 004: case 005: DSP (10_004)                /* BMI */
             if (N) {
                 BRANCH_F (IR);
                 } 
             break;
 
-        case 006: case 007:                             /* BMI */
+        case 006: case 007: DSP (10_006)                /* BMI */
             if (N) {
                 BRANCH_B (IR);
                 }
             break;
 
-        case 010: case 011:                             /* BHI */
+        case 010: case 011: DSP (10_010)                /* BHI */
             if ((C | Z) == 0) {
                 BRANCH_F (IR);
                 } 
             break;
 
-        case 012: case 013:                             /* BHI */
+        case 012: case 013: DSP (10_012)                /* BHI */
             if ((C | Z) == 0) {
                 BRANCH_B (IR);
                 }
             break;
 
-        case 014: case 015:                             /* BLOS */
+        case 014: case 015: DSP (10_014)                /* BLOS */
             if (C | Z) {
                 BRANCH_F (IR);
                 } 
             break;
 
-        case 016: case 017:                             /* BLOS */
+        case 016: case 017: DSP (10_016)                /* BLOS */
             if (C | Z) {
                 BRANCH_B (IR);
                 }
             break;
 
-        case 020: case 021:                             /* BVC */
+        case 020: case 021: DSP (10_020)                /* BVC */
             if (V == 0) {
                 BRANCH_F (IR);
                 } 
             break;
 
-        case 022: case 023:                             /* BVC */
+        case 022: case 023: DSP (10_022)                /* BVC */
             if (V == 0) {
                 BRANCH_B (IR);
                 }
             break;
 
-        case 024: case 025:                             /* BVS */
+        case 024: case 025: DSP (10_024)                /* BVS */
             if (V) {
                 BRANCH_F (IR);
                 } 
             break;
 
-        case 026: case 027:                             /* BVS */
+        case 026: case 027: DSP (10_026)                /* BVS */
             if (V) {
                 BRANCH_B (IR);
                 }
             break;
 
-        case 030: case 031:                             /* BCC */
+        case 030: case 031: DSP (10_030)                /* BCC */
             if (C == 0) {
                 BRANCH_F (IR);
                 } 
             break;
 
-        case 032: case 033:                             /* BCC */
+        case 032: case 033: DSP (10_032)                /* BCC */
             if (C == 0) {
                 BRANCH_B (IR);
                 }
             break;
 
-        case 034: case 035:                             /* BCS */
+        case 034: case 035: DSP (10_034)                /* BCS */
             if (C) {
                 BRANCH_F (IR);
                 } 
             break;
 
-        case 036: case 037:                             /* BCS */
+        case 036: case 037: DSP (10_036)                /* BCS */
             if (C) {
                 BRANCH_B (IR);
                 }
             break;
 
-        case 040: case 041: case 042: case 043:         /* EMT */
+        case 040: case 041: case 042: case 043: DSP (10_040) /* EMT */
             setTRAP (TRAP_EMT);
             break;
 
-        case 044: case 045: case 046: case 047:         /* TRAP */
+        case 044: case 045: case 046: case 047: DSP (10_044) /* TRAP */
             setTRAP (TRAP_TRAP);
             break;
 
-        case 050:                                       /* CLRB */
+        case 050: DSP (10_050)                          /* CLRB */
             N = V = C = 0;
             Z = 1;
             if (dstreg)
@@ -2028,7 +2122,7 @@ while (reason == 0)  {
             }
             break;
 
-        case 051:                                       /* COMB */
+        case 051: DSP (10_051)                          /* COMB */
             dst = dstreg? R[dstspec]: ReadMB (GeteaB (dstspec));
             dst = (dst ^ 0377) & 0377;
             N = GET_SIGN_B (dst);
@@ -2045,7 +2139,7 @@ while (reason == 0)  {
             }
             break;
 
-        case 052:                                       /* INCB */
+        case 052: DSP (10_052)                          /* INCB */
             dst = dstreg? R[dstspec]: ReadMB (GeteaB (dstspec));
             dst = (dst + 1) & 0377;
             N = GET_SIGN_B (dst);
@@ -2061,7 +2155,7 @@ while (reason == 0)  {
             }
             break;
 
-        case 053:                                       /* DECB */
+        case 053: DSP (10_053)                          /* DECB */
             dst = dstreg? R[dstspec]: ReadMB (GeteaB (dstspec));
             dst = (dst - 1) & 0377;
             N = GET_SIGN_B (dst);
@@ -2077,7 +2171,7 @@ while (reason == 0)  {
             }
             break;
 
-        case 054:                                       /* NEGB */
+        case 054: DSP (10_054)                          /* NEGB */
             dst = dstreg? R[dstspec]: ReadMB (GeteaB (dstspec));
             dst = (-dst) & 0377;
             N = GET_SIGN_B (dst);
@@ -2094,7 +2188,7 @@ while (reason == 0)  {
             }
             break;
 
-        case 055:                                       /* ADCB */
+        case 055: DSP (10_055)                          /* ADCB */
             dst = dstreg? R[dstspec]: ReadMB (GeteaB (dstspec));
             dst = (dst + C) & 0377;
             N = GET_SIGN_B (dst);
@@ -2111,7 +2205,7 @@ while (reason == 0)  {
             }
             break;
 
-        case 056:                                       /* SBCB */
+        case 056: DSP (10_056)                          /* SBCB */
             dst = dstreg? R[dstspec]: ReadMB (GeteaB (dstspec));
             dst = (dst - C) & 0377;
             N = GET_SIGN_B (dst);
@@ -2128,7 +2222,7 @@ while (reason == 0)  {
             }
             break;
 
-        case 057:                                       /* TSTB */
+        case 057: DSP (10_057)                          /* TSTB */
             dst = dstreg? R[dstspec] & 0377: ReadB (GeteaB (dstspec));
             if (hst_ent)
                 hst_ent->dst = dst;
@@ -2137,7 +2231,7 @@ while (reason == 0)  {
             V = C = 0;
             break;
 
-        case 060:                                       /* RORB */
+        case 060: DSP (10_060)                          /* RORB */
             src = dstreg? R[dstspec]: ReadMB (GeteaB (dstspec));
             dst = ((src & 0377) >> 1) | (C << 7);
             N = GET_SIGN_B (dst);
@@ -2154,7 +2248,7 @@ while (reason == 0)  {
             }
             break;
 
-        case 061:                                       /* ROLB */
+        case 061: DSP (10_061)                          /* ROLB */
             src = dstreg? R[dstspec]: ReadMB (GeteaB (dstspec));
             dst = ((src << 1) | C) & 0377;
             N = GET_SIGN_B (dst);
@@ -2171,7 +2265,7 @@ while (reason == 0)  {
             }
             break;
 
-        case 062:                                       /* ASRB */
+        case 062: DSP (10_062)                          /* ASRB */
             src = dstreg? R[dstspec]: ReadMB (GeteaB (dstspec));
             dst = ((src & 0377) >> 1) | (src & 0200);
             N = GET_SIGN_B (dst);
@@ -2188,7 +2282,7 @@ while (reason == 0)  {
             }
             break;
 
-        case 063:                                       /* ASLB */
+        case 063: DSP (10_063)                          /* ASLB */
             src = dstreg? R[dstspec]: ReadMB (GeteaB (dstspec));
             dst = (src << 1) & 0377;
             N = GET_SIGN_B (dst);
@@ -2211,7 +2305,7 @@ while (reason == 0)  {
    - MxPD must set MMR1 for SP recovery in case of fault
 */
 
-        case 064:                                       /* MTPS */
+        case 064: DSP (10_064)                          /* MTPS */
             if (CPUT (HAS_MXPS)) {
                 dst = dstreg? R[dstspec]: ReadB (GeteaB (dstspec));
                 if (cm == MD_KER) {
@@ -2226,7 +2320,7 @@ while (reason == 0)  {
             else setTRAP (TRAP_ILL);
             break;
 
-        case 065:                                       /* MFPD */
+        case 065: DSP (10_065)                          /* MFPD */
             if (CPUT (HAS_MXPY)) {
                 if (dstreg) {
                     if ((dstspec == 6) && (cm != pm))
@@ -2250,7 +2344,7 @@ while (reason == 0)  {
             else setTRAP (TRAP_ILL);
             break;
 
-        case 066:                                       /* MTPD */
+        case 066: DSP (10_066)                          /* MTPD */
             if (CPUT (HAS_MXPY)) {
                 dst = ReadW (SP | dsenable);
                 N = GET_SIGN_W (dst);
@@ -2272,7 +2366,7 @@ while (reason == 0)  {
             else setTRAP (TRAP_ILL);
             break;
 
-        case 067:                                       /* MFPS */
+        case 067: DSP (10_067)                          /* MFPS */
             if (CPUT (HAS_MXPS)) {
                 dst = get_PSW () & 0377;
                 N = GET_SIGN_B (dst);
@@ -2285,7 +2379,7 @@ while (reason == 0)  {
             else setTRAP (TRAP_ILL);
             break;
 
-        default:
+        default: DSP (10_dflt)
             setTRAP (TRAP_ILL);
             break;
             }                                           /* end switch SOPs */
@@ -2297,7 +2391,7 @@ while (reason == 0)  {
    Sub: v = [sign (src) != sign (src2)] and [sign (src) = sign (result)]
 */
 
-    case 011:                                           /* MOVB */
+    case 011: DSP (11)                                  /* MOVB */
         if (CPUT (IS_SDSD) && srcreg && !dstreg) {      /* R,not R */
             ea = GeteaB (dstspec);
             dst = R[srcspec] & 0377;
@@ -2319,7 +2413,7 @@ while (reason == 0)  {
             }
         break;
 
-    case 012:                                           /* CMPB */
+    case 012: DSP (12)                                  /* CMPB */
         if (CPUT (IS_SDSD) && srcreg && !dstreg) {      /* R,not R */
             src2 = ReadB (GeteaB (dstspec));
             src = R[srcspec] & 0377;
@@ -2339,7 +2433,7 @@ while (reason == 0)  {
         C = (src < src2);
         break;
 
-    case 013:                                           /* BITB */
+    case 013: DSP (13)                                  /* BITB */
         if (CPUT (IS_SDSD) && srcreg && !dstreg) {      /* R,not R */
             src2 = ReadB (GeteaB (dstspec));
             src = R[srcspec] & 0377;
@@ -2358,7 +2452,7 @@ while (reason == 0)  {
         V = 0;
         break;
 
-    case 014:                                           /* BICB */
+    case 014: DSP (14)                                  /* BICB */
         if (CPUT (IS_SDSD) && srcreg && !dstreg) {      /* R,not R */
             src2 = ReadMB (GeteaB (dstspec));
             src = R[srcspec];
@@ -2380,7 +2474,7 @@ while (reason == 0)  {
         else PWriteB (dst, last_pa);
         break;
 
-    case 015:                                           /* BISB */
+    case 015: DSP (15)                                  /* BISB */
         if (CPUT (IS_SDSD) && srcreg && !dstreg) {      /* R,not R */
             src2 = ReadMB (GeteaB (dstspec));
             src = R[srcspec];
@@ -2402,7 +2496,7 @@ while (reason == 0)  {
         else PWriteB (dst, last_pa);
         break;
 
-    case 016:                                           /* SUB */
+    case 016: DSP (16)                                  /* SUB */
         if (CPUT (IS_SDSD) && srcreg && !dstreg) {      /* R,not R */
             src2 = ReadMW (GeteaW (dstspec));
             src = R[srcspec];
@@ -2427,7 +2521,7 @@ while (reason == 0)  {
 
 /* Opcode 17: floating point */
 
-    case 017:
+    case 017: DSP (17)
         if (CPUO (OPT_FPP))
             fp11 (IR);                  /* call fpp */
         else setTRAP (TRAP_ILL);
@@ -2437,6 +2531,8 @@ while (reason == 0)  {
 
 /* Simulation halted */
 
+cpu_run_inst = sim_gtime () - start_inst;               /* record run speed */
+cpu_run_msec = sim_os_msec () - start_msec;
 PSW = get_PSW ();
 for (i = 0; i < 6; i++)
     REGFILE[i][rs] = R[i];
@@ -3683,6 +3779,88 @@ fprintf (of, "Invalid argument\n");
 return SCPE_OK;
 }
 
+/* Set instruction dispatch */
+
+t_stat cpu_set_dispatch (UNIT *uptr, int32 val, CONST char *cptr, void *desc)
+{
+if (cptr == NULL)
+    return SCPE_ARG;
+if (MATCH_CMD (cptr, "SWITCH") == 0)
+    cpu_dispatch = DISP_SWITCH;
+else if (MATCH_CMD (cptr, "TABLE") == 0) {
+#if defined (PDP11_DISPATCH_TABLE)
+    cpu_dispatch = DISP_TABLE;
+#else
+    return sim_messagef (SCPE_NOFNC, "Table dispatch is not available in this build\n");
+#endif
+    }
+else return SCPE_ARG;
+return SCPE_OK;
+}
+
+/* Show instruction dispatch and speed of the last run */
+
+t_stat cpu_show_dispatch (FILE *st, UNIT *uptr, int32 val, CONST void *desc)
+{
+fprintf (st, "dispatch=%s", (cpu_dispatch == DISP_TABLE)? "TABLE": "SWITCH");
+if (cpu_run_msec != 0)
+    fprintf (st, ", last run %.0f instructions in %u msec (%.2f MIPS)",
+             cpu_run_inst, cpu_run_msec, cpu_run_inst / (1000.0 * cpu_run_msec));
+fprintf (st, "\n");
+return SCPE_OK;
+}
+
+/* Load dispatch benchmark
+
+   The loop exercises double and single operand instructions, byte
+   operations, branches and a subroutine call, 14 or 15 instructions per
+   inner iteration, 256 inner iterations per outer iteration.  It runs in
+   kernel mode at IPL 7 with memory management off and HALTs when done.
+*/
+
+static const uint16 bench_rom[] = {
+    0012700, 0000000,                                   /* MOV #n,R0 */
+    0012701, 0000400,                                   /* L1: MOV #256.,R1 */
+    0012702, BENCH_BUF,                                 /* MOV #BUF,R2 */
+    0010322,                                            /* L2: MOV R3,(R2)+ */
+    0060103,                                            /* ADD R1,R3 */
+    0020304,                                            /* CMP R3,R4 */
+    0001001,                                            /* BNE .+4 */
+    0005204,                                            /* INC R4 */
+    0110305,                                            /* MOVB R3,R5 */
+    0006305,                                            /* ASL R5 */
+    0042705, 0177400,                                   /* BIC #177400,R5 */
+    0050504,                                            /* BIS R5,R4 */
+    0004767, 0000016,                                   /* JSR PC,SUB */
+    0162702, 0000002,                                   /* SUB #2,R2 */
+    0005301,                                            /* DEC R1 */
+    0001360,                                            /* BNE L2 */
+    0005300,                                            /* DEC R0 */
+    0001352,                                            /* BNE L1 */
+    0000000,                                            /* HALT */
+    0005104,                                            /* SUB: COM R4 */
+    0000207                                             /* RTS PC */
+    };
+
+t_stat cpu_set_bench (UNIT *uptr, int32 val, CONST char *cptr, void *desc)
+{
+int32 i, n = 4000;
+t_stat r;
+
+if (cptr) {
+    n = (int32) get_uint (cptr, 10, 0177777, &r);
+    if ((r != SCPE_OK) || (n == 0))
+        return SCPE_ARG;
+    }
+for (i = 0; i < (int32) (sizeof (bench_rom) / sizeof (bench_rom[0])); i++)
+    M[(BENCH_PC >> 1) + i] = bench_rom[i];
+M[(BENCH_PC >> 1) + 1] = (uint16) n;                    /* outer count */
+MMR0 = MMR0 & ~MMR0_MME;                                /* mem mgt off */
+STACKFILE[MD_KER] = BENCH_PC;                           /* stack below loop */
+cpu_set_boot (BENCH_PC);                                /* PC, kernel, IPL 7 */
+return SCPE_OK;
+}
+
 const char *cpu_description (DEVICE *dptr)
 {
 return "PDP-11 CPU";
@@ -3749,6 +3927,19 @@ fprintf (st, "     SET CPU HISTORY=n        enable history, length = n\n");
 fprintf (st, "     SHOW CPU HISTORY         print CPU history\n");
 fprintf (st, "     SHOW CPU HISTORY=n       print first n entries of CPU history\n\n");
 fprintf (st, "The maximum length for the history is 262144 entries.\n\n");
+fprintf (st, "When built with GCC or Clang, the CPU can dispatch instructions through a\n");
+fprintf (st, "65536 entry table instead of nested switch statements:\n\n");
+fprintf (st, "     SET CPU DISPATCH=SWITCH  decode with switch statements (default)\n");
+fprintf (st, "     SET CPU DISPATCH=TABLE   dispatch with a table of handlers\n");
+fprintf (st, "     SHOW CPU DISPATCH        show method and speed of the last run\n\n");
+fprintf (st, "To compare the methods, SET CPU BENCHMARK{=n} loads an instruction mix\n");
+fprintf (st, "at 1000 that runs about n*3600 instructions (default n = 4000) and halts:\n\n");
+fprintf (st, "     sim> SET CPU DISPATCH=SWITCH\n");
+fprintf (st, "     sim> SET CPU BENCHMARK\n");
+fprintf (st, "     sim> GO\n");
+fprintf (st, "     sim> SHOW CPU DISPATCH\n\n");
+fprintf (st, "then repeat with DISPATCH=TABLE.  The benchmark overwrites memory from 776\n");
+fprintf (st, "to 1100 and turns off memory management.\n\n");
 
 fprintf (st, "Unibus and Qbus DMA Devices\n\n");
 fprintf (st, "DMA peripherals function differently, depending on whether the CPU type\n");
@@ -439,8 +439,20 @@ MTAB rk_mod[] = {
       NULL, NULL, NULL, "Set type based on file size at attach" },
     { UNIT_NOAUTO, UNIT_NOAUTO, "noautosize",   "NOAUTOSIZE",   
       NULL, NULL, NULL, "Disable disk autosize on attach" },
-    { MTAB_XTD|MTAB_VUN|MTAB_VALR, 0, "FORMAT", "FORMAT={AUTO|SIMH|VHD|RAW}",
+    { MTAB_XTD|MTAB_VUN|MTAB_VALR, 0, "FORMAT", "FORMAT={AUTO|SIMH|VHD|RAW|DEDUP}",
       &sim_disk_set_fmt, &sim_disk_show_fmt, NULL, "Set/Display disk format" },
+    { MTAB_XTD|MTAB_VUN, 0, "MAPPING", "NOMAPPED",
+      &sim_disk_set_mapped, &sim_disk_show_mapped, NULL, "Access container with file I/O" },
+    { MTAB_XTD|MTAB_VUN, 1, NULL, "MAPPED",
+      &sim_disk_set_mapped, NULL, NULL, "Memory map container when attached" },
+    { MTAB_XTD|MTAB_VUN, 2, NULL, "SCRATCH",
+      &sim_disk_set_mapped, NULL, NULL, "Memory map container, discard changes on detach" },
+    { MTAB_XTD|MTAB_VUN, 0, "OVERLAY", "DISCARD",
+      &sim_disk_set_overlay, &sim_disk_show_overlay, NULL, "Discard the writes held in the overlay" },
+    { MTAB_XTD|MTAB_VUN, 1, NULL, "COMMIT",
+      &sim_disk_set_overlay, NULL, NULL, "Write the overlay to the container" },
+    { MTAB_XTD|MTAB_VUN|MTAB_NMO, 0, "STATISTICS", "STATISTICS",
+      &sim_disk_set_stats, &sim_disk_show_stats, NULL, "Display or reset host I/O statistics" },
     { MTAB_XTD|MTAB_VDV|MTAB_VALR, 010, "ADDRESS", "ADDRESS",
         &set_addr, &show_addr, NULL, "Bus address" },
     { MTAB_XTD|MTAB_VDV|MTAB_VALR, 0, "VECTOR", "VECTOR",
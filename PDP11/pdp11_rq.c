@@ -172,6 +172,7 @@ extern int32 MMR2;
 #define unit_plug       u4                              /* drive unit plug value */
 #define io_status       u5                              /* io status from callback */
 #define io_complete     u6                              /* io completion flag */
+#define io_pieces       u3                              /* queued pieces outstanding */
 /* we can re-use filebuf because we don't set UNIT_BUFABLE in flags */
 #define rqxb            filebuf                         /* xfer buffer */
 #define RQ_RMV(u)       ((drv_tab[GET_DTYPE (u->flags)].flgs & RQDF_RMV)? \
@@ -1386,8 +1387,30 @@ MTAB rq_mod[] = {
       &rq_set_drives, NULL, NULL, "Set Number of Drives" },
     { UNIT_NOAUTO, UNIT_NOAUTO, "noautosize", "NOAUTOSIZE", NULL, NULL, NULL, "Disable disk autosize on attach" },
     { UNIT_NOAUTO,           0, "autosize",   "AUTOSIZE",   NULL, NULL, NULL, "Enable disk autosize on attach" },
-    { MTAB_XTD|MTAB_VUN|MTAB_VALR, 0, "FORMAT", "FORMAT={AUTO|SIMH|VHD|RAW}",
+    { MTAB_XTD|MTAB_VUN|MTAB_VALR, 0, "FORMAT", "FORMAT={AUTO|SIMH|VHD|RAW|DEDUP}",
       &sim_disk_set_fmt, &sim_disk_show_fmt, NULL, "Set/Display disk format" },
+    { MTAB_XTD|MTAB_VUN|MTAB_VALR, 0, "ASYNCH", "ASYNCH=depth (1-16)",
+      &sim_disk_set_asynch_depth, &sim_disk_show_asynch_depth, NULL, "Set/Display host I/O queue depth" },
+    { MTAB_XTD|MTAB_VUN, 0, "MAPPING", "NOMAPPED",
+      &sim_disk_set_mapped, &sim_disk_show_mapped, NULL, "Access container with file I/O" },
+    { MTAB_XTD|MTAB_VUN, 1, NULL, "MAPPED",
+      &sim_disk_set_mapped, NULL, NULL, "Memory map container when attached" },
+    { MTAB_XTD|MTAB_VUN, 2, NULL, "SCRATCH",
+      &sim_disk_set_mapped, NULL, NULL, "Memory map container, discard changes on detach" },
+    { MTAB_XTD|MTAB_VUN, 0, "OVERLAY", "DISCARD",
+      &sim_disk_set_overlay, &sim_disk_show_overlay, NULL, "Discard the writes held in the overlay" },
+    { MTAB_XTD|MTAB_VUN, 1, NULL, "COMMIT",
+      &sim_disk_set_overlay, NULL, NULL, "Write the overlay to the container" },
+    { MTAB_XTD|MTAB_VUN|MTAB_NMO, 0, "STATISTICS", "STATISTICS",
+      &sim_disk_set_stats, &sim_disk_show_stats, NULL, "Display or reset host I/O statistics" },
+    { MTAB_XTD|MTAB_VUN|MTAB_VALR, 0, "CACHE", "CACHE=sectors",
+      &sim_disk_set_cache, &sim_disk_show_cache, NULL, "Set/Display host sector cache" },
+    { MTAB_XTD|MTAB_VUN, 1, NULL, "NOCACHE",
+      &sim_disk_set_cache, NULL, NULL, "Disable host sector cache" },
+    { MTAB_XTD|MTAB_VUN, 2, NULL, "WRITEBACK",
+      &sim_disk_set_cache, NULL, NULL, "Host sector cache defers writes" },
+    { MTAB_XTD|MTAB_VUN, 3, NULL, "WRITETHROUGH",
+      &sim_disk_set_cache, NULL, NULL, "Host sector cache writes immediately" },
 #if defined (VM_PDP11)
     { MTAB_XTD|MTAB_VDV|MTAB_VALR, 004, "ADDRESS", "ADDRESS",
       &set_addr, &show_addr, NULL, "Bus address" },
@@ -2361,6 +2384,54 @@ uptr->io_complete = 1;
 sim_activate_notbefore (uptr, uptr->iostarttime+rq_xtime);
 }
 
+/* Queued piece completion callback, pieces complete in any order */
+
+void rq_io_piece_complete (UNIT *uptr, void *arg, t_stat status)
+{
+if (uptr->io_pieces == 0)                               /* reset since queued? */
+    return;
+if ((status != SCPE_OK) && (uptr->io_status == SCPE_OK))
+    uptr->io_status = status;                           /* keep first error */
+if (--uptr->io_pieces == 0)                             /* last piece? */
+    rq_io_complete (uptr, uptr->io_status);
+}
+
+/* Start a transfer between the unit and its transfer buffer
+
+   When the unit's host I/O queue is deeper than one request, the transfer
+   is split into that many pieces which the host performs at once. */
+
+t_stat rq_io_start (UNIT *uptr, t_bool wr, uint32 bl, uint32 sects)
+{
+uint32 depth = sim_disk_asynch_depth (uptr);
+uint32 per, pieces, queued, i, n;
+t_stat r = SCPE_OK;
+
+if ((depth <= 1) || (sects <= 1))
+    return wr ? sim_disk_wrsect_a (uptr, bl, (uint8 *)uptr->rqxb, NULL, sects, rq_io_complete) :
+                sim_disk_rdsect_a (uptr, bl, (uint8 *)uptr->rqxb, NULL, sects, rq_io_complete);
+per = (sects + depth - 1) / depth;                      /* sectors per piece */
+pieces = (sects + per - 1) / per;
+uptr->io_status = SCPE_OK;
+uptr->io_pieces = pieces;
+for (i = queued = 0; i < sects; i += n, queued++) {
+    uint8 *buf = (uint8 *)uptr->rqxb + i * RQ_NUMBY;
+
+    n = ((sects - i) < per) ? (sects - i) : per;
+    r = wr ? sim_disk_wrsect_q (uptr, bl + i, buf, NULL, n, rq_io_piece_complete, NULL) :
+             sim_disk_rdsect_q (uptr, bl + i, buf, NULL, n, rq_io_piece_complete, NULL);
+    if (r != SCPE_OK)
+        break;
+    }
+if (r != SCPE_OK) {                                     /* couldn't queue all? */
+    uptr->io_status = r;
+    uptr->io_pieces -= pieces - queued;                 /* finish with those queued */
+    if (uptr->io_pieces == 0)
+        rq_io_complete (uptr, r);
+    }
+return r;
+}
+
 /* Map buffer address */
 
 uint32 rq_map_ba (uint32 ba, uint32 ma)
@@ -2504,7 +2575,7 @@ if (!uptr->io_complete) { /* Top End (I/O Initiation) Processing */
         wwc = ((tbc + (RQ_NUMBY - 1)) & ~(RQ_NUMBY - 1)) >> 1;
         memset (uptr->rqxb, 0, wwc * sizeof(uint16));   /* clr buf */
         sim_disk_data_trace(uptr, (uint8 *)uptr->rqxb, bl, wwc << 1, "sim_disk_wrsect-ERS", DBG_DAT & rq_devmap[cp->cnum]->dctrl, DBG_REQ);
-        err = sim_disk_wrsect_a (uptr, bl, (uint8 *)uptr->rqxb, NULL, (wwc << 1) / RQ_NUMBY, rq_io_complete);
+        err = rq_io_start (uptr, TRUE, bl, (wwc << 1) / RQ_NUMBY);
         }
 
     else if (cmd == OP_WR) {                            /* write? */
@@ -2514,12 +2585,12 @@ if (!uptr->io_complete) { /* Top End (I/O Initiation) Processing */
             for (i = (abc >> 1); i < wwc; i++)
                 ((uint16 *)(uptr->rqxb))[i] = 0;
             sim_disk_data_trace(uptr, (uint8 *)uptr->rqxb, bl, wwc << 1, "sim_disk_wrsect-WR", DBG_DAT & rq_devmap[cp->cnum]->dctrl, DBG_REQ);
-            err = sim_disk_wrsect_a (uptr, bl, (uint8 *)uptr->rqxb, NULL, (wwc << 1) / RQ_NUMBY, rq_io_complete);
+            err = rq_io_start (uptr, TRUE, bl, (wwc << 1) / RQ_NUMBY);
             }
         }
 
     else {  /* OP_RD & OP_CMP */
-        err = sim_disk_rdsect_a (uptr, bl, (uint8 *)uptr->rqxb, NULL, (tbc + RQ_NUMBY - 1) / RQ_NUMBY, rq_io_complete);
+        err = rq_io_start (uptr, FALSE, bl, (tbc + RQ_NUMBY - 1) / RQ_NUMBY);
         }                                               /* end else read */
     return SCPE_OK;                                     /* done for now until callback */    
     }
@@ -3356,6 +3427,7 @@ for (i = 0; i < dptr->numunits; i++) {                  /* init units */
     uptr->flags = uptr->flags & ~(UNIT_ONL | UNIT_ATP);
     uptr->uf = 0;                                       /* clr unit flags */
     uptr->cpkt = uptr->pktq = 0;                        /* clr pkt q's */
+    uptr->io_pieces = 0;                                /* forget queued pieces */
     uptr->rqxb = (uint16 *) realloc (uptr->rqxb, (RQ_MAXFR >> 1) * sizeof (uint16));
     if (uptr->rqxb == NULL)
         return SCPE_MEM;
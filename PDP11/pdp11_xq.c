@@ -276,6 +276,10 @@ t_stat xq_show_sanity (FILE* st, UNIT* uptr, int32 val, CONST void* desc);
 t_stat xq_set_sanity (UNIT* uptr, int32 val, CONST char* cptr, void* desc);
 t_stat xq_show_throttle (FILE* st, UNIT* uptr, int32 val, CONST void* desc);
 t_stat xq_set_throttle (UNIT* uptr, int32 val, CONST char* cptr, void* desc);
+t_stat xq_show_rcvqueue (FILE* st, UNIT* uptr, int32 val, CONST void* desc);
+t_stat xq_set_rcvqueue (UNIT* uptr, int32 val, CONST char* cptr, void* desc);
+t_stat xq_show_xmtqueue (FILE* st, UNIT* uptr, int32 val, CONST void* desc);
+t_stat xq_set_xmtqueue (UNIT* uptr, int32 val, CONST char* cptr, void* desc);
 t_stat xq_show_lockmode (FILE* st, UNIT* uptr, int32 val, CONST void* desc);
 t_stat xq_set_lockmode (UNIT* uptr, int32 val, CONST char* cptr, void* desc);
 t_stat xq_show_poll (FILE* st, UNIT* uptr, int32 val, CONST void* desc);
@@ -319,7 +323,9 @@ struct xq_device    xqa = {
   ETH_THROT_DEFAULT_TIME,                   /* ms throttle window */
   ETH_THROT_DEFAULT_BURST,                  /* packet packet burst in throttle window */
   ETH_THROT_DISABLED_DELAY,                 /* throttle disabled */
-  XQ_STARTUP_DELAY                          /* instructions to delay when starting the receiver */
+  XQ_STARTUP_DELAY,                         /* instructions to delay when starting the receiver */
+  0,                                        /* default receive queue depth */
+  0                                         /* default transmit queue depth */
   };
 
 struct xq_device    xqb = {
@@ -335,7 +341,9 @@ struct xq_device    xqb = {
   ETH_THROT_DEFAULT_TIME,                   /* ms throttle window */
   ETH_THROT_DEFAULT_BURST,                  /* packet packet burst in throttle window */
   ETH_THROT_DISABLED_DELAY,                 /* throttle disabled */
-  XQ_STARTUP_DELAY                          /* instructions to delay when starting the receiver */
+  XQ_STARTUP_DELAY,                         /* instructions to delay when starting the receiver */
+  0,                                        /* default receive queue depth */
+  0                                         /* default transmit queue depth */
   };
 
 /* SIMH device structures */
@@ -420,6 +428,8 @@ REG xqa_reg[] = {
   { GRDATA ( THR_TIME, xqa.throttle_time, XQ_RDX, 32, 0), REG_HRO},
   { GRDATA ( THR_BURST, xqa.throttle_burst, XQ_RDX, 32, 0), REG_HRO},
   { GRDATA ( THR_DELAY, xqa.throttle_delay, XQ_RDX, 32, 0), REG_HRO},
+  { GRDATA ( RCV_QUEUE, xqa.rcv_queue, XQ_RDX, 32, 0), REG_HRO},
+  { GRDATA ( XMT_QUEUE, xqa.xmt_queue, XQ_RDX, 32, 0), REG_HRO},
   { GRDATAD ( START_DELAY, xqa.startup_delay,  XQ_RDX, 32, 0, "instruction delay before receiver starts"), REG_FIT },
   { NULL },
 };
@@ -484,6 +494,8 @@ REG xqb_reg[] = {
   { GRDATA ( THR_TIME, xqb.throttle_time, XQ_RDX, 32, 0), REG_HRO},
   { GRDATA ( THR_BURST, xqb.throttle_burst, XQ_RDX, 32, 0), REG_HRO},
   { GRDATA ( THR_DELAY, xqb.throttle_delay, XQ_RDX, 32, 0), REG_HRO},
+  { GRDATA ( RCV_QUEUE, xqb.rcv_queue, XQ_RDX, 32, 0), REG_HRO},
+  { GRDATA ( XMT_QUEUE, xqb.xmt_queue, XQ_RDX, 32, 0), REG_HRO},
   { GRDATAD ( START_DELAY, xqb.startup_delay,  XQ_RDX, 32, 0, "instruction delay before receiver starts"), REG_FIT },
   { NULL },
 };
@@ -514,6 +526,12 @@ MTAB xq_mod[] = {
     &xq_set_sanity, &xq_show_sanity, NULL, "Sanity timer" },
   { MTAB_XTD|MTAB_VDV|MTAB_VALR, 0, "THROTTLE", "THROTTLE=DISABLED|TIME=n{;BURST=n{;DELAY=n}}",
     &xq_set_throttle, &xq_show_throttle, NULL, "Display transmit throttle configuration" },
+#ifdef USE_READER_THREAD
+  { MTAB_XTD|MTAB_VDV|MTAB_VALR, 0, "RCVQUEUE", "RCVQUEUE={DEFAULT|16..16384}",
+    &xq_set_rcvqueue, &xq_show_rcvqueue, NULL, "Display receive queue depth" },
+  { MTAB_XTD|MTAB_VDV|MTAB_VALR, 0, "XMTQUEUE", "XMTQUEUE={DEFAULT|1..16384}",
+    &xq_set_xmtqueue, &xq_show_xmtqueue, NULL, "Display transmit queue depth" },
+#endif
   { MTAB_XTD|MTAB_VDV|MTAB_VALR, 0, "DEQNALOCK", "DEQNALOCK={ON|OFF}",
     &xq_set_lockmode, &xq_show_lockmode, NULL, "DEQNA-Lock mode" },
   { MTAB_XTD|MTAB_VDV,           0, "LEDS", NULL,
@@ -951,6 +969,72 @@ t_stat xq_set_throttle (UNIT* uptr, int32 val, CONST char* cptr, void* desc)
   return SCPE_OK;
 }
 
+t_stat xq_show_rcvqueue (FILE* st, UNIT* uptr, int32 val, CONST void* desc)
+{
+  CTLR* xq = xq_unit2ctlr(uptr);
+
+  if (xq->var->rcv_queue == 0)
+    fprintf(st, "rcvqueue=default");
+  else
+    fprintf(st, "rcvqueue=%d", xq->var->rcv_queue);
+  return SCPE_OK;
+}
+
+t_stat xq_set_rcvqueue (UNIT* uptr, int32 val, CONST char* cptr, void* desc)
+{
+  CTLR* xq = xq_unit2ctlr(uptr);
+  uint32 newval;
+  t_stat r = SCPE_OK;
+
+  if (!cptr) return SCPE_IERR;
+
+  /* this assumes that the parameter has already been upcased */
+  if (!strcmp(cptr, "DEFAULT"))
+    newval = 0;
+  else {
+    newval = (uint32) get_uint(cptr, 10, ETH_RING_MAX, &r);
+    if ((r != SCPE_OK) || (newval < ETH_RING_MIN))
+      return SCPE_ARG;
+  }
+  xq->var->rcv_queue = newval;
+  if (xq->unit->flags & UNIT_ATT)
+    return eth_set_rx_queue (xq->var->etherface, xq->var->rcv_queue);
+  return SCPE_OK;
+}
+
+t_stat xq_show_xmtqueue (FILE* st, UNIT* uptr, int32 val, CONST void* desc)
+{
+  CTLR* xq = xq_unit2ctlr(uptr);
+
+  if (xq->var->xmt_queue == 0)
+    fprintf(st, "xmtqueue=default");
+  else
+    fprintf(st, "xmtqueue=%d", xq->var->xmt_queue);
+  return SCPE_OK;
+}
+
+t_stat xq_set_xmtqueue (UNIT* uptr, int32 val, CONST char* cptr, void* desc)
+{
+  CTLR* xq = xq_unit2ctlr(uptr);
+  uint32 newval;
+  t_stat r = SCPE_OK;
+
+  if (!cptr) return SCPE_IERR;
+
+  /* this assumes that the parameter has already been upcased */
+  if (!strcmp(cptr, "DEFAULT"))
+    newval = 0;
+  else {
+    newval = (uint32) get_uint(cptr, 10, ETH_WRITE_QUEUE_MAX, &r);
+    if ((r != SCPE_OK) || (newval < 1))
+      return SCPE_ARG;
+  }
+  xq->var->xmt_queue = newval;
+  if (xq->unit->flags & UNIT_ATT)
+    return eth_set_tx_queue (xq->var->etherface, xq->var->xmt_queue);
+  return SCPE_OK;
+}
+
 t_stat xq_show_lockmode (FILE* st, UNIT* uptr, int32 val, CONST void* desc)
 {
   CTLR* xq = xq_unit2ctlr(uptr);
@@ -2894,6 +2978,10 @@ t_stat xq_attach(UNIT* uptr, CONST char* cptr)
     return status;
   }
   eth_set_throttle (xq->var->etherface, xq->var->throttle_time, xq->var->throttle_burst, xq->var->throttle_delay);
+  if (xq->var->rcv_queue)
+    eth_set_rx_queue (xq->var->etherface, xq->var->rcv_queue);
+  if (xq->var->xmt_queue)
+    eth_set_tx_queue (xq->var->etherface, xq->var->xmt_queue);
   if (xq->var->poll == 0) {
     status = eth_set_async(xq->var->etherface, xq->var->coalesce_latency_ticks);
     if (status != SCPE_OK) {
@@ -3296,6 +3384,30 @@ const char helpString[] =
     " DELAY specifies the number of milliseconds which a throttled packet will\n"
     " be delayed prior to its transmission.\n"
     "\n"
+#if defined(USE_READER_THREAD)
+     /****************************************************************************/
+    "3 RCVQUEUE\n"
+    " Packets arriving from the LAN are queued until the simulated device\n"
+    " takes them.  When bursts of traffic arrive faster than the simulated\n"
+    " system accepts them, packets that find the queue full are dropped and\n"
+    " counted (see SHOW %D ETH).  A deeper queue absorbs longer bursts:\n"
+    "\n"
+    "+sim> SET %D RCVQUEUE=4096\n"
+    "+sim> SET %D RCVQUEUE=DEFAULT\n"
+    "\n"
+    " The depth is rounded up to a power of 2.\n"
+    "\n"
+     /****************************************************************************/
+    "3 XMTQUEUE\n"
+    " Packets sent by the simulated system are queued for a separate transmit\n"
+    " thread which sends whatever has accumulated as a batch.  When the queue\n"
+    " is full the simulated system waits for room rather than losing packets\n"
+    " (see SHOW %D ETH):\n"
+    "\n"
+    "+sim> SET %D XMTQUEUE=4096\n"
+    "+sim> SET %D XMTQUEUE=DEFAULT\n"
+    "\n"
+#endif /* USE_READER_THREAD */
      /****************************************************************************/
     "2 Attach\n"
     " The device must be attached to a LAN device to communicate with systems\n"
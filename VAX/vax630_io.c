@@ -516,6 +516,7 @@ uint32 ma;
 
 if (qba_map_addr (qa, &ma)) {                           /* in map? */
     if (ADDR_IS_MEM (ma)) {                             /* real memory? */
+        IC_WRITE (ma);                                  /* invalidate icache */
         if (md == WRITE) {                              /* word access? */
             int32 sc = (ma & 2) << 3;                   /* aligned only */
             M[ma >> 2] = (M[ma >> 2] & ~(WMASK << sc)) |
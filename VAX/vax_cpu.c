@@ -267,6 +267,14 @@ int32 cpu_astop = 0;
 int32 mchk_va, mchk_ref;                                /* mem ref param */
 int32 ibufl, ibufh;                                     /* prefetch buf */
 int32 ibcnt, ppc;                                       /* prefetch ctl */
+ICENT *ic_tab = NULL;                                   /* decoded inst cache */
+ICENT *ic_cur = NULL;                                   /* entry being replayed */
+ICENT *ic_rec = NULL;                                   /* entry being recorded */
+int32 ic_nval = 0;                                      /* istream values replayed/recorded */
+uint32 *ic_page = NULL;                                 /* page generations */
+uint32 ic_npage = 0;                                    /* pages covered */
+uint32 ic_gen = 1;                                      /* cache generation */
+t_uint64 ic_hit, ic_miss, ic_fill, ic_flush;            /* cache statistics */
 uint32 cpu_idle_mask =                                  /* idle mask */
 #if defined (VAX_411) || defined (VAX_412)
                        VAX_IDLE_INFOSERVER;
@@ -286,6 +294,20 @@ int32 hst_switches;                                     /* history option switch
 FILE *hst_log;                                          /* history log file */
 int32 hst_log_p;                                        /* history last log written pointer */
 int32 step_out_nest_level = 0;                          /* step to call return - nest level */
+int32 cpu_prof = PROF_OFF;                              /* instruction profile mode */
+t_uint64 cpu_prof_opc[NUM_INST];                        /* executions per opcode */
+double cpu_prof_nsec[NUM_INST];                         /* host nsec per opcode */
+t_uint64 cpu_prof_spec[16];                             /* specifiers per addressing mode */
+t_uint64 cpu_prof_mode[4];                              /* instructions per access mode */
+t_uint64 cpu_prof_cmode;                                /* compatibility mode instructions */
+int32 cpu_prof_last = -1;                               /* opcode being timed */
+double cpu_prof_start;                                  /* host time it started */
+#define TRC_NREG        16                              /* R0-R14, PSL */
+SIM_TRACE_REC *trc_rec = NULL;                          /* record being built */
+uint32 trc_val[TRC_NREG];                               /* values last recorded */
+uint32 trc_num[TRC_NREG];                               /* register table indexes */
+int32 trc_pend[SIM_TRACE_NREG];                         /* regs held in trc_rec */
+t_bool trc_valid = FALSE;                               /* trc_val is meaningful */
 
 const uint32 byte_mask[33] = { 0x00000000,
  0x00000001, 0x00000003, 0x00000007, 0x0000000F,
@@ -322,6 +344,8 @@ t_stat cpu_dep (t_value val, t_addr exta, UNIT *uptr, int32 sw);
 t_stat cpu_set_size (UNIT *uptr, int32 val, CONST char *cptr, void *desc);
 t_stat cpu_set_hist (UNIT *uptr, int32 val, CONST char *cptr, void *desc);
 t_stat cpu_show_hist (FILE *st, UNIT *uptr, int32 val, CONST void *desc);
+t_stat cpu_set_prof (UNIT *uptr, int32 val, CONST char *cptr, void *desc);
+t_stat cpu_show_prof (FILE *st, UNIT *uptr, int32 val, CONST void *desc);
 t_stat cpu_show_virt (FILE *st, UNIT *uptr, int32 val, CONST void *desc);
 t_stat cpu_set_idle (UNIT *uptr, int32 val, CONST char *cptr, void *desc);
 t_stat cpu_show_idle (FILE *st, UNIT *uptr, int32 val, CONST void *desc);
@@ -330,6 +354,14 @@ t_stat cpu_show_instruction_set (FILE *st, UNIT *uptr, int32 val, CONST void *de
 const char *cpu_description (DEVICE *dptr);
 int32 cpu_get_vsw (int32 sw);
 static SIM_INLINE int32 get_istr (int32 lnt, int32 acc);
+static SIM_INLINE int32 ic_next (int32 lnt);
+static SIM_INLINE int32 ic_record (int32 val);
+static void ic_insert (uint32 va, int32 lnt, int32 opc, int32 key, int32 acc);
+static t_stat ic_reset (void);
+static SIM_TRACE_REC *cpu_trace_start (int32 cc);
+static void cpu_trace_end (uint32 va, int32 lnt, int32 acc);
+t_stat cpu_set_icache (UNIT *uptr, int32 val, CONST char *cptr, void *desc);
+t_stat cpu_show_icache (FILE *st, UNIT *uptr, int32 val, CONST void *desc);
 int32 ReadOcta (int32 va, int32 *opnd, int32 j, int32 acc);
 t_bool cpu_show_opnd (FILE *st, InstHistory *h, int32 line);
 t_stat cpu_show_hist_records (FILE *st, t_bool do_header, int32 start, int32 count);
@@ -435,6 +467,14 @@ MTAB cpu_mod[] = {
     MEM_MODIFIERS,   /* Model specific memory modifiers from vaxXXX_defs.h */
     { MTAB_XTD|MTAB_VDV|MTAB_NMO|MTAB_SHP|MTAB_NC, 0, "HISTORY", "HISTORY=n",
       &cpu_set_hist, &cpu_show_hist, NULL, "Enable/Display instruction history" },
+    { MTAB_XTD|MTAB_VDV|MTAB_NMO|MTAB_SHP, PROF_COUNT, "PROFILE", "PROFILE{=TIME|RESET}",
+      &cpu_set_prof, &cpu_show_prof, NULL, "Enable/Display instruction profile" },
+    { MTAB_XTD|MTAB_VDV|MTAB_NMO, PROF_OFF, NULL, "NOPROFILE",
+      &cpu_set_prof, NULL, NULL, "Disable instruction profile" },
+    { MTAB_XTD|MTAB_VDV|MTAB_NMO, 1, "ICACHE", "ICACHE",
+      &cpu_set_icache, &cpu_show_icache, NULL, "Enable/Display decoded instruction cache" },
+    { MTAB_XTD|MTAB_VDV|MTAB_NMO, 0, NULL, "NOICACHE",
+      &cpu_set_icache, NULL, NULL, "Disable decoded instruction cache" },
     { MTAB_XTD|MTAB_VDV|MTAB_NMO|MTAB_SHP, 0, "VIRTUAL", NULL,
       NULL, &cpu_show_virt, NULL, "show translation for address arg in KESU mode" },
     CPU_MODEL_MODIFIERS  /* Model specific cpu modifiers from vaxXXX_defs.h */
@@ -513,14 +553,25 @@ cc = PSL & CC_MASK;                                     /* split PSL */
 PSL = PSL & ~CC_MASK;
 in_ie = 0;                                              /* not in exc */
 set_map_reg ();                                         /* set map reg */
+set_tlb_mem ();                                         /* set TB host ptrs */
 GET_CUR;                                                /* set access mask */
 SET_IRQL;                                               /* eval interrupts */
 FLUSH_ISTR;                                             /* clear prefetch */
+if ((ret = ic_reset ()) != SCPE_OK)                     /* memory may have changed */
+    return ret;
+
+cpu_prof_last = -1;                                     /* nothing being timed */
+trc_valid = FALSE;                                      /* trace all regs first */
 
 abortval = setjmp (save_env);                           /* set abort hdlr */
+ic_cur = ic_rec = NULL;                                 /* not using the cache */
 if (abortval > 0) {                                     /* sim stop? */
     PSL = PSL | cc;                                     /* put PSL together */
     pcq_r->qptr = pcq_p;                                /* update pc q ptr */
+    if (cpu_prof_last >= 0) {                           /* close out timed opcode */
+        cpu_prof_nsec[cpu_prof_last] += sim_os_nsec () - cpu_prof_start;
+        cpu_prof_last = -1;
+        }
     if (hst_log) {                                      /* auto logging history? */
         cpu_show_hist_records (hst_log, FALSE, hst_log_p, (hst_p < hst_log_p) ? hst_lnt - (hst_log_p - hst_p) : hst_p - hst_log_p);
         hst_log_p = hst_p;                              /* record everything logged */
@@ -716,6 +767,8 @@ for ( ;; ) {
         if (PSL & PSW_T)                                /* if T, set TP */
             PSL = PSL | PSL_TP;
         if (PSL & PSL_CM) {                             /* compat mode? */
+            if (cpu_prof)
+                cpu_prof_cmode++;
             cc = op_cmode (cc);                         /* exec instr */
             continue;                                   /* skip fetch */
             }
@@ -728,10 +781,42 @@ for ( ;; ) {
 
     sim_interval = sim_interval - (1 + (extra_bytes>>5));/* count instr */
     extra_bytes = 0;                                    /* digest string count */
-    GET_ISTR (opc, L_BYTE);                             /* get opcode */
-    if (opc == 0xFD) {                                  /* 2 byte op? */
-        GET_ISTR (opc, L_BYTE);                         /* get second byte */
-        opc = opc | 0x100;                              /* flag */
+    if (ic_page && ((PSL & PSL_FPD) == 0)) {            /* decoded inst cache? */
+        ICENT *ice = &ic_tab[IC_HASH ((uint32) PC)];
+
+        if ((ice->va == (uint32) PC) && (ice->gen == ic_gen) &&
+            (ice->key == IC_KEY) && (ic_page[ice->ppn] == ice->pgen)) {
+            ic_cur = ice;                               /* replay from entry */
+            ic_hit++;
+            }
+        else {
+            ic_rec = ice;                               /* record into entry */
+            ice->gen = 0;                               /* invalid until complete */
+            ic_miss++;
+            }
+        ic_nval = 0;
+        }
+    trc_rec = sim_trace_active? cpu_trace_start (cc): NULL;
+    if (ic_cur) {                                       /* cached decode? */
+        opc = ic_cur->opc;                              /* opcode, both bytes */
+        PC = PC + ic_cur->olnt;
+        }
+    else {
+        opc = get_istr (L_BYTE, acc);                   /* get opcode */
+        if (opc == 0xFD)                                /* 2 byte op? */
+            opc = get_istr (L_BYTE, acc) | 0x100;       /* get second byte, flag */
+        }
+    if (cpu_prof) {                                     /* profiling? */
+        cpu_prof_opc[opc]++;
+        cpu_prof_mode[PSL_GETCUR (PSL)]++;
+        if (cpu_prof == PROF_TIME) {
+            double now = sim_os_nsec ();
+
+            if (cpu_prof_last >= 0)
+                cpu_prof_nsec[cpu_prof_last] += now - cpu_prof_start;
+            cpu_prof_last = opc;
+            cpu_prof_start = now;
+            }
         }
     numspec = drom[opc][0];                             /* get # specs */
 #if !defined(FULL_VAX)
@@ -785,6 +870,8 @@ for ( ;; ) {
                 break;
                 }
             GET_ISTR (spec, L_BYTE);                    /* get spec byte */
+            if (cpu_prof)
+                cpu_prof_spec[spec >> 4]++;
             rn = spec & RGMASK;                         /* get reg # */
             disp = (spec & ~RGMASK) | disp;             /* merge w dispatch */
             switch (disp) {                             /* dispatch spec */
@@ -1556,6 +1643,12 @@ for ( ;; ) {
                 break;
                 }                                       /* end case spec */
             }                                           /* end for */
+        if (ic_cur) {                                   /* replayed from cache? */
+            ic_cur = NULL;
+            FLUSH_ISTR;                                 /* prefetch is behind PC */
+            }
+        else if (ic_rec)                                /* recorded for cache? */
+            ic_insert (fault_PC, PC - fault_PC, opc, IC_KEY, acc);
         }                                               /* end if not FPD */
 
 /* Optionally record instruction history */
@@ -1589,6 +1682,8 @@ for ( ;; ) {
         if (hst_log && (hst_p == hst_log_p))
             cpu_show_hist_records (hst_log, FALSE, hst_log_p, hst_lnt);
         }
+    if (trc_rec)                                        /* binary trace? */
+        cpu_trace_end (fault_PC, PC - fault_PC, acc);
 
 /* Dispatch to instructions */
 
@@ -3232,6 +3327,188 @@ if ((bo + lnt) >= 4) {                                  /* retire ibufl? */
 return val;
 }
 
+/* Decoded instruction cache routines
+
+   A cache entry holds an instruction that was completely decoded from a
+   single page of memory: its opcode, and every value the specifier flows
+   took from the instruction stream, in order.  Those are the specifier
+   bytes and the assembled branch displacements, address displacements and
+   immediates, which depend only on the instruction bytes.
+
+   On a miss, GET_ISTR records each value it returns in the entry.  On a
+   hit, which is only used when PSL<fpd> is clear, the opcode is taken from
+   the entry and GET_ISTR returns the recorded values in turn, advancing PC.
+   The prefetch buffer, translation and memory references are bypassed;
+   the prefetch buffer is left alone until the instruction is decoded and
+   then invalidated, since PC has moved on without it.
+
+   Entries are validated by three generations:
+        ic_gen          =       bumped on any translation buffer change
+        ic_page[ppn]    =       bumped on a write to a page holding entries
+        key             =       access mode and memory management state
+*/
+
+static SIM_INLINE int32 ic_next (int32 lnt)
+{
+PC = PC + lnt;                                          /* incr PC */
+return ic_cur->val[ic_nval++];
+}
+
+static SIM_INLINE int32 ic_record (int32 val)
+{
+if (ic_nval < IC_MAXVAL)
+    ic_rec->val[ic_nval++] = val;
+else ic_rec = NULL;                                     /* too long to cache */
+return val;
+}
+
+static void ic_insert (uint32 va, int32 lnt, int32 opc, int32 key, int32 acc)
+{
+ICENT *ice = ic_rec;
+int32 pa, t;
+
+ic_rec = NULL;                                          /* recording done */
+if ((lnt <= 0) || (lnt > IC_MAXLNT) ||                  /* too long or */
+    ((VA_GETOFF (va) + lnt) > VA_PAGSIZE))              /* crosses page? */
+    return;
+pa = Test (va, RA, &t);                                 /* xlate PC */
+if ((pa < 0) || !ADDR_IS_MEM (pa + lnt - 1))            /* not in memory? */
+    return;
+ice->va = va;
+ice->key = key;
+ice->lnt = lnt;
+ice->opc = opc;
+ice->olnt = (opc > 0xFF)? 2: 1;
+ice->ppn = ((uint32) pa) >> VA_N_OFF;
+ic_page[ice->ppn] |= IC_CACHED;                         /* page holds code */
+ice->pgen = ic_page[ice->ppn];
+ice->gen = ic_gen;                                      /* now valid */
+ic_fill++;
+}
+
+/* Write to a page holding cached instructions */
+
+void ic_write (uint32 pa)
+{
+uint32 ppn = pa >> VA_N_OFF;
+
+if (++ic_page[ppn] == 0)                                /* generation wrapped? */
+    ic_invalidate ();                                   /* flush everything */
+}
+
+/* Translation change - invalidate all entries */
+
+void ic_invalidate (void)
+{
+ic_flush++;
+if (++ic_gen == 0) {                                    /* generation wrapped? */
+    memset (ic_tab, 0, IC_SIZE * sizeof (*ic_tab));
+    ic_gen = 1;
+    }
+}
+
+/* Binary trace routines
+
+   cpu_trace_start claims the record for the instruction about to be
+   decoded and fills in the registers changed since the last record;
+   any beyond SIM_TRACE_NREG go out first in SIM_TRACE_REGS records.
+   The claimed record is only published by cpu_trace_end, after the
+   specifiers are decoded.  If decode aborts, the next instruction
+   claims the same record again, and since trc_val is only updated for
+   published registers, no changes are lost.
+*/
+
+static SIM_TRACE_REC *cpu_trace_start (int32 cc)
+{
+SIM_TRACE_REC *rec = NULL;
+uint32 i, val, nchg = 0;
+int32 chg[TRC_NREG];
+
+if (!trc_valid) {                                       /* new run? */
+    for (i = 0; i < TRC_NREG; i++) {                    /* find regs in cpu_reg */
+        void *loc = (i < 15)? (void *) &R[i]: (void *) &PSL;
+        REG *rptr;
+
+        for (rptr = cpu_reg; rptr->name != NULL; rptr++) {
+            if (rptr->loc == loc)
+                break;
+            }
+        trc_num[i] = (uint32) (rptr - cpu_reg);
+        }
+    }
+for (i = 0; i < TRC_NREG; i++) {                        /* find changed regs */
+    val = (i < 15)? (uint32) R[i]: (uint32) (PSL | cc);
+    if (!trc_valid || (val != trc_val[i]))
+        chg[nchg++] = i;
+    }
+trc_valid = TRUE;
+while (nchg > SIM_TRACE_NREG) {                         /* too many for one? */
+    rec = sim_trace_rec (SIM_TRACE_REGS);
+    rec->pc = (uint32) PC;
+    for ( ; (nchg > SIM_TRACE_NREG) && (rec->nreg < SIM_TRACE_NREG); nchg--) {
+        i = chg[nchg - 1];
+        trc_val[i] = (i < 15)? (uint32) R[i]: (uint32) (PSL | cc);
+        rec->reg[rec->nreg].num = trc_num[i];
+        rec->reg[rec->nreg++].val = trc_val[i];
+        }
+    sim_trace_put ();
+    }
+rec = sim_trace_rec (SIM_TRACE_INST);
+for (i = 0; i < nchg; i++) {
+    trc_pend[i] = chg[i];
+    rec->reg[i].num = trc_num[chg[i]];
+    rec->reg[i].val = (chg[i] < 15)? (uint32) R[chg[i]]: (uint32) (PSL | cc);
+    }
+rec->nreg = (uint8) nchg;
+return rec;
+}
+
+static void cpu_trace_end (uint32 va, int32 lnt, int32 acc)
+{
+int32 i, pa = -1, t;
+t_value wd;
+
+for (i = 0; i < trc_rec->nreg; i++)                     /* regs now recorded */
+    trc_val[trc_pend[i]] = trc_rec->reg[i].val;
+if ((uint32) lnt > SIM_TRACE_ILEN)
+    lnt = SIM_TRACE_ILEN;
+for (i = 0; i < lnt; i++, va++, pa++) {                 /* copy inst bytes */
+    if ((i == 0) || (VA_GETOFF (va) == 0))              /* new page? */
+        pa = Test (va, RA, &t);
+    if ((pa >= 0) && ADDR_IS_MEM (pa))                  /* memory? */
+        trc_rec->inst[i] = (uint8) (M[pa >> 2] >> ((pa & 3) << 3));
+    else if (cpu_ex (&wd, va, &cpu_unit, SWMASK ('V')) == SCPE_OK)
+        trc_rec->inst[i] = (uint8) wd;                  /* ROM, etc */
+    else break;
+    }
+trc_rec->ilen = (uint8) i;
+trc_rec->pc = va - i;
+sim_trace_put ();
+trc_rec = NULL;
+}
+
+/* Start of simulation - memory or its size may have been changed by SCP */
+
+static t_stat ic_reset (void)
+{
+uint32 npage = (uint32) (MEMSIZE >> VA_N_OFF);
+
+ic_cur = ic_rec = NULL;
+if (ic_tab == NULL)                                     /* disabled? */
+    return SCPE_OK;
+if (npage != ic_npage) {                                /* size changed? */
+    uint32 *np = (uint32 *) realloc (ic_page, npage * sizeof (*ic_page));
+
+    if (np == NULL)
+        return SCPE_MEM;
+    ic_page = np;
+    ic_npage = npage;
+    }
+memset (ic_page, 0, ic_npage * sizeof (*ic_page));
+ic_invalidate ();
+return SCPE_OK;
+}
+
 /* Read octaword specifier */
 
 int32 ReadOcta (int32 va, int32 *opnd, int32 j, int32 acc)
@@ -3343,6 +3620,9 @@ if (M == NULL) {                        /* first time init? */
     M = (uint32 *) calloc (((uint32) MEMSIZE) >> 2, sizeof (uint32));
     if (M == NULL)
         return SCPE_MEM;
+    cpu_unit.filebuf = M;                               /* SAVE/RESTORE directly */
+    if (sim_end)                                        /* if bytes are in order */
+        cpu_unit.dynflags |= UNIT_MEM_BUF;
     auto_config(NULL, 0);               /* do an initial auto configure */
     }
 return build_dib_tab ();
@@ -3462,9 +3742,10 @@ for (i = 0; i < clim; i = i + 4)
     nM[i >> 2] = M[i >> 2];
 free (M);
 M = nM;
+cpu_unit.filebuf = M;
 MEMSIZE = uval; 
 reset_all (0);
-return SCPE_OK;
+return ic_reset ();                                     /* resize icache page map */
 }
 
 /* Virtual address translation */
@@ -3519,6 +3800,182 @@ else md = PSL_GETCUR (PSL);
 return ACC_MASK (md);
 }
 
+/* Set instruction profile
+
+   SET CPU PROFILE              count opcodes, specifiers and access modes
+   SET CPU PROFILE=TIME         also accumulate host time per opcode
+   SET CPU PROFILE=RESET        clear counts
+   SET CPU NOPROFILE            stop profiling
+*/
+
+t_stat cpu_set_prof (UNIT *uptr, int32 val, CONST char *cptr, void *desc)
+{
+char gbuf[CBUFSIZE];
+
+if (val == PROF_OFF) {
+    if (cptr)
+        return SCPE_ARG;
+    cpu_prof = PROF_OFF;
+    return SCPE_OK;
+    }
+if (cptr == NULL) {
+    cpu_prof = PROF_COUNT;
+    return SCPE_OK;
+    }
+get_glyph (cptr, gbuf, 0);
+if (MATCH_CMD (gbuf, "TIME") == 0)
+    cpu_prof = PROF_TIME;
+else if (MATCH_CMD (gbuf, "RESET") == 0) {
+    memset (cpu_prof_opc, 0, sizeof (cpu_prof_opc));
+    memset (cpu_prof_nsec, 0, sizeof (cpu_prof_nsec));
+    memset (cpu_prof_spec, 0, sizeof (cpu_prof_spec));
+    memset (cpu_prof_mode, 0, sizeof (cpu_prof_mode));
+    cpu_prof_cmode = 0;
+    }
+else
+    return sim_messagef (SCPE_ARG, "Invalid profile option: %s\n", gbuf);
+return SCPE_OK;
+}
+
+/* Show instruction profile
+
+   SHOW CPU PROFILE{=n}         summaries and the n most frequent opcodes
+*/
+
+static int cpu_prof_compare (const void *pa, const void *pb)
+{
+int32 a = *(const int32 *)pa;
+int32 b = *(const int32 *)pb;
+
+if (cpu_prof_opc[a] != cpu_prof_opc[b])
+    return (cpu_prof_opc[a] > cpu_prof_opc[b]) ? -1 : 1;
+return a - b;
+}
+
+t_stat cpu_show_prof (FILE *st, UNIT *uptr, int32 val, CONST void *desc)
+{
+static const char *mode_name[4] = { "Kernel", "Executive", "Supervisor", "User" };
+static const char *grp_name[IG_MAX_GRP + 1] = {
+    "Reserved", "Base", "G-float", "D-float",
+    "Packed decimal", "Extended accuracy", "Emulated only", "Vector" };
+static const char *spec_name[16] = {
+    "Literal", "Literal", "Literal", "Literal",
+    "Indexed", "Register", "Register deferred", "Autodecrement",
+    "Autoincrement", "Autoincrement deferred", "Byte displacement", "Byte disp deferred",
+    "Word displacement", "Word disp deferred", "Long displacement", "Long disp deferred" };
+const char *cptr = (const char *) desc;
+int32 order[NUM_INST];
+double grp[IG_MAX_GRP + 1] = { 0 };
+double grp_nsec[IG_MAX_GRP + 1] = { 0 };
+double total = 0.0, total_nsec = 0.0, specs = 0.0;
+int32 i, lnt = 20;
+t_stat r;
+
+if (cptr) {
+    lnt = (int32) get_uint (cptr, 10, NUM_INST, &r);
+    if ((r != SCPE_OK) || (lnt == 0))
+        return SCPE_ARG;
+    }
+for (i = 0; i < NUM_INST; i++) {
+    order[i] = i;
+    total += (double)cpu_prof_opc[i];
+    total_nsec += cpu_prof_nsec[i];
+    grp[DR_GETIGRP (drom[i][0])] += (double)cpu_prof_opc[i];
+    grp_nsec[DR_GETIGRP (drom[i][0])] += cpu_prof_nsec[i];
+    }
+for (i = 0; i < 16; i++)
+    specs += (double)cpu_prof_spec[i];
+fprintf (st, "Instruction profile %s, %.0f instructions",
+         (cpu_prof == PROF_TIME) ? "counting with host time" : (cpu_prof ? "counting" : "disabled"), total);
+if (cpu_prof_cmode)
+    fprintf (st, ", %.0f compatibility mode", (double)cpu_prof_cmode);
+fprintf (st, "\n");
+if (total == 0.0)
+    return SCPE_OK;
+fprintf (st, "\nAccess mode:\n");
+for (i = 0; i < 4; i++)
+    fprintf (st, "  %-24s %14.0f %6.2f%%\n", mode_name[i], (double)cpu_prof_mode[i], (100.0 * cpu_prof_mode[i]) / total);
+fprintf (st, "\nInstruction group:\n");
+for (i = 0; i <= IG_MAX_GRP; i++) {
+    if (grp[i] == 0.0)
+        continue;
+    fprintf (st, "  %-24s %14.0f %6.2f%%", grp_name[i], grp[i], (100.0 * grp[i]) / total);
+    if (total_nsec != 0.0)
+        fprintf (st, " %6.2f%% host time", (100.0 * grp_nsec[i]) / total_nsec);
+    fprintf (st, "\n");
+    }
+if (specs != 0.0) {
+    fprintf (st, "\nSpecifier mode:\n");
+    for (i = 3; i < 16; i++) {
+        double cnt = (double)cpu_prof_spec[i];
+
+        if (i == 3)                                     /* fold short literals */
+            cnt += (double)(cpu_prof_spec[0] + cpu_prof_spec[1] + cpu_prof_spec[2]);
+        fprintf (st, "  %-24s %14.0f %6.2f%%\n", spec_name[i], cnt, (100.0 * cnt) / specs);
+        }
+    }
+qsort (order, NUM_INST, sizeof (order[0]), cpu_prof_compare);
+fprintf (st, "\n  %-24s %14s %7s", "Opcode", "Count", "%");
+if (total_nsec != 0.0)
+    fprintf (st, " %9s %7s", "nsec/inst", "% time");
+fprintf (st, "\n");
+for (i = 0; (i < lnt) && (cpu_prof_opc[order[i]] != 0); i++) {
+    int32 op = order[i];
+    char name[16];
+
+    if (opcode[op] == NULL)
+        sprintf (name, "%03X", op);
+    fprintf (st, "  %-24s %14.0f %6.2f%%", opcode[op] ? opcode[op] : name,
+             (double)cpu_prof_opc[op], (100.0 * cpu_prof_opc[op]) / total);
+    if (total_nsec != 0.0)
+        fprintf (st, " %9.1f %6.2f%%", cpu_prof_nsec[op] / cpu_prof_opc[op],
+                 (100.0 * cpu_prof_nsec[op]) / total_nsec);
+    fprintf (st, "\n");
+    }
+return SCPE_OK;
+}
+
+/* Set/show decoded instruction cache
+
+   SET CPU ICACHE               enable the cache, clearing its statistics
+   SET CPU NOICACHE             disable the cache
+   SHOW CPU ICACHE              display state and statistics
+*/
+
+t_stat cpu_set_icache (UNIT *uptr, int32 val, CONST char *cptr, void *desc)
+{
+if (cptr)
+    return SCPE_ARG;
+free (ic_tab);
+free (ic_page);
+ic_tab = NULL;
+ic_page = NULL;
+ic_npage = 0;
+ic_cur = ic_rec = NULL;
+if (val == 0)
+    return SCPE_OK;
+ic_tab = (ICENT *) calloc (IC_SIZE, sizeof (*ic_tab));
+if (ic_tab == NULL)
+    return SCPE_MEM;
+ic_hit = ic_miss = ic_fill = ic_flush = 0;
+return ic_reset ();
+}
+
+t_stat cpu_show_icache (FILE *st, UNIT *uptr, int32 val, CONST void *desc)
+{
+double lookups = (double) ic_hit + (double) ic_miss;
+
+if (ic_tab == NULL) {
+    fprintf (st, "decoded instruction cache disabled\n");
+    return SCPE_OK;
+    }
+fprintf (st, "decoded instruction cache, %d entries\n", IC_SIZE);
+fprintf (st, "  lookups: %.0f, hits: %.0f (%.2f%%)\n", lookups, (double) ic_hit,
+         (lookups == 0.0) ? 0.0 : (100.0 * ic_hit) / lookups);
+fprintf (st, "  fills: %.0f, invalidations: %.0f\n", (double) ic_fill, (double) ic_flush);
+return SCPE_OK;
+}
+
 /* Set history */
 
 t_stat cpu_set_hist (UNIT *uptr, int32 val, CONST char *cptr, void *desc)
@@ -682,7 +682,8 @@ enum opcodes {
 #define PCQ_SIZE        64                              /* must be 2**n */
 #define PCQ_MASK        (PCQ_SIZE - 1)
 #define PCQ_ENTRY       pcq[pcq_p = (pcq_p - 1) & PCQ_MASK] = fault_PC
-#define GET_ISTR(d,l)   d = get_istr (l, acc)
+#define GET_ISTR(d,l)   d = (ic_cur? ic_next (l): \
+                            (ic_rec? ic_record (get_istr (l, acc)): get_istr (l, acc)))
 #define CHECK_FOR_IDLE_LOOP if (PC == fault_PC) {                           /* to self? */ \
                                 if (PSL_GETIPL (PSL) == 0x1F)               /* int locked out? */ \
                                     ABORT (STOP_LOOP);                      /* infinite loop */ \
@@ -700,6 +701,38 @@ enum opcodes {
 #define SETPC(d)        PC = (d), FLUSH_ISTR
 #define FLUSH_ISTR      ibcnt = 0, ppc = -1
 
+/* Decoded instruction cache
+
+   Entries hold the opcode of a fully decoded instruction and the values its
+   specifier flows took from the instruction stream (specifier bytes and
+   assembled displacements and immediates), tagged by virtual PC and access
+   mode.  Entries are invalidated by writes to the physical page holding
+   them (IC_WRITE) and by translation changes (IC_INVALIDATE).
+*/
+
+#define IC_SIZE         4096                            /* entries, must be 2**n */
+#define IC_MASK         (IC_SIZE - 1)
+#define IC_MAXLNT       24                              /* max cached inst length */
+#define IC_MAXVAL       IC_MAXLNT                       /* max istream values, >= 1 byte each */
+#define IC_CACHED       1                               /* page has cached insts */
+#define IC_HASH(va)     (((va) ^ ((va) >> 13)) & IC_MASK)
+#define IC_KEY          ((acc << 1) | mapen)            /* mode, mapping */
+#define IC_WRITE(pa)    if (ic_page && (ic_page[(pa) >> VA_N_OFF] & IC_CACHED)) \
+                            ic_write (pa)
+#define IC_INVALIDATE   if (ic_page) ic_invalidate ()
+
+typedef struct {
+    uint32              va;                             /* virtual PC */
+    uint32              gen;                            /* cache generation */
+    uint32              ppn;                            /* physical page */
+    uint32              pgen;                           /* page generation */
+    int32               key;                            /* access mode, mapen */
+    int32               lnt;                            /* instruction length */
+    int32               opc;                            /* opcode, 0x1xx for FD xx */
+    int32               olnt;                           /* opcode length */
+    int32               val[IC_MAXVAL];                 /* istream values in fetch order */
+    } ICENT;
+
 /* Character string instructions */
 
 #define STR_V_DPC       24                              /* delta PC */
@@ -846,6 +879,15 @@ extern const uint16 drom[NUM_INST][MAX_SPEC + 1];
 extern int32 cpu_emulate_exception (int32 *opnd, int32 cc, int32 opc, int32 acc);
 void cpu_idle (void);
 
+/* Decoded instruction cache */
+void ic_write (uint32 pa);
+void ic_invalidate (void);
+
+/* Instruction Profile */
+#define PROF_OFF        0                               /* not profiling */
+#define PROF_COUNT      1                               /* count opcodes, specifiers, modes */
+#define PROF_TIME       2                               /* also host time per opcode */
+
 /* Instruction History */
 #define HIST_MIN        64
 #define HIST_MAX        250000
@@ -886,6 +928,9 @@ extern int32 pcq[PCQ_SIZE];                             /* PC queue */
 extern int32 pcq_p;                                     /* PC queue ptr */
 extern int32 in_ie;                                     /* in exc, int */
 extern int32 ibcnt, ppc;                                /* prefetch ctl */
+extern uint32 *ic_page;                                 /* icache page gens */
+extern ICENT *ic_cur;                                   /* icache entry in use */
+extern ICENT *ic_rec;                                   /* icache entry being filled */
 extern int32 hlt_pin;                                   /* HLT pin intr */
 extern int32 mxpr_cc_vc;                                /* cc V & C bits from mtpr/mfpr operations */
 extern int32 mem_err;
@@ -47,6 +47,7 @@
         zap_tb_ent      -       clear TB entry
         chk_tb_ent      -       check TB entry
         set_map_reg     -       set up working map registers
+        set_tlb_mem     -       set up TB host memory pointers
 */
 
 #include "vax_defs.h"
@@ -142,7 +143,7 @@ TLBENT fill (uint32 va, int32 lnt, int32 acc, int32 *stat)
 {
 int32 ptidx = (((uint32) va) >> 7) & ~03;
 int32 tlbpte, ptead, pte, tbi, vpn;
-static TLBENT zero_pte = { 0, 0 };
+static TLBENT zero_pte = { 0, 0, NULL };
 
 if (va & VA_S0) {                                       /* system space? */
     if (ptidx >= d_slr)                                 /* system */
@@ -179,6 +180,7 @@ else {
         stlb[tbi].tag = vpn;                            /* set stlb tag */
         stlb[tbi].pte = cvtacc[PTE_GETACC (pte)] |
             ((pte << VA_N_OFF) & TLB_PFN);              /* set stlb data */
+        stlb[tbi].mem = TLB_MEM (stlb[tbi].pte);
         }
     ptead = (stlb[tbi].pte & TLB_PFN) | VA_GETOFF (ptead);
 #endif
@@ -200,10 +202,12 @@ tbi = VA_GETTBI (vpn);
 if ((va & VA_S0) == 0) {                                /* process space? */
     ptlb[tbi].tag = vpn;                                /* store tlb ent */
     ptlb[tbi].pte = tlbpte;
+    ptlb[tbi].mem = TLB_MEM (tlbpte);
     return ptlb[tbi];
     }
 stlb[tbi].tag = vpn;                                    /* system space */
 stlb[tbi].pte = tlbpte;                                 /* store tlb ent */
+stlb[tbi].mem = TLB_MEM (tlbpte);
 return stlb[tbi];
 }
 
@@ -219,6 +223,18 @@ d_p1lr = (P1LR << 2) + 0x800000;                        /* VA<30> >> 7 */
 d_slr = (SLR << 2) + 0x1000000;                         /* VA<31> >> 7 */
 }
 
+/* Set up TB host memory pointers - memory may have been reallocated */
+
+void set_tlb_mem (void)
+{
+size_t i;
+
+for (i = 0; i < VA_TBSIZE; i++) {
+    ptlb[i].mem = (ptlb[i].tag == -1)? NULL: TLB_MEM (ptlb[i].pte);
+    stlb[i].mem = (stlb[i].tag == -1)? NULL: TLB_MEM (stlb[i].pte);
+    }
+}
+
 /* Zap process (0) or whole (1) tb */
 
 void zap_tb (int stb)
@@ -227,9 +243,13 @@ size_t i;
 
 for (i = 0; i < VA_TBSIZE; i++) {
     ptlb[i].tag = ptlb[i].pte = -1;
-    if (stb)
+    ptlb[i].mem = NULL;
+    if (stb) {
         stlb[i].tag = stlb[i].pte = -1;
+        stlb[i].mem = NULL;
+        }
     }
+IC_INVALIDATE;                                          /* mappings changed */
 }
 
 /* Zap single tb entry corresponding to va */
@@ -238,9 +258,15 @@ void zap_tb_ent (uint32 va)
 {
 int32 tbi = VA_GETTBI (VA_GETVPN (va));
 
-if (va & VA_S0)
+if (va & VA_S0) {
     stlb[tbi].tag = stlb[tbi].pte = -1;
-else ptlb[tbi].tag = ptlb[tbi].pte = -1;
+    stlb[tbi].mem = NULL;
+    }
+else {
+    ptlb[tbi].tag = ptlb[tbi].pte = -1;
+    ptlb[tbi].mem = NULL;
+    }
+IC_INVALIDATE;                                          /* mapping changed */
 }
 
 /* Check for tlb entry corresponding to va */
@@ -282,8 +308,14 @@ uint32 idx = (uint32) addr >> 1;
 if (idx >= VA_TBSIZE)
     return SCPE_NXM;
 if (addr & 1) {
-    if (tlbn) stlb[idx].pte = (int32) val;
-    else ptlb[idx].pte = (int32) val;
+    if (tlbn) {
+        stlb[idx].pte = (int32) val;
+        stlb[idx].mem = TLB_MEM (stlb[idx].pte);
+        }
+    else {
+        ptlb[idx].pte = (int32) val;
+        ptlb[idx].mem = TLB_MEM (ptlb[idx].pte);
+        }
     }
 else {
     if (tlbn) stlb[idx].tag = (int32) val;
@@ -298,8 +330,10 @@ t_stat tlb_reset (DEVICE *dptr)
 {
 size_t i;
 
-for (i = 0; i < VA_TBSIZE; i++)
+for (i = 0; i < VA_TBSIZE; i++) {
     stlb[i].tag = ptlb[i].tag = stlb[i].pte = ptlb[i].pte = -1;
+    stlb[i].mem = ptlb[i].mem = NULL;
+    }
 return SCPE_OK;
 }
 
@@ -54,8 +54,11 @@
 typedef struct {
     int32       tag;                                    /* tag */
     int32       pte;                                    /* pte */
+    uint32      *mem;                                   /* host page, NULL if not RAM */
     } TLBENT;
 
+#define TLB_MEM(p)      (ADDR_IS_MEM ((p) & TLB_PFN)? M + (((uint32) (p) & TLB_PFN) >> 2): NULL)
+
 extern uint32 *M;
 extern UNIT cpu_unit;
 extern DEVICE cpu_dev;
@@ -72,6 +75,7 @@ extern void zap_tb (int stb);
 extern void zap_tb_ent (uint32 va);
 extern t_bool chk_tb_ent (uint32 va);
 extern void set_map_reg (void);
+extern void set_tlb_mem (void);
 extern int32 ReadIO (uint32 pa, int32 lnt);
 extern void WriteIO (uint32 pa, int32 val, int32 lnt);
 extern int32 ReadReg (uint32 pa, int32 lnt);
@@ -103,6 +107,10 @@ static SIM_INLINE void WriteL (uint32 pa, int32 val);
         write, with three cases: unaligned long, unaligned word within
         a longword, unaligned word crossing a longword boundary.
 
+   TLB entries for pages of main memory carry a host pointer to the
+   page, so an aligned reference that hits in the TLB is done directly
+   on M, without forming the physical address or testing for I/O space.
+
    Note that these routines do not handle quad or octa references.
 */
 
@@ -131,6 +139,14 @@ if (mapen) {                                            /* mapping on? */
     if (((xpte.pte & acc) == 0) || (xpte.tag != vpn) ||
         ((acc & TLB_WACC) && ((xpte.pte & TLB_M) == 0)))
         xpte = fill (va, lnt, acc, NULL);               /* fill if needed */
+    if (xpte.mem && ((off & (lnt - 1)) == 0)) {         /* memory, aligned? */
+        wl = xpte.mem[off >> 2];
+        if (lnt >= L_LONG)
+            return wl;
+        if (lnt == L_WORD)
+            return ((wl >> ((off & 2)? 16: 0)) & WMASK);
+        return ((wl >> ((off & 3) << 3)) & BMASK);
+        }
     pa = (xpte.pte & TLB_PFN) | off;                    /* get phys addr */
     }
 else {
@@ -197,6 +213,20 @@ if (mapen) {
     if (((xpte.pte & acc) == 0) || (xpte.tag != vpn) ||
         ((xpte.pte & TLB_M) == 0))
         xpte = fill (va, lnt, acc, NULL);
+    if (xpte.mem && ((off & (lnt - 1)) == 0)) {         /* memory, aligned? */
+        uint32 *lp = xpte.mem + (off >> 2);
+
+        IC_WRITE ((xpte.pte & TLB_PFN) | off);
+        if (lnt >= L_LONG)
+            *lp = val;
+        else if (lnt == L_WORD)
+            *lp = (off & 2)? (*lp & 0xFFFF) | (val << 16): (*lp & ~0xFFFF) | val;
+        else {
+            sc = (off & 3) << 3;
+            *lp = (*lp & ~(0xFF << sc)) | (val << sc);
+            }
+        return;
+        }
     pa = (xpte.pte & TLB_PFN) | off;
     }
 else {
@@ -365,6 +395,7 @@ if (ADDR_IS_MEM (pa)) {
     int32 id = pa >> 2;
     int32 sc = (pa & 3) << 3;
     int32 mask = 0xFF << sc;
+    IC_WRITE (pa);
     M[id] = (M[id] & ~mask) | (val << sc);
     }
 else {
@@ -381,6 +412,7 @@ static SIM_INLINE void WriteW (uint32 pa, int32 val)
 {
 if (ADDR_IS_MEM (pa)) {
     int32 id = pa >> 2;
+    IC_WRITE (pa);
     M[id] = (pa & 2)? (M[id] & 0xFFFF) | (val << 16):
         (M[id] & ~0xFFFF) | val;
     }
@@ -396,8 +428,10 @@ return;
 
 static SIM_INLINE void WriteL (uint32 pa, int32 val)
 {
-if (ADDR_IS_MEM (pa))
+if (ADDR_IS_MEM (pa)) {
+    IC_WRITE (pa);
     M[pa >> 2] = val;
+    }
 else {
     mchk_ref = REF_V;
     if (ADDR_IS_IO (pa))
@@ -410,8 +444,10 @@ return;
 
 static SIM_INLINE void WriteLP (uint32 pa, int32 val)
 {
-if (ADDR_IS_MEM (pa))
+if (ADDR_IS_MEM (pa)) {
+    IC_WRITE (pa);
     M[pa >> 2] = val;
+    }
 else {
     mchk_va = pa;
     mchk_ref = REF_P;
@@ -438,6 +474,7 @@ static SIM_INLINE void WriteU (uint32 pa, int32 val, int32 lnt)
 if (ADDR_IS_MEM (pa)) {
     int32 bo = pa & 3;
     int32 sc = bo << 3;
+    IC_WRITE (pa);
     M[pa >> 2] = (M[pa >> 2] & ~(insert[lnt] << sc)) | ((val & insert[lnt]) << sc);
     }
 else {
@@ -244,10 +244,17 @@
 #include <fcntl.h>
 #endif
 #include <setjmp.h>
+#if !defined(_WIN32)
+#include <unistd.h>
+#include <sys/wait.h>
+#endif
 
 #if defined(HAVE_EDITLINE)              /* Editline command line editing */
 #include <editline/readline.h>
 #endif
+#if defined(HAVE_ZLIB)                  /* SAVE file compression */
+#include <zlib.h>
+#endif
 
 #if defined(SIM_NEED_GIT_COMMIT_ID)
 #include ".git-commit-id.h"
@@ -279,8 +286,14 @@
 
 #define MAX_DO_NEST_LVL 20                              /* DO cmd nesting level limit */
 #define SRBSIZ          1024                            /* save/restore buffer */
+#define SRPAGE          16384                           /* save/restore memory page */
 #define SIM_BRK_INILNT  4096                            /* bpt tbl length */
 #define SIM_BRK_ALLTYP  0xFFFFFFFB
+#define SIM_BRK_V_GRAN  4                               /* bpt map block size (log2) */
+#define SIM_BRK_MAP_BITS (1u << 16)                     /* bpt map size */
+#define SIM_BRK_MAP_BIT(loc) ((uint32) (((loc) >> SIM_BRK_V_GRAN) ^ ((loc) >> (SIM_BRK_V_GRAN + 16))) & (SIM_BRK_MAP_BITS - 1))
+#define SIM_BRK_MAP_SET(loc) sim_brk_map[SIM_BRK_MAP_BIT (loc) >> 5] |= (1u << (SIM_BRK_MAP_BIT (loc) & 31))
+#define SIM_BRK_MAP_TEST(loc) (sim_brk_map[SIM_BRK_MAP_BIT (loc) >> 5] & (1u << (SIM_BRK_MAP_BIT (loc) & 31)))
 #define UPDATE_SIM_TIME                                         \
     if (1) {                                                    \
         int32 _x;                                               \
@@ -291,6 +304,7 @@
             _x = sim_clock_queue->time;                         \
         sim_time = sim_time + (_x - sim_interval);              \
         sim_rtime = sim_rtime + ((uint32) (_x - sim_interval)); \
+        sim_eventq_clock = sim_eventq_clock + (_x - sim_interval);\
         if (sim_clock_queue == QUEUE_LIST_END)                  \
             noqueue_time = sim_interval;                        \
         else                                                    \
@@ -461,6 +475,7 @@ WEAK void (*sim_vm_init) (void);
  */
 char* (*sim_vm_read) (char *ptr, int32 size, FILE *stream) = NULL;
 void (*sim_vm_post) (t_bool from_scp) = NULL;
+void (*sim_vm_save_done) (const char *filename, t_stat status) = NULL;
 CTAB *sim_vm_cmd = NULL;
 void (*sim_vm_sprint_addr) (char *buf, DEVICE *dptr, t_addr addr) = NULL;
 void (*sim_vm_fprint_addr) (FILE *st, DEVICE *dptr, t_addr addr) = NULL;
@@ -571,6 +586,9 @@ t_stat step_svc (UNIT *ptr);
 t_stat runlimit_svc (UNIT *ptr);
 t_stat expect_svc (UNIT *ptr);
 t_stat flush_svc (UNIT *ptr);
+t_stat save_bg_svc (UNIT *ptr);
+t_stat show_save (FILE *st, DEVICE *dptr, UNIT *uptr, int32 flag, CONST char *cptr);
+static void _sim_save_bg_reap (t_bool wait);
 t_stat shift_args (char *do_arg[], size_t arg_count);
 t_stat set_on (int32 flag, CONST char *cptr);
 t_stat set_verify (int32 flag, CONST char *cptr);
@@ -583,6 +601,14 @@ void int_handler (int signal);
 t_stat set_prompt (int32 flag, CONST char *cptr);
 t_stat set_runlimit (int32 flag, CONST char *cptr);
 t_stat sim_set_asynch (int32 flag, CONST char *cptr);
+t_stat sim_set_queue (int32 flag, CONST char *cptr);
+t_stat sim_set_profile (int32 flag, CONST char *cptr);
+t_stat sim_show_profile (FILE *st, DEVICE *dptr, UNIT *uptr, int32 flag, CONST char *cptr);
+t_stat sim_set_trace (int32 flag, CONST char *cptr);
+t_stat sim_show_trace (FILE *st, DEVICE *dptr, UNIT *uptr, int32 flag, CONST char *cptr);
+static void _sim_trace_event (UNIT *uptr);
+static t_stat _sim_trace_close (void);
+static int _sim_eventq_compare (const void *pa, const void *pb);
 static const char *_get_dbg_verb (uint32 dbits, DEVICE* dptr, UNIT *uptr);
 static t_stat sim_sanity_check_register_declarations (DEVICE **devices);
 static void fix_writelock_mtab (DEVICE *dptr);
@@ -619,6 +645,7 @@ t_addr sim_brk_match_addr;
 char *sim_brk_act[MAX_DO_NEST_LVL];
 char *sim_brk_act_buf[MAX_DO_NEST_LVL];
 BRKTAB **sim_brk_tab = NULL;
+static uint32 sim_brk_map[SIM_BRK_MAP_BITS / 32];       /* addresses which may have breakpoints */
 int32 sim_brk_ent = 0;
 int32 sim_brk_lnt = 0;
 int32 sim_brk_ins = 0;
@@ -638,6 +665,73 @@ size_t *sim_sub_instr_off = NULL;   /* offsets in substitution buffer where orig
 static double sim_time;
 static uint32 sim_rtime;
 static int32 noqueue_time;
+
+/* Event queue engines
+
+   The LIST engine keeps sim_clock_queue as a singly linked list ordered by
+   time with each entry's time RELATIVE to the previous entry.  Activation
+   and cancellation are O(n) in the number of active units.
+
+   The HEAP engine keeps active units in a binary min-heap ordered by
+   ABSOLUTE due time (ties broken by activation order, as the list does).
+   Activation and cancellation are O(log n).  sim_clock_queue always points
+   at the heap root, and the root's time field holds the delay until it
+   fires, so code which only examines the head of the queue sees the same
+   state with either engine.  Units in the heap have their next field set
+   to QUEUE_LIST_END so that sim_is_active () is unchanged; simulators
+   which walk sim_clock_queue through the next links must use LIST.
+*/
+
+#define SIM_EVENTQ_LIST     0                           /* delta time linked list */
+#define SIM_EVENTQ_HEAP     1                           /* absolute time binary heap */
+
+#if defined (SIM_EVENTQ_HEAP_DEFAULT)
+static int32 sim_eventq_engine = SIM_EVENTQ_HEAP;
+#else
+static int32 sim_eventq_engine = SIM_EVENTQ_LIST;
+#endif
+static double sim_eventq_clock = 0.0;                   /* absolute time at last UPDATE_SIM_TIME */
+static UNIT **sim_eventq_heap = NULL;                   /* heap of active units */
+static uint32 sim_eventq_heap_count = 0;
+static uint32 sim_eventq_heap_size = 0;
+static uint32 sim_eventq_seq = 0;                       /* activation sequence (tie breaker) */
+
+/* Event profiling */
+
+typedef struct SIM_EVENT_PROFILE SIM_EVENT_PROFILE;
+struct SIM_EVENT_PROFILE {
+    SIM_EVENT_PROFILE   *next;                          /* next profiled unit */
+    char                *uname;                         /* unit name when first seen */
+    double              activations;                    /* sim_activate calls which queued */
+    double              cancels;                        /* sim_cancel calls which dequeued */
+    double              services;                       /* service routine calls */
+    double              delay;                          /* total scheduled delay */
+    double              host_nsec;                      /* host time in service routine */
+    };
+
+static t_bool sim_profile_events = FALSE;               /* event profiling enabled */
+static SIM_EVENT_PROFILE *sim_event_profiles = NULL;    /* profiled units */
+static double sim_profile_start_gtime;                  /* sim_gtime when data was reset */
+static double sim_profile_start_nsec;                   /* host time when data was reset */
+
+/* Binary trace */
+
+t_bool sim_trace_active = FALSE;                        /* trace file open */
+static FILE *sim_trace_file = NULL;
+static char sim_trace_name[CBUFSIZE];
+static SIM_TRACE_REC *sim_trace_ring = NULL;            /* record ring */
+static volatile uint32 sim_trace_head = 0;              /* next record to fill (producer) */
+static volatile uint32 sim_trace_tail = 0;              /* next record to write (consumer) */
+static double sim_trace_records;                        /* records produced */
+static double sim_trace_stalls;                         /* waits for a full ring */
+static uint32 sim_trace_errors;                         /* write errors */
+#if defined(SIM_ASYNCH_IO)
+static pthread_t sim_trace_thread;                      /* writer thread */
+static pthread_mutex_t sim_trace_lock;
+static pthread_cond_t sim_trace_wake;                   /* writer has work */
+static pthread_cond_t sim_trace_space;                  /* ring has space */
+static t_bool sim_trace_stop;                           /* writer should exit */
+#endif
 volatile t_bool stop_cpu = FALSE;
 volatile t_bool sigterm_received = FALSE;
 static unsigned int sim_stop_sleep_ms = 250;
@@ -761,6 +855,20 @@ DEVICE sim_flush_dev = {
     NULL, NULL, NULL, NULL, NULL, NULL,
     sim_int_flush_description};
 
+static const char *sim_int_save_description (DEVICE *dptr)
+{
+return "Background SAVE completion poll";
+}
+
+static UNIT sim_save_bg_unit = { UDATA (&save_bg_svc, UNIT_IDLE, 0) };
+DEVICE sim_save_bg_dev = {
+    "INT-SAVE", &sim_save_bg_unit, NULL, NULL,
+    1, 0, 0, 0, 0, 0,
+    NULL, NULL, NULL, NULL, NULL, NULL,
+    NULL, DEV_NOSAVE, 0,
+    NULL, NULL, NULL, NULL, NULL, NULL,
+    sim_int_save_description};
+
 #if defined USE_INT64
 static const char *sim_si64 = "64b data";
 #else
@@ -775,7 +883,8 @@ const char *sim_savename = sim_name;      /* Simulator Name used in SAVE/RESTORE
 
 /* Tables and strings */
 
-const char save_vercur[] = "V4.0";
+const char save_vercur[] = "V4.1";
+const char save_ver41[] = "V4.1";
 const char save_ver40[] = "V4.0";
 const char save_ver35[] = "V3.5";
 const char save_ver32[] = "V3.2";
@@ -1023,6 +1132,22 @@ static const char simh_help1[] =
       " to a file.  This includes the contents of main memory and all registers,\n"
       " and the I/O connections of devices:\n\n"
       "++SAVE <filename>\n\n"
+      "4Switches\n"
+      "++-I      Incremental save\n\n"
+      " An incremental save (SAVE -I) writes the registers and device state as\n"
+      " usual, but only the memory pages which changed since the previous SAVE\n"
+      " in this session.  The file names that previous save file by its full\n"
+      " path, and it must be kept there: restoring an incremental save first\n"
+      " restores the save it is based on (and so on back to the last full\n"
+      " save), whatever the current directory is.\n\n"
+      "++-B      Background save\n\n"
+      " A background save (SAVE -B, not available on Windows) forks a copy of\n"
+      " the simulator which writes the save file while the simulator itself\n"
+      " continues, so the pause is only the time it takes to fork.  Only one\n"
+      " background save can be in progress at a time.  SHOW SAVE displays its\n"
+      " progress and the result of the last one.  Since the pages written by\n"
+      " the background copy are not known here, the next SAVE after a\n"
+      " background save must be a full save.\n\n"
 #define HLP_RESTORE     "*Commands Saving_and_Restoring_State RESTORE"
       "3RESTORE\n"
       " The RESTORE command (abbreviation REST, alternately GET) restores a\n"
@@ -1035,7 +1160,8 @@ static const char simh_help1[] =
       "++-F      Overrides the related file timestamp validation check\n"
       "\n"
       "4Notes:\n"
-      " 1) SAVE file format compresses zeroes to minimize file size.\n"
+      " 1) SAVE file format omits zero memory pages and compresses the rest\n"
+      "    (when built with zlib) to minimize file size.\n"
       " 2) The simulator can't restore active incoming telnet sessions to\n"
       " multiplexer devices, but the listening ports will be restored across a\n"
       " save/restore.\n"
@@ -1469,6 +1595,43 @@ static const char simh_help1[] =
       "3Asynch\n"
       "+SET ASYNCH                  enable asynchronous I/O\n"
       "+SET NOASYNCH                disable asynchronous I/O\n"
+#define HLP_SET_QUEUE "*Commands SET Queue"
+      "3Queue\n"
+      "+SET QUEUE LIST              keep the event queue as a delta time list\n"
+      "+SET QUEUE HEAP              keep the event queue as an absolute time heap\n\n"
+      " The event queue engine determines how pending unit events are ordered.\n"
+      " LIST, the default, inserts and removes events in time proportional to\n"
+      " the number of active units.  HEAP does so in logarithmic time, which\n"
+      " helps configurations with many active units (multiplexer lines, disk\n"
+      " and network controllers).  Event ordering and timing are identical with\n"
+      " either engine.  Pending events are moved when the engine is changed.\n"
+      " A few simulators walk the event queue directly and must use LIST.\n"
+      " The SHOW QUEUE ENGINE command displays the current engine.\n"
+#define HLP_SET_PROFILE "*Commands SET Profile"
+      "3Profile\n"
+      "+SET PROFILE EVENTS          enable event and unit service profiling\n"
+      "+SET PROFILE RESET           clear collected profile data\n"
+      "+SET NOPROFILE               disable profiling\n\n"
+      " Event profiling records, for each unit, the number of activations,\n"
+      " cancellations and service routine calls, the average scheduled delay\n"
+      " and the host time spent in the unit's service routine.  The results\n"
+      " are displayed with SHOW PROFILE EVENTS, or written as comma separated\n"
+      " values with SHOW -C PROFILE EVENTS {file}.  Data is retained when\n"
+      " profiling is disabled.\n"
+#define HLP_SET_TRACE "*Commands SET Trace"
+      "3Trace\n"
+      "+SET TRACE file              write binary trace records to file\n"
+      "+SET NOTRACE                 stop tracing and close the file\n\n"
+      " A binary trace records executed instructions (PC, instruction bytes\n"
+      " and the registers changed since the previous record) and unit events\n"
+      " as fixed size records, which is much faster than instruction tracing\n"
+      " with SET DEBUG.  Records are queued in memory and written by a\n"
+      " background thread when asynchronous I/O is available.  The file is\n"
+      " rendered as text with SHOW TRACE file {outfile}, using the same\n"
+      " simulator's instruction display.  SHOW TRACE displays the number of\n"
+      " records written and the number of times the simulator waited for the\n"
+      " writer.  Only simulators whose CPU emits trace records (currently the\n"
+      " VAX family) record instructions.\n"
 #define HLP_SET_ENVIRON "*Commands SET Environment"
       "3Environment\n"
       "4Explicitily Changing a Variable\n"
@@ -1579,6 +1742,7 @@ static const char simh_help2[] =
       "+sh{ow} s{how}               show SHOW commands for all devices\n"
       "+sh{ow} n{ames}              show logical names\n"
       "+sh{ow} q{ueue}              show event queue\n"
+      "+sh{ow} q{ueue} engine       show event queue engine\n"
       "+sh{ow} ti{me}               show simulated time\n"
       "+sh{ow} th{rottle}           show simulation rate\n"
       "+sh{ow} a{synch}             show asynchronous I/O state\n"
@@ -1602,12 +1766,19 @@ static const char simh_help2[] =
       "+sh{ow} on                   show on condition actions\n"
       "+sh{ow} do                   show do nesting state\n"
       "+sh{ow} runlimit             show execution limit states\n"
+      "+sh{ow} {-c} pro{file} events {file}  show event profile\n"
+      "+sh{ow} trace                show binary trace status\n"
+      "+sh{ow} trace file {outfile} display binary trace file\n"
+      "+sh{ow} save                 show background SAVE status\n"
       "+h{elp} <dev> show           displays the device specific show commands\n"
       "++++++++                     available\n"
 #define HLP_SHOW_CONFIG         "*Commands SHOW"
 #define HLP_SHOW_DEVICES        "*Commands SHOW"
 #define HLP_SHOW_FEATURES       "*Commands SHOW"
 #define HLP_SHOW_QUEUE          "*Commands SHOW"
+#define HLP_SHOW_PROFILE        "*Commands SHOW"
+#define HLP_SHOW_TRACE          "*Commands SHOW"
+#define HLP_SHOW_SAVE           "*Commands SHOW"
 #define HLP_SHOW_TIME           "*Commands SHOW"
 #define HLP_SHOW_MODIFIERS      "*Commands SHOW"
 #define HLP_SHOW_NAMES          "*Commands SHOW"
@@ -2612,6 +2783,11 @@ static CTAB set_glob_tab[] = {
     { "CLOCKS",     &sim_set_timers,            1, HLP_SET_CLOCK },
     { "ASYNCH",     &sim_set_asynch,            1, HLP_SET_ASYNCH },
     { "NOASYNCH",   &sim_set_asynch,            0, HLP_SET_ASYNCH },
+    { "QUEUE",      &sim_set_queue,             0, HLP_SET_QUEUE },
+    { "PROFILE",    &sim_set_profile,           1, HLP_SET_PROFILE },
+    { "NOPROFILE",  &sim_set_profile,           0, HLP_SET_PROFILE },
+    { "TRACE",      &sim_set_trace,             1, HLP_SET_TRACE },
+    { "NOTRACE",    &sim_set_trace,             0, HLP_SET_TRACE },
     { "ENVIRONMENT", &sim_set_environment,      1, HLP_SET_ENVIRON },
     { "ON",         &set_on,                    1, HLP_SET_ON },
     { "NOON",       &set_on,                    0, HLP_SET_ON },
@@ -2685,6 +2861,9 @@ static SHTAB show_glob_tab[] = {
     { "ON",             &show_on,                  -1, HLP_SHOW_ON },
     { "DO",             &show_do,                   0, HLP_SHOW_DO },
     { "RUNLIMIT",       &show_runlimit,             0, HLP_SHOW_RUNLIMIT },
+    { "PROFILE",        &sim_show_profile,          0, HLP_SHOW_PROFILE },
+    { "TRACE",          &sim_show_trace,            0, HLP_SHOW_TRACE },
+    { "SAVE",           &show_save,                 0, HLP_SHOW_SAVE },
     { NULL,             NULL,                       0 }
     };
 
@@ -2858,6 +3037,7 @@ sim_register_internal_device (&sim_expect_dev);
 sim_register_internal_device (&sim_step_dev);
 sim_register_internal_device (&sim_flush_dev);
 sim_register_internal_device (&sim_runlimit_dev);
+sim_register_internal_device (&sim_save_bg_dev);
 
 if ((stat = sim_ttinit ()) != SCPE_OK) {
     fprintf (stderr, "Fatal terminal initialization error\n%s\n",
@@ -2976,8 +3156,10 @@ if (SCPE_BARE_STATUS(stat) != SCPE_EXIT)
 
 cleanup_and_exit:
 
+_sim_save_bg_reap (TRUE);                               /* let background SAVE finish */
 detach_all (0, TRUE);                                   /* close files */
 sim_set_deboff (0, NULL);                               /* close debug */
+_sim_trace_close ();                                    /* close binary trace */
 sim_set_logoff (0, NULL);                               /* close log */
 sim_set_notelnet (0, NULL);                             /* close Telnet */
 vid_close_all ();                                       /* close video */
@@ -6989,6 +7171,36 @@ else if (!flag)
 return SCPE_OK;
 }
 
+static void show_queue_entry (FILE *st, UNIT *uptr, double inst_per_sec)
+{
+DEVICE *dptr;
+const char *tim = "";
+
+if (uptr == &sim_step_unit)
+    fprintf (st, "  Step timer");
+else
+    if (uptr == &sim_expect_unit)
+        fprintf (st, "  Expect fired");
+    else
+        if ((dptr = find_dev_from_unit (uptr)) != NULL) {
+            fprintf (st, "  %s", sim_dname (dptr));
+            if (dptr->numunits > 1)
+                fprintf (st, " unit %d", (int32) (uptr - dptr->units));
+            }
+        else
+            fprintf (st, "  Unknown");
+if (inst_per_sec != 0.0)
+    tim = sim_fmt_secs(((_sim_activate_queue_time (uptr) - 1) / sim_timer_inst_per_sec ()) + (uptr->usecs_remaining / 1000000.0));
+if (uptr->usecs_remaining)
+    fprintf (st, " at %d plus %.0f usecs%s%s%s%s\n", _sim_activate_queue_time (uptr) - 1, uptr->usecs_remaining,
+                                    (*tim) ? " (" : "", tim, (*tim) ? " total)" : "",
+                                    (uptr->flags & UNIT_IDLE) ? " (Idle capable)" : "");
+else
+    fprintf (st, " at %d%s%s%s%s\n", _sim_activate_queue_time (uptr) - 1,
+                                    (*tim) ? " (" : "", tim, (*tim) ? ")" : "",
+                                    (uptr->flags & UNIT_IDLE) ? " (Idle capable)" : "");
+}
+
 t_stat show_queue (FILE *st, DEVICE *dnotused, UNIT *unotused, int32 flag, CONST char *cptr)
 {
 DEVICE *dptr;
@@ -6996,41 +7208,38 @@ UNIT *uptr;
 MEMFILE buf;
 
 memset (&buf, 0, sizeof (buf));
-if (cptr && (*cptr != 0))
-    return SCPE_2MARG;
+if (cptr && (*cptr != 0)) {
+    char gbuf[CBUFSIZE];
+
+    cptr = get_glyph (cptr, gbuf, 0);
+    if ((*cptr != 0) || (MATCH_CMD (gbuf, "ENGINE") != 0))
+        return SCPE_2MARG;
+    fprintf (st, "%s event queue engine: %s\n", sim_name, (sim_eventq_engine == SIM_EVENTQ_HEAP) ? "HEAP" : "LIST");
+    return SCPE_OK;
+    }
 if (sim_clock_queue == QUEUE_LIST_END)
     fprintf (st, "%s event queue empty, time = %.0f, executing %s %s/sec\n",
              sim_name, sim_time, sim_fmt_numeric (sim_timer_inst_per_sec ()), sim_vm_interval_units);
 else {
-    const char *tim = "";
     double inst_per_sec = sim_timer_inst_per_sec ();
 
     fprintf (st, "%s event queue status, time = %.0f, executing %s %s/sec\n",
              sim_name, sim_time, sim_fmt_numeric (inst_per_sec), sim_vm_interval_units);
-    for (uptr = sim_clock_queue; uptr != QUEUE_LIST_END; uptr = uptr->next) {
-        if (uptr == &sim_step_unit)
-            fprintf (st, "  Step timer");
-        else
-            if (uptr == &sim_expect_unit)
-                fprintf (st, "  Expect fired");
-            else
-                if ((dptr = find_dev_from_unit (uptr)) != NULL) {
-                    fprintf (st, "  %s", sim_dname (dptr));
-                    if (dptr->numunits > 1)
-                        fprintf (st, " unit %d", (int32) (uptr - dptr->units));
-                    }
-                else
-                    fprintf (st, "  Unknown");
-        if (inst_per_sec != 0.0)
-            tim = sim_fmt_secs(((_sim_activate_queue_time (uptr) - 1) / sim_timer_inst_per_sec ()) + (uptr->usecs_remaining / 1000000.0));
-        if (uptr->usecs_remaining)
-            fprintf (st, " at %d plus %.0f usecs%s%s%s%s\n", _sim_activate_queue_time (uptr) - 1, uptr->usecs_remaining,
-                                            (*tim) ? " (" : "", tim, (*tim) ? " total)" : "",
-                                            (uptr->flags & UNIT_IDLE) ? " (Idle capable)" : "");
-        else
-            fprintf (st, " at %d%s%s%s%s\n", _sim_activate_queue_time (uptr) - 1,
-                                            (*tim) ? " (" : "", tim, (*tim) ? ")" : "",
-                                            (uptr->flags & UNIT_IDLE) ? " (Idle capable)" : "");
+    if (sim_eventq_engine == SIM_EVENTQ_HEAP) {
+        UNIT **sorted = (UNIT **)malloc (sim_eventq_heap_count * sizeof (*sorted));
+        uint32 i;
+
+        if (sorted == NULL)
+            return SCPE_MEM;
+        memcpy (sorted, sim_eventq_heap, sim_eventq_heap_count * sizeof (*sorted));
+        qsort (sorted, sim_eventq_heap_count, sizeof (*sorted), _sim_eventq_compare);
+        for (i = 0; i < sim_eventq_heap_count; i++)
+            show_queue_entry (st, sorted[i], inst_per_sec);
+        free (sorted);
+        }
+    else {
+        for (uptr = sim_clock_queue; uptr != QUEUE_LIST_END; uptr = uptr->next)
+            show_queue_entry (st, uptr, inst_per_sec);
         }
     }
 sim_show_clock_queues (st, dnotused, unotused, flag, cptr);
@@ -8550,9 +8759,506 @@ return uptr->uname = strcpy ((char *)malloc (1 + strlen (uname)), uname);
 }
 
 
+/* Memory snapshot pages
+
+   V4.1 save files store memory-like units as pages of SRPAGE values.
+   Each page is compressed when zlib is available, and all zero pages
+   are left out of full snapshots.  A unit which sets UNIT_MEM_BUF keeps
+   its memory in filebuf (one SZ_D sized value per aincr addresses), and
+   pages are copied directly instead of calling examine/deposit per value.
+
+   An incremental snapshot (SAVE -I) only writes the pages which changed
+   since the previous snapshot written by this process, found by comparing
+   a hash of each page with the one recorded then.  The incremental file
+   names the previous snapshot, which RESTORE loads first.
+*/
+
+typedef struct SAVE_PAGES SAVE_PAGES;
+struct SAVE_PAGES {
+    SAVE_PAGES          *next;
+    UNIT                *uptr;                          /* memory unit */
+    t_addr              high;                           /* size when hashed */
+    uint32              npages;
+    t_uint64            *hash;                          /* page hashes */
+    };
+
+static SAVE_PAGES *sim_save_pages = NULL;               /* hashes at last save */
+static char *sim_save_last = NULL;                      /* last snapshot file */
+
+static void _sim_save_pages_reset (void)
+{
+SAVE_PAGES *pg;
+
+while ((pg = sim_save_pages) != NULL) {
+    sim_save_pages = pg->next;
+    free (pg->hash);
+    free (pg);
+    }
+free (sim_save_last);
+sim_save_last = NULL;
+}
+
+static SAVE_PAGES *_sim_save_pages_unit (UNIT *uptr)
+{
+SAVE_PAGES *pg;
+
+for (pg = sim_save_pages; pg != NULL; pg = pg->next)
+    if (pg->uptr == uptr)
+        return pg;
+pg = (SAVE_PAGES *)calloc (1, sizeof (*pg));
+if (pg == NULL)
+    return NULL;
+pg->uptr = uptr;
+pg->next = sim_save_pages;
+sim_save_pages = pg;
+return pg;
+}
+
+static t_uint64 _sim_save_hash (const uint8 *buf, size_t lnt)
+{
+t_uint64 w, h = 0xCBF29CE484222325ULL;
+size_t i;
+
+for (i = 0; i + sizeof (w) <= lnt; i += sizeof (w)) {
+    memcpy (&w, buf + i, sizeof (w));
+    h = (h ^ w) * 0x100000001B3ULL;
+    h = h ^ (h >> 29);
+    }
+for ( ; i < lnt; i++)
+    h = (h ^ buf[i]) * 0x100000001B3ULL;
+return h;
+}
+
+/* Read cnt values starting at address k of a memory unit */
+
+static t_stat _sim_save_page_get (DEVICE *dptr, UNIT *uptr, t_addr k, uint32 cnt, void *mbuf, size_t sz)
+{
+t_value val;
+uint32 l;
+t_stat r;
+
+if (uptr->dynflags & UNIT_MEM_BUF) {
+    memcpy (mbuf, (uint8 *)uptr->filebuf + (size_t)(k / dptr->aincr) * sz, cnt * sz);
+    return SCPE_OK;
+    }
+for (l = 0; l < cnt; l++, k = k + dptr->aincr) {
+    r = dptr->examine (&val, k, uptr, SIM_SW_REST);
+    if (r != SCPE_OK)
+        return r;
+    SZ_STORE (sz, val, mbuf, l);
+    }
+return SCPE_OK;
+}
+
+/* Write cnt values starting at address k of a memory unit */
+
+static t_stat _sim_save_page_put (DEVICE *dptr, UNIT *uptr, t_addr k, uint32 cnt, const void *mbuf, size_t sz)
+{
+t_value val;
+uint32 l;
+t_stat r;
+
+if (uptr->dynflags & UNIT_MEM_BUF) {
+    memcpy ((uint8 *)uptr->filebuf + (size_t)(k / dptr->aincr) * sz, mbuf, cnt * sz);
+    return SCPE_OK;
+    }
+for (l = 0; l < cnt; l++, k = k + dptr->aincr) {
+    SZ_LOAD (sz, val, mbuf, l);
+    r = dptr->deposit (val, k, uptr, SIM_SW_REST);
+    if (r != SCPE_OK)
+        return r;
+    }
+return SCPE_OK;
+}
+
+/* Save a memory unit as pages
+
+   Each page is written as its page number, the stored length and the
+   data.  A stored length less than the page's size means the data is
+   compressed.  A page number of -1 ends the unit.
+*/
+
+static t_stat _sim_save_mem (FILE *sfile, DEVICE *dptr, UNIT *uptr, t_addr high, t_bool incr)
+{
+size_t sz = SZ_D (dptr);
+t_addr nval = (high + dptr->aincr - 1) / dptr->aincr;   /* values in unit */
+uint32 npages = (uint32)((nval + SRPAGE - 1) / SRPAGE);
+uint32 p, cnt;
+int32 pno;
+uint32 raw, clen;
+uint8 *mbuf, *cbuf = NULL;
+SAVE_PAGES *pg = _sim_save_pages_unit (uptr);
+t_bool all = !incr || (pg == NULL) || (pg->hash == NULL) || (pg->high != high);
+t_uint64 hash;
+t_stat r = SCPE_OK;
+#if defined(HAVE_ZLIB)
+uLongf zlen;
+#endif
+
+if (pg == NULL)
+    return SCPE_MEM;
+if ((pg->hash == NULL) || (pg->npages != npages)) {
+    free (pg->hash);
+    pg->hash = (t_uint64 *)calloc (npages, sizeof (*pg->hash));
+    pg->npages = npages;
+    }
+pg->high = high;
+mbuf = (uint8 *)malloc (SRPAGE * sz);
+#if defined(HAVE_ZLIB)
+cbuf = (uint8 *)malloc (compressBound ((uLong)(SRPAGE * sz)));
+#endif
+if ((mbuf == NULL) || (pg->hash == NULL)
+#if defined(HAVE_ZLIB)
+    || (cbuf == NULL)
+#endif
+    ) {
+    free (mbuf);
+    free (cbuf);
+    return SCPE_MEM;
+    }
+for (p = 0; p < npages; p++) {
+    cnt = (uint32)(((nval - (t_addr)p * SRPAGE) < SRPAGE) ? (nval - (t_addr)p * SRPAGE) : SRPAGE);
+    raw = (uint32)(cnt * sz);
+    r = _sim_save_page_get (dptr, uptr, (t_addr)p * SRPAGE * dptr->aincr, cnt, mbuf, sz);
+    if (r != SCPE_OK)
+        break;
+    hash = _sim_save_hash (mbuf, raw);
+    if (!all && (hash == pg->hash[p]))                  /* unchanged since last? */
+        continue;
+    pg->hash[p] = hash;
+    if (!incr && (mbuf[0] == 0) &&                      /* all zero in full save? */
+        (memcmp (mbuf, mbuf + 1, raw - 1) == 0))
+        continue;
+    pno = (int32)p;
+    sim_fwrite (&pno, sizeof (pno), 1, sfile);
+    clen = raw;
+#if defined(HAVE_ZLIB)
+    zlen = (uLongf)compressBound ((uLong)raw);
+    if (!sim_end)                                       /* file is little endian */
+        sim_buf_swap_data (mbuf, sz, cnt);
+    if ((compress2 (cbuf, &zlen, mbuf, (uLong)raw, Z_BEST_SPEED) == Z_OK) &&
+        (zlen < raw))
+        clen = (uint32)zlen;
+    if (!sim_end)
+        sim_buf_swap_data (mbuf, sz, cnt);
+#endif
+    sim_fwrite (&clen, sizeof (clen), 1, sfile);
+    if (clen < raw)
+        sim_fwrite (cbuf, 1, clen, sfile);
+    else
+        sim_fwrite (mbuf, sz, cnt, sfile);
+    }
+pno = -1;                                               /* end of pages */
+sim_fwrite (&pno, sizeof (pno), 1, sfile);
+free (mbuf);
+free (cbuf);
+return r;
+}
+
+/* Restore a memory unit's pages; a full snapshot zeroes memory first */
+
+static t_stat _sim_rest_mem (FILE *rfile, DEVICE *dptr, UNIT *uptr, t_addr high, t_bool incr)
+{
+size_t sz = SZ_D (dptr);
+t_addr nval = (high + dptr->aincr - 1) / dptr->aincr;
+uint32 npages = (uint32)((nval + SRPAGE - 1) / SRPAGE);
+uint32 p, cnt, raw, clen;
+int32 pno;
+uint8 *mbuf, *cbuf;
+t_stat r = SCPE_OK;
+#if defined(HAVE_ZLIB)
+uLongf zlen;
+#endif
+
+mbuf = (uint8 *)calloc (SRPAGE, sz);
+cbuf = (uint8 *)malloc (SRPAGE * sz);
+if ((mbuf == NULL) || (cbuf == NULL)) {
+    free (mbuf);
+    free (cbuf);
+    return SCPE_MEM;
+    }
+if (!incr) {                                            /* zero pages not saved */
+    for (p = 0; (p < npages) && (r == SCPE_OK); p++) {
+        cnt = (uint32)(((nval - (t_addr)p * SRPAGE) < SRPAGE) ? (nval - (t_addr)p * SRPAGE) : SRPAGE);
+        r = _sim_save_page_put (dptr, uptr, (t_addr)p * SRPAGE * dptr->aincr, cnt, mbuf, sz);
+        }
+    }
+while (r == SCPE_OK) {
+    if (sim_fread (&pno, sizeof (pno), 1, rfile) == 0) {
+        r = SCPE_IOERR;
+        break;
+        }
+    if (pno < 0)                                        /* end of pages? */
+        break;
+    p = (uint32)pno;
+    if ((p >= npages) ||
+        (sim_fread (&clen, sizeof (clen), 1, rfile) == 0)) {
+        r = SCPE_IOERR;
+        break;
+        }
+    cnt = (uint32)(((nval - (t_addr)p * SRPAGE) < SRPAGE) ? (nval - (t_addr)p * SRPAGE) : SRPAGE);
+    raw = (uint32)(cnt * sz);
+    if (clen > raw) {
+        r = SCPE_IOERR;
+        break;
+        }
+    if (clen == raw) {                                  /* stored? */
+        if (sim_fread (mbuf, sz, cnt, rfile) != cnt)
+            r = SCPE_IOERR;
+        }
+    else {
+#if defined(HAVE_ZLIB)
+        zlen = (uLongf)raw;
+        if ((sim_fread (cbuf, 1, clen, rfile) != clen) ||
+            (uncompress (mbuf, &zlen, cbuf, (uLong)clen) != Z_OK) ||
+            (zlen != raw))
+            r = SCPE_IOERR;
+        else if (!sim_end)
+            sim_buf_swap_data (mbuf, sz, cnt);
+#else
+        sim_printf ("Can't restore compressed memory without zlib support: %s\n", sim_uname (uptr));
+        r = SCPE_NOFNC;
+#endif
+        }
+    if (r == SCPE_OK)
+        r = _sim_save_page_put (dptr, uptr, (t_addr)p * SRPAGE * dptr->aincr, cnt, mbuf, sz);
+    }
+free (mbuf);
+free (cbuf);
+return r;
+}
+
+/* Background save state
+
+   A background save forks the simulator; the child writes the save file
+   from its copy-on-write image of memory and exits with the sim_save
+   status, while the parent carries on.  The parent reaps the child from
+   the INT-SAVE poll unit while running, or from SHOW SAVE otherwise.
+
+   Only the forking thread exists in the child, so any lock another thread
+   held at the fork stays held there.  The parent holds the timer and
+   asynch queue locks across the fork, which sim_save can reach through
+   sim_activate_time, and the child starts over with fresh ones rather
+   than unlocking copies it does not own.  The child reports how long the
+   save took through a pipe, since the parent only sees it when reaped.
+*/
+
+#if !defined(_WIN32)
+static pid_t sim_save_bg_pid = 0;                       /* child, 0 if none */
+static int sim_save_bg_fd = -1;                         /* child's timing pipe */
+#endif
+static t_bool sim_save_bg_child = FALSE;                /* TRUE in the child */
+static char *sim_save_bg_file = NULL;                   /* file being written */
+static uint32 sim_save_bg_start;                        /* start time (msec) */
+static uint32 sim_save_bg_msec;                         /* last elapsed time */
+static double sim_save_bg_fork_usec;                    /* last fork latency */
+static t_stat sim_save_bg_stat = SCPE_OK;               /* last status */
+static uint32 sim_save_bg_count = 0;                    /* completed saves */
+
+/* Write back a buffered unit's file, as a save does */
+
+static void _sim_save_flush_buf (DEVICE *dptr, UNIT *uptr)
+{
+if ((uptr->flags & UNIT_ATT) &&                         /* attached */
+    (uptr->flags & UNIT_BUF) &&                         /* writable buffered */
+    uptr->hwmark &&                                     /* files need to be */
+    ((uptr->flags & UNIT_RO) == 0)) {                   /* written on save */
+    uint32 cap = (uptr->hwmark + dptr->aincr - 1) / dptr->aincr;
+    rewind (uptr->fileref);
+    sim_fwrite (uptr->filebuf, SZ_D (dptr), cap, uptr->fileref);
+    fclose (uptr->fileref);                             /* flush data and state */
+    uptr->fileref = sim_fopen (uptr->filename, "rb+");  /* reopen r/w */
+    }
+}
+
+/* Collect a finished background save, waiting for it if requested */
+
+static void _sim_save_bg_reap (t_bool wait)
+{
+#if !defined(_WIN32)
+int status;
+pid_t pid;
+
+if (sim_save_bg_pid == 0)
+    return;
+do
+    pid = waitpid (sim_save_bg_pid, &status, wait ? 0 : WNOHANG);
+    while ((pid < 0) && (errno == EINTR));
+if (pid == 0)                                           /* still running */
+    return;
+if (pid < 0)                                            /* lost track of it */
+    sim_save_bg_stat = SCPE_IOERR;
+else if (WIFEXITED (status))
+    sim_save_bg_stat = (WEXITSTATUS (status) == 0) ? SCPE_OK : WEXITSTATUS (status);
+else
+    sim_save_bg_stat = SCPE_IOERR;                      /* killed */
+sim_save_bg_pid = 0;
+if ((sim_save_bg_fd < 0) ||                             /* child timed itself? */
+    (read (sim_save_bg_fd, &sim_save_bg_msec, sizeof (sim_save_bg_msec)) != sizeof (sim_save_bg_msec)))
+    sim_save_bg_msec = sim_os_msec () - sim_save_bg_start;
+if (sim_save_bg_fd >= 0)
+    close (sim_save_bg_fd);
+sim_save_bg_fd = -1;
+++sim_save_bg_count;
+sim_cancel (&sim_save_bg_unit);
+sim_debug (SIM_DBG_SAVE, &sim_scp_dev, "Background save of %s done: %s, %u ms\n",
+           sim_save_bg_file, sim_error_text (sim_save_bg_stat), sim_save_bg_msec);
+if (sim_vm_save_done != NULL)
+    (*sim_vm_save_done) (sim_save_bg_file, sim_save_bg_stat);
+#endif
+}
+
+t_stat save_bg_svc (UNIT *uptr)
+{
+_sim_save_bg_reap (FALSE);
+#if !defined(_WIN32)
+if (sim_save_bg_pid != 0)                               /* poll again */
+    sim_activate_after (uptr, 100000);
+#endif
+return SCPE_OK;
+}
+
+/* Hold the locks a forked child may need, or hand the child fresh ones */
+
+static void _sim_save_bg_locks (int phase)
+{
+#if defined (SIM_ASYNCH_IO)
+pthread_mutexattr_t attr;
+
+switch (phase) {
+    case 0:                                             /* before fork */
+        pthread_mutex_lock (&sim_timer_lock);           /* timer thread takes */
+        pthread_mutex_lock (&sim_asynch_lock);          /* them in this order */
+        break;
+    case 1:                                             /* parent */
+        pthread_mutex_unlock (&sim_asynch_lock);
+        pthread_mutex_unlock (&sim_timer_lock);
+        break;
+    default:                                            /* child */
+        pthread_mutexattr_init (&attr);
+        pthread_mutexattr_settype (&attr, PTHREAD_MUTEX_RECURSIVE);
+        pthread_mutex_init (&sim_asynch_lock, &attr);
+        pthread_mutexattr_destroy (&attr);
+        pthread_mutex_init (&sim_timer_lock, NULL);
+        break;
+    }
+#endif
+}
+
+/* Start a background save of an already created file */
+
+static t_stat _sim_save_bg (const char *fname)
+{
+#if defined(_WIN32)
+return sim_messagef (SCPE_NOFNC, "Background SAVE is not available on this host\n");
+#else
+uint32 i, j, device_count;
+DEVICE *dptr;
+double start;
+pid_t pid;
+int fds[2];
+
+for (device_count = 0; sim_devices[device_count]; device_count++);
+for (i = 0; i < device_count; i++) {                    /* buffered files are */
+    dptr = sim_devices[i];                              /* shared with the child, */
+    if (dptr->flags & DEV_NOSAVE)                       /* so write them here */
+        continue;
+    for (j = 0; j < dptr->numunits; j++)
+        _sim_save_flush_buf (dptr, dptr->units + j);
+    }
+fflush (stdout);                                        /* nothing buffered may */
+if (sim_log)                                            /* be written twice */
+    fflush (sim_log);
+if (sim_deb)
+    _sim_debug_flush ();
+if (pipe (fds))                                         /* without it, the time */
+    fds[0] = fds[1] = -1;                               /* is taken at the reap */
+start = sim_os_nsec ();
+_sim_save_bg_locks (0);
+pid = fork ();
+_sim_save_bg_locks ((pid == 0) ? 2 : 1);
+if (pid < 0) {
+    if (fds[0] >= 0) {
+        close (fds[0]);
+        close (fds[1]);
+        }
+    return sim_messagef (SCPE_IOERR, "Can't fork background SAVE: %s\n", strerror (errno));
+    }
+if (pid == 0) {                                         /* child */
+    FILE *sfile;
+    t_stat r;
+    uint32 msec = sim_os_msec ();
+
+    sim_save_bg_child = TRUE;
+    if (fds[0] >= 0)
+        close (fds[0]);
+    sim_deb = NULL;                                     /* parent's streams */
+    sim_log = NULL;
+    if ((sfile = sim_fopen (fname, "r+b")) == NULL)
+        _exit (SCPE_OPENERR);
+    r = sim_save (sfile);
+    if (fclose (sfile) && (r == SCPE_OK))
+        r = SCPE_IOERR;
+    msec = sim_os_msec () - msec;
+    if ((fds[1] >= 0) &&
+        (write (fds[1], &msec, sizeof (msec)) != sizeof (msec)))
+        close (fds[1]);                                 /* parent times the reap */
+    r = SCPE_BARE_STATUS (r);
+    _exit ((r > 255) ? SCPE_IOERR : (int)r);
+    }
+sim_save_bg_fork_usec = (sim_os_nsec () - start) / 1000.0;
+sim_save_bg_pid = pid;
+sim_save_bg_start = sim_os_msec ();
+if (fds[1] >= 0)
+    close (fds[1]);
+sim_save_bg_fd = fds[0];
+free (sim_save_bg_file);
+sim_save_bg_file = (char *)malloc (1 + strlen (fname));
+if (sim_save_bg_file)
+    strcpy (sim_save_bg_file, fname);
+_sim_save_pages_reset ();                               /* child's hashes are lost */
+sim_activate_after (&sim_save_bg_unit, 100000);
+sim_debug (SIM_DBG_SAVE, &sim_scp_dev, "Background save of %s started, pid %d, fork %.0f us\n",
+           fname, (int)pid, sim_save_bg_fork_usec);
+return SCPE_OK;
+#endif
+}
+
+/* Show background save status */
+
+t_stat show_save (FILE *st, DEVICE *dptr, UNIT *uptr, int32 flag, CONST char *cptr)
+{
+if (cptr && (*cptr != 0))
+    return SCPE_2MARG;
+_sim_save_bg_reap (FALSE);
+if (sim_save_last)
+    fprintf (st, "Incremental SAVE base:   %s\n", sim_save_last);
+#if !defined(_WIN32)
+if (sim_save_bg_pid != 0) {
+    fprintf (st, "Background SAVE of %s in progress for %u msec\n", sim_save_bg_file,
+             sim_os_msec () - sim_save_bg_start);
+    fprintf (st, "Fork latency:            %.0f usec\n", sim_save_bg_fork_usec);
+    return SCPE_OK;
+    }
+#endif
+if (sim_save_bg_count == 0) {
+    fprintf (st, "No background SAVE done\n");
+    return SCPE_OK;
+    }
+fprintf (st, "Last background SAVE:    %s\n", sim_save_bg_file);
+fprintf (st, "Status:                  %s\n", sim_error_text (sim_save_bg_stat));
+fprintf (st, "Fork latency:            %.0f usec\n", sim_save_bg_fork_usec);
+fprintf (st, "Elapsed time:            %u msec\n", sim_save_bg_msec);
+if (sim_save_bg_count > 1)
+    fprintf (st, "Background SAVEs:        %u\n", sim_save_bg_count);
+return SCPE_OK;
+}
+
 /* Save command
 
    sa[ve] filename              save state to specified file
+   sa[ve] -i filename           save only memory changed since the last save
+   sa[ve] -b filename           save in a forked process while running on
 */
 
 t_stat save_cmd (int32 flag, CONST char *cptr)
@@ -8567,25 +9273,52 @@ if (*cptr == 0)                                         /* must be more */
 gbuf[sizeof(gbuf)-1] = '\0';
 strlcpy (gbuf, cptr, sizeof(gbuf));
 sim_trim_endspc (gbuf);
+if ((sim_switches & SWMASK ('I')) && (sim_save_last == NULL))
+    return sim_messagef (SCPE_ARG, "No previous SAVE for an incremental save\n");
+if (sim_switches & SWMASK ('I')) {
+    char *fullpath = sim_filepath_parts (gbuf, "f");
+    t_bool same = (fullpath == NULL) || (strcmp (fullpath, sim_save_last) == 0);
+
+    free (fullpath);
+    if (same)
+        return sim_messagef (SCPE_ARG, "An incremental save can't replace the file it is based on\n");
+    }
+_sim_save_bg_reap (FALSE);
+#if !defined(_WIN32)
+if (sim_save_bg_pid != 0) {
+    if (sim_switches & SWMASK ('B'))
+        return sim_messagef (SCPE_ARG, "Background SAVE of %s still in progress\n", sim_save_bg_file);
+    if (strcmp (gbuf, sim_save_bg_file) == 0)
+        return sim_messagef (SCPE_ARG, "%s is being written by a background SAVE\n", gbuf);
+    }
+#endif
 if ((sfile = sim_fopen (gbuf, "r+b")) == NULL) {    /* try existing file */
     if ((sfile = sim_fopen (gbuf, "wb")) == NULL)   /* create new empty file */
         return SCPE_OPENERR;
     }
+if (sim_switches & SWMASK ('B')) {                      /* background? */
+    fclose (sfile);                                     /* child reopens it */
+    return _sim_save_bg (gbuf);
+    }
 r = sim_save (sfile);
 fclose (sfile);
+if (r == SCPE_OK) {
+    free (sim_save_last);                               /* base for next -I, */
+    sim_save_last = sim_filepath_parts (gbuf, "f");     /* found from any directory */
+    }
+else
+    _sim_save_pages_reset ();                           /* next must be full */
 return r;
 }
 
 t_stat sim_save (FILE *sfile)
 {
-void *mbuf;
-int32 l, t;
+int32 t;
 uint32 i, j, device_count;
-t_addr k, high;
+t_addr high;
 t_value val;
 t_stat r;
-t_bool zeroflg;
-size_t sz;
+t_bool incr = ((sim_switches & SWMASK ('I')) != 0) && (sim_save_last != NULL);
 DEVICE *dptr;
 UNIT *uptr;
 REG *rptr;
@@ -8611,6 +9344,11 @@ fprintf (sfile, "git commit id: %8.8s\n", S_xstr(SIM_GIT_COMMIT_ID));
 #else
 fprintf (sfile, "git commit id: unknown\n");
 #endif
+fprintf (sfile, "%s\n", incr ? sim_save_last : "");    /* [V4.1] base snapshot */
+if (!incr)
+    _sim_save_pages_reset ();                           /* rehash everything */
+free (sim_save_last);                                   /* caller sets new base */
+sim_save_last = NULL;
 
 for (device_count = 0; sim_devices[device_count]; device_count++);/* count devices */
 for (i = 0; i < (device_count + sim_internal_device_count); i++) {/* loop thru devices */
@@ -8647,48 +9385,17 @@ for (i = 0; i < (device_count + sim_internal_device_count); i++) {/* loop thru d
         WRITE_I (uptr->pos);
         if (uptr->flags & UNIT_ATT) {
             fputs (uptr->filename, sfile);
-            if ((uptr->flags & UNIT_BUF) &&             /* writable buffered */
-                uptr->hwmark &&                         /* files need to be */
-                ((uptr->flags & UNIT_RO) == 0)) {       /* written on save */
-                uint32 cap = (uptr->hwmark + dptr->aincr - 1) / dptr->aincr;
-                rewind (uptr->fileref);
-                sim_fwrite (uptr->filebuf, SZ_D (dptr), cap, uptr->fileref);
-                fclose (uptr->fileref);                 /* flush data and state */
-                uptr->fileref = sim_fopen (uptr->filename, "rb+");/* reopen r/w */
-                }
+            if (!sim_save_bg_child)                     /* parent did it */
+                _sim_save_flush_buf (dptr, uptr);
             }
         fputc ('\n', sfile);
         if (((uptr->flags & (UNIT_FIX + UNIT_ATTABLE)) == UNIT_FIX) &&
              (dptr->examine != NULL) &&
              ((high = uptr->capac) != 0)) {             /* memory-like unit? */
             WRITE_I (high);                             /* [V2.5] write size */
-            sz = SZ_D (dptr);
-            if ((mbuf = calloc (SRBSIZ, sz)) == NULL) {
-                fclose (sfile);
-                return SCPE_MEM;
-                }
-            for (k = 0; k < high; ) {                   /* loop thru mem */
-                zeroflg = TRUE;
-                for (l = 0; (l < SRBSIZ) && (k < high); l++,
-                     k = k + (dptr->aincr)) {           /* check for 0 block */
-                    r = dptr->examine (&val, k, uptr, SIM_SW_REST);
-                    if (r != SCPE_OK) {
-                        free (mbuf);
-                        return r;
-                        }
-                    if (val) zeroflg = FALSE;
-                    SZ_STORE (sz, val, mbuf, l);
-                    }                                   /* end for l */
-                if (zeroflg) {                          /* all zero's? */
-                    l = -l;                             /* invert block count */
-                    WRITE_I (l);                        /* write only count */
-                    }
-                else {
-                    WRITE_I (l);                        /* block count */
-                    sim_fwrite (mbuf, sz, l, sfile);
-                    }
-                }                                       /* end for k */
-            free (mbuf);                                /* dealloc buffer */
+            r = _sim_save_mem (sfile, dptr, uptr, high, incr);/* [V4.1] pages */
+            if (r != SCPE_OK)
+                return r;
             }                                           /* end if mem */
         else {                                          /* no memory */
             high = 0;                                   /* write 0 */
@@ -8723,6 +9430,8 @@ return (ferror (sfile))? SCPE_IOERR: SCPE_OK;           /* error during save? */
 /* Restore command
 
    re[store] filename           restore state from specified file
+
+   An incremental snapshot first restores the snapshot it is based on.
 */
 
 t_stat restore_cmd (int32 flag, CONST char *cptr)
@@ -8737,6 +9446,8 @@ if (*cptr == 0)                                         /* must be more */
 gbuf[sizeof(gbuf)-1] = '\0';
 strlcpy (gbuf, cptr, sizeof(gbuf));
 sim_trim_endspc (gbuf);
+if (sim_save_bg_file && (strcmp (gbuf, sim_save_bg_file) == 0))
+    _sim_save_bg_reap (TRUE);                           /* wait for it */
 if ((rfile = sim_fopen (gbuf, "rb")) == NULL)
     return SCPE_OPENERR;
 r = sim_rest (rfile);
@@ -8758,7 +9469,9 @@ t_addr k, high, old_capac;
 t_value val, max;
 t_stat r;
 size_t sz;
-t_bool v40, v35, v32;
+t_bool v41, v40, v35, v32;
+t_bool incr = FALSE;
+int32 saved_switches = sim_switches;
 DEVICE *dptr;
 UNIT *uptr;
 REG *rptr;
@@ -8785,8 +9498,10 @@ if (fstat (fileno (rfile), &rstat)) {
     }
 READ_S (buf);                                           /* [V2.5+] read version */
 sim_debug (SIM_DBG_RESTORE, &sim_scp_dev, "version=%s\n", buf);
-v40 = v35 = v32 = FALSE;
-if (strcmp (buf, save_ver40) == 0)                      /* version 4.0? */
+v41 = v40 = v35 = v32 = FALSE;
+if (strcmp (buf, save_ver41) == 0)                      /* version 4.1? */
+    v41 = v40 = v35 = v32 = TRUE;
+else if (strcmp (buf, save_ver40) == 0)                 /* version 4.0? */
     v40 = v35 = v32 = TRUE;
 else if (strcmp (buf, save_ver35) == 0)                 /* version 3.5? */
     v35 = v32 = TRUE;
@@ -8796,7 +9511,7 @@ else if (strcmp (buf, save_ver30) != 0) {               /* version 3.0? */
     sim_printf ("Invalid file version: %s\n", buf);
     return SCPE_INCOMP;
     }
-if ((strcmp (buf, save_ver40) != 0) && (!sim_quiet) && (!suppress_warning)) {
+if ((strcmp (buf, save_vercur) != 0) && (!sim_quiet) && (!suppress_warning)) {
     sim_printf ("warning - attempting to restore a saved simulator image in %s image format.\n", buf);
     warned = TRUE;
     }
@@ -8839,6 +9554,29 @@ if (v40) {
 #undef S_xstr
 #endif
     }
+_sim_save_pages_reset ();                               /* memory will change */
+if (v41) {
+    READ_S (buf);                                       /* [V4.1] base snapshot */
+    if (buf[0] != '\0') {
+        FILE *bfile = sim_fopen (buf, "rb");
+        double save_time = sim_time;
+        uint32 save_rtime = sim_rtime;
+
+        sim_debug (SIM_DBG_RESTORE, &sim_scp_dev, "base=%s\n", buf);
+        if (bfile == NULL) {
+            sim_printf ("Can't open base snapshot %s: %s\n", buf, strerror (errno));
+            return SCPE_OPENERR;
+            }
+        sim_switches = saved_switches;
+        r = sim_rest (bfile);                           /* restore it first */
+        fclose (bfile);
+        if (r != SCPE_OK)
+            return r;
+        sim_time = save_time;                           /* this file's times */
+        sim_rtime = save_rtime;
+        incr = TRUE;
+        }
+    }
 if (!dont_detach_attach)
     detach_all (0, 0);                                  /* Detach everything to start from a consistent state */
 else {
@@ -8903,7 +9641,10 @@ for ( ;; ) {                                            /* device loop */
         READ_I (uptr->u6);
         READ_I (flg);                                   /* [V2.10+] unit flags */
         if (v40) {                                      /* [V4.0+] dynflags */
+            uint32 memflag = uptr->dynflags & UNIT_MEM_BUF;
+
             READ_I (uptr->dynflags);
+            uptr->dynflags = (uptr->dynflags & ~UNIT_MEM_BUF) | memflag;
             READ_I (uptr->wait);
             READ_I (uptr->buf);
             READ_I (uptr->recsize);
@@ -8974,6 +9715,12 @@ for ( ;; ) {                                            /* device loop */
                     fprint_capac (sim_log, dptr, uptr);
                 sim_printf ("\n");
                 }
+            if (v41) {                                  /* [V4.1] pages */
+                r = _sim_rest_mem (rfile, dptr, uptr, high, incr);
+                if (r != SCPE_OK)
+                    goto Cleanup_Return;
+                continue;
+                }
             sz = SZ_D (dptr);                           /* allocate buffer */
             if ((mbuf = realloc (mbuf, SRBSIZ * sz)) == NULL) {
                 r = SCPE_MEM;
@@ -9401,6 +10148,7 @@ if ((SCPE_BARE_STATUS(r) == SCPE_STOP) &&               /* WRU exit from sim_ins
     (sim_on_actions[sim_do_depth][0] == NULL))
     sim_os_ms_sleep (sim_stop_sleep_ms);                /* wait a bit for SIGINT */
 sim_is_running = FALSE;                                 /* flag idle */
+sim_trace_flush ();                                     /* write queued trace records */
 sim_stop_timer_services ();                             /* disable wall clock timing */
 sim_ttcmd ();                                           /* restore console */
 sim_brk_clrall (BRK_TYP_DYN_STEPOVER);                  /* cancel any step/over subroutine breakpoints */
@@ -11913,13 +12661,235 @@ return buf;
                         or 0 (SCPE_OK) if no exceptions
 */
 
-t_stat sim_process_event (void)
+/* Event profiling
+
+   _sim_profile_unit    - find (or create) the profile data for a unit
+   _sim_profile_service - call a unit's service routine, accounting for
+                          the host time it consumes
+*/
+
+static SIM_EVENT_PROFILE *_sim_profile_unit (UNIT *uptr)
 {
-UNIT *uptr;
-t_stat reason, bare_reason;
-int32 sim_interval_catchup;
+SIM_EVENT_PROFILE *prof = (SIM_EVENT_PROFILE *)uptr->e_profile;
 
-if (stop_cpu) {                                         /* stop CPU? */
+if (prof != NULL)
+    return prof;
+prof = (SIM_EVENT_PROFILE *)calloc (1, sizeof (*prof));
+if (prof == NULL)
+    return NULL;
+prof->uname = strdup (sim_uname (uptr));
+prof->next = sim_event_profiles;
+sim_event_profiles = prof;
+uptr->e_profile = prof;
+return prof;
+}
+
+static t_stat _sim_profile_service (UNIT *uptr)
+{
+SIM_EVENT_PROFILE *prof = _sim_profile_unit (uptr);
+double start;
+t_stat reason;
+
+if (prof == NULL)
+    return uptr->action (uptr);
+start = sim_os_nsec ();
+reason = uptr->action (uptr);
+prof->host_nsec += sim_os_nsec () - start;
+prof->services += 1;
+return reason;
+}
+
+/* Event heap primitives
+
+   _sim_eventq_before   - TRUE if unit a is due before unit b
+   _sim_eventq_sift_up  - move heap entry toward the root
+   _sim_eventq_sift_down - move heap entry toward the leaves
+   _sim_eventq_insert   - add a unit to the heap
+   _sim_eventq_remove   - remove a unit from the heap
+   _sim_eventq_head     - point sim_clock_queue at the root and
+                          recompute the root's relative time
+*/
+
+static t_bool _sim_eventq_before (UNIT *a, UNIT *b)
+{
+if (a->e_due != b->e_due)
+    return (a->e_due < b->e_due);
+return ((int32)(a->e_seq - b->e_seq) < 0);
+}
+
+static void _sim_eventq_sift_up (uint32 i)
+{
+UNIT *uptr = sim_eventq_heap[i];
+
+while (i > 0) {
+    uint32 p = (i - 1) / 2;
+
+    if (!_sim_eventq_before (uptr, sim_eventq_heap[p]))
+        break;
+    sim_eventq_heap[i] = sim_eventq_heap[p];
+    sim_eventq_heap[i]->e_index = i + 1;
+    i = p;
+    }
+sim_eventq_heap[i] = uptr;
+uptr->e_index = i + 1;
+}
+
+static void _sim_eventq_sift_down (uint32 i)
+{
+UNIT *uptr = sim_eventq_heap[i];
+
+while (1) {
+    uint32 c = 2 * i + 1;
+
+    if (c >= sim_eventq_heap_count)
+        break;
+    if ((c + 1 < sim_eventq_heap_count) &&
+        _sim_eventq_before (sim_eventq_heap[c + 1], sim_eventq_heap[c]))
+        ++c;
+    if (!_sim_eventq_before (sim_eventq_heap[c], uptr))
+        break;
+    sim_eventq_heap[i] = sim_eventq_heap[c];
+    sim_eventq_heap[i]->e_index = i + 1;
+    i = c;
+    }
+sim_eventq_heap[i] = uptr;
+uptr->e_index = i + 1;
+}
+
+static t_stat _sim_eventq_insert (UNIT *uptr)
+{
+if (sim_eventq_heap_count == sim_eventq_heap_size) {
+    uint32 size = sim_eventq_heap_size ? 2 * sim_eventq_heap_size : 64;
+    UNIT **heap = (UNIT **)realloc (sim_eventq_heap, size * sizeof (*heap));
+
+    if (heap == NULL)
+        return SCPE_MEM;
+    sim_eventq_heap = heap;
+    sim_eventq_heap_size = size;
+    }
+sim_eventq_heap[sim_eventq_heap_count++] = uptr;
+_sim_eventq_sift_up (sim_eventq_heap_count - 1);
+return SCPE_OK;
+}
+
+static void _sim_eventq_remove (UNIT *uptr)
+{
+uint32 i = uptr->e_index - 1;
+UNIT *last = sim_eventq_heap[--sim_eventq_heap_count];
+
+uptr->e_index = 0;
+if (last == uptr)
+    return;
+sim_eventq_heap[i] = last;
+last->e_index = i + 1;
+if ((i > 0) && _sim_eventq_before (last, sim_eventq_heap[(i - 1) / 2]))
+    _sim_eventq_sift_up (i);
+else
+    _sim_eventq_sift_down (i);
+}
+
+static void _sim_eventq_head (void)
+{
+if (sim_eventq_heap_count == 0) {
+    sim_clock_queue = QUEUE_LIST_END;
+    return;
+    }
+sim_clock_queue = sim_eventq_heap[0];
+sim_clock_queue->time = (int32)(sim_clock_queue->e_due - sim_eventq_clock);
+}
+
+static int _sim_eventq_compare (const void *pa, const void *pb)
+{
+UNIT *a = *(UNIT * const *)pa;
+UNIT *b = *(UNIT * const *)pb;
+
+if (a == b)
+    return 0;
+return _sim_eventq_before (a, b) ? -1 : 1;
+}
+
+/* sim_set_queue - select the event queue engine
+
+   The pending events are moved to the new engine preserving both their
+   due times and their relative order.
+*/
+
+t_stat sim_set_queue (int32 flag, CONST char *cptr)
+{
+char gbuf[CBUFSIZE];
+int32 engine;
+UNIT *uptr, *nptr;
+uint32 i;
+
+if ((cptr == NULL) || (*cptr == 0))
+    return SCPE_2FARG;
+cptr = get_glyph (cptr, gbuf, 0);
+if (*cptr != 0)
+    return SCPE_2MARG;
+if (MATCH_CMD (gbuf, "HEAP") == 0)
+    engine = SIM_EVENTQ_HEAP;
+else {
+    if (MATCH_CMD (gbuf, "LIST") == 0)
+        engine = SIM_EVENTQ_LIST;
+    else
+        return sim_messagef (SCPE_ARG, "Unknown event queue engine: %s\n", gbuf);
+    }
+if (engine == sim_eventq_engine)
+    return SCPE_OK;
+UPDATE_SIM_TIME;
+if (engine == SIM_EVENTQ_HEAP) {
+    double due = sim_eventq_clock;
+    uint32 count = (uint32)sim_qcount ();
+
+    if (count > sim_eventq_heap_size) {             /* allocate up front so the move can't fail */
+        UNIT **heap = (UNIT **)realloc (sim_eventq_heap, count * sizeof (*heap));
+
+        if (heap == NULL)
+            return SCPE_MEM;
+        sim_eventq_heap = heap;
+        sim_eventq_heap_size = count;
+        }
+    for (uptr = sim_clock_queue; uptr != QUEUE_LIST_END; uptr = nptr) {
+        nptr = uptr->next;
+        due = due + uptr->time;
+        uptr->e_due = due;
+        uptr->e_seq = sim_eventq_seq++;
+        _sim_eventq_insert (uptr);
+        uptr->next = QUEUE_LIST_END;
+        }
+    sim_eventq_engine = engine;
+    _sim_eventq_head ();
+    }
+else {
+    double due = sim_eventq_clock;
+
+    qsort (sim_eventq_heap, sim_eventq_heap_count, sizeof (*sim_eventq_heap), _sim_eventq_compare);
+    sim_clock_queue = QUEUE_LIST_END;
+    for (i = sim_eventq_heap_count; i > 0; i--) {   /* rebuild as a delta list */
+        uptr = sim_eventq_heap[i - 1];
+        uptr->e_index = 0;
+        uptr->next = sim_clock_queue;
+        sim_clock_queue = uptr;
+        }
+    for (uptr = sim_clock_queue; uptr != QUEUE_LIST_END; uptr = uptr->next) {
+        uptr->time = (int32)(uptr->e_due - due);
+        due = uptr->e_due;
+        }
+    sim_eventq_heap_count = 0;
+    sim_eventq_engine = engine;
+    }
+if (sim_clock_queue != QUEUE_LIST_END)
+    sim_interval = sim_clock_queue->time;
+return SCPE_OK;
+}
+
+t_stat sim_process_event (void)
+{
+UNIT *uptr;
+t_stat reason, bare_reason;
+int32 sim_interval_catchup;
+
+if (stop_cpu) {                                         /* stop CPU? */
     stop_cpu = 0;
     return SCPE_STOP;
     }
@@ -11956,7 +12926,13 @@ else
     sim_interval_catchup = 0;
 do {
     uptr = sim_clock_queue;                             /* get first */
-    sim_clock_queue = uptr->next;                       /* remove first */
+    if (sim_eventq_engine == SIM_EVENTQ_HEAP) {
+        _sim_eventq_remove (uptr);                      /* remove root */
+        sim_eventq_clock = uptr->e_due;                 /* time base is now its due time */
+        _sim_eventq_head ();
+        }
+    else
+        sim_clock_queue = uptr->next;                   /* remove first */
     uptr->next = NULL;                                  /* hygiene */
     uptr->time = 0;
     if (sim_clock_queue != QUEUE_LIST_END) {
@@ -11973,8 +12949,14 @@ do {
         }
     else {
         sim_debug (SIM_DBG_EVENT, &sim_scp_dev, "Processing Event for %s\n", sim_uname (uptr));
-        if (uptr->action != NULL)
-            reason = uptr->action (uptr);
+        if (uptr->action != NULL) {
+            if (sim_trace_active)
+                _sim_trace_event (uptr);
+            if (sim_profile_events)
+                reason = _sim_profile_service (uptr);
+            else
+                reason = uptr->action (uptr);
+            }
         else
             reason = SCPE_OK;
         }
@@ -12048,7 +13030,28 @@ if (sim_is_active (uptr))                               /* already active? */
 UPDATE_SIM_TIME;                                        /* update sim time */
 
 sim_debug (SIM_DBG_ACTIVATE, &sim_scp_dev, "Activating %s delay=%d\n", sim_uname (uptr), event_time);
+if (sim_profile_events) {
+    SIM_EVENT_PROFILE *prof = _sim_profile_unit (uptr);
+
+    if (prof) {
+        prof->activations += 1;
+        prof->delay += event_time;
+        }
+    }
+
+if (sim_eventq_engine == SIM_EVENTQ_HEAP) {
+    t_stat r;
 
+    uptr->e_due = sim_eventq_clock + event_time;
+    uptr->e_seq = sim_eventq_seq++;
+    r = _sim_eventq_insert (uptr);
+    if (r != SCPE_OK)
+        return r;
+    uptr->next = QUEUE_LIST_END;                        /* mark active */
+    _sim_eventq_head ();
+    sim_interval = sim_clock_queue->time;
+    return SCPE_OK;
+    }
 prvptr = NULL;
 accum = 0;
 for (cptr = sim_clock_queue; cptr != QUEUE_LIST_END; cptr = cptr->next) {
@@ -12182,23 +13185,38 @@ if (!sim_is_active (uptr))
     return SCPE_OK;
 UPDATE_SIM_TIME;                                        /* update sim time */
 sim_debug (SIM_DBG_EVENT, &sim_scp_dev, "Canceling Event for %s\n", sim_uname(uptr));
+if (sim_profile_events) {
+    SIM_EVENT_PROFILE *prof = _sim_profile_unit (uptr);
+
+    if (prof)
+        prof->cancels += 1;
+    }
 nptr = QUEUE_LIST_END;
 
-if (sim_clock_queue == uptr) {
-    nptr = sim_clock_queue = uptr->next;
-    uptr->next = NULL;                                  /* hygiene */
+if (sim_eventq_engine == SIM_EVENTQ_HEAP) {
+    if (uptr->e_index) {
+        _sim_eventq_remove (uptr);
+        uptr->next = NULL;                              /* hygiene */
+        _sim_eventq_head ();
+        }
     }
 else {
-    for (cptr = sim_clock_queue; cptr != QUEUE_LIST_END; cptr = cptr->next) {
-        if (cptr->next == uptr) {
-            nptr = cptr->next = uptr->next;
-            uptr->next = NULL;                          /* hygiene */
-            break;                                      /* end queue scan */
+    if (sim_clock_queue == uptr) {
+        nptr = sim_clock_queue = uptr->next;
+        uptr->next = NULL;                              /* hygiene */
+        }
+    else {
+        for (cptr = sim_clock_queue; cptr != QUEUE_LIST_END; cptr = cptr->next) {
+            if (cptr->next == uptr) {
+                nptr = cptr->next = uptr->next;
+                uptr->next = NULL;                      /* hygiene */
+                break;                                  /* end queue scan */
+                }
             }
         }
+    if (nptr != QUEUE_LIST_END)
+        nptr->time += (uptr->next) ? 0 : uptr->time;
     }
-if (nptr != QUEUE_LIST_END)
-    nptr->time += (uptr->next) ? 0 : uptr->time;
 if (!uptr->next)
     uptr->time = 0;
 uptr->usecs_remaining = 0;
@@ -12243,6 +13261,12 @@ int32 _sim_activate_queue_time (UNIT *uptr)
 UNIT *cptr;
 int32 accum;
 
+if (sim_eventq_engine == SIM_EVENTQ_HEAP) {
+    if (uptr->e_index == 0)
+        return 0;
+    accum = (sim_interval > 0) ? sim_interval : 0;
+    return accum + (int32)(uptr->e_due - sim_clock_queue->e_due) + 1;
+    }
 accum = 0;
 for (cptr = sim_clock_queue; cptr != QUEUE_LIST_END; cptr = cptr->next) {
     if (cptr == sim_clock_queue) {
@@ -12279,7 +13303,6 @@ return _sim_activate_time (uptr);
 
 double sim_activate_time_usecs (UNIT *uptr)
 {
-UNIT *cptr;
 int32 accum;
 double result;
 
@@ -12287,17 +13310,9 @@ AIO_VALIDATE(uptr);
 result = sim_timer_activate_time_usecs (uptr);
 if (result >= 0)
     return result;
-accum = 0;
-for (cptr = sim_clock_queue; cptr != QUEUE_LIST_END; cptr = cptr->next) {
-    if (cptr == sim_clock_queue) {
-        if (sim_interval > 0)
-            accum = accum + sim_interval;
-        }
-    else
-        accum = accum + cptr->time;
-    if (cptr == uptr)
-        return 1.0 + uptr->usecs_remaining + ((1000000.0 * accum) / sim_timer_inst_per_sec ());
-    }
+accum = _sim_activate_queue_time (uptr);
+if (accum)
+    return 1.0 + uptr->usecs_remaining + ((1000000.0 * (accum - 1)) / sim_timer_inst_per_sec ());
 return 0.0;
 }
 
@@ -12335,12 +13350,521 @@ int32 sim_qcount (void)
 int32 cnt;
 UNIT *uptr;
 
+if (sim_eventq_engine == SIM_EVENTQ_HEAP)
+    return (int32)sim_eventq_heap_count;
 cnt = 0;
 for (uptr = sim_clock_queue; uptr != QUEUE_LIST_END; uptr = uptr->next)
     cnt++;
 return cnt;
 }
 
+/* sim_set_profile - enable/disable/reset profiling
+
+   SET PROFILE EVENTS           enable event profiling
+   SET PROFILE RESET            clear collected data
+   SET NOPROFILE                disable profiling
+*/
+
+static void _sim_profile_reset (void)
+{
+SIM_EVENT_PROFILE *prof;
+
+for (prof = sim_event_profiles; prof != NULL; prof = prof->next) {
+    prof->activations = prof->cancels = prof->services = 0;
+    prof->delay = prof->host_nsec = 0;
+    }
+sim_profile_start_gtime = sim_gtime ();
+sim_profile_start_nsec = sim_os_nsec ();
+}
+
+t_stat sim_set_profile (int32 flag, CONST char *cptr)
+{
+char gbuf[CBUFSIZE];
+
+if (!flag) {
+    if (cptr && (*cptr != 0))
+        return SCPE_2MARG;
+    sim_profile_events = FALSE;
+    return SCPE_OK;
+    }
+if ((cptr == NULL) || (*cptr == 0))
+    return SCPE_2FARG;
+cptr = get_glyph (cptr, gbuf, 0);
+if (*cptr != 0)
+    return SCPE_2MARG;
+if (MATCH_CMD (gbuf, "EVENTS") == 0) {
+    if (!sim_profile_events && (sim_event_profiles == NULL))
+        _sim_profile_reset ();
+    sim_profile_events = TRUE;
+    return SCPE_OK;
+    }
+if (MATCH_CMD (gbuf, "RESET") == 0) {
+    _sim_profile_reset ();
+    return SCPE_OK;
+    }
+return sim_messagef (SCPE_ARG, "Unknown profile option: %s\n", gbuf);
+}
+
+static int _sim_profile_compare (const void *pa, const void *pb)
+{
+const SIM_EVENT_PROFILE *a = *(SIM_EVENT_PROFILE * const *)pa;
+const SIM_EVENT_PROFILE *b = *(SIM_EVENT_PROFILE * const *)pb;
+
+if (a->host_nsec != b->host_nsec)                   /* most expensive first */
+    return (a->host_nsec > b->host_nsec) ? -1 : 1;
+if (a->services != b->services)
+    return (a->services > b->services) ? -1 : 1;
+return strcmp (a->uname, b->uname);
+}
+
+/* sim_show_profile - display profile data
+
+   SHOW PROFILE EVENTS          formatted table, most expensive unit first
+   SHOW -C PROFILE EVENTS {file} comma separated values, to file if given
+*/
+
+t_stat sim_show_profile (FILE *st, DEVICE *dptr, UNIT *uptr, int32 flag, CONST char *cptr)
+{
+char gbuf[CBUFSIZE];
+SIM_EVENT_PROFILE *prof, **profs;
+int32 i, count;
+t_bool csv = ((sim_switches & SWMASK ('C')) != 0);
+FILE *out = st;
+double total_nsec = 0.0;
+
+cptr = get_glyph (cptr, gbuf, 0);
+if ((gbuf[0] == '\0') || (MATCH_CMD (gbuf, "EVENTS") != 0))
+    return sim_messagef (SCPE_ARG, "Expected: SHOW {-C} PROFILE EVENTS {file}\n");
+if (*cptr != 0) {
+    if (!csv)
+        return SCPE_2MARG;
+    cptr = get_glyph_nc (cptr, gbuf, 0);
+    if (*cptr != 0)
+        return SCPE_2MARG;
+    out = sim_fopen (gbuf, "w");
+    if (out == NULL)
+        return sim_messagef (SCPE_OPENERR, "Can't open %s: %s\n", gbuf, strerror (errno));
+    }
+for (count = 0, prof = sim_event_profiles; prof != NULL; prof = prof->next)
+    ++count;
+profs = (SIM_EVENT_PROFILE **)calloc (count + 1, sizeof (*profs));
+if (profs == NULL) {
+    if (out != st)
+        fclose (out);
+    return SCPE_MEM;
+    }
+for (i = 0, prof = sim_event_profiles; prof != NULL; prof = prof->next) {
+    profs[i++] = prof;
+    total_nsec += prof->host_nsec;
+    }
+qsort (profs, count, sizeof (*profs), _sim_profile_compare);
+if (csv) {
+    fprintf (out, "Unit,Activations,Cancels,Services,AvgDelay,HostNsec,AvgNsecPerService\n");
+    for (i = 0; i < count; i++) {
+        prof = profs[i];
+        fprintf (out, "%s,%.0f,%.0f,%.0f,%.1f,%.0f,%.1f\n", prof->uname,
+                 prof->activations, prof->cancels, prof->services,
+                 prof->activations ? prof->delay / prof->activations : 0.0,
+                 prof->host_nsec,
+                 prof->services ? prof->host_nsec / prof->services : 0.0);
+        }
+    }
+else {
+    fprintf (out, "Event profiling %s, %.0f %s and %s host time profiled\n",
+             sim_profile_events ? "enabled" : "disabled",
+             (count || sim_profile_events) ? sim_gtime () - sim_profile_start_gtime : 0.0,
+             sim_vm_interval_units,
+             sim_fmt_secs ((count || sim_profile_events) ? (sim_os_nsec () - sim_profile_start_nsec) / 1000000000.0 : 0.0));
+    if (count == 0)
+        fprintf (out, "No events recorded\n");
+    else {
+        fprintf (out, "%-16s %12s %10s %12s %10s %12s %8s %6s\n",
+                 "Unit", "Activations", "Cancels", "Services", "Avg Delay", "Host usecs", "ns/Svc", "Host%");
+        for (i = 0; i < count; i++) {
+            prof = profs[i];
+            fprintf (out, "%-16s %12.0f %10.0f %12.0f %10.0f %12.0f %8.0f %5.1f%%\n", prof->uname,
+                     prof->activations, prof->cancels, prof->services,
+                     prof->activations ? prof->delay / prof->activations : 0.0,
+                     prof->host_nsec / 1000.0,
+                     prof->services ? prof->host_nsec / prof->services : 0.0,
+                     total_nsec ? (100.0 * prof->host_nsec) / total_nsec : 0.0);
+            }
+        }
+    }
+free (profs);
+if (out != st)
+    fclose (out);
+return SCPE_OK;
+}
+
+/* Binary trace sink
+
+   Instruction level tracing through sim_debug formats every line as it
+   is produced.  The binary trace instead stores fixed size records
+   (SIM_TRACE_REC) which are rendered later with SHOW TRACE file, using
+   the simulator's own fprint_sym.
+
+   The simulator fills records in place with sim_trace_rec/sim_trace_put.
+   Records go into a single producer, single consumer ring.  With
+   asynchronous I/O support, a writer thread drains the ring to the file;
+   the producer only waits (a stall) when the ring is full.  Otherwise,
+   the ring is written by the simulation thread whenever it fills.
+*/
+
+#define SIM_TRACE_RING  4096                            /* ring size (power of 2) */
+#define SIM_TRACE_MAGIC "SIMHTRC1"
+#define SIM_TRACE_ORDER 0x01020304                      /* byte order marker */
+
+#if defined(__GNUC__)
+#define TRC_LOAD(x)     __atomic_load_n (&(x), __ATOMIC_ACQUIRE)
+#define TRC_STORE(x,v)  __atomic_store_n (&(x), (v), __ATOMIC_RELEASE)
+#else
+#define TRC_LOAD(x)     (x)
+#define TRC_STORE(x,v)  (x) = (v)
+#endif
+
+static uint32 _sim_trace_drain (uint32 tail, uint32 head)
+{
+while (tail != head) {
+    uint32 first = tail & (SIM_TRACE_RING - 1);
+    uint32 cnt = head - tail;
+
+    if (cnt > (SIM_TRACE_RING - first))                 /* wraps? */
+        cnt = SIM_TRACE_RING - first;
+    if (fwrite (&sim_trace_ring[first], sizeof (SIM_TRACE_REC), cnt, sim_trace_file) != cnt)
+        sim_trace_errors++;
+    tail = tail + cnt;
+    }
+return tail;
+}
+
+#if defined(SIM_ASYNCH_IO)
+static void *_sim_trace_writer (void *arg)
+{
+uint32 head, tail;
+
+pthread_mutex_lock (&sim_trace_lock);
+while (1) {
+    head = TRC_LOAD (sim_trace_head);
+    tail = sim_trace_tail;
+    if (head == tail) {
+        if (sim_trace_stop)
+            break;
+        pthread_cond_wait (&sim_trace_wake, &sim_trace_lock);
+        continue;
+        }
+    pthread_mutex_unlock (&sim_trace_lock);
+    tail = _sim_trace_drain (tail, head);
+    pthread_mutex_lock (&sim_trace_lock);
+    TRC_STORE (sim_trace_tail, tail);
+    pthread_cond_signal (&sim_trace_space);
+    }
+pthread_mutex_unlock (&sim_trace_lock);
+return NULL;
+}
+#endif
+
+/* Ring full - wait for the writer, or write it here */
+
+static void _sim_trace_wait (void)
+{
+sim_trace_stalls++;
+#if defined(SIM_ASYNCH_IO)
+pthread_mutex_lock (&sim_trace_lock);
+pthread_cond_signal (&sim_trace_wake);
+while ((sim_trace_head - TRC_LOAD (sim_trace_tail)) >= SIM_TRACE_RING)
+    pthread_cond_wait (&sim_trace_space, &sim_trace_lock);
+pthread_mutex_unlock (&sim_trace_lock);
+#else
+sim_trace_tail = _sim_trace_drain (sim_trace_tail, sim_trace_head);
+#endif
+}
+
+/* Get the next free record and fill in the common fields */
+
+SIM_TRACE_REC *sim_trace_rec (uint32 type)
+{
+SIM_TRACE_REC *rec;
+
+if ((sim_trace_head - TRC_LOAD (sim_trace_tail)) >= SIM_TRACE_RING)
+    _sim_trace_wait ();
+rec = &sim_trace_ring[sim_trace_head & (SIM_TRACE_RING - 1)];
+rec->time = sim_gtime ();
+rec->pc = 0;
+rec->type = (uint16) type;
+rec->ilen = rec->nreg = 0;
+return rec;
+}
+
+/* Publish the record returned by the last sim_trace_rec */
+
+void sim_trace_put (void)
+{
+TRC_STORE (sim_trace_head, sim_trace_head + 1);
+sim_trace_records++;
+#if defined(SIM_ASYNCH_IO)
+if ((sim_trace_head & ((SIM_TRACE_RING >> 1) - 1)) == 0) {  /* half a ring queued? */
+    pthread_mutex_lock (&sim_trace_lock);
+    pthread_cond_signal (&sim_trace_wake);
+    pthread_mutex_unlock (&sim_trace_lock);
+    }
+#endif
+}
+
+/* Write all queued records to the file */
+
+t_stat sim_trace_flush (void)
+{
+if (!sim_trace_active)
+    return SCPE_OK;
+#if defined(SIM_ASYNCH_IO)
+pthread_mutex_lock (&sim_trace_lock);
+pthread_cond_signal (&sim_trace_wake);
+while (TRC_LOAD (sim_trace_tail) != sim_trace_head)
+    pthread_cond_wait (&sim_trace_space, &sim_trace_lock);
+pthread_mutex_unlock (&sim_trace_lock);
+#else
+sim_trace_tail = _sim_trace_drain (sim_trace_tail, sim_trace_head);
+#endif
+fflush (sim_trace_file);
+return sim_trace_errors ? SCPE_IOERR : SCPE_OK;
+}
+
+/* Trace a unit's event, called before its service routine */
+
+static void _sim_trace_event (UNIT *uptr)
+{
+SIM_TRACE_REC *rec = sim_trace_rec (SIM_TRACE_EVENT);
+const char *uname = sim_uname (uptr);
+size_t lnt = strlen (uname);
+
+if (lnt > SIM_TRACE_ILEN)
+    lnt = SIM_TRACE_ILEN;
+memcpy (rec->inst, uname, lnt);
+rec->ilen = (uint8) lnt;
+if (sim_PC)
+    rec->pc = (uint32) get_rval (sim_PC, 0);
+sim_trace_put ();
+}
+
+/* sim_set_trace - open/close binary trace file
+
+   SET TRACE file               start tracing to file
+   SET NOTRACE                  stop tracing and close file
+*/
+
+static t_stat _sim_trace_close (void)
+{
+t_stat r;
+
+if (!sim_trace_active)
+    return SCPE_OK;
+r = sim_trace_flush ();
+#if defined(SIM_ASYNCH_IO)
+pthread_mutex_lock (&sim_trace_lock);
+sim_trace_stop = TRUE;
+pthread_cond_signal (&sim_trace_wake);
+pthread_mutex_unlock (&sim_trace_lock);
+pthread_join (sim_trace_thread, NULL);
+pthread_cond_destroy (&sim_trace_space);
+pthread_cond_destroy (&sim_trace_wake);
+pthread_mutex_destroy (&sim_trace_lock);
+#endif
+sim_trace_active = FALSE;
+fclose (sim_trace_file);
+sim_trace_file = NULL;
+free (sim_trace_ring);
+sim_trace_ring = NULL;
+return r;
+}
+
+t_stat sim_set_trace (int32 flag, CONST char *cptr)
+{
+char gbuf[CBUFSIZE];
+SIM_TRACE_REC hdr;
+t_stat r;
+#if defined(SIM_ASYNCH_IO)
+pthread_attr_t attr;
+#endif
+
+if (!flag) {
+    if (cptr && (*cptr != 0))
+        return SCPE_2MARG;
+    r = _sim_trace_close ();
+    if (r != SCPE_OK)
+        return sim_messagef (r, "Error writing trace file %s\n", sim_trace_name);
+    return SCPE_OK;
+    }
+if ((cptr == NULL) || (*cptr == 0))
+    return SCPE_2FARG;
+cptr = get_glyph_nc (cptr, gbuf, 0);
+if (*cptr != 0)
+    return SCPE_2MARG;
+_sim_trace_close ();
+sim_trace_ring = (SIM_TRACE_REC *)calloc (SIM_TRACE_RING, sizeof (*sim_trace_ring));
+if (sim_trace_ring == NULL)
+    return SCPE_MEM;
+sim_trace_file = sim_fopen (gbuf, "wb");
+if (sim_trace_file == NULL) {
+    free (sim_trace_ring);
+    sim_trace_ring = NULL;
+    return sim_messagef (SCPE_OPENERR, "Can't open %s: %s\n", gbuf, strerror (errno));
+    }
+memset (&hdr, 0, sizeof (hdr));                         /* header record */
+memcpy (&hdr, SIM_TRACE_MAGIC, 8);
+hdr.pc = SIM_TRACE_ORDER;
+hdr.type = SIM_TRACE_HDR;
+hdr.ilen = (uint8) strlen (sim_name);
+if (hdr.ilen > SIM_TRACE_ILEN)
+    hdr.ilen = SIM_TRACE_ILEN;
+memcpy (hdr.inst, sim_name, hdr.ilen);
+hdr.reg[0].num = sizeof (SIM_TRACE_REC);
+fwrite (&hdr, sizeof (hdr), 1, sim_trace_file);
+strlcpy (sim_trace_name, gbuf, sizeof (sim_trace_name));
+sim_trace_head = sim_trace_tail = 0;
+sim_trace_records = sim_trace_stalls = 0.0;
+sim_trace_errors = 0;
+#if defined(SIM_ASYNCH_IO)
+sim_trace_stop = FALSE;
+pthread_mutex_init (&sim_trace_lock, NULL);
+pthread_cond_init (&sim_trace_wake, NULL);
+pthread_cond_init (&sim_trace_space, NULL);
+pthread_attr_init (&attr);
+pthread_attr_setscope (&attr, PTHREAD_SCOPE_SYSTEM);
+pthread_create (&sim_trace_thread, &attr, _sim_trace_writer, NULL);
+pthread_attr_destroy (&attr);
+#endif
+sim_trace_active = TRUE;
+return SCPE_OK;
+}
+
+/* sim_show_trace - show trace status or decode a trace file
+
+   SHOW TRACE                   status of the current trace
+   SHOW TRACE file {outfile}    display the records in file
+*/
+
+static void _sim_trace_show_regs (FILE *st, const SIM_TRACE_REC *rec)
+{
+REG *rptr = sim_dflt_dev->registers;
+uint32 i, nregs;
+
+if (rec->nreg == 0)
+    return;
+for (nregs = 0; (rptr != NULL) && (rptr[nregs].name != NULL); nregs++)
+    ;
+fprintf (st, "%16s", "");
+for (i = 0; (i < rec->nreg) && (i < SIM_TRACE_NREG); i++) {
+    if (rec->reg[i].num < nregs)
+        fprintf (st, " %s=", rptr[rec->reg[i].num].name);
+    else
+        fprintf (st, " ?%u=", rec->reg[i].num);
+    fprint_val (st, (t_value) rec->reg[i].val, 16, 32, PV_RZRO);
+    }
+fprintf (st, "\n");
+}
+
+static t_stat _sim_trace_decode (FILE *st, FILE *fp)
+{
+SIM_TRACE_REC rec;
+uint32 bpv = (sim_dflt_dev->dwidth + 7) / 8;            /* bytes per value */
+int32 i, k;
+double count = 0.0;
+
+if ((fread (&rec, sizeof (rec), 1, fp) != 1) ||
+    (memcmp (&rec, SIM_TRACE_MAGIC, 8) != 0) ||
+    (rec.type != SIM_TRACE_HDR))
+    return sim_messagef (SCPE_FMT, "Not a binary trace file\n");
+if ((rec.pc != SIM_TRACE_ORDER) || (rec.reg[0].num != sizeof (SIM_TRACE_REC)))
+    return sim_messagef (SCPE_FMT, "Trace file was written on an incompatible host\n");
+if ((rec.ilen > SIM_TRACE_ILEN) ||
+    (strncmp ((char *)rec.inst, sim_name, rec.ilen) != 0))
+    return sim_messagef (SCPE_FMT, "Trace file was written by the %.*s simulator\n", (int)MIN (rec.ilen, SIM_TRACE_ILEN), (char *)rec.inst);
+while (fread (&rec, sizeof (rec), 1, fp) == 1) {
+    ++count;
+    switch (rec.type) {
+
+    case SIM_TRACE_INST:
+    case SIM_TRACE_REGS:
+        _sim_trace_show_regs (st, &rec);                /* results of previous */
+        if (rec.type == SIM_TRACE_REGS)
+            break;
+        for (i = 0; i < sim_emax; i++) {                /* bytes to values */
+            sim_eval[i] = 0;
+            for (k = 0; k < (int32)bpv; k++) {
+                if ((i * bpv + k) < rec.ilen)
+                    sim_eval[i] |= ((t_value)rec.inst[i * bpv + k]) << (k * 8);
+                }
+            }
+        fprintf (st, "%15.0f ", rec.time);
+        fprint_val (st, (t_value) rec.pc, 16, 32, PV_RZRO);
+        fprintf (st, "  ");
+        if (fprint_sym (st, (t_addr) rec.pc, sim_eval, sim_dflt_dev->units, SWMASK ('M')) > 0) {
+            for (i = 0; i < rec.ilen; i++)
+                fprintf (st, "%02X ", rec.inst[i]);
+            }
+        fprintf (st, "\n");
+        break;
+
+    case SIM_TRACE_EVENT:
+        fprintf (st, "%15.0f ", rec.time);
+        fprint_val (st, (t_value) rec.pc, 16, 32, PV_RZRO);
+        fprintf (st, "  Event %.*s\n", (int)MIN (rec.ilen, SIM_TRACE_ILEN), (char *)rec.inst);
+        break;
+
+    default:
+        fprintf (st, "Unknown record type %d\n", rec.type);
+        break;
+        }
+    }
+fprintf (st, "%.0f records\n", count);
+return SCPE_OK;
+}
+
+t_stat sim_show_trace (FILE *st, DEVICE *dptr, UNIT *uptr, int32 flag, CONST char *cptr)
+{
+char gbuf[CBUFSIZE];
+FILE *fp, *out = st;
+t_stat r;
+
+if ((cptr == NULL) || (*cptr == 0)) {
+    if (!sim_trace_active)
+        fprintf (st, "Binary trace disabled\n");
+    else {
+        fprintf (st, "Binary trace to %s\n", sim_trace_name);
+        fprintf (st, "  Records:      %.0f\n", sim_trace_records);
+        fprintf (st, "  Queued:       %u\n", sim_trace_head - TRC_LOAD (sim_trace_tail));
+        fprintf (st, "  Ring stalls:  %.0f\n", sim_trace_stalls);
+        if (sim_trace_errors)
+            fprintf (st, "  Write errors: %u\n", sim_trace_errors);
+        }
+    return SCPE_OK;
+    }
+cptr = get_glyph_nc (cptr, gbuf, 0);
+if (sim_trace_active && (strcmp (gbuf, sim_trace_name) == 0))
+    sim_trace_flush ();
+fp = sim_fopen (gbuf, "rb");
+if (fp == NULL)
+    return sim_messagef (SCPE_OPENERR, "Can't open %s: %s\n", gbuf, strerror (errno));
+if (*cptr != 0) {
+    cptr = get_glyph_nc (cptr, gbuf, 0);
+    if (*cptr != 0) {
+        fclose (fp);
+        return SCPE_2MARG;
+        }
+    out = sim_fopen (gbuf, "w");
+    if (out == NULL) {
+        fclose (fp);
+        return sim_messagef (SCPE_OPENERR, "Can't open %s: %s\n", gbuf, strerror (errno));
+        }
+    }
+r = _sim_trace_decode (out, fp);
+fclose (fp);
+if (out != st)
+    fclose (out);
+return r;
+}
+
 /* Breakpoint package.  This module replaces the VM-implemented one
    instruction breakpoint capability.
 
@@ -12360,6 +13884,13 @@ return cnt;
    is the bitwise OR of all the type fields).  A simulator need only check for
    a breakpoint of type X if bit SWMASK('X') is set in sim_brk_summ.
 
+   sim_brk_map is a bitmap with one bit for each block of 2^SIM_BRK_V_GRAN
+   addresses (folded into SIM_BRK_MAP_BITS bits).  A bit is set when any
+   breakpoint might be in the block, so sim_brk_test can reject most
+   addresses with a single bit test instead of searching sim_brk_tab.
+   Bits are set as breakpoints are added and the map is rebuilt when
+   breakpoints are cleared.
+
    The package contains the following public routines:
 
         sim_brk_init            initialize
@@ -12397,6 +13928,7 @@ sim_brk_tab = (BRKTAB **) realloc (sim_brk_tab, sim_brk_lnt*sizeof (BRKTAB*));
 if (sim_brk_tab == NULL)
     return SCPE_MEM;
 memset (sim_brk_tab, 0, sim_brk_lnt*sizeof (BRKTAB*));
+memset (sim_brk_map, 0, sizeof (sim_brk_map));
 sim_brk_ent = sim_brk_ins = 0;
 sim_brk_clract ();
 sim_brk_npc (0);
@@ -12485,6 +14017,7 @@ bp->addr = loc;
 bp->typ = btyp;
 bp->cnt = 0;
 bp->act = NULL;
+SIM_BRK_MAP_SET (loc);
 for (i = 0; i < SIM_BKPT_N_SPC; i++)
     bp->time_fired[i] = -1.0;
 return bp;
@@ -12567,8 +14100,10 @@ if (sim_brk_tab[sim_brk_ins] == NULL) {                 /* erased entry */
         sim_brk_tab[i] = sim_brk_tab[i+1];
     }
 sim_brk_summ = 0;                                       /* recalc summary */
+memset (sim_brk_map, 0, sizeof (sim_brk_map));          /* and map */
 for (i = 0; i < sim_brk_ent; i++) {
     bp = sim_brk_tab[i];
+    SIM_BRK_MAP_SET (bp->addr);
     while (bp) {
         sim_brk_summ |= (bp->typ & ~BRK_TYP_TEMP);
         bp = bp->next;
@@ -12713,6 +14248,8 @@ uint32 sim_brk_test (t_addr loc, uint32 btyp)
 BRKTAB *bp;
 uint32 spc = (btyp >> SIM_BKPT_V_SPC) & (SIM_BKPT_N_SPC - 1);
 
+if (!SIM_BRK_MAP_TEST (loc))                            /* none near loc? */
+    return 0;
 if (sim_brk_summ & BRK_TYP_DYN_ALL)
     btyp |= BRK_TYP_DYN_ALL;
 
@@ -16578,6 +18115,17 @@ if ((strcmp (gbuf, "ALL") == 0) || (strcmp (gbuf, "SCP") == 0)) {
         return sim_messagef (SCPE_IERR, "SCP argument parsing test failed\n");
     if (test_scp_event_sequencing () != SCPE_OK)
         return sim_messagef (SCPE_IERR, "SCP event sequencing test failed\n");
+    if (1) {
+        const char *engine = (sim_eventq_engine == SIM_EVENTQ_HEAP) ? "HEAP" : "LIST";
+        const char *other = (sim_eventq_engine == SIM_EVENTQ_HEAP) ? "LIST" : "HEAP";
+        t_stat tstat;
+
+        sim_set_queue (0, other);                   /* repeat with the other event queue engine */
+        tstat = test_scp_event_sequencing ();
+        sim_set_queue (0, engine);
+        if (tstat != SCPE_OK)
+            return sim_messagef (SCPE_IERR, "SCP event sequencing test failed with %s event queue\n", other);
+        }
     if (test_scp_debug_logging () != SCPE_OK)
         return sim_messagef (SCPE_IERR, "SCP debug logging test failed\n");
 }
@@ -225,6 +225,9 @@ void sim_brk_npc (uint32 cnt);
 void sim_brk_setact (const char *action);
 char *sim_brk_replace_act (char *new_action);
 const char *sim_brk_message(void);
+SIM_TRACE_REC *sim_trace_rec (uint32 type);
+void sim_trace_put (void);
+t_stat sim_trace_flush (void);
 t_stat sim_send_input (SEND *snd, uint8 *data, size_t size, uint32 after, uint32 delay);
 t_stat sim_show_send_input (FILE *st, const SEND *snd);
 t_bool sim_send_poll_data (SEND *snd, t_stat *stat);
@@ -312,6 +315,7 @@ extern FILEREF *sim_log_ref;                            /* log file file referen
 extern FILE *sim_deb;                                   /* debug file */
 extern FILEREF *sim_deb_ref;                            /* debug file file reference */
 extern int32 sim_deb_switches;                          /* debug display flags */
+extern t_bool sim_trace_active;                         /* binary trace file open */
 extern size_t sim_deb_buffer_size;                      /* debug memory buffer size */
 extern char *sim_deb_buffer;                            /* debug memory buffer */
 extern size_t sim_debug_buffer_offset;                  /* debug memory buffer insertion offset */
@@ -369,6 +373,7 @@ extern void (*sim_vm_init) (void);
  */
 extern char *(*sim_vm_read) (char *ptr, int32 size, FILE *stream);
 extern void (*sim_vm_post) (t_bool from_scp);
+extern void (*sim_vm_save_done) (const char *filename, t_stat status);
 extern CTAB *sim_vm_cmd;
 extern void (*sim_vm_sprint_addr) (char *buf, DEVICE *dptr, t_addr addr);
 extern void (*sim_vm_fprint_addr) (FILE *st, DEVICE *dptr, t_addr addr);
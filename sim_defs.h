@@ -617,6 +617,10 @@ struct UNIT {
     char                *uname;                         /* Unit name */
     DEVICE              *dptr;                          /* DEVICE linkage (backpointer) */
     uint32              dctrl;                          /* debug control */
+    uint32              e_index;                        /* event heap slot + 1 (0 = not in heap) */
+    uint32              e_seq;                          /* event heap insertion sequence */
+    double              e_due;                          /* event heap absolute due time */
+    void                *e_profile;                     /* event profile data */
 #ifdef SIM_ASYNCH_IO
     void                (*a_check_completion)(UNIT *);
     t_bool              (*a_is_active)(UNIT *);
@@ -674,9 +678,18 @@ struct UNIT {
 #define UNIT_TM_POLL        0000002         /* TMXR Polling unit */
 #define UNIT_NO_FIO         0000004         /* fileref is NOT a FILE * */
 #define UNIT_DISK_CHK       0000010         /* disk data debug checking (sim_disk) */
+#define UNIT_MEM_BUF        0000020         /* memory unit's values are in filebuf (SAVE/RESTORE) */
 #define UNIT_TMR_UNIT       0000200         /* Unit registered as a calibrated timer */
 #define UNIT_TAPE_MRK       0000400         /* Tape Unit Tapemark */
 #define UNIT_TAPE_PNU       0001000         /* Tape Unit Position Not Updated */
+#define UNIT_V_DISK_DEPTH   10              /* Bit offset for Disk Asynch Queue Depth - 1 (shares Tape bits) */
+#define UNIT_S_DISK_DEPTH   4               /* Bits Reserved for Disk Asynch Queue Depth */
+#define UNIT_V_DISK_CACHE   14              /* Bit offset for Disk Sector Cache size, log2 + 1 (shares Tape bits) */
+#define UNIT_S_DISK_CACHE   5               /* Bits Reserved for Disk Sector Cache size */
+#define UNIT_DISK_WBACK     02000000        /* Disk Sector Cache is write-back (shares Tape bits) */
+#define UNIT_DISK_MAPPED    04000000        /* Disk container is memory mapped (shares Tape bits) */
+#define UNIT_DISK_SCRATCH   010000000       /* Disk container is mapped, changes discarded (shares Tape bits) */
+#define UNIT_DISK_DEDUP     020000000       /* Disk container is in DEDUP format (sim_disk) */
 #define UNIT_V_DF_TAPE      10              /* Bit offset for Tape Density reservation */
 #define UNIT_S_DF_TAPE      3               /* Bits Reserved for Tape Density */
 #define UNIT_V_TAPE_FMT     13              /* Bit offset for Tape Format */
@@ -827,6 +840,34 @@ struct BRKTYPTAB {
     };
 #define BRKTYPE(typ,descrip) {SWMASK(typ), descrip}
 
+/* Binary trace record
+
+   Records are written in host byte order, preceded by a header record
+   (type SIM_TRACE_HDR) naming the simulator which wrote the file.
+   reg[] holds registers (as indexes into the default device's register
+   table) whose values changed since the previous record.
+*/
+
+typedef struct SIM_TRACE_REC SIM_TRACE_REC;
+struct SIM_TRACE_REC {
+    double              time;                           /* sim_gtime */
+    uint32              pc;                             /* PC of instruction */
+    uint16              type;                           /* record type */
+#define SIM_TRACE_HDR   0                               /* file header */
+#define SIM_TRACE_INST  1                               /* instruction */
+#define SIM_TRACE_EVENT 2                               /* unit event, inst = unit name */
+#define SIM_TRACE_REGS  3                               /* more changed registers */
+    uint8               ilen;                           /* bytes in inst */
+    uint8               nreg;                           /* entries in reg */
+#define SIM_TRACE_ILEN  16
+#define SIM_TRACE_NREG  4
+    uint8               inst[SIM_TRACE_ILEN];           /* instruction bytes */
+    struct {
+        uint32          num;                            /* register index */
+        uint32          val;                            /* new value */
+        }               reg[SIM_TRACE_NREG];
+    };
+
 /* Expect rule */
 
 struct EXPTAB {
@@ -48,6 +48,7 @@ typedef uint32          t_lba;                          /* disk logical block ad
 #define DKUF_F_STD       1                              /* SIMH format */
 #define DKUF_F_RAW       2                              /* Raw Physical Disk Access */
 #define DKUF_F_VHD       3                              /* VHD format */
+#define DKUF_F_DEDUP     4                              /* Deduplicating container format (UNIT_DISK_DEDUP) */
 #define DKUF_V_NOAUTOSIZE (DKUF_V_FMT + DKUF_W_FMT)     /* Don't Autosize disk option */
 #define DKUF_V_UF       (DKUF_V_NOAUTOSIZE + 1)
 #define DKUF_WLK        UNIT_WLK
@@ -59,13 +60,14 @@ typedef uint32          t_lba;                          /* disk logical block ad
 #define DK_F_RAW        (DKUF_F_RAW << DKUF_V_FMT)
 #define DK_F_VHD        (DKUF_F_VHD << DKUF_V_FMT)
 
-#define DK_GET_FMT(u)   (((u)->flags >> DKUF_V_FMT) & DKUF_M_FMT)
+#define DK_GET_FMT(u)   (((u)->dynflags & UNIT_DISK_DEDUP) ? DKUF_F_DEDUP : (((u)->flags >> DKUF_V_FMT) & DKUF_M_FMT))
 
 /* Return status codes */
 
 #define DKSE_OK         0                               /* no error */
 
 typedef void (*DISK_PCALLBACK)(UNIT *unit, t_stat status);
+typedef void (*DISK_QCALLBACK)(UNIT *unit, void *arg, t_stat status);
 
 /* Prototypes */
 
@@ -108,12 +110,25 @@ t_stat sim_disk_rdsect (UNIT *uptr, t_lba lba, uint8 *buf, t_seccnt *sectsread,
 t_stat sim_disk_rdsect_a (UNIT *uptr, t_lba lba, uint8 *buf, t_seccnt *sectsread, t_seccnt sects, DISK_PCALLBACK callback);
 t_stat sim_disk_wrsect (UNIT *uptr, t_lba lba, uint8 *buf, t_seccnt *sectswritten, t_seccnt sects);
 t_stat sim_disk_wrsect_a (UNIT *uptr, t_lba lba, uint8 *buf, t_seccnt *sectswritten, t_seccnt sects, DISK_PCALLBACK callback);
+t_stat sim_disk_rdsect_q (UNIT *uptr, t_lba lba, uint8 *buf, t_seccnt *sectsread, t_seccnt sects, DISK_QCALLBACK callback, void *arg);
+t_stat sim_disk_wrsect_q (UNIT *uptr, t_lba lba, uint8 *buf, t_seccnt *sectswritten, t_seccnt sects, DISK_QCALLBACK callback, void *arg);
 t_stat sim_disk_unload (UNIT *uptr);
 t_stat sim_disk_erase (UNIT *uptr);
 t_stat sim_disk_set_fmt (UNIT *uptr, int32 val, CONST char *cptr, void *desc);
 t_stat sim_disk_show_fmt (FILE *st, UNIT *uptr, int32 val, CONST void *desc);
 t_stat sim_disk_set_capac (UNIT *uptr, int32 val, CONST char *cptr, void *desc);
 t_stat sim_disk_show_capac (FILE *st, UNIT *uptr, int32 val, CONST void *desc);
+t_stat sim_disk_set_asynch_depth (UNIT *uptr, int32 val, CONST char *cptr, void *desc);
+t_stat sim_disk_show_asynch_depth (FILE *st, UNIT *uptr, int32 val, CONST void *desc);
+uint32 sim_disk_asynch_depth (UNIT *uptr);
+t_stat sim_disk_set_cache (UNIT *uptr, int32 val, CONST char *cptr, void *desc);
+t_stat sim_disk_show_cache (FILE *st, UNIT *uptr, int32 val, CONST void *desc);
+t_stat sim_disk_set_mapped (UNIT *uptr, int32 val, CONST char *cptr, void *desc);
+t_stat sim_disk_show_mapped (FILE *st, UNIT *uptr, int32 val, CONST void *desc);
+t_stat sim_disk_set_overlay (UNIT *uptr, int32 val, CONST char *cptr, void *desc);
+t_stat sim_disk_show_overlay (FILE *st, UNIT *uptr, int32 val, CONST void *desc);
+t_stat sim_disk_set_stats (UNIT *uptr, int32 val, CONST char *cptr, void *desc);
+t_stat sim_disk_show_stats (FILE *st, UNIT *uptr, int32 val, CONST void *desc);
 t_stat sim_disk_set_asynch (UNIT *uptr, int latency);
 t_stat sim_disk_clr_asynch (UNIT *uptr);
 t_stat sim_disk_reset (UNIT *uptr);
@@ -157,6 +157,18 @@
   HAVE_SLIRP_NETWORK- Specifies that support for SLiRP networking should be
                       included.  This can be leveraged to provide User Mode
                       IP NAT connectivity for simulators.
+  HAVE_PACKET_NETWORK
+                    - Defined automatically on Linux when USE_READER_THREAD
+                      is active.  Includes support for device names of the
+                      form pkt:eth0 which move frames directly through
+                      AF_PACKET memory mapped rings without libpcap.  Define
+                      DONT_USE_PACKET_NETWORK to leave it out.
+  HAVE_VSW_NETWORK  - Defined automatically when USE_READER_THREAD is active
+                      and shared memory is available.  Includes support for
+                      device names of the form vsw:name which attach to a
+                      virtual Ethernet switch shared by every simulator on
+                      the host using the same name.  Define
+                      DONT_USE_VSW_NETWORK to leave it out.
 
   NEED_PCAP_SENDPACKET
                     - Specifies that you are using an older version of libpcap
@@ -777,6 +789,146 @@ void ethq_insert(ETH_QUE* que, int32 type, ETH_PACK* pack, int32 status)
 ethq_insert_data(que, type, pack->oversize ? pack->oversize : pack->msg, pack->used, pack->len, pack->crc_len, NULL, status);
 }
 
+#if defined (USE_READER_THREAD) && (defined (USE_NETWORK) || defined (USE_SHARED))
+/* Receive ring
+
+   Frames move from the reader thread to the simulator thread through a
+   preallocated ring with exactly one producer (the reader thread, in
+   _eth_callback) and one consumer (the simulator thread, in eth_read and
+   eth_read_batch).  head is only written by the producer and tail only by
+   the consumer, so neither side takes a lock per frame.  Unlike ETH_QUE,
+   which discards the oldest frame when full, the producer can't touch
+   frames the consumer owns, so a frame arriving at a full ring is dropped
+   and counted.
+*/
+
+#if defined(__GNUC__)
+#define ETH_RING_LOAD(x)     __atomic_load_n (&(x), __ATOMIC_ACQUIRE)
+#define ETH_RING_STORE(x,v)  __atomic_store_n (&(x), (v), __ATOMIC_RELEASE)
+#else
+#define ETH_RING_LOAD(x)     (x)
+#define ETH_RING_STORE(x,v)  (x) = (v)
+#endif
+
+static t_stat eth_ring_init (ETH_RING* ring, int depth)
+{
+uint32 size = ETH_RING_MIN;
+
+if (depth <= 0)
+  depth = ETH_RING_DEFAULT;
+if (depth > ETH_RING_MAX)
+  depth = ETH_RING_MAX;
+while (size < (uint32)depth)
+  size <<= 1;
+memset (ring, 0, sizeof (*ring));
+ring->item = (struct eth_item *)calloc (size, sizeof (*ring->item));
+if (!ring->item) {
+  sim_printf ("Eth: failed to allocate receive ring[%u]\n", size);
+  return SCPE_MEM;
+  }
+ring->size = size;
+return SCPE_OK;
+}
+
+static void eth_ring_destroy (ETH_RING* ring)
+{
+uint32 i;
+
+for (i = 0; i < ring->size; ++i)
+  free (ring->item[i].packet.oversize);
+free (ring->item);
+memset (ring, 0, sizeof (*ring));
+}
+
+static uint32 eth_ring_count (ETH_RING* ring)
+{
+return ETH_RING_LOAD (ring->head) - ETH_RING_LOAD (ring->tail);
+}
+
+/* Producer side: queue a frame, returning FALSE if it was dropped */
+
+static t_bool eth_ring_insert_data (ETH_RING* ring, int32 type, const uint8 *data, size_t len, size_t crc_len, const uint8 *crc_data)
+{
+uint32 head = ring->head;
+uint32 count = head - ETH_RING_LOAD (ring->tail);
+size_t size = (len > crc_len) ? len : crc_len;
+struct eth_item* item;
+uint8 *msg;
+
+if (count >= ring->size) {
+  if (!ring->dropping) {
+    ring->dropping = TRUE;
+    ++ring->overflows;
+    }
+  ++ring->drops;
+  return FALSE;
+  }
+ring->dropping = FALSE;
+if (count + 1 > ring->high)
+  ring->high = count + 1;
+item = &ring->item[head & (ring->size - 1)];
+item->type = type;
+item->packet.len = (uint32)len;
+item->packet.used = 0;
+item->packet.crc_len = (uint32)crc_len;
+item->packet.status = 0;
+if (size <= sizeof (item->packet.msg)) {
+  free (item->packet.oversize);
+  item->packet.oversize = NULL;
+  msg = item->packet.msg;
+  }
+else {
+  msg = (uint8 *)realloc (item->packet.oversize, size);
+  if (!msg) {
+    ++ring->drops;
+    return FALSE;
+    }
+  item->packet.oversize = msg;
+  }
+memcpy (msg, data, len);
+if (crc_len > len) {
+  if (crc_data)
+    memcpy (&msg[len], crc_data, crc_len - len);
+  else
+    memset (&msg[len], 0, crc_len - len);
+  }
+ETH_RING_STORE (ring->head, head + 1);          /* publish the frame */
+return TRUE;
+}
+
+/* Consumer side: take up to max frames */
+
+static int eth_ring_remove (ETH_RING* ring, ETH_PACK* packets, int max)
+{
+uint32 tail = ring->tail;
+uint32 avail = ETH_RING_LOAD (ring->head) - tail;
+int n;
+
+for (n = 0; (n < max) && (avail > 0); ++n, ++tail, --avail) {
+  struct eth_item* item = &ring->item[tail & (ring->size - 1)];
+  ETH_PACK* packet = &packets[n];
+  size_t size = (item->packet.len > item->packet.crc_len) ? item->packet.len : item->packet.crc_len;
+
+  if (size > sizeof (packet->msg))
+    size = sizeof (packet->msg);
+  packet->len = item->packet.len;
+  packet->crc_len = item->packet.crc_len;
+  packet->used = 0;
+  packet->status = 0;
+  memcpy (packet->msg, item->packet.oversize ? item->packet.oversize : item->packet.msg, size);
+  }
+ETH_RING_STORE (ring->tail, tail);              /* release the slots */
+return n;
+}
+
+/* Consumer side: discard everything queued */
+
+static void eth_ring_clear (ETH_RING* ring)
+{
+ETH_RING_STORE (ring->tail, ETH_RING_LOAD (ring->head));
+}
+#endif /* USE_READER_THREAD && (USE_NETWORK || USE_SHARED) */
+
 t_stat eth_show_devices (FILE* st, DEVICE *dptr, UNIT* uptr, int32 val, CONST char *desc)
 {
 return eth_show (st, uptr, val, NULL);
@@ -958,6 +1110,12 @@ t_stat eth_write (ETH_DEV* dev, ETH_PACK* packet, ETH_PCALLBACK routine)
   {return SCPE_NOFNC;}
 int eth_read (ETH_DEV* dev, ETH_PACK* packet, ETH_PCALLBACK routine)
   {return SCPE_NOFNC;}
+int eth_read_batch (ETH_DEV* dev, ETH_PACK* packets, int max)
+  {return 0;}
+t_stat eth_set_rx_queue (ETH_DEV* dev, int depth)
+  {return SCPE_NOFNC;}
+t_stat eth_set_tx_queue (ETH_DEV* dev, int depth)
+  {return SCPE_NOFNC;}
 t_stat eth_filter (ETH_DEV* dev, int addr_count, ETH_MAC* const addresses,
                    ETH_BOOL all_multicast, ETH_BOOL promiscuous)
   {return SCPE_NOFNC;}
@@ -986,6 +1144,116 @@ t_stat sim_ether_test (DEVICE *dptr, const char *cptr)
   {return SCPE_OK;}
 #else    /* endif unimplemented */
 
+/* Linux AF_PACKET sockets with TPACKET_V3 memory mapped rings */
+#if defined (USE_READER_THREAD) && (defined (__linux) || defined (__linux__)) && !defined (DONT_USE_PACKET_NETWORK)
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <linux/if_packet.h>
+#include <linux/filter.h>
+#if defined (TPACKET3_HDRLEN)
+#define HAVE_PACKET_NETWORK 1
+#endif
+#endif
+
+#if defined (HAVE_PACKET_NETWORK)
+#define ETH_PACKET_P_ALL        0x0003                  /* every protocol (ETH_P_ALL) */
+#define ETH_PACKET_BLOCK_SIZE   (1 << 17)               /* receive ring block size */
+#define ETH_PACKET_BLOCKS       32                      /* receive ring blocks */
+#define ETH_PACKET_BLOCK_TMO    2                       /* ms before a partly filled block is handed over */
+#define ETH_PACKET_TX_FRAME_SIZE 2048                   /* transmit ring slot size */
+#define ETH_PACKET_TX_FRAMES    128                     /* transmit ring slots */
+#define ETH_PACKET_TX_DATA      (TPACKET3_HDRLEN - sizeof (struct sockaddr_ll)) /* frame offset in a slot */
+#define ETH_PACKET_SNAPLEN      0x40000                 /* bytes kept of an accepted frame */
+#define ETH_PACKET_FILTER_MAX   (8 * ETH_FILTER_MAX + 32) /* most kernel filter instructions */
+
+typedef struct eth_packet_ring {
+  int           ifindex;                                /* interface index bound to */
+  ETH_MAC       hw_addr;                                /* interface MAC address */
+  int           have_hw_addr;                           /* hw_addr is valid */
+  uint8         *map;                                   /* receive ring followed by transmit ring */
+  size_t        map_size;
+  uint32        block_size;                             /* receive ring block size */
+  uint32        block_count;                            /* receive ring blocks */
+  uint32        block;                                  /* next receive block to examine */
+  uint8         *tx;                                    /* transmit ring (NULL when unavailable) */
+  uint32        tx_frame_size;                          /* transmit ring slot size */
+  uint32        tx_frame_count;                         /* transmit ring slots */
+  uint32        tx_frame;                               /* next transmit slot */
+  int           filter_len;                             /* kernel filter instructions */
+  uint32        blocks;                                 /* receive blocks processed */
+  uint32        tx_frames;                              /* frames sent from the transmit ring */
+  uint32        tx_copies;                              /* frames sent with send() */
+  uint32        kernel_drops;                           /* frames the kernel dropped with the ring full */
+  } ETH_PACKET_RING;
+#endif /* HAVE_PACKET_NETWORK */
+
+/* Virtual switch between simulators on this host, kept in shared memory */
+#if defined (USE_READER_THREAD) && !defined (DONT_USE_VSW_NETWORK) && \
+    (defined (_WIN32) || (defined (HAVE_SHM_OPEN) && defined (__GCC_HAVE_SYNC_COMPARE_AND_SWAP_4)))
+#define HAVE_VSW_NETWORK 1
+#endif
+
+#if defined (HAVE_VSW_NETWORK)
+#define ETH_VSW_MAGIC           0x31575356              /* "VSW1" */
+#define ETH_VSW_PORTS           16                      /* switch ports */
+#define ETH_VSW_SLOTS           256                     /* frames queued per port (power of 2) */
+#define ETH_VSW_SLOT_SIZE       1536                    /* bytes per queued frame, with its length */
+#define ETH_VSW_MAC_BITS        10
+#define ETH_VSW_MACS            (1 << ETH_VSW_MAC_BITS) /* learned address table entries */
+#define ETH_VSW_NAME_MAX        64                      /* longest switch name */
+#define ETH_VSW_POLL_MS         5                       /* ms a port keeps polling after a frame */
+#define ETH_VSW_LOCK_TRIES      1000                    /* attempts at a port lock before dropping */
+#if defined (__linux) || defined (__linux__)
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#if defined (SYS_futex)
+#define ETH_VSW_FUTEX           1                       /* readers sleep on their queue head */
+#endif
+#endif
+
+typedef struct eth_vsw_slot {
+  uint32        len;
+  uint8         msg[ETH_VSW_SLOT_SIZE - sizeof (uint32)];
+  } ETH_VSW_SLOT;
+
+typedef struct eth_vsw_port {
+  int32         in_use;                                 /* claimed by an attached device */
+  int32         pid;                                    /* process of the attached device */
+  int32         lock;                                   /* process of the sender queueing, or 0 */
+  volatile uint32 head;                                 /* frames queued (senders) */
+  volatile uint32 tail;                                 /* frames taken (port owner) */
+  int32         waiting;                                /* owner is asleep waiting for head to move */
+  uint32        drops;                                  /* frames dropped with the queue full */
+  ETH_VSW_SLOT  slot[ETH_VSW_SLOTS];
+  } ETH_VSW_PORT;
+
+typedef struct eth_vsw_mac {
+  ETH_MAC       mac;
+  uint8         port;                                   /* port + 1, 0 when unused */
+  uint8         pad;
+  } ETH_VSW_MAC;
+
+typedef struct eth_vsw {
+  int32         magic;                                  /* ETH_VSW_MAGIC once in use */
+  ETH_VSW_MAC   macs[ETH_VSW_MACS];                     /* learned source addresses */
+  ETH_VSW_PORT  port[ETH_VSW_PORTS];
+  } ETH_VSW;
+
+typedef struct eth_vsw_handle {
+  SHMEM         *shmem;
+  ETH_VSW       *sw;                                    /* the shared switch */
+  char          name[ETH_VSW_NAME_MAX + 1];
+  int           port;                                   /* port this device owns */
+  int32         pid;                                    /* our process, as recorded in the switch */
+  uint32        last_frame;                             /* sim_os_msec of the last frame received */
+  uint32        forwarded;                              /* frames sent to a single port */
+  uint32        flooded;                                /* frames sent to every other port */
+  uint32        lock_drops;                             /* frames dropped waiting for a port lock */
+  } ETH_VSW_HANDLE;
+#endif /* HAVE_VSW_NETWORK */
+
 const char *eth_capabilities(void)
  {
 #if defined (USE_READER_THREAD)
@@ -1005,6 +1273,12 @@ const char *eth_capabilities(void)
 #endif
 #if defined (HAVE_SLIRP_NETWORK)
      ":NAT"
+#endif
+#if defined (HAVE_PACKET_NETWORK)
+     ":PACKET"
+#endif
+#if defined (HAVE_VSW_NETWORK)
+     ":VSW"
 #endif
      ":UDP";
  }
@@ -1180,6 +1454,14 @@ if (used < max) {
   ++used;
   }
 #endif
+#ifdef HAVE_PACKET_NETWORK
+if (used < max) {
+  sprintf(list[used].name, "%s", "pkt:ifname");
+  sprintf(list[used].desc, "%s", "Integrated AF_PACKET support");
+  list[used].eth_api = ETH_API_PACKET;
+  ++used;
+  }
+#endif
 #ifdef HAVE_VDE_NETWORK
 if (used < max) {
   sprintf(list[used].name, "%s", "vde:device{:switch-port-number}");
@@ -1203,6 +1485,14 @@ if (used < max) {
   list[used].eth_api = ETH_API_UDP;
   ++used;
   }
+#ifdef HAVE_VSW_NETWORK
+if (used < max) {
+  sprintf(list[used].name, "%s", "vsw:switchname");
+  sprintf(list[used].desc, "%s", "Integrated virtual switch support");
+  list[used].eth_api = ETH_API_VSW;
+  ++used;
+  }
+#endif
 
 /* return device count */
 return used;
@@ -1236,6 +1526,11 @@ extern "C" {
 #include "sim_slirp.h"
 #endif /* HAVE_SLIRP_NETWORK */
 
+/* Linux can send a batch of datagrams with a single system call */
+#if defined(USE_READER_THREAD) && defined(__linux__) && defined(MSG_WAITFORONE)
+#define HAVE_SENDMMSG 1
+#endif
+
 /* Allows windows to look up user-defined adapter names */
 #if defined(_WIN32)
 #include <winreg.h>
@@ -1763,6 +2058,15 @@ static void eth_get_nic_hw_addr(ETH_DEV* dev, const char *devname, int set_on)
 {
   memset(&dev->host_nic_phy_hw_addr, 0, sizeof(dev->host_nic_phy_hw_addr));
   dev->have_host_nic_phy_addr = 0;
+#if defined(HAVE_PACKET_NETWORK)
+  if (dev->eth_api == ETH_API_PACKET) {
+    ETH_PACKET_RING *ring = (ETH_PACKET_RING *)dev->handle;
+
+    memcpy(dev->host_nic_phy_hw_addr, ring->hw_addr, sizeof(ETH_MAC));
+    dev->have_host_nic_phy_addr = ring->have_hw_addr;
+    return;
+    }
+#endif
   if (dev->eth_api != ETH_API_PCAP)
     return;
 #if defined(_WIN32) || defined(__CYGWIN__)
@@ -1917,9 +2221,17 @@ return 0;
 static void
 _eth_callback(u_char* info, const struct pcap_pkthdr* header, const u_char* data);
 
+static uint32
+_eth_mac_hash (const u_char* mac);
+
 static t_stat
 _eth_write(ETH_DEV* dev, ETH_PACK* packet, ETH_PCALLBACK routine);
 
+#if defined (USE_READER_THREAD)
+static t_stat
+_eth_write_batch(ETH_DEV* dev, ETH_PACK** packets, int count);
+#endif
+
 static void
 _eth_error(ETH_DEV* dev, const char* where);
 
@@ -1934,6 +2246,789 @@ _eth_callback((u_char *)opaque, &header, buf);
 }
 #endif
 
+#if defined (HAVE_PACKET_NETWORK)
+/*============================================================================*/
+/*       Linux AF_PACKET transport using TPACKET_V3 memory mapped rings       */
+/*============================================================================*/
+
+/* The receive ring is handed to the kernel a block at a time.  The kernel
+   packs arriving frames into the current block and passes it to us when it
+   fills or its timer expires, so the reader thread wakes once per block and
+   _eth_callback is handed each frame where the kernel left it.  Frames to
+   send are built in the transmit ring and one send() passes every frame
+   staged so far to the kernel.  The same addresses eth_bpf_filter turns
+   into a pcap filter string are compiled here into a kernel socket filter,
+   so unwanted frames never reach the ring.
+
+   Each attached device has its own socket on the interface.  PACKET_FANOUT
+   isn't used since a simulated NIC must see all of its frames, in order,
+   on a single socket.  */
+
+static int
+_eth_packet_set_filter (ETH_DEV *dev, SOCKET fd);
+
+static t_stat
+_eth_packet_open (const char *devname, void **handle, SOCKET *fd_handle, char errbuf[PCAP_ERRBUF_SIZE], void *opaque)
+{
+ETH_PACKET_RING *ring;
+struct tpacket_req3 req;
+struct sockaddr_ll sll;
+struct ifreq ifr;
+struct packet_mreq mreq;
+struct sock_filter none = BPF_STMT(BPF_RET|BPF_K, 0);
+struct sock_fprog prog;
+int fd, version = TPACKET_V3;
+size_t rx_size, tx_size = 0;
+
+ring = (ETH_PACKET_RING *)calloc (1, sizeof (*ring));
+if (ring == NULL) {
+  strlcpy (errbuf, "Out of memory", PCAP_ERRBUF_SIZE);
+  return SCPE_MEM;
+  }
+fd = socket (AF_PACKET, SOCK_RAW, htons (ETH_PACKET_P_ALL));
+if (fd < 0) {
+  strlcpy (errbuf, strerror (errno), PCAP_ERRBUF_SIZE);
+  free (ring);
+  return SCPE_OPENERR;
+  }
+/* Nothing is queued until the device's own filter replaces this one */
+prog.len = 1;
+prog.filter = &none;
+memset (&ifr, 0, sizeof (ifr));
+strlcpy (ifr.ifr_name, devname, sizeof (ifr.ifr_name));
+if ((setsockopt (fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof (prog))) ||
+    (ioctl (fd, SIOCGIFINDEX, &ifr)))
+  goto Error;
+ring->ifindex = ifr.ifr_ifindex;
+if (ioctl (fd, SIOCGIFHWADDR, &ifr))
+  goto Error;
+if ((ifr.ifr_hwaddr.sa_family != ARPHRD_ETHER) &&
+    (ifr.ifr_hwaddr.sa_family != ARPHRD_LOOPBACK)) {
+  snprintf (errbuf, PCAP_ERRBUF_SIZE, "%s is not an Ethernet interface", devname);
+  close (fd);
+  free (ring);
+  return SCPE_OPENERR;
+  }
+if (ifr.ifr_hwaddr.sa_family == ARPHRD_ETHER) {
+  memcpy (ring->hw_addr, ifr.ifr_hwaddr.sa_data, sizeof (ETH_MAC));
+  ring->have_hw_addr = 1;
+  }
+/* try to force an otherwise unused interface to be turned on */
+if ((0 == ioctl (fd, SIOCGIFFLAGS, &ifr)) && (!(ifr.ifr_flags & IFF_UP))) {
+  ifr.ifr_flags |= IFF_UP;
+  if (ioctl (fd, SIOCSIFFLAGS, &ifr)) {};
+  }
+if (setsockopt (fd, SOL_PACKET, PACKET_VERSION, &version, sizeof (version)))
+  goto Error;
+memset (&req, 0, sizeof (req));
+req.tp_block_size = ETH_PACKET_BLOCK_SIZE;
+req.tp_block_nr = ETH_PACKET_BLOCKS;
+req.tp_frame_size = TPACKET_ALIGNMENT << 7;
+req.tp_frame_nr = (req.tp_block_size / req.tp_frame_size) * req.tp_block_nr;
+req.tp_retire_blk_tov = ETH_PACKET_BLOCK_TMO;
+if (setsockopt (fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof (req)))
+  goto Error;
+ring->block_size = req.tp_block_size;
+ring->block_count = req.tp_block_nr;
+rx_size = (size_t)req.tp_block_size * req.tp_block_nr;
+/* A transmit ring needs Linux 4.11 or later, otherwise frames are sent
+   with send() */
+memset (&req, 0, sizeof (req));
+req.tp_block_size = ETH_PACKET_TX_FRAME_SIZE * ETH_PACKET_TX_FRAMES;
+req.tp_block_nr = 1;
+req.tp_frame_size = ETH_PACKET_TX_FRAME_SIZE;
+req.tp_frame_nr = ETH_PACKET_TX_FRAMES;
+if (0 == setsockopt (fd, SOL_PACKET, PACKET_TX_RING, &req, sizeof (req))) {
+  tx_size = (size_t)req.tp_block_size;
+  ring->tx_frame_size = req.tp_frame_size;
+  ring->tx_frame_count = req.tp_frame_nr;
+  }
+ring->map_size = rx_size + tx_size;
+ring->map = (uint8 *)mmap (NULL, ring->map_size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+if (ring->map == (uint8 *)MAP_FAILED) {
+  ring->map = NULL;
+  goto Error;
+  }
+if (tx_size)
+  ring->tx = ring->map + rx_size;
+memset (&sll, 0, sizeof (sll));
+sll.sll_family = AF_PACKET;
+sll.sll_protocol = htons (ETH_PACKET_P_ALL);
+sll.sll_ifindex = ring->ifindex;
+if (bind (fd, (struct sockaddr *)&sll, sizeof (sll)))
+  goto Error;
+memset (&mreq, 0, sizeof (mreq));
+mreq.mr_ifindex = ring->ifindex;
+mreq.mr_type = PACKET_MR_PROMISC;
+if (setsockopt (fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mreq, sizeof (mreq)))
+  goto Error;
+*handle = (void *)ring;
+*fd_handle = (SOCKET)fd;
+if (opaque)
+  ring->filter_len = _eth_packet_set_filter ((ETH_DEV *)opaque, *fd_handle);
+return SCPE_OK;
+
+Error:
+strlcpy (errbuf, strerror (errno), PCAP_ERRBUF_SIZE);
+if (ring->map)
+  munmap (ring->map, ring->map_size);
+close (fd);
+free (ring);
+return SCPE_OPENERR;
+}
+
+static void
+_eth_packet_close (ETH_PACKET_RING *ring, SOCKET fd)
+{
+if (ring->map)
+  munmap (ring->map, ring->map_size);
+close (fd);
+free (ring);
+}
+
+static void
+_eth_packet_show (ETH_PACKET_RING *ring, SOCKET fd, FILE *st)
+{
+struct tpacket_stats_v3 stats;
+socklen_t len = sizeof (stats);
+
+/* the kernel clears its counters each time they are read */
+if (0 == getsockopt ((int)fd, SOL_PACKET, PACKET_STATISTICS, &stats, &len))
+  ring->kernel_drops += stats.tp_drops;
+fprintf(st, "  Packet Ring: Blocks:     %u x %u bytes\n", ring->block_count, ring->block_size);
+fprintf(st, "  Packet Ring: Processed:  %u blocks\n", ring->blocks);
+fprintf(st, "  Packet Ring: Dropped:    %u\n", ring->kernel_drops);
+if (ring->tx)
+  fprintf(st, "  Packet Ring: Tx Slots:   %u\n", ring->tx_frame_count);
+fprintf(st, "  Packet Ring: Tx Frames:  %u\n", ring->tx_frames);
+if (ring->tx_copies)
+  fprintf(st, "  Packet Ring: Tx Copied:  %u\n", ring->tx_copies);
+fprintf(st, "  Kernel Filter:           %d instructions\n", ring->filter_len);
+}
+
+/* Pass one received frame to _eth_callback.  The kernel strips a VLAN tag
+   into the frame header, so put it back the way pcap would show it. */
+
+static void
+_eth_packet_deliver (ETH_DEV *dev, struct tpacket3_hdr *hdr)
+{
+struct pcap_pkthdr header;
+const u_char *data = (const u_char *)hdr + hdr->tp_mac;
+
+memset (&header, 0, sizeof (header));
+header.caplen = hdr->tp_snaplen;
+header.len = hdr->tp_len;
+if ((hdr->tp_status & TP_STATUS_VLAN_VALID) &&
+    (header.caplen >= 12) && (header.caplen <= ETH_MAX_JUMBO_FRAME)) {
+  u_char buf[ETH_MAX_JUMBO_FRAME + 4];
+  uint16 tpid = 0x8100;
+
+#if defined (TP_STATUS_VLAN_TPID_VALID)
+  if (hdr->tp_status & TP_STATUS_VLAN_TPID_VALID)
+    tpid = hdr->hv1.tp_vlan_tpid;
+#endif
+  memcpy (buf, data, 12);
+  buf[12] = (u_char)(tpid >> 8);
+  buf[13] = (u_char)tpid;
+  buf[14] = (u_char)(hdr->hv1.tp_vlan_tci >> 8);
+  buf[15] = (u_char)hdr->hv1.tp_vlan_tci;
+  memcpy (&buf[16], data + 12, header.caplen - 12);
+  header.caplen += 4;
+  header.len += 4;
+  _eth_callback ((u_char *)dev, &header, buf);
+  return;
+  }
+_eth_callback ((u_char *)dev, &header, data);
+}
+
+/* Process every receive block the kernel has handed over, returning the
+   number of frames seen */
+
+static int
+_eth_packet_dispatch (ETH_DEV *dev)
+{
+ETH_PACKET_RING *ring = (ETH_PACKET_RING *)dev->handle;
+int frames = 0;
+
+while (1) {
+  struct tpacket_block_desc *block = (struct tpacket_block_desc *)(ring->map + (size_t)ring->block * ring->block_size);
+  struct tpacket3_hdr *hdr;
+  uint32 i, count;
+
+  if (!(ETH_RING_LOAD (block->hdr.bh1.block_status) & TP_STATUS_USER))
+    break;
+  count = block->hdr.bh1.num_pkts;
+  hdr = (struct tpacket3_hdr *)((uint8 *)block + block->hdr.bh1.offset_to_first_pkt);
+  for (i = 0; i < count; i++) {
+    _eth_packet_deliver (dev, hdr);
+    hdr = (struct tpacket3_hdr *)((uint8 *)hdr + hdr->tp_next_offset);
+    }
+  frames += count;
+  ETH_RING_STORE (block->hdr.bh1.block_status, TP_STATUS_KERNEL);
+  ring->block = (ring->block + 1) % ring->block_count;
+  ++ring->blocks;
+  }
+return frames;
+}
+
+/* Send frames, returning how many leading frames were sent.  Frames are
+   copied into free transmit ring slots and handed to the kernel with a
+   single send().  Once the ring is full, or when there is no ring, the
+   rest go out one send() each. */
+
+static int
+_eth_packet_send (ETH_DEV *dev, ETH_PACK **packets, int count)
+{
+ETH_PACKET_RING *ring = (ETH_PACKET_RING *)dev->handle;
+int fd = (int)dev->fd_handle;
+int i, staged = 0, sent = 0;
+uint32 slot = ring->tx_frame;
+
+if (ring->tx) {
+  while (staged < count) {
+    struct tpacket3_hdr *hdr = (struct tpacket3_hdr *)(ring->tx + (size_t)slot * ring->tx_frame_size);
+
+    if ((ETH_RING_LOAD (hdr->tp_status) != TP_STATUS_AVAILABLE) ||
+        (packets[staged]->len > ring->tx_frame_size - ETH_PACKET_TX_DATA))
+      break;
+    memcpy ((uint8 *)hdr + ETH_PACKET_TX_DATA, packets[staged]->msg, packets[staged]->len);
+    hdr->tp_len = hdr->tp_snaplen = packets[staged]->len;
+    hdr->tp_next_offset = 0;
+    ETH_RING_STORE (hdr->tp_status, TP_STATUS_SEND_REQUEST);
+    slot = (slot + 1) % ring->tx_frame_count;
+    ++staged;
+    }
+  if (staged) {
+    int status = (int)send (fd, NULL, 0, 0);   /* waits for the frames to go */
+
+    /* Slots the kernel did not take are failures; reclaim them */
+    slot = ring->tx_frame;
+    for (i = 0; i < staged; i++) {
+      struct tpacket3_hdr *hdr = (struct tpacket3_hdr *)(ring->tx + (size_t)slot * ring->tx_frame_size);
+
+      if ((status >= 0) && (ETH_RING_LOAD (hdr->tp_status) == TP_STATUS_AVAILABLE)) {
+        if (sent == i)
+          ++sent;
+        }
+      else
+        ETH_RING_STORE (hdr->tp_status, TP_STATUS_AVAILABLE);
+      slot = (slot + 1) % ring->tx_frame_count;
+      }
+    ring->tx_frame = slot;
+    ring->tx_frames += staged;
+    if (sent < staged)
+      return sent;
+    }
+  }
+for (i = staged; i < count; i++) {
+  if ((int)packets[i]->len != (int)send (fd, packets[i]->msg, packets[i]->len, 0))
+    break;
+  ++ring->tx_copies;
+  ++sent;
+  }
+return sent;
+}
+
+/* Compile the filter eth_bpf_filter describes into a kernel socket filter
+   program, returning the number of instructions produced.  Jumps to later
+   parts of the program are emitted against labels and resolved at the end.
+   The accepted frames are:
+
+     (dst is a filter address or, with all_multicast or a hash, any
+      multicast) and not (src is a unicast filter address when reflecting)
+     or (dst and src are the physical address, or dst is the host NIC and
+         the type is loopback, when reflecting)  */
+
+#define ETH_PF_NEXT     0
+#define ETH_PF_SRC      1
+#define ETH_PF_SPECIAL  2
+#define ETH_PF_HOST     3
+#define ETH_PF_ACCEPT   4
+#define ETH_PF_REJECT   5
+#define ETH_PF_LABELS   6
+
+typedef struct eth_packet_filter {
+  struct sock_filter *insn;
+  uint8   jt_label[ETH_PACKET_FILTER_MAX];
+  uint8   jf_label[ETH_PACKET_FILTER_MAX];
+  int     label[ETH_PF_LABELS];
+  int     count;
+  } ETH_PACKET_FILTER;
+
+static void
+_eth_pf_emit (ETH_PACKET_FILTER *pf, uint16 code, uint32 k, int jt, int jf)
+{
+struct sock_filter *insn = &pf->insn[pf->count];
+
+insn->code = code;
+insn->k = k;
+insn->jt = (uint8)((jt < 0) ? 0 : jt);
+insn->jf = (uint8)((jf < 0) ? 0 : jf);
+pf->jt_label[pf->count] = (uint8)((jt < 0) ? -jt : ETH_PF_NEXT);
+pf->jf_label[pf->count] = (uint8)((jf < 0) ? -jf : ETH_PF_NEXT);
+++pf->count;
+}
+
+/* Jump to label when the 6 bytes at offset equal mac, else fall through */
+
+static void
+_eth_pf_mac (ETH_PACKET_FILTER *pf, int offset, const ETH_MAC mac, int label)
+{
+_eth_pf_emit (pf, BPF_LD|BPF_W|BPF_ABS, offset + 2, ETH_PF_NEXT, ETH_PF_NEXT);
+_eth_pf_emit (pf, BPF_JMP|BPF_JEQ|BPF_K, ((uint32)mac[2] << 24) | (mac[3] << 16) | (mac[4] << 8) | mac[5], 0, 2);
+_eth_pf_emit (pf, BPF_LD|BPF_H|BPF_ABS, offset, ETH_PF_NEXT, ETH_PF_NEXT);
+_eth_pf_emit (pf, BPF_JMP|BPF_JEQ|BPF_K, (mac[0] << 8) | mac[1], -label, 0);
+}
+
+/* Jump to label_true when the 6 bytes at offset equal mac, else to label_false */
+
+static void
+_eth_pf_mac_else (ETH_PACKET_FILTER *pf, int offset, const ETH_MAC mac, int label_true, int label_false)
+{
+_eth_pf_emit (pf, BPF_LD|BPF_W|BPF_ABS, offset + 2, ETH_PF_NEXT, ETH_PF_NEXT);
+_eth_pf_emit (pf, BPF_JMP|BPF_JEQ|BPF_K, ((uint32)mac[2] << 24) | (mac[3] << 16) | (mac[4] << 8) | mac[5], 0, -label_false);
+_eth_pf_emit (pf, BPF_LD|BPF_H|BPF_ABS, offset, ETH_PF_NEXT, ETH_PF_NEXT);
+_eth_pf_emit (pf, BPF_JMP|BPF_JEQ|BPF_K, (mac[0] << 8) | mac[1], -label_true, -label_false);
+}
+
+static int
+_eth_packet_filter (int addr_count, ETH_MAC* const filter_address,
+                    ETH_BOOL all_multicast, ETH_BOOL promiscuous,
+                    int reflections,
+                    ETH_MAC* physical_addr,
+                    ETH_MAC* host_nic_phy_hw_addr,
+                    ETH_MULTIHASH* const hash,
+                    struct sock_filter *insn)
+{
+static const ETH_MAC zeros = {0, 0, 0, 0, 0, 0};
+ETH_PACKET_FILTER pf;
+int i, j;
+
+memset (&pf, 0, sizeof (pf));
+pf.insn = insn;
+/* destination filters */
+if (!promiscuous) {
+  for (i = 0; i < addr_count; i++) {
+    for (j = 0; j < i; j++)
+      if (0 == memcmp (filter_address[i], filter_address[j], sizeof (ETH_MAC)))
+        break;
+    if (j == i)                 /* eliminate duplicates */
+      _eth_pf_mac (&pf, 0, filter_address[i], ETH_PF_SRC);
+    }
+  if (all_multicast || hash) {
+    _eth_pf_emit (&pf, BPF_LD|BPF_B|BPF_ABS, 0, ETH_PF_NEXT, ETH_PF_NEXT);
+    _eth_pf_emit (&pf, BPF_JMP|BPF_JSET|BPF_K, 0x01, -ETH_PF_SRC, 0);
+    }
+  _eth_pf_emit (&pf, BPF_JMP|BPF_JA, 0, -ETH_PF_SPECIAL, ETH_PF_NEXT);
+  }
+/* source filters which drop our own reflected frames */
+pf.label[ETH_PF_SRC] = pf.count;
+if ((addr_count > 0) && (reflections > 0)) {
+  for (i = 0; i < addr_count; i++) {
+    if (filter_address[i][0] & 0x01)
+      continue;                 /* skip multicast addresses */
+    for (j = 0; j < i; j++)
+      if (0 == memcmp (filter_address[i], filter_address[j], sizeof (ETH_MAC)))
+        break;
+    if (j == i)
+      _eth_pf_mac (&pf, 6, filter_address[i], ETH_PF_SPECIAL);
+    }
+  }
+_eth_pf_emit (&pf, BPF_JMP|BPF_JA, 0, -ETH_PF_ACCEPT, ETH_PF_NEXT);
+/* loopback frames to our physical address (see eth_bpf_filter) */
+pf.label[ETH_PF_SPECIAL] = pf.count;
+if ((!promiscuous) && (addr_count) && (reflections > 0) &&
+    (0 != memcmp (physical_addr[0], zeros, sizeof (ETH_MAC)))) {
+  _eth_pf_mac_else (&pf, 0, physical_addr[0], ETH_PF_NEXT, ETH_PF_HOST);
+  _eth_pf_mac_else (&pf, 6, physical_addr[0], ETH_PF_ACCEPT, ETH_PF_HOST);
+  pf.label[ETH_PF_HOST] = pf.count;
+  if (host_nic_phy_hw_addr) {
+    _eth_pf_mac_else (&pf, 0, host_nic_phy_hw_addr[0], ETH_PF_NEXT, ETH_PF_REJECT);
+    _eth_pf_emit (&pf, BPF_LD|BPF_H|BPF_ABS, 12, ETH_PF_NEXT, ETH_PF_NEXT);
+    _eth_pf_emit (&pf, BPF_JMP|BPF_JEQ|BPF_K, 0x9000, -ETH_PF_ACCEPT, -ETH_PF_REJECT);
+    }
+  }
+else
+  pf.label[ETH_PF_HOST] = pf.count;
+pf.label[ETH_PF_REJECT] = pf.count;
+_eth_pf_emit (&pf, BPF_RET|BPF_K, 0, ETH_PF_NEXT, ETH_PF_NEXT);
+pf.label[ETH_PF_ACCEPT] = pf.count;
+_eth_pf_emit (&pf, BPF_RET|BPF_K, ETH_PACKET_SNAPLEN, ETH_PF_NEXT, ETH_PF_NEXT);
+/* resolve labels */
+for (i = 0; i < pf.count; i++) {
+  if (insn[i].code == (BPF_JMP|BPF_JA)) {
+    insn[i].k = pf.label[pf.jt_label[i]] - (i + 1);
+    continue;
+    }
+  if (pf.jt_label[i])
+    insn[i].jt = (uint8)(pf.label[pf.jt_label[i]] - (i + 1));
+  if (pf.jf_label[i])
+    insn[i].jf = (uint8)(pf.label[pf.jf_label[i]] - (i + 1));
+  }
+return pf.count;
+}
+
+/* Attach the kernel filter for the device's current address filters */
+
+static int
+_eth_packet_set_filter (ETH_DEV *dev, SOCKET fd)
+{
+struct sock_filter insn[ETH_PACKET_FILTER_MAX];
+struct sock_fprog prog;
+
+prog.len = (unsigned short)_eth_packet_filter (dev->addr_count, dev->filter_address,
+                                               dev->all_multicast, dev->promiscuous,
+                                               dev->reflections, &dev->physical_addr,
+                                               dev->have_host_nic_phy_addr ? &dev->host_nic_phy_hw_addr: NULL,
+                                               (dev->hash_filter ? &dev->hash : NULL), insn);
+prog.filter = insn;
+if (setsockopt ((int)fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof (prog)))
+  return -1;
+return (int)prog.len;
+}
+#endif /* HAVE_PACKET_NETWORK */
+
+#if defined (HAVE_VSW_NETWORK)
+/*============================================================================*/
+/*         Virtual Ethernet switch between simulators in shared memory        */
+/*============================================================================*/
+
+/* Devices attached to vsw:name are ports of a switch kept in a shared
+   memory segment, so simulators in one process or in several processes on
+   the same host exchange frames without involving the host's network.
+
+   Each port owns a queue of frame slots.  Any port may add to a queue, so
+   a sender holds the queue's lock just long enough to copy its frame in,
+   while the owning device's reader thread takes frames out without
+   locking.  Senders switch frames directly from eth_write on the
+   simulator's thread rather than through the writer thread, so they never
+   wait: a frame which finds the queue full, or its lock held for longer
+   than a copy takes, is dropped as a real switch would drop it.  A port
+   whose queue stays full or whose lock stays held may belong to a
+   simulator which exited without detaching, so the sender checks and
+   releases the port or the lock when their owner is gone.  Source addresses are learned in a table indexed by a
+   hash of the address: a unicast frame to a learned address goes to that
+   port only and everything else is flooded to every other port.  A frame
+   to an address learned on the sender's own port is flooded too, so the
+   address conflict check still finds another device using that address.
+   Table entries are updated without a lock; a lookup racing an update at
+   worst floods a frame or hands it to a port whose filter discards it.
+
+   On Linux a reader with nothing queued sleeps on a futex on its queue's
+   head, which works across processes, and senders wake it.  Elsewhere
+   nothing in the segment can wake a reader, so the reader thread keeps
+   polling its queue for a few milliseconds after each frame and then
+   looks once a millisecond.  */
+
+#if !defined (_WIN32)
+#include <signal.h>
+#endif
+
+static int32
+_eth_vsw_pid (void)
+{
+#if defined (_WIN32)
+return (int32)GetCurrentProcessId ();
+#else
+return (int32)getpid ();
+#endif
+}
+
+/* Whether the process which claimed a port went away without releasing it */
+
+static t_bool
+_eth_vsw_owner_gone (int32 pid)
+{
+#if defined (_WIN32)
+HANDLE hProcess = OpenProcess (SYNCHRONIZE, FALSE, (DWORD)pid);
+t_bool gone;
+
+if (hProcess == NULL)
+  return (GetLastError () == ERROR_INVALID_PARAMETER);
+gone = (WaitForSingleObject (hProcess, 0) == WAIT_OBJECT_0);
+CloseHandle (hProcess);
+return gone;
+#else
+return ((kill ((pid_t)pid, 0) != 0) && (errno == ESRCH));
+#endif
+}
+
+/* Forget the addresses learned on a port */
+
+static void
+_eth_vsw_forget (ETH_VSW *sw, int port)
+{
+int i;
+
+for (i = 0; i < ETH_VSW_MACS; i++)
+  if (sw->macs[i].port == port + 1)
+    sw->macs[i].port = 0;
+}
+
+/* Release a port whose simulator exited without detaching */
+
+static t_bool
+_eth_vsw_reclaim (ETH_VSW *sw, int i)
+{
+ETH_VSW_PORT *port = &sw->port[i];
+int32 pid = port->pid;
+
+if ((!port->in_use) || (pid == 0) || !_eth_vsw_owner_gone (pid) ||
+    !sim_shmem_atomic_cas (&port->pid, pid, 0))
+  return FALSE;
+_eth_vsw_forget (sw, i);
+sim_shmem_atomic_cas (&port->in_use, 1, 0);
+return TRUE;
+}
+
+/* Release a port's lock if the sender holding it exited while queueing */
+
+static void
+_eth_vsw_break_lock (ETH_VSW_PORT *port)
+{
+int32 holder = port->lock;
+
+if ((holder != 0) && _eth_vsw_owner_gone (holder))
+  sim_shmem_atomic_cas (&port->lock, holder, 0);
+}
+
+static t_stat
+_eth_vsw_open (const char *name, void **handle, char errbuf[PCAP_ERRBUF_SIZE])
+{
+ETH_VSW_HANDLE *vsw;
+char shmname[ETH_VSW_NAME_MAX + 16];
+void *addr;
+const char *c;
+int i;
+
+if ((*name == '\0') || (strlen (name) > ETH_VSW_NAME_MAX)) {
+  snprintf (errbuf, PCAP_ERRBUF_SIZE, "Switch names are 1 to %d characters", ETH_VSW_NAME_MAX);
+  return SCPE_OPENERR;
+  }
+for (c = name; *c; c++)
+  if (!isalnum ((unsigned char)*c) && !strchr ("-_.", *c)) {
+    snprintf (errbuf, PCAP_ERRBUF_SIZE, "Invalid switch name: %s", name);
+    return SCPE_OPENERR;
+    }
+vsw = (ETH_VSW_HANDLE *)calloc (1, sizeof (*vsw));
+if (vsw == NULL) {
+  strlcpy (errbuf, "Out of memory", PCAP_ERRBUF_SIZE);
+  return SCPE_MEM;
+  }
+strlcpy (vsw->name, name, sizeof (vsw->name));
+snprintf (shmname, sizeof (shmname), "simh-vsw-%s", name);
+if (SCPE_OK != sim_shmem_open (shmname, sizeof (ETH_VSW), &vsw->shmem, &addr)) {
+  snprintf (errbuf, PCAP_ERRBUF_SIZE, "Can't open shared memory for switch %s", name);
+  free (vsw);
+  return SCPE_OPENERR;
+  }
+vsw->sw = (ETH_VSW *)addr;
+/* A new segment is all zeros, which is an empty switch */
+if ((!sim_shmem_atomic_cas (&vsw->sw->magic, 0, ETH_VSW_MAGIC)) &&
+    (vsw->sw->magic != ETH_VSW_MAGIC)) {
+  snprintf (errbuf, PCAP_ERRBUF_SIZE, "Shared memory %s isn't a virtual switch", shmname);
+  sim_shmem_close (vsw->shmem);
+  free (vsw);
+  return SCPE_OPENERR;
+  }
+vsw->port = -1;
+vsw->pid = _eth_vsw_pid ();
+for (i = 0; (i < ETH_VSW_PORTS) && (vsw->port < 0); i++) {
+  ETH_VSW_PORT *port = &vsw->sw->port[i];
+
+  _eth_vsw_reclaim (vsw->sw, i);
+  if (sim_shmem_atomic_cas (&port->in_use, 0, 1)) {
+    _eth_vsw_break_lock (port);
+    ETH_RING_STORE (port->tail, ETH_RING_LOAD (port->head));  /* discard stale frames */
+    port->drops = 0;
+    port->pid = vsw->pid;
+    vsw->port = i;
+    }
+  }
+if (vsw->port < 0) {
+  snprintf (errbuf, PCAP_ERRBUF_SIZE, "All %d ports of switch %s are in use", ETH_VSW_PORTS, name);
+  sim_shmem_close (vsw->shmem);
+  free (vsw);
+  return SCPE_OPENERR;
+  }
+vsw->last_frame = sim_os_msec ();
+*handle = (void *)vsw;
+return SCPE_OK;
+}
+
+static void
+_eth_vsw_close (ETH_VSW_HANDLE *vsw)
+{
+ETH_VSW_PORT *port = &vsw->sw->port[vsw->port];
+
+_eth_vsw_forget (vsw->sw, vsw->port);
+port->pid = 0;
+sim_shmem_atomic_cas (&port->in_use, 1, 0);
+sim_shmem_close (vsw->shmem);
+free (vsw);
+}
+
+static void
+_eth_vsw_show (ETH_VSW_HANDLE *vsw, FILE *st)
+{
+ETH_VSW_PORT *port = &vsw->sw->port[vsw->port];
+int i, ports = 0, learned = 0;
+
+for (i = 0; i < ETH_VSW_PORTS; i++)
+  if (vsw->sw->port[i].in_use)
+    ++ports;
+for (i = 0; i < ETH_VSW_MACS; i++)
+  if (vsw->sw->macs[i].port)
+    ++learned;
+fprintf(st, "  Switch: Name:            %s\n", vsw->name);
+fprintf(st, "  Switch: Port:            %d of %d, %d in use\n", vsw->port, ETH_VSW_PORTS, ports);
+fprintf(st, "  Switch: Learned:         %d addresses\n", learned);
+fprintf(st, "  Switch: Queued:          %u of %d frames\n", ETH_RING_LOAD (port->head) - port->tail, ETH_VSW_SLOTS);
+fprintf(st, "  Switch: Dropped:         %u\n", port->drops);
+fprintf(st, "  Switch: Forwarded:       %u\n", vsw->forwarded);
+fprintf(st, "  Switch: Flooded:         %u\n", vsw->flooded);
+if (vsw->lock_drops)
+  fprintf(st, "  Switch: Lock Timeouts:   %u\n", vsw->lock_drops);
+}
+
+/* Queue a frame on a port, returning FALSE when it was dropped */
+
+static t_bool
+_eth_vsw_queue (ETH_VSW_HANDLE *vsw, int dest, const ETH_PACK *packet)
+{
+ETH_VSW_PORT *port = &vsw->sw->port[dest];
+ETH_VSW_SLOT *slot;
+uint32 head;
+int tries = 0;
+
+while (!sim_shmem_atomic_cas (&port->lock, 0, vsw->pid)) {
+  if (++tries == ETH_VSW_LOCK_TRIES) {
+    ++vsw->lock_drops;
+    _eth_vsw_break_lock (port);             /* holder died while queueing? */
+    _eth_vsw_reclaim (vsw->sw, dest);
+    return FALSE;
+    }
+  }
+head = port->head;
+if (head - ETH_RING_LOAD (port->tail) >= ETH_VSW_SLOTS) {
+  ++port->drops;
+  sim_shmem_atomic_cas (&port->lock, vsw->pid, 0);
+  _eth_vsw_reclaim (vsw->sw, dest);         /* nobody left to empty it? */
+  return FALSE;
+  }
+slot = &port->slot[head & (ETH_VSW_SLOTS - 1)];
+slot->len = packet->len;
+memcpy (slot->msg, packet->msg, packet->len);
+ETH_RING_STORE (port->head, head + 1);      /* publish the frame */
+sim_shmem_atomic_cas (&port->lock, vsw->pid, 0);
+#if defined (ETH_VSW_FUTEX)
+if (ETH_RING_LOAD (port->waiting))
+  syscall (SYS_futex, (void *)&port->head, FUTEX_WAKE, 1, NULL, NULL, 0);
+#endif
+return TRUE;
+}
+
+/* Switch frames, returning how many leading frames were sent.  As on a
+   real switch, a frame which can't be queued at a port is lost rather
+   than failed. */
+
+static int
+_eth_vsw_send (ETH_DEV *dev, ETH_PACK **packets, int count)
+{
+ETH_VSW_HANDLE *vsw = (ETH_VSW_HANDLE *)dev->handle;
+ETH_VSW *sw;
+int i, p;
+
+if (vsw == NULL)
+  return 0;
+sw = vsw->sw;
+for (i = 0; i < count; i++) {
+  const uint8 *msg = packets[i]->msg;
+  int dest = -1;
+
+  if (!(msg[6] & 0x01)) {                   /* learn unicast sources */
+    ETH_VSW_MAC *src = &sw->macs[_eth_mac_hash (&msg[6]) >> (32 - ETH_VSW_MAC_BITS)];
+
+    if ((src->port != vsw->port + 1) || memcmp (src->mac, &msg[6], sizeof (ETH_MAC))) {
+      memcpy (src->mac, &msg[6], sizeof (ETH_MAC));
+      src->port = (uint8)(vsw->port + 1);
+      }
+    }
+  if (!(msg[0] & 0x01)) {
+    ETH_VSW_MAC *dst = &sw->macs[_eth_mac_hash (msg) >> (32 - ETH_VSW_MAC_BITS)];
+    int port = dst->port - 1;
+
+    if ((port >= 0) && (port < ETH_VSW_PORTS) && (port != vsw->port) &&
+        (sw->port[port].in_use) && (0 == memcmp (dst->mac, msg, sizeof (ETH_MAC))))
+      dest = port;
+    }
+  if (dest >= 0) {
+    ++vsw->forwarded;                       /* counted before the receiver can see it */
+    _eth_vsw_queue (vsw, dest, packets[i]);
+    }
+  else {                                    /* broadcast, multicast or unknown */
+    ++vsw->flooded;
+    for (p = 0; p < ETH_VSW_PORTS; p++)
+      if ((p != vsw->port) && (sw->port[p].in_use))
+        _eth_vsw_queue (vsw, p, packets[i]);
+    }
+  }
+return count;
+}
+
+/* Pass the frames queued on our port to _eth_callback, returning the
+   number of frames seen.  When nothing is queued this pauses briefly so
+   the reader thread doesn't spin. */
+
+static int
+_eth_vsw_dispatch (ETH_DEV *dev)
+{
+ETH_VSW_HANDLE *vsw = (ETH_VSW_HANDLE *)dev->handle;
+ETH_VSW_PORT *port;
+uint32 head, tail;
+int frames = 0;
+
+if (vsw == NULL)
+  return 0;
+port = &vsw->sw->port[vsw->port];
+tail = port->tail;
+head = ETH_RING_LOAD (port->head);
+while (tail != head) {
+  ETH_VSW_SLOT *slot = &port->slot[tail & (ETH_VSW_SLOTS - 1)];
+
+  if (slot->len <= sizeof (slot->msg)) {
+    struct pcap_pkthdr header;
+
+    memset (&header, 0, sizeof (header));
+    header.caplen = header.len = slot->len;
+    _eth_callback ((u_char *)dev, &header, slot->msg);
+    }
+  ETH_RING_STORE (port->tail, ++tail);      /* release the slot */
+  ++frames;
+  if (tail == head)
+    head = ETH_RING_LOAD (port->head);
+  }
+if (frames)
+  vsw->last_frame = sim_os_msec ();
+else {
+#if defined (ETH_VSW_FUTEX)
+  /* Setting waiting and the sender's unlock are both full barriers, so
+     either the sender sees waiting or head has moved before the kernel
+     compares it, and no wakeup is lost */
+  struct timespec timeout = {0, 250*1000*1000};
+
+  sim_shmem_atomic_cas (&port->waiting, 0, 1);
+  if (ETH_RING_LOAD (port->head) == head)
+    syscall (SYS_futex, (void *)&port->head, FUTEX_WAIT, head, &timeout, NULL, 0);
+  ETH_RING_STORE (port->waiting, 0);
+#else
+  sim_os_ms_sleep (((sim_os_msec () - vsw->last_frame) < ETH_VSW_POLL_MS) ? 0 : 1);
+#endif
+  }
+return frames;
+}
+#endif /* HAVE_VSW_NETWORK */
+
 #if defined (USE_READER_THREAD)
 static void *
 _eth_reader(void *arg)
@@ -1960,9 +3055,12 @@ switch (dev->eth_api) {
   case ETH_API_VDE:
   case ETH_API_UDP:
   case ETH_API_NAT:
+  case ETH_API_PACKET:
     do_select = 1;
     select_fd = dev->fd_handle;
     break;
+  case ETH_API_VSW:                               /* polls its queue */
+    break;
   }
 
 sim_debug(dev->dbit, dev->dptr, "Reader Thread Starting\n");
@@ -1973,12 +3071,19 @@ sim_debug(dev->dbit, dev->dptr, "Reader Thread Starting\n");
 sim_os_set_thread_priority (PRIORITY_ABOVE_NORMAL);
 
 while (dev->handle) {
+  if (ETH_RING_LOAD (dev->reader_pause)) {      /* receive ring being replaced? */
+    ETH_RING_STORE (dev->reader_paused, 1);
+    while (ETH_RING_LOAD (dev->reader_pause) && dev->handle)
+      sim_os_ms_sleep (1);
+    ETH_RING_STORE (dev->reader_paused, 0);
+    continue;
+    }
 #if defined (_WIN32)
   if (dev->eth_api == ETH_API_PCAP) {
     if (WAIT_OBJECT_0 == WaitForSingleObject (hWait, 250))
       sel_ret = 1;
     }
-  if ((dev->eth_api == ETH_API_UDP) || (dev->eth_api == ETH_API_NAT))
+  if ((dev->eth_api == ETH_API_UDP) || (dev->eth_api == ETH_API_NAT) || (dev->eth_api == ETH_API_VSW))
 #endif /* _WIN32 */
   if (1) {
     if (do_select) {
@@ -2066,6 +3171,16 @@ while (dev->handle) {
         status = 1;
         break;
 #endif /* HAVE_SLIRP_NETWORK */
+#ifdef HAVE_PACKET_NETWORK
+      case ETH_API_PACKET:
+        status = (_eth_packet_dispatch (dev) > 0) ? 1 : 0;
+        break;
+#endif /* HAVE_PACKET_NETWORK */
+#ifdef HAVE_VSW_NETWORK
+      case ETH_API_VSW:
+        status = (_eth_vsw_dispatch (dev) > 0) ? 1 : 0;
+        break;
+#endif /* HAVE_VSW_NETWORK */
       case ETH_API_UDP:
         if (1) {
           struct pcap_pkthdr header;
@@ -2091,9 +3206,7 @@ while (dev->handle) {
     if ((status > 0) && (dev->asynch_io)) {
       int wakeup_needed;
 
-      pthread_mutex_lock (&dev->lock);
-      wakeup_needed = (dev->read_queue.count != 0);
-      pthread_mutex_unlock (&dev->lock);
+      wakeup_needed = (eth_ring_count (&dev->read_ring) != 0);
       if (wakeup_needed) {
         sim_debug(dev->dbit, dev->dptr, "Queueing automatic poll\n");
         sim_activate_abs (dev->dptr->units, dev->asynch_io_latency);
@@ -2126,7 +3239,9 @@ static void *
 _eth_writer(void *arg)
 {
 ETH_DEV* volatile dev = (ETH_DEV*)arg;
-ETH_WRITE_REQUEST *request = NULL;
+ETH_WRITE_REQUEST *batch[ETH_WRITE_BATCH];
+ETH_PACK *packets[ETH_WRITE_BATCH];
+int i, count;
 
 /* Boost Priority for this I/O thread vs the CPU instruction execution
    thread which in general won't be readily yielding the processor when
@@ -2137,12 +3252,24 @@ sim_debug(dev->dbit, dev->dptr, "Writer Thread Starting\n");
 
 pthread_mutex_lock (&dev->writer_lock);
 while (dev->handle) {
-  pthread_cond_wait (&dev->writer_cond, &dev->writer_lock);
-  while (NULL != (request = dev->write_requests)) {
+  if (NULL == dev->write_requests)
+    pthread_cond_wait (&dev->writer_cond, &dev->writer_lock);
+  while (NULL != dev->write_requests) {
     if (dev->handle == NULL)      /* Shutting down? */
       break;
-    /* Pull buffer off request list */
-    dev->write_requests = request->next;
+    /* Pull a batch of buffers off request list (one at a time when throttling) */
+    count = 0;
+    do {
+      batch[count] = dev->write_requests;
+      packets[count] = &batch[count]->packet;
+      dev->write_requests = batch[count]->next;
+      ++count;
+      } while ((count < ETH_WRITE_BATCH) && (NULL != dev->write_requests) &&
+               (dev->throttle_delay == ETH_THROT_DISABLED_DELAY));
+    if (NULL == dev->write_requests)
+      dev->write_requests_tail = NULL;
+    dev->write_queue_count -= count;
+    pthread_cond_broadcast (&dev->writer_space_cond);
     pthread_mutex_unlock (&dev->writer_lock);
 
     if (dev->throttle_delay != ETH_THROT_DISABLED_DELAY) {
@@ -2155,21 +3282,21 @@ while (dev->handle) {
         }
       dev->throttle_packet_time = sim_os_msec();
       }
-    dev->write_status = _eth_write(dev, &request->packet, NULL);
+    if (count == 1)
+      dev->write_status = _eth_write(dev, packets[0], NULL);
+    else {
+      ++dev->write_batches;
+      dev->write_status = _eth_write_batch(dev, packets, count);
+      }
 
     pthread_mutex_lock (&dev->writer_lock);
-    /* Put buffer on free buffer list */
-    request->next = dev->write_buffers;
-    dev->write_buffers = request;
-    request = NULL;
+    /* Put buffers on free buffer list */
+    for (i = 0; i < count; i++) {
+      batch[i]->next = dev->write_buffers;
+      dev->write_buffers = batch[i];
+      }
     }
   }
-/* If we exited these loops with a request allocated, */
-/* avoid buffer leaking by putting it on free buffer list */
-if (request) {
-  request->next = dev->write_buffers;
-  dev->write_buffers = request;
-  }
 pthread_mutex_unlock (&dev->writer_lock);
 
 sim_debug(dev->dbit, dev->dptr, "Writer Thread Exiting\n");
@@ -2192,9 +3319,7 @@ int wakeup_needed;
 
 dev->asynch_io = sim_asynch_enabled;
 dev->asynch_io_latency = latency;
-pthread_mutex_lock (&dev->lock);
-wakeup_needed = (dev->read_queue.count != 0);
-pthread_mutex_unlock (&dev->lock);
+wakeup_needed = (eth_ring_count (&dev->read_ring) != 0);
 if (wakeup_needed) {
   sim_debug(dev->dbit, dev->dptr, "Queueing automatic poll\n");
   sim_activate_abs (dev->dptr->units, dev->asynch_io_latency);
@@ -2244,7 +3369,41 @@ if (bufsz < ETH_MAX_JUMBO_FRAME)
 
 /* attempt to connect device */
 memset(errbuf, 0, PCAP_ERRBUF_SIZE);
-if (0 == strncmp("tap:", savname, 4)) {
+if (0 == strncmp("pkt:", savname, 4)) {
+  const char *devname = savname + 4;
+
+  while (isspace(*devname))
+      ++devname;
+#if defined(HAVE_PACKET_NETWORK)
+  if (!strcmp(savname, "pkt:ifname"))
+    return sim_messagef (SCPE_OPENERR, "Eth: Must specify actual interface name (i.e. pkt:eth0)\n");
+  if (SCPE_OK == _eth_packet_open(devname, handle, fd_handle, errbuf, opaque))
+    *eth_api = ETH_API_PACKET;
+  else
+    if (0 == errbuf[0])
+      strlcpy(errbuf, "Can't open AF_PACKET socket", PCAP_ERRBUF_SIZE);
+#else
+  strlcpy(errbuf, "No support for pkt: network devices", PCAP_ERRBUF_SIZE);
+#endif /* defined(HAVE_PACKET_NETWORK) */
+  }
+else if (0 == strncmp("vsw:", savname, 4)) {
+  const char *devname = savname + 4;
+
+  while (isspace(*devname))
+      ++devname;
+#if defined(HAVE_VSW_NETWORK)
+  if (!strcmp(savname, "vsw:switchname"))
+    return sim_messagef (SCPE_OPENERR, "Eth: Must specify actual switch name (i.e. vsw:cluster)\n");
+  if (SCPE_OK == _eth_vsw_open(devname, handle, errbuf))
+    *eth_api = ETH_API_VSW;
+  else
+    if (0 == errbuf[0])
+      strlcpy(errbuf, "Can't open virtual switch", PCAP_ERRBUF_SIZE);
+#else
+  strlcpy(errbuf, "No support for vsw: network devices", PCAP_ERRBUF_SIZE);
+#endif /* defined(HAVE_VSW_NETWORK) */
+  }
+else if (0 == strncmp("tap:", savname, 4)) {
   int  tun = -1;    /* TUN/TAP Socket */
   int  on = 1;
   const char *devname = savname + 4;
@@ -2593,11 +3752,13 @@ dev->dbit = dbit;
 if (1) {
   pthread_attr_t attr;
 
-  ethq_init (&dev->read_queue, 200);         /* initialize FIFO queue */
+  eth_ring_init (&dev->read_ring, ETH_RING_DEFAULT); /* initialize receive ring */
   pthread_mutex_init (&dev->lock, NULL);
   pthread_mutex_init (&dev->writer_lock, NULL);
   pthread_mutex_init (&dev->self_lock, NULL);
   pthread_cond_init (&dev->writer_cond, NULL);
+  pthread_cond_init (&dev->writer_space_cond, NULL);
+  dev->write_queue_depth = ETH_WRITE_QUEUE_DEFAULT;
   pthread_attr_init(&attr);
   pthread_attr_setscope(&attr, PTHREAD_SCOPE_SYSTEM);
 #if defined(__hpux)
@@ -2650,6 +3811,16 @@ switch (eth_api) {
   case ETH_API_UDP:
     sim_close_sock(pcap_fd);
     break;
+#ifdef HAVE_PACKET_NETWORK
+  case ETH_API_PACKET:
+    _eth_packet_close((ETH_PACKET_RING *)pcap, pcap_fd);
+    break;
+#endif
+#ifdef HAVE_VSW_NETWORK
+  case ETH_API_VSW:
+    _eth_vsw_close((ETH_VSW_HANDLE *)pcap);
+    break;
+#endif
   }
 return SCPE_OK;
 }
@@ -2677,6 +3848,7 @@ pthread_join (dev->writer_thread, NULL);
 pthread_mutex_destroy (&dev->self_lock);
 pthread_mutex_destroy (&dev->writer_lock);
 pthread_cond_destroy (&dev->writer_cond);
+pthread_cond_destroy (&dev->writer_space_cond);
 if (1) {
   ETH_WRITE_REQUEST *buffer;
    while (NULL != (buffer = dev->write_buffers)) {
@@ -2687,8 +3859,10 @@ if (1) {
     dev->write_requests = buffer->next;
     free(buffer);
     }
+  dev->write_requests_tail = NULL;
+  dev->write_queue_count = 0;
   }
-ethq_destroy (&dev->read_queue);         /* release FIFO queue */
+eth_ring_destroy (&dev->read_ring);      /* release receive ring */
 #endif
 
 _eth_close_port (dev->eth_api, pcap, pcap_fd);
@@ -2736,16 +3910,29 @@ fprintf (st, "    eth0   en0                                  (No description av
 #if defined(HAVE_TAP_NETWORK)
 fprintf (st, "    eth1   tap:tapN                             (Integrated Tun/Tap support)\n");
 #endif
+#if defined(HAVE_PACKET_NETWORK)
+fprintf (st, "    eth2   pkt:ifname                           (Integrated AF_PACKET support)\n");
+#endif
 #if defined(HAVE_VDE_NETWORK)
-fprintf (st, "    eth2   vde:device{:switch-port-number}      (Integrated VDE support)\n");
+fprintf (st, "    eth3   vde:device{:switch-port-number}      (Integrated VDE support)\n");
 #endif
 #if defined(HAVE_SLIRP_NETWORK)
-fprintf (st, "    eth3   nat:{optional-nat-parameters}        (Integrated NAT (SLiRP) support)\n");
+fprintf (st, "    eth4   nat:{optional-nat-parameters}        (Integrated NAT (SLiRP) support)\n");
+#endif
+fprintf (st, "    eth5   udp:sourceport:remotehost:remoteport (Integrated UDP bridge support)\n");
+#if defined(HAVE_VSW_NETWORK)
+fprintf (st, "    eth6   vsw:switchname                       (Integrated virtual switch support)\n");
 #endif
-fprintf (st, "    eth4   udp:sourceport:remotehost:remoteport (Integrated UDP bridge support)\n");
 fprintf (st, "   sim> ATTACH %s eth0\n\n", dptr->name);
 fprintf (st, "or equivalently:\n\n");
 fprintf (st, "   sim> ATTACH %s en0\n\n", dptr->name);
+#if defined(HAVE_VSW_NETWORK)
+fprintf (st, "Devices attached to the same vsw: switch name, in this simulator or in\n");
+fprintf (st, "other simulators on this host, share a virtual Ethernet switch without\n");
+fprintf (st, "using the host's network.  The switch is created by the first device\n");
+fprintf (st, "attached to it and has %d ports:\n\n", ETH_VSW_PORTS);
+fprintf (st, "   sim> ATTACH %s vsw:cluster\n\n", dptr->name);
+#endif
 #if defined(HAVE_SLIRP_NETWORK)
 sim_slirp_attach_help (st, dptr, uptr, flag, cptr);
 #endif
@@ -2960,6 +4147,12 @@ switch (dev->eth_api) {
   case ETH_API_NAT:
       netname = "nat";
       break;
+  case ETH_API_PACKET:
+      netname = "pkt";
+      break;
+  case ETH_API_VSW:
+      netname = "vsw";
+      break;
   }
 sprintf(msg, "%s(%s): ", where, netname);
 switch (dev->eth_api) {
@@ -3019,10 +4212,68 @@ pthread_mutex_unlock (&dev->lock);
 #endif
 }
 
+/* Per frame transmit bookkeeping shared by _eth_write and _eth_write_batch.
+   _eth_write_begin returns -1 when the frame has an unacceptable length,
+   otherwise whether it is a loopback self frame.  */
+
+static int
+_eth_write_begin(ETH_DEV* dev, ETH_PACK* packet)
+{
+int loopback_self_frame, loopback_physical_response;
+
+/* make sure packet is acceptable length */
+if ((packet->len < ETH_MIN_PACKET) || (packet->len > ETH_MAX_PACKET))
+  return -1;
+loopback_self_frame = LOOPBACK_SELF_FRAME(packet->msg, packet->msg);
+loopback_physical_response = LOOPBACK_PHYSICAL_RESPONSE(dev, packet->msg);
+
+eth_packet_trace (dev, packet->msg, packet->len, "writing");
+
+/* record sending of loopback packet (done before actual send to avoid race conditions with receiver) */
+if (loopback_self_frame || loopback_physical_response) {
+  /* Direct loopback responses to the host physical address since our physical address
+     may not have been learned yet. */
+  if (loopback_self_frame && dev->have_host_nic_phy_addr) {
+    memcpy(&packet->msg[6],  dev->host_nic_phy_hw_addr, sizeof(ETH_MAC));
+    memcpy(&packet->msg[18], dev->host_nic_phy_hw_addr, sizeof(ETH_MAC));
+    eth_packet_trace (dev, packet->msg, packet->len, "writing-fixed");
+  }
+#ifdef USE_READER_THREAD
+  pthread_mutex_lock (&dev->self_lock);
+#endif
+  dev->loopback_self_sent += dev->reflections;
+  dev->loopback_self_sent_total++;
+#ifdef USE_READER_THREAD
+  pthread_mutex_unlock (&dev->self_lock);
+#endif
+}
+return loopback_self_frame;
+}
+
+static void
+_eth_write_end(ETH_DEV* dev, int loopback_self_frame, int status)
+{
+++dev->packets_sent;              /* basic bookkeeping */
+/* On error, correct loopback bookkeeping */
+if ((status != 0) && loopback_self_frame) {
+#ifdef USE_READER_THREAD
+  pthread_mutex_lock (&dev->self_lock);
+#endif
+  dev->loopback_self_sent -= dev->reflections;
+  dev->loopback_self_sent_total--;
+#ifdef USE_READER_THREAD
+  pthread_mutex_unlock (&dev->self_lock);
+#endif
+  }
+if (status != 0)
+  ++dev->transmit_packet_errors;
+}
+
 static
 t_stat _eth_write(ETH_DEV* dev, ETH_PACK* packet, ETH_PCALLBACK routine)
 {
 int status = 1;   /* default to failure */
+int loopback_self_frame;
 
 /* make sure device exists */
 if ((!dev) || (dev->eth_api == ETH_API_NONE)) return SCPE_UNATT;
@@ -3030,32 +4281,8 @@ if ((!dev) || (dev->eth_api == ETH_API_NONE)) return SCPE_UNATT;
 /* make sure packet exists */
 if (!packet) return SCPE_ARG;
 
-/* make sure packet is acceptable length */
-if ((packet->len >= ETH_MIN_PACKET) && (packet->len <= ETH_MAX_PACKET)) {
-  int loopback_self_frame = LOOPBACK_SELF_FRAME(packet->msg, packet->msg);
-  int loopback_physical_response = LOOPBACK_PHYSICAL_RESPONSE(dev, packet->msg);
-
-  eth_packet_trace (dev, packet->msg, packet->len, "writing");
-
-  /* record sending of loopback packet (done before actual send to avoid race conditions with receiver) */
-  if (loopback_self_frame || loopback_physical_response) {
-    /* Direct loopback responses to the host physical address since our physical address
-       may not have been learned yet. */
-    if (loopback_self_frame && dev->have_host_nic_phy_addr) {
-      memcpy(&packet->msg[6],  dev->host_nic_phy_hw_addr, sizeof(ETH_MAC));
-      memcpy(&packet->msg[18], dev->host_nic_phy_hw_addr, sizeof(ETH_MAC));
-      eth_packet_trace (dev, packet->msg, packet->len, "writing-fixed");
-    }
-#ifdef USE_READER_THREAD
-    pthread_mutex_lock (&dev->self_lock);
-#endif
-    dev->loopback_self_sent += dev->reflections;
-    dev->loopback_self_sent_total++;
-#ifdef USE_READER_THREAD
-    pthread_mutex_unlock (&dev->self_lock);
-#endif
-  }
-
+loopback_self_frame = _eth_write_begin(dev, packet);
+if (loopback_self_frame >= 0) {
     /* dispatch write request (synchronous; no need to save write info to dev) */
   switch (dev->eth_api) {
 #ifdef HAVE_PCAP_NETWORK
@@ -3092,23 +4319,20 @@ if ((packet->len >= ETH_MIN_PACKET) && (packet->len <= ETH_MAX_PACKET)) {
     case ETH_API_UDP:
       status = (((int32)packet->len == sim_write_sock (dev->fd_handle, (char *)packet->msg, (int32)packet->len)) ? 0 : -1);
       break;
-    }
-  ++dev->packets_sent;              /* basic bookkeeping */
-  /* On error, correct loopback bookkeeping */
-  if ((status != 0) && loopback_self_frame) {
-#ifdef USE_READER_THREAD
-    pthread_mutex_lock (&dev->self_lock);
+#ifdef HAVE_PACKET_NETWORK
+    case ETH_API_PACKET:
+      status = (1 == _eth_packet_send (dev, &packet, 1)) ? 0 : -1;
+      break;
 #endif
-    dev->loopback_self_sent -= dev->reflections;
-    dev->loopback_self_sent_total--;
-#ifdef USE_READER_THREAD
-    pthread_mutex_unlock (&dev->self_lock);
+#ifdef HAVE_VSW_NETWORK
+    case ETH_API_VSW:
+      status = (1 == _eth_vsw_send (dev, &packet, 1)) ? 0 : -1;
+      break;
 #endif
     }
-  if (status != 0) {
-    ++dev->transmit_packet_errors;
+  _eth_write_end (dev, loopback_self_frame, status);
+  if (status != 0)
     _eth_error (dev, "_eth_write");
-    }
 
   } /* if packet->len */
 
@@ -3119,11 +4343,108 @@ if (routine)
 return ((status == 0) ? SCPE_OK : SCPE_IOERR);
 }
 
+#if defined (USE_READER_THREAD)
+#if defined (HAVE_SENDMMSG)
+/* Send frames as UDP datagrams with sendmmsg, returning how many leading
+   frames were sent */
+
+static int
+_eth_udp_send(ETH_DEV* dev, ETH_PACK** packets, int count)
+{
+struct mmsghdr msgs[ETH_WRITE_BATCH];
+struct iovec iov[ETH_WRITE_BATCH];
+int i, sent = 0;
+
+memset (msgs, 0, sizeof (msgs));
+for (i = 0; i < count; i++) {
+  iov[i].iov_base = packets[i]->msg;
+  iov[i].iov_len = packets[i]->len;
+  msgs[i].msg_hdr.msg_iov = &iov[i];
+  msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+while (sent < count) {
+  int n = sendmmsg (dev->fd_handle, &msgs[sent], count - sent, 0);
+
+  if (n <= 0)
+    break;
+  sent += n;
+  }
+for (i = 0; i < sent; i++)
+  if (msgs[i].msg_len != iov[i].iov_len)
+    break;
+return i;
+}
+#endif /* HAVE_SENDMMSG */
+
+/* Send a batch of frames taken from the write queue in one writer pass.
+   Where sendmmsg is available a UDP batch goes to the kernel in a single
+   call, and an AF_PACKET batch is staged in the transmit ring and sent
+   with one call.  TAP and VDE take exactly one frame per write, so the
+   other transports send the batch back to back.  */
+
+static t_stat
+_eth_write_batch(ETH_DEV* dev, ETH_PACK** packets, int count)
+{
+t_stat r = SCPE_OK;
+int i, batched = 0;
+
+#if defined (HAVE_SENDMMSG)
+batched |= (dev->eth_api == ETH_API_UDP);
+#endif
+#if defined (HAVE_PACKET_NETWORK)
+batched |= (dev->eth_api == ETH_API_PACKET);
+#endif
+if (batched) {
+  ETH_PACK *ready[ETH_WRITE_BATCH];
+  int loopback[ETH_WRITE_BATCH];
+  int n = 0, sent = 0, errors = 0;
+
+  for (i = 0; i < count; i++) {
+    int loopback_self_frame = _eth_write_begin (dev, packets[i]);
+
+    if (loopback_self_frame < 0) {
+      r = SCPE_IOERR;
+      continue;
+      }
+    ready[n] = packets[i];
+    loopback[n++] = loopback_self_frame;
+    }
+  switch (dev->eth_api) {
+#if defined (HAVE_SENDMMSG)
+    case ETH_API_UDP:
+      sent = _eth_udp_send (dev, ready, n);
+      break;
+#endif
+#if defined (HAVE_PACKET_NETWORK)
+    case ETH_API_PACKET:
+      sent = _eth_packet_send (dev, ready, n);
+      break;
+#endif
+    }
+  for (i = 0; i < n; i++) {
+    int status = (i < sent) ? 0 : -1;
+
+    _eth_write_end (dev, loopback[i], status);
+    if (status != 0)
+      ++errors;
+    }
+  if (errors) {
+    r = SCPE_IOERR;
+    _eth_error (dev, "_eth_write");
+    }
+  return r;
+  }
+for (i = 0; i < count; i++)
+  if (_eth_write (dev, packets[i], NULL) != SCPE_OK)
+    r = SCPE_IOERR;
+return r;
+}
+#endif /* USE_READER_THREAD */
+
 t_stat eth_write(ETH_DEV* dev, ETH_PACK* packet, ETH_PCALLBACK routine)
 {
 #ifdef USE_READER_THREAD
 ETH_WRITE_REQUEST *request;
-int write_queue_size = 1;
 
 /* make sure device exists */
 if ((!dev) || (dev->eth_api == ETH_API_NONE)) return SCPE_UNATT;
@@ -3131,6 +4452,14 @@ if ((!dev) || (dev->eth_api == ETH_API_NONE)) return SCPE_UNATT;
 if (packet->len > sizeof (packet->msg)) /* packet oversized? */
     return SCPE_IERR;                   /* that's no good! */
 
+#if defined (HAVE_VSW_NETWORK)
+/* Switching is a copy into shared memory which drops a frame rather than
+   wait for a port, so it is done here rather than paying for a hand off to
+   the writer thread */
+if (dev->eth_api == ETH_API_VSW)
+  return _eth_write(dev, packet, routine);
+#endif
+
 /* Get a buffer */
 pthread_mutex_lock (&dev->writer_lock);
 if (NULL != (request = dev->write_buffers))
@@ -3150,32 +4479,83 @@ memcpy(request->packet.msg, packet->msg, packet->len);
 /* packets make it to the wire in the order they were presented here) */
 pthread_mutex_lock (&dev->writer_lock);
 request->next = NULL;
-if (dev->write_requests) {
-  ETH_WRITE_REQUEST *last_request = dev->write_requests;
-
-  ++write_queue_size;
-  while (last_request->next) {
-    last_request = last_request->next;
-    ++write_queue_size;
+if (dev->write_queue_count >= dev->write_queue_depth) {  /* queue full? */
+  ++dev->write_queue_waits;
+  while ((dev->write_queue_count >= dev->write_queue_depth) && (dev->handle)) {
+    pthread_cond_signal (&dev->writer_cond);
+    pthread_cond_wait (&dev->writer_space_cond, &dev->writer_lock);
     }
-  last_request->next = request;
   }
+if (dev->write_requests_tail)
+  dev->write_requests_tail->next = request;
 else
-    dev->write_requests = request;
-if (write_queue_size > dev->write_queue_peak)
-  dev->write_queue_peak = write_queue_size;
+  dev->write_requests = request;
+dev->write_requests_tail = request;
+if (++dev->write_queue_count > dev->write_queue_peak)
+  dev->write_queue_peak = dev->write_queue_count;
 pthread_mutex_unlock (&dev->writer_lock);
 
-/* Awaken writer thread to perform actual write */
-pthread_cond_signal (&dev->writer_cond);
+/* Awaken writer thread to perform actual write */
+pthread_cond_signal (&dev->writer_cond);
+
+/* Return with a status from some prior write */
+if (routine)
+  (routine)(dev->write_status);
+return dev->write_status;
+#else
+return _eth_write(dev, packet, routine);
+#endif
+}
+
+/* The software filtered transports (TAP, VDE, UDP and NAT) look up the
+   destination and source of every received frame in the filter address
+   list.  The list is hashed into a small open addressed table when the
+   filter is set so that most lookups, including misses, touch one slot. */
+
+static uint32
+_eth_mac_hash (const u_char* mac)
+{
+uint32 key = ((uint32)mac[2] << 24) | ((uint32)mac[3] << 16) | ((uint32)mac[4] << 8) | mac[5];
+
+return (key ^ ((uint32)mac[0] << 8) ^ mac[1]) * 2654435761u;
+}
+
+static uint32
+_eth_filter_slot (const u_char* mac)
+{
+return _eth_mac_hash (mac) >> 26;               /* top 6 bits index the table */
+}
+
+static void
+_eth_filter_table_build (ETH_DEV* dev)
+{
+int i;
+
+memset (dev->filter_table, 0, sizeof (dev->filter_table));
+for (i = 0; i < dev->addr_count; i++) {
+  uint32 slot = _eth_filter_slot (dev->filter_address[i]);
+
+  while (dev->filter_table[slot] != 0) {
+    if (0 == memcmp (dev->filter_address[dev->filter_table[slot] - 1], dev->filter_address[i], sizeof (ETH_MAC)))
+      break;                                    /* duplicate address */
+    slot = (slot + 1) & (ETH_FILTER_TABLE_SIZE - 1);
+    }
+  if (dev->filter_table[slot] == 0)
+    dev->filter_table[slot] = (uint8)(i + 1);
+  }
+}
+
+static int
+_eth_filter_lookup (const ETH_DEV* dev, const u_char* mac)
+{
+uint32 slot = _eth_filter_slot (mac);
 
-/* Return with a status from some prior write */
-if (routine)
-  (routine)(dev->write_status);
-return dev->write_status;
-#else
-return _eth_write(dev, packet, routine);
-#endif
+while (dev->filter_table[slot] != 0) {
+  if (0 == memcmp (dev->filter_address[dev->filter_table[slot] - 1], mac, sizeof (ETH_MAC)))
+    return 1;
+  slot = (slot + 1) & (ETH_FILTER_TABLE_SIZE - 1);
+  }
+return 0;
 }
 
 static int
@@ -3699,6 +5079,15 @@ if (LOOPBACK_PHYSICAL_RESPONSE(dev, data)) {
   return;
 }
 switch (dev->eth_api) {
+#ifdef HAVE_PACKET_NETWORK
+  case ETH_API_PACKET:                              /* kernel filter applied */
+    bpf_used = 1;
+    to_me = 1;
+    /* AUTODIN II hash mode? */
+    if ((dev->hash_filter) && (data[0] & 0x01) && (!dev->promiscuous) && (!dev->all_multicast))
+      to_me = _eth_hash_lookup(dev->hash, data);
+    break;
+#endif /* HAVE_PACKET_NETWORK */
   case ETH_API_PCAP:
 #ifdef USE_BPF
     bpf_used = 1;
@@ -3712,14 +5101,13 @@ switch (dev->eth_api) {
   case ETH_API_VDE:
   case ETH_API_UDP:
   case ETH_API_NAT:
+  case ETH_API_VSW:
     bpf_used = 0;
     to_me = 0;
     eth_packet_trace (dev, data, header->len, "received");
 
-    for (i = 0; i < dev->addr_count; i++) {
-      if (memcmp(data, dev->filter_address[i], 6) == 0) to_me = 1;
-      if (memcmp(&data[6], dev->filter_address[i], 6) == 0) from_me = 1;
-    }
+    to_me = _eth_filter_lookup(dev, data);
+    from_me = _eth_filter_lookup(dev, &data[6]);
 
     /* all multicast mode? */
     if (dev->all_multicast && (data[0] & 0x01)) to_me = 1;
@@ -3797,10 +5185,8 @@ if (bpf_used ? to_me : (to_me && !from_me)) {
 
     eth_packet_trace (dev, data, len, "rcvqd");
 
-    pthread_mutex_lock (&dev->lock);
-    ethq_insert_data(&dev->read_queue, ETH_ITM_NORMAL, data, 0, len, crc_len, crc_data, 0);
-    ++dev->packets_received;
-    pthread_mutex_unlock (&dev->lock);
+    if (eth_ring_insert_data (&dev->read_ring, ETH_ITM_NORMAL, data, len, crc_len, crc_data))
+      ++dev->packets_received;
     free(moved_data);
     }
 #else /* !USE_READER_THREAD */
@@ -3938,17 +5324,7 @@ if (status < 0) {
 
 #else /* USE_READER_THREAD */
 
-  status = 0;
-  pthread_mutex_lock (&dev->lock);
-  if (dev->read_queue.count > 0) {
-    ETH_ITEM* item = &dev->read_queue.item[dev->read_queue.head];
-    packet->len = item->packet.len;
-    packet->crc_len = item->packet.crc_len;
-    memcpy(packet->msg, item->packet.msg, ((packet->len > packet->crc_len) ? packet->len : packet->crc_len));
-    status = 1;
-    ethq_remove(&dev->read_queue);
-  }
-  pthread_mutex_unlock (&dev->lock);
+  status = eth_ring_remove (&dev->read_ring, packet, 1);
   if ((status) && (routine))
     routine(0);
 #endif
@@ -3956,6 +5332,107 @@ if (status < 0) {
 return status;
 }
 
+/* eth_read_batch
+ *
+ * Read up to max queued packets without callbacks, returning the number read.
+ * With the reader thread the whole batch is taken from the receive ring at
+ * once.
+ */
+int eth_read_batch (ETH_DEV* dev, ETH_PACK* packets, int max)
+{
+int count = 0;
+
+if ((!dev) || (dev->eth_api == ETH_API_NONE) || (!packets))
+  return 0;
+#if defined (USE_READER_THREAD)
+count = eth_ring_remove (&dev->read_ring, packets, max);
+#else
+while ((count < max) && (eth_read (dev, &packets[count], NULL) > 0))
+  ++count;
+#endif
+return count;
+}
+
+/* eth_set_tx_queue
+ *
+ * Set how many frames eth_write may queue for the writer thread before it
+ * waits for room (0 selects the default depth).
+ */
+t_stat eth_set_tx_queue (ETH_DEV* dev, int depth)
+{
+#if !defined (USE_READER_THREAD)
+return SCPE_NOFNC;
+#else
+if (!dev)
+  return SCPE_IERR;
+if (!dev->handle)                   /* not open, set again when attached */
+  return SCPE_OK;
+if (depth <= 0)
+  depth = ETH_WRITE_QUEUE_DEFAULT;
+if (depth > ETH_WRITE_QUEUE_MAX)
+  depth = ETH_WRITE_QUEUE_MAX;
+pthread_mutex_lock (&dev->writer_lock);
+dev->write_queue_depth = depth;
+pthread_cond_broadcast (&dev->writer_space_cond);
+pthread_mutex_unlock (&dev->writer_lock);
+return SCPE_OK;
+#endif
+}
+
+/* eth_set_rx_queue
+ *
+ * Resize the receive ring (0 selects the default depth).  The reader thread
+ * is paused while frames already queued move to the new ring.
+ */
+t_stat eth_set_rx_queue (ETH_DEV* dev, int depth)
+{
+#if !defined (USE_READER_THREAD)
+return SCPE_NOFNC;
+#else
+ETH_RING ring;
+ETH_PACK *packet;
+uint32 waited;
+t_stat r;
+
+if (!dev)
+  return SCPE_IERR;
+if (!dev->handle)                   /* not open, set again when attached */
+  return SCPE_OK;
+if ((r = eth_ring_init (&ring, depth)) != SCPE_OK)
+  return r;
+if (ring.size == dev->read_ring.size) {
+  eth_ring_destroy (&ring);
+  return SCPE_OK;
+  }
+packet = (ETH_PACK *)malloc (sizeof (*packet));
+if (!packet) {
+  eth_ring_destroy (&ring);
+  return SCPE_MEM;
+  }
+ETH_RING_STORE (dev->reader_pause, 1);
+for (waited = 0; !ETH_RING_LOAD (dev->reader_paused); ++waited) {
+  if (waited == 2000) {             /* reader thread not running? */
+    ETH_RING_STORE (dev->reader_pause, 0);
+    eth_ring_destroy (&ring);
+    free (packet);
+    return sim_messagef (SCPE_IERR, "Eth: receive queue can't be resized now\n");
+    }
+  sim_os_ms_sleep (1);
+  }
+while (eth_ring_remove (&dev->read_ring, packet, 1))
+  eth_ring_insert_data (&ring, ETH_ITM_NORMAL, packet->msg, packet->len, packet->crc_len, packet->msg + packet->len);
+ring.high = dev->read_ring.high;
+ring.drops += dev->read_ring.drops;
+ring.overflows += dev->read_ring.overflows;
+eth_ring_destroy (&dev->read_ring);
+dev->read_ring = ring;
+ETH_RING_STORE (dev->reader_pause, 0);
+free (packet);
+sim_debug(dev->dbit, dev->dptr, "Receive queue depth set to %u\n", ring.size);
+return SCPE_OK;
+#endif
+}
+
 t_stat eth_bpf_filter (ETH_DEV* dev, int addr_count, ETH_MAC* const filter_address,
                        ETH_BOOL all_multicast, ETH_BOOL promiscuous,
                        int reflections,
@@ -4101,6 +5578,7 @@ if (match_broadcast) {
   ++addr_count;
   }
 dev->addr_count = addr_count;
+_eth_filter_table_build(dev);
 
 /* store other flags */
 dev->all_multicast = all_multicast;
@@ -4157,6 +5635,21 @@ eth_bpf_filter (dev, dev->addr_count, dev->filter_address,
                 dev->have_host_nic_phy_addr ? &dev->host_nic_phy_hw_addr: NULL,
                 (dev->hash_filter ? &dev->hash : NULL), buf);
 
+#if defined (HAVE_PACKET_NETWORK)
+/* the kernel filter implements the same expression as the BPF string */
+if (dev->eth_api == ETH_API_PACKET) {
+  ETH_PACKET_RING *ring = (ETH_PACKET_RING *)dev->handle;
+
+  ring->filter_len = _eth_packet_set_filter (dev, dev->fd_handle);
+  if (ring->filter_len < 0)
+    sim_printf ("Eth: SO_ATTACH_FILTER error: %s\n", strerror (errno));
+  else {
+    dev->bpf_filter = (char *)realloc(dev->bpf_filter, 1 + strlen(buf));
+    strcpy (dev->bpf_filter, buf);
+    }
+  }
+#endif /* HAVE_PACKET_NETWORK */
+
 /* get netmask, which is a required argument for compiling.  The value,
    in our case isn't actually interesting since the filters we generate
    aren't referencing IP fields, networks or values */
@@ -4214,9 +5707,7 @@ if (dev->eth_api == ETH_API_PCAP) {
     pcap_freecode(&bpf);
     }
 #ifdef USE_READER_THREAD
-  pthread_mutex_lock (&dev->lock);
-  ethq_clear (&dev->read_queue); /* Empty FIFO Queue when filter list changes */
-  pthread_mutex_unlock (&dev->lock);
+  eth_ring_clear (&dev->read_ring); /* Empty receive ring when filter list changes */
 #endif
   }
 #endif /* USE_BPF */
@@ -4265,10 +5756,17 @@ if (dev->asynch_io)
   fprintf(st, "  Interrupt Latency:       %d uSec\n", dev->asynch_io_latency);
 if (dev->throttle_count)
   fprintf(st, "  Throttle Delays:         %d\n", dev->throttle_count);
-fprintf(st, "  Read Queue: Count:       %d\n", dev->read_queue.count);
-fprintf(st, "  Read Queue: High:        %d\n", dev->read_queue.high);
-fprintf(st, "  Read Queue: Loss:        %d\n", dev->read_queue.loss);
+fprintf(st, "  Read Queue: Size:        %u\n", dev->read_ring.size);
+fprintf(st, "  Read Queue: Count:       %u\n", eth_ring_count (&dev->read_ring));
+fprintf(st, "  Read Queue: High:        %u\n", dev->read_ring.high);
+fprintf(st, "  Read Queue: Dropped:     %u\n", dev->read_ring.drops);
+fprintf(st, "  Read Queue: Overflows:   %u\n", dev->read_ring.overflows);
+fprintf(st, "  Write Queue: Depth:      %d\n", dev->write_queue_depth);
 fprintf(st, "  Peak Write Queue Size:   %d\n", dev->write_queue_peak);
+if (dev->write_batches)
+  fprintf(st, "  Write Queue: Batches:    %u\n", dev->write_batches);
+if (dev->write_queue_waits)
+  fprintf(st, "  Write Queue: Waits:      %u\n", dev->write_queue_waits);
 #endif
 if (dev->error_needs_reset)
   fprintf(st, "  In Error Needs Reset:    True\n");
@@ -4296,6 +5794,14 @@ if (dev->bpf_filter)
 if (dev->eth_api == ETH_API_NAT)
   sim_slirp_show ((SLIRP *)dev->handle, st);
 #endif
+#if defined(HAVE_PACKET_NETWORK)
+if (dev->eth_api == ETH_API_PACKET)
+  _eth_packet_show ((ETH_PACKET_RING *)dev->handle, dev->fd_handle, st);
+#endif
+#if defined(HAVE_VSW_NETWORK)
+if (dev->eth_api == ETH_API_VSW)
+  _eth_vsw_show ((ETH_VSW_HANDLE *)dev->handle, st);
+#endif
 }
 
 static
@@ -4412,6 +5918,7 @@ for (eth_num=0; eth_num<eth_device_count; eth_num++) {
 
   if ((0 == memcmp (eth_list[eth_num].name, "nat:", 4)) ||
       (0 == memcmp (eth_list[eth_num].name, "tap:", 4)) ||
+      (0 == memcmp (eth_list[eth_num].name, "pkt:", 4)) ||
       (0 == memcmp (eth_list[eth_num].name, "vde:", 4)) ||
       (0 == memcmp (eth_list[eth_num].name, "udp:", 4)))
       continue;
@@ -4492,6 +5999,744 @@ if (bpf_compile_skip_count)
 return (errors == 0) ? SCPE_OK : SCPE_IERR;
 }
 
+#if defined (USE_READER_THREAD)
+#define ETH_TEST_RING_FRAMES 200000
+
+static void eth_test_ring_frame (uint8 *frame, uint32 seq)
+{
+memset (frame, 0, ETH_MIN_PACKET);
+frame[0] = (uint8)seq;
+frame[1] = (uint8)(seq >> 8);
+frame[2] = (uint8)(seq >> 16);
+frame[3] = (uint8)(seq >> 24);
+}
+
+static uint32 eth_test_ring_seq (const ETH_PACK *packet)
+{
+return packet->msg[0] | (packet->msg[1] << 8) | (packet->msg[2] << 16) | ((uint32)packet->msg[3] << 24);
+}
+
+static void *
+eth_test_ring_producer (void *arg)
+{
+ETH_RING *ring = (ETH_RING *)arg;
+uint8 frame[ETH_MIN_PACKET];
+uint32 seq;
+
+for (seq = 0; seq < ETH_TEST_RING_FRAMES; ++seq) {
+  eth_test_ring_frame (frame, seq);
+  eth_ring_insert_data (ring, ETH_ITM_NORMAL, frame, sizeof (frame), 0, NULL);
+  }
+return NULL;
+}
+
+static
+t_stat eth_test_ring (DEVICE *dptr)
+{
+int errors = 0;
+ETH_RING ring;
+ETH_PACK *packets;
+uint8 frame[ETH_MIN_PACKET];
+uint32 seq, next, received;
+int i, n;
+pthread_t producer;
+
+packets = (ETH_PACK *)calloc (32, sizeof (*packets));
+if ((packets == NULL) || (eth_ring_init (&ring, 100) != SCPE_OK)) {
+  free (packets);
+  return SCPE_MEM;
+  }
+/* Fill past capacity, then drain in batches */
+for (seq = 0; seq < 200; ++seq) {
+  eth_test_ring_frame (frame, seq);
+  eth_ring_insert_data (&ring, ETH_ITM_NORMAL, frame, sizeof (frame), 0, NULL);
+  }
+if ((ring.size != 128) || (eth_ring_count (&ring) != 128) || (ring.drops != 72) || (ring.overflows != 1)) {
+  sim_printf ("Eth: ring size %u holding %u after 200 inserts, %u drops, %u overflows\n", ring.size, eth_ring_count (&ring), ring.drops, ring.overflows);
+  ++errors;
+  }
+n = eth_ring_remove (&ring, packets, 32);
+for (i = 0; i < n; ++i)
+  if (eth_test_ring_seq (&packets[i]) != (uint32)i)
+    ++errors;
+eth_test_ring_frame (frame, 1000);
+eth_ring_insert_data (&ring, ETH_ITM_NORMAL, frame, sizeof (frame), 0, NULL);
+for (seq = 0; seq < 40; ++seq)
+  eth_ring_insert_data (&ring, ETH_ITM_NORMAL, frame, sizeof (frame), 0, NULL);
+if ((n != 32) || (ring.overflows != 2) || (ring.high != 128)) {
+  sim_printf ("Eth: ring batch returned %d, %u overflows, %u high\n", n, ring.overflows, ring.high);
+  ++errors;
+  }
+eth_ring_clear (&ring);
+if (eth_ring_count (&ring) != 0) {
+  sim_printf ("Eth: ring not empty after clear\n");
+  ++errors;
+  }
+/* Concurrent producer: frames arrive in order, and none go missing uncounted */
+ring.drops = 0;
+pthread_create (&producer, NULL, eth_test_ring_producer, &ring);
+next = received = 0;
+while (1) {
+  t_bool done = (ring.drops + received == ETH_TEST_RING_FRAMES);
+
+  n = eth_ring_remove (&ring, packets, 32);
+  for (i = 0; i < n; ++i) {
+    seq = eth_test_ring_seq (&packets[i]);
+    if (seq < next)
+      ++errors;
+    next = seq + 1;
+    }
+  received += n;
+  if (done && (n == 0))
+    break;
+  if (n == 0)
+    sim_os_ms_sleep (0);
+  }
+pthread_join (producer, NULL);
+if ((errors) || (received + ring.drops != ETH_TEST_RING_FRAMES)) {
+  sim_printf ("Eth: ring received %u of %u frames, %u dropped, %d errors\n", received, ETH_TEST_RING_FRAMES, ring.drops, errors);
+  ++errors;
+  }
+eth_ring_destroy (&ring);
+free (packets);
+return (errors == 0) ? SCPE_OK : SCPE_IERR;
+}
+
+#define ETH_TEST_WRITE_FRAMES 2000
+
+/* Send a burst across a pair of UDP transports on the loopback interface
+   with a small transmit queue, so the writer thread drains full batches
+   and eth_write has to wait for room.  */
+
+static
+t_stat eth_test_write_batch (DEVICE *dptr)
+{
+int errors = 0;
+ETH_DEV *tx, *rx;
+ETH_MAC mac = {0xAA, 0x00, 0x04, 0x00, 0x45, 0x12};
+ETH_PACK packet;
+SOCKET peer;
+uint32 seq, sent, next = 0, idle = 0;
+t_bool saved_quiet = sim_quiet;
+t_stat r;
+
+tx = (ETH_DEV *)calloc (1, sizeof (*tx));
+rx = (ETH_DEV *)calloc (1, sizeof (*rx));
+if ((tx == NULL) || (rx == NULL)) {
+  free (tx);
+  free (rx);
+  return SCPE_MEM;
+  }
+sim_quiet = TRUE;
+/* Hold the transmit port while the receiver opens so its reflection probe
+   isn't answered with a port unreachable error */
+peer = sim_connect_sock_ex ("47012", "127.0.0.1:47011", NULL, NULL, SIM_SOCK_OPT_DATAGRAM);
+r = eth_open (rx, "udp:47011:127.0.0.1:47012", dptr, 0);
+if (peer != INVALID_SOCKET)
+  sim_close_sock (peer);
+if ((peer == INVALID_SOCKET) || (r != SCPE_OK) ||
+    (eth_open (tx, "udp:47012:127.0.0.1:47011", dptr, 0) != SCPE_OK)) {
+  if (rx->handle)                 /* ports unavailable, nothing to test */
+    eth_close (rx);
+  sim_quiet = saved_quiet;
+  free (tx);
+  free (rx);
+  return SCPE_OK;
+  }
+eth_filter (rx, 1, &mac, FALSE, FALSE);
+eth_set_tx_queue (tx, 8);
+sent = tx->packets_sent;
+memset (&packet, 0, sizeof (packet));
+memcpy (packet.msg, mac, sizeof (mac));
+for (seq = 0; seq < ETH_TEST_WRITE_FRAMES; ++seq) {
+  eth_test_ring_frame (&packet.msg[14], seq);
+  packet.len = ETH_MIN_PACKET;
+  if (eth_write (tx, &packet, NULL) != SCPE_OK)
+    ++errors;
+  }
+/* Loopback UDP may drop datagrams under load, but never reorders them */
+while ((next < ETH_TEST_WRITE_FRAMES) && (idle < 500)) {
+  ETH_PACK in;
+
+  if (eth_read (rx, &in, NULL)) {
+    memmove (in.msg, &in.msg[14], 4);
+    seq = eth_test_ring_seq (&in);
+    if (seq < next)
+      ++errors;
+    next = seq + 1;
+    idle = 0;
+    }
+  else {
+    ++idle;
+    sim_os_ms_sleep (1);
+    }
+  }
+if ((errors) || (tx->write_queue_peak > 8) || (tx->transmit_packet_errors) ||
+    (tx->packets_sent - sent != ETH_TEST_WRITE_FRAMES) ||
+    ((tx->write_batches == 0) && (tx->write_queue_waits == 0))) {
+  sim_printf ("Eth: sent %u frames, %u errors, peak queue %d, %u batches, %u waits, %d ordering errors\n",
+              tx->packets_sent - sent, tx->transmit_packet_errors, tx->write_queue_peak,
+              tx->write_batches, tx->write_queue_waits, errors);
+  ++errors;
+  }
+/* A frame queued while the receive queue is resized keeps its CRC */
+eth_setcrc (rx, 1);
+eth_test_ring_frame (&packet.msg[14], ETH_TEST_WRITE_FRAMES);
+eth_write (tx, &packet, NULL);
+for (idle = 0; (eth_ring_count (&rx->read_ring) == 0) && (idle < 500); ++idle)
+  sim_os_ms_sleep (1);
+if (idle < 500) {
+  ETH_PACK in;
+  uint8 crc[4];
+
+  eth_set_rx_queue (rx, 2 * rx->read_ring.size);
+  eth_get_packet_crc32_data (packet.msg, packet.len, crc);
+  if ((!eth_read (rx, &in, NULL)) || (in.crc_len != in.len + sizeof (crc)) ||
+      (memcmp (&in.msg[in.len], crc, sizeof (crc)))) {
+    sim_printf ("Eth: frame lost its CRC when the receive queue was resized\n");
+    ++errors;
+    }
+  }
+eth_close (tx);
+eth_close (rx);
+sim_quiet = saved_quiet;
+free (tx);
+free (rx);
+return (errors == 0) ? SCPE_OK : SCPE_IERR;
+}
+#define ETH_TEST_FILTER_FRAMES 1000000
+#define ETH_TEST_FILTER_MIX    4096
+
+/* Feed a mix of frames through the software filter used by the TAP, VDE,
+   UDP and NAT transports with a full filter list (physical address,
+   broadcast and the multicast groups a DECnet/LAT/cluster node listens
+   on), and compare what gets queued with a linear scan of the list.
+   With -D the callback's frame rate is reported.  */
+
+static
+t_stat eth_test_filter (DEVICE *dptr)
+{
+int errors = 0;
+ETH_DEV *dev;
+ETH_MAC addrs[ETH_FILTER_MAX - 1];
+uint8 (*frames)[ETH_MIN_PACKET];
+struct pcap_pkthdr header;
+uint32 seed = 12345, n, accepted, expected = 0;
+uint32 start, msec;
+int j, count = 0;
+
+dev = (ETH_DEV *)calloc (1, sizeof (*dev));
+frames = (uint8 (*)[ETH_MIN_PACKET])calloc (ETH_TEST_FILTER_MIX, ETH_MIN_PACKET);
+if ((dev == NULL) || (frames == NULL) ||
+    (eth_ring_init (&dev->read_ring, 1024) != SCPE_OK)) {
+  free (frames);
+  free (dev);
+  return SCPE_MEM;
+  }
+pthread_mutex_init (&dev->self_lock, NULL);
+dev->dptr = dptr;
+dev->eth_api = ETH_API_UDP;
+memcpy (addrs[count++], "\xAA\x00\x04\x00\x45\x12", sizeof (ETH_MAC));
+memcpy (addrs[count++], "\xAB\x00\x00\x01\x00\x00", sizeof (ETH_MAC));
+memcpy (addrs[count++], "\xAB\x00\x00\x02\x00\x00", sizeof (ETH_MAC));
+memcpy (addrs[count++], "\xAB\x00\x00\x03\x00\x00", sizeof (ETH_MAC));
+memcpy (addrs[count++], "\xAB\x00\x00\x04\x00\x00", sizeof (ETH_MAC));
+memcpy (addrs[count++], "\x09\x00\x2B\x00\x00\x0F", sizeof (ETH_MAC));
+memcpy (addrs[count++], "\x09\x00\x2B\x02\x01\x00", sizeof (ETH_MAC));
+memcpy (addrs[count++], "\x09\x00\x2B\x02\x01\x01", sizeof (ETH_MAC));
+memcpy (addrs[count++], "\xCF\x00\x00\x00\x00\x00", sizeof (ETH_MAC));
+while (count < ETH_FILTER_MAX - 1) {        /* fill with cluster groups */
+  memcpy (addrs[count], "\xAB\x00\x04\x01\x00\x00", sizeof (ETH_MAC));
+  addrs[count][4] = (uint8)count;
+  ++count;
+  }
+eth_filter_hash_ex (dev, count, addrs, FALSE, FALSE, TRUE, NULL);
+if ((dev->addr_count != ETH_FILTER_MAX) ||
+    (memcmp (dev->physical_addr, addrs[0], sizeof (ETH_MAC)) != 0)) {
+  sim_printf ("Eth: filter holds %d addresses\n", dev->addr_count);
+  ++errors;
+  }
+for (n = 0; n < ETH_TEST_FILTER_MIX; ++n) {
+  uint8 *frame = frames[n];
+  t_bool to_me = FALSE, from_me = FALSE;
+
+  seed = seed * 1103515245 + 12345;
+  switch ((seed >> 16) % 8) {
+    case 0:                                 /* one of ours */
+    case 1:
+      memcpy (frame, dev->filter_address[(seed >> 8) % ETH_FILTER_MAX], sizeof (ETH_MAC));
+      break;
+    case 2:                                 /* a near miss */
+      memcpy (frame, dev->filter_address[(seed >> 8) % ETH_FILTER_MAX], sizeof (ETH_MAC));
+      frame[5] ^= 0x40;
+      break;
+    case 3:                                 /* someone else's multicast */
+    case 4:
+      memcpy (frame, "\x09\x00\x2B\x00\x00\x00", sizeof (ETH_MAC));
+      frame[5] = (uint8)(seed >> 24);
+      break;
+    default:                                /* someone else's unicast */
+      memcpy (frame, "\x08\x00\x2B\x00\x00\x00", sizeof (ETH_MAC));
+      frame[4] = (uint8)(seed >> 8);
+      frame[5] = (uint8)(seed >> 24);
+      break;
+    }
+  if ((seed & 0x3F) == 0)                   /* our own frames come back */
+    memcpy (&frame[6], addrs[0], sizeof (ETH_MAC));
+  else {
+    memcpy (&frame[6], "\x08\x00\x2B\x10\x00\x00", sizeof (ETH_MAC));
+    frame[11] = (uint8)(seed >> 4);
+    }
+  frame[12] = 0x60;                         /* LAT */
+  frame[13] = 0x04;
+  for (j = 0; j < dev->addr_count; j++) {
+    if (memcmp (frame, dev->filter_address[j], sizeof (ETH_MAC)) == 0)
+      to_me = TRUE;
+    if (memcmp (&frame[6], dev->filter_address[j], sizeof (ETH_MAC)) == 0)
+      from_me = TRUE;
+    }
+  if (to_me && !from_me)
+    ++expected;
+  }
+expected *= ETH_TEST_FILTER_FRAMES / ETH_TEST_FILTER_MIX;
+header.len = header.caplen = ETH_MIN_PACKET;
+start = sim_os_msec ();
+for (n = 0; n < ETH_TEST_FILTER_FRAMES - (ETH_TEST_FILTER_FRAMES % ETH_TEST_FILTER_MIX); ++n) {
+  _eth_callback ((u_char *)dev, &header, frames[n % ETH_TEST_FILTER_MIX]);
+  if ((n & 0x1FF) == 0x1FF)
+    eth_ring_clear (&dev->read_ring);
+  }
+msec = sim_os_msec () - start;
+accepted = dev->packets_received;
+if ((accepted != expected) || (dev->read_ring.drops != 0)) {
+  sim_printf ("Eth: software filter accepted %u of %u frames, expected %u\n", accepted, n, expected);
+  ++errors;
+  }
+if (sim_switches & SWMASK('D'))
+  sim_printf ("Software filter: %u frames, %u accepted, %u msec, %u frames/sec\n",
+              n, accepted, msec, (uint32)((1000.0 * n) / (msec ? msec : 1)));
+pthread_mutex_destroy (&dev->self_lock);
+eth_ring_destroy (&dev->read_ring);
+free (dev->bpf_filter);
+free (dev);
+free (frames);
+return (errors == 0) ? SCPE_OK : SCPE_IERR;
+}
+#endif /* USE_READER_THREAD */
+
+#if defined (HAVE_PACKET_NETWORK)
+/* What the BPF string from eth_bpf_filter accepts, for checking the
+   kernel filter compiled from the same inputs */
+
+static int
+eth_test_packet_expect (const uint8 *frame, int addr_count, ETH_MAC *addrs,
+                        int all_multicast, int promiscuous, int reflections,
+                        ETH_MAC *physical_addr, ETH_MAC *host, int hash)
+{
+static const ETH_MAC zeros = {0, 0, 0, 0, 0, 0};
+int i, dst = promiscuous, src = 0;
+
+for (i = 0; (i < addr_count) && !promiscuous; i++)
+  if (0 == memcmp (frame, addrs[i], sizeof (ETH_MAC)))
+    dst = 1;
+if (!promiscuous && (all_multicast || hash) && (frame[0] & 0x01))
+  dst = 1;
+for (i = 0; (i < addr_count) && (reflections > 0); i++)
+  if (!(addrs[i][0] & 0x01) && (0 == memcmp (&frame[6], addrs[i], sizeof (ETH_MAC))))
+    src = 1;
+if (dst && !src)
+  return 1;
+if ((!promiscuous) && (addr_count) && (reflections > 0) &&
+    (0 != memcmp (physical_addr, zeros, sizeof (ETH_MAC)))) {
+  if ((0 == memcmp (frame, physical_addr, sizeof (ETH_MAC))) &&
+      (0 == memcmp (&frame[6], physical_addr, sizeof (ETH_MAC))))
+    return 1;
+  if (host && (0 == memcmp (frame, host, sizeof (ETH_MAC))) &&
+      (frame[12] == 0x90) && (frame[13] == 0x00))
+    return 1;
+  }
+return 0;
+}
+
+/* Run each compiled kernel filter against a set of frames.  The filter is
+   attached to one end of a datagram socket pair, which needs no privilege
+   and drops whatever the filter rejects, just as a packet socket would. */
+
+static
+t_stat eth_test_packet_filter (DEVICE *dptr)
+{
+int errors = 0, checked = 0;
+ETH_MAC filter_address[3] = {
+    {0x04, 0x05, 0x06, 0x07, 0x08, 0x09},
+    {0x09, 0x00, 0x2B, 0x02, 0x01, 0x07},
+    {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF},
+  };
+ETH_MAC host_nic_phy_hw_addr = {0x02, 0x03, 0x04, 0x05, 0x06, 0x07};
+ETH_MAC dsts[6] = {
+    {0x04, 0x05, 0x06, 0x07, 0x08, 0x09},
+    {0x09, 0x00, 0x2B, 0x02, 0x01, 0x07},
+    {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF},
+    {0x08, 0x00, 0x2B, 0x11, 0x22, 0x33},
+    {0xAB, 0x00, 0x00, 0x01, 0x00, 0x00},
+    {0x02, 0x03, 0x04, 0x05, 0x06, 0x07},
+  };
+ETH_MAC srcs[3] = {
+    {0x04, 0x05, 0x06, 0x07, 0x08, 0x09},
+    {0x08, 0x00, 0x2B, 0x44, 0x55, 0x66},
+    {0x02, 0x03, 0x04, 0x05, 0x06, 0x07},
+  };
+ETH_MULTIHASH hash = {0x01, 0x40, 0x00, 0x00, 0x48, 0x88, 0x40, 0x00};
+int reflections, all_multicast, promiscuous, addr_count, hashed, host;
+int sv[2];
+
+if (socketpair (AF_UNIX, SOCK_DGRAM, 0, sv))
+  return SCPE_OK;
+for (reflections=0; reflections<=1; reflections++)
+ for (all_multicast=0; all_multicast<=1; all_multicast++)
+  for (promiscuous=0; promiscuous<=1; promiscuous++)
+   for (addr_count=0; addr_count<=3; addr_count++)
+    for (hashed=0; hashed<=1; hashed++)
+     for (host=0; host<=1; host++) {
+      struct sock_filter insn[ETH_PACKET_FILTER_MAX];
+      struct sock_fprog prog;
+      int d, s, t;
+
+      prog.len = (unsigned short)_eth_packet_filter (addr_count, filter_address,
+                                                     all_multicast, promiscuous, reflections,
+                                                     &filter_address[0],
+                                                     host ? &host_nic_phy_hw_addr : NULL,
+                                                     hashed ? &hash : NULL, insn);
+      prog.filter = insn;
+      if (setsockopt (sv[1], SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof (prog))) {
+        sim_printf ("Eth: kernel rejected filter for %d addresses, reflections %d, all_multicast %d, promiscuous %d: %s\n",
+                    addr_count, reflections, all_multicast, promiscuous, strerror (errno));
+        ++errors;
+        continue;
+        }
+      for (d = 0; d < 6; d++)
+       for (s = 0; s < 3; s++)
+        for (t = 0; t < 2; t++) {
+          uint8 frame[ETH_MIN_PACKET], in[ETH_MIN_PACKET];
+          int expected, got;
+
+          memset (frame, 0, sizeof (frame));
+          memcpy (frame, dsts[d], sizeof (ETH_MAC));
+          memcpy (&frame[6], srcs[s], sizeof (ETH_MAC));
+          frame[12] = t ? 0x90 : 0x08;
+          expected = eth_test_packet_expect (frame, addr_count, filter_address,
+                                             all_multicast, promiscuous, reflections,
+                                             &filter_address[0],
+                                             host ? &host_nic_phy_hw_addr : NULL, hashed);
+          if (sizeof (frame) != send (sv[0], frame, sizeof (frame), 0))
+            continue;
+          got = (sizeof (in) == recv (sv[1], in, sizeof (in), MSG_DONTWAIT));
+          ++checked;
+          if (got != expected) {
+            sim_printf ("Eth: kernel filter %s dst %d src %d type %d with %d addresses, reflections %d, all_multicast %d, promiscuous %d, hash %d, host %d\n",
+                        got ? "accepted" : "rejected", d, s, t, addr_count,
+                        reflections, all_multicast, promiscuous, hashed, host);
+            ++errors;
+            }
+          }
+      }
+close (sv[0]);
+close (sv[1]);
+if (sim_switches & SWMASK('D'))
+  sim_printf ("Kernel filter frames checked: %d\n", checked);
+return (errors == 0) ? SCPE_OK : SCPE_IERR;
+}
+
+/* Move frames between two devices attached to the loopback interface.
+   This needs CAP_NET_RAW and is skipped without it. */
+
+static
+t_stat eth_test_packet (DEVICE *dptr)
+{
+int errors = 0;
+ETH_DEV *tx, *rx;
+ETH_MAC tx_mac = {0xAA, 0x00, 0x04, 0x00, 0x46, 0x12};
+ETH_MAC rx_mac = {0xAA, 0x00, 0x04, 0x00, 0x47, 0x12};
+ETH_MAC other_mac = {0xAA, 0x00, 0x04, 0x00, 0x48, 0x12};
+ETH_PACK packet;
+uint32 seq, next = 0, received = 0, foreign = 0, idle = 0;
+t_bool saved_quiet = sim_quiet;
+
+tx = (ETH_DEV *)calloc (1, sizeof (*tx));
+rx = (ETH_DEV *)calloc (1, sizeof (*rx));
+if ((tx == NULL) || (rx == NULL)) {
+  free (tx);
+  free (rx);
+  return SCPE_MEM;
+  }
+sim_quiet = TRUE;
+if ((eth_open (rx, "pkt:lo", dptr, 0) != SCPE_OK) ||
+    (eth_open (tx, "pkt:lo", dptr, 0) != SCPE_OK)) {
+  if (rx->handle)                   /* no privilege, nothing to test */
+    eth_close (rx);
+  sim_quiet = saved_quiet;
+  free (tx);
+  free (rx);
+  return SCPE_OK;
+  }
+eth_filter (rx, 1, &rx_mac, FALSE, FALSE);
+eth_filter (tx, 1, &tx_mac, FALSE, FALSE);
+eth_set_rx_queue (rx, 4 * ETH_TEST_WRITE_FRAMES);
+memset (&packet, 0, sizeof (packet));
+memcpy (&packet.msg[6], tx_mac, sizeof (ETH_MAC));
+packet.msg[12] = 0x60;              /* DEC MOP type, nothing on the host cares */
+packet.msg[13] = 0x02;
+for (seq = 0; seq < ETH_TEST_WRITE_FRAMES; ++seq) {
+  /* every fourth frame is for someone else and must be filtered out */
+  memcpy (packet.msg, (seq & 3) ? rx_mac : other_mac, sizeof (ETH_MAC));
+  eth_test_ring_frame (&packet.msg[14], seq);
+  packet.msg[12] = 0x60;
+  packet.msg[13] = 0x02;
+  packet.len = ETH_MIN_PACKET;
+  if (eth_write (tx, &packet, NULL) != SCPE_OK)
+    ++errors;
+  }
+/* The loopback interface shows a packet socket each frame going out and
+   coming back in, so every frame can arrive twice */
+while ((next < ETH_TEST_WRITE_FRAMES) && (idle < 500)) {
+  ETH_PACK in;
+
+  if (eth_read (rx, &in, NULL)) {
+    if (memcmp (in.msg, rx_mac, sizeof (ETH_MAC)))
+      ++foreign;
+    memmove (in.msg, &in.msg[14], 4);
+    seq = eth_test_ring_seq (&in);
+    if (seq + 1 < next)
+      ++errors;
+    if (seq + 1 != next)
+      ++received;
+    next = seq + 1;
+    idle = 0;
+    }
+  else {
+    ++idle;
+    sim_os_ms_sleep (1);
+    }
+  }
+if ((errors) || (foreign) || (tx->transmit_packet_errors) ||
+    (received != (ETH_TEST_WRITE_FRAMES * 3) / 4)) {
+  sim_printf ("Eth: pkt:lo received %u of %u frames, %u not addressed to it, %u send errors, %d ordering errors\n",
+              received, (ETH_TEST_WRITE_FRAMES * 3) / 4, foreign, tx->transmit_packet_errors, errors);
+  ++errors;
+  }
+eth_close (tx);
+eth_close (rx);
+sim_quiet = saved_quiet;
+free (tx);
+free (rx);
+return (errors == 0) ? SCPE_OK : SCPE_IERR;
+}
+#endif /* HAVE_PACKET_NETWORK */
+
+#if defined (HAVE_VSW_NETWORK)
+static int eth_test_vsw_read (ETH_DEV *dev, ETH_PACK *packet)
+{
+int idle;
+
+for (idle = 0; idle < 500; idle++) {
+  if (eth_read (dev, packet, NULL))
+    return 1;
+  sim_os_ms_sleep (1);
+  }
+return 0;
+}
+
+static uint32 eth_test_vsw_queued (ETH_DEV *dev)
+{
+ETH_VSW_HANDLE *vsw = (ETH_VSW_HANDLE *)dev->handle;
+
+return vsw->sw->port[vsw->port].head;
+}
+
+/* Three devices on a private switch.  A broadcast reaches the other two
+   ports, a unicast to a learned address reaches only its port, a burst
+   arrives in order with anything missing counted as dropped, and a device
+   which detaches and reattaches is back on the same switch.  A port left
+   behind by a simulator which exited is released by the next sender which
+   finds it full or locked.  */
+
+#if !defined (_WIN32)
+#include <sys/wait.h>
+#endif
+
+static
+t_stat eth_test_vsw (DEVICE *dptr)
+{
+int errors = 0;
+ETH_DEV *dev[3];
+ETH_MAC mac[3] = {{0xAA, 0x00, 0x04, 0x00, 0x01, 0x04},
+                  {0xAA, 0x00, 0x04, 0x00, 0x02, 0x04},
+                  {0xAA, 0x00, 0x04, 0x00, 0x03, 0x04}};
+ETH_PACK packet, in;
+ETH_VSW_HANDLE *vsw;
+char name[64];
+uint32 seq, next = 0, idle = 0, queued[3], received = 0;
+t_bool saved_quiet = sim_quiet;
+int i;
+
+snprintf (name, sizeof (name), "vsw:simh-test-%d", (int)_eth_vsw_pid ());
+sim_quiet = TRUE;
+for (i = 0; i < 3; i++) {
+  dev[i] = (ETH_DEV *)calloc (1, sizeof (*dev[i]));
+  if ((dev[i] == NULL) || (eth_open (dev[i], name, dptr, 0) != SCPE_OK)) {
+    sim_printf ("Eth: can't attach device %d to %s\n", i, name);
+    free (dev[i]);
+    while (i-- > 0) {
+      eth_close (dev[i]);
+      free (dev[i]);
+      }
+    sim_quiet = saved_quiet;
+    return SCPE_IERR;
+    }
+  eth_filter_hash_ex (dev[i], 1, &mac[i], FALSE, FALSE, TRUE, NULL);
+  }
+memset (&packet, 0, sizeof (packet));
+packet.len = ETH_MIN_PACKET;
+packet.msg[12] = 0x60;                      /* LAT */
+packet.msg[13] = 0x04;
+/* Broadcast from 0 reaches 1 and 2, and teaches the switch where 0 is */
+memset (packet.msg, 0xFF, sizeof (ETH_MAC));
+memcpy (&packet.msg[6], mac[0], sizeof (ETH_MAC));
+queued[0] = eth_test_vsw_queued (dev[0]);
+eth_write (dev[0], &packet, NULL);
+if (!eth_test_vsw_read (dev[1], &in) || !eth_test_vsw_read (dev[2], &in) ||
+    (eth_test_vsw_queued (dev[0]) != queued[0])) {
+  sim_printf ("Eth: broadcast wasn't flooded to the other ports\n");
+  ++errors;
+  }
+/* Unicast from 1 to 0 is switched to 0's port alone */
+memcpy (packet.msg, mac[0], sizeof (ETH_MAC));
+memcpy (&packet.msg[6], mac[1], sizeof (ETH_MAC));
+queued[2] = eth_test_vsw_queued (dev[2]);
+eth_write (dev[1], &packet, NULL);
+if (!eth_test_vsw_read (dev[0], &in) || (eth_test_vsw_queued (dev[2]) != queued[2]) ||
+    (((ETH_VSW_HANDLE *)dev[1]->handle)->forwarded != 1)) {
+  sim_printf ("Eth: unicast to a learned address wasn't switched\n");
+  ++errors;
+  }
+/* A burst from 0 to 1 arrives in order */
+memcpy (packet.msg, mac[1], sizeof (ETH_MAC));
+memcpy (&packet.msg[6], mac[0], sizeof (ETH_MAC));
+for (seq = 0; seq < ETH_TEST_WRITE_FRAMES; ++seq) {
+  eth_test_ring_frame (&packet.msg[14], seq);
+  packet.msg[12] = 0x60;
+  packet.msg[13] = 0x04;
+  if (eth_write (dev[0], &packet, NULL) != SCPE_OK)
+    ++errors;
+  }
+while ((next < ETH_TEST_WRITE_FRAMES) && (idle < 500)) {
+  if (eth_read (dev[1], &in, NULL)) {
+    memmove (in.msg, &in.msg[14], 4);
+    seq = eth_test_ring_seq (&in);
+    if (seq < next)
+      ++errors;
+    next = seq + 1;
+    ++received;
+    idle = 0;
+    }
+  else {
+    ++idle;
+    sim_os_ms_sleep (1);
+    }
+  }
+vsw = (ETH_VSW_HANDLE *)dev[1]->handle;
+if ((errors) ||
+    (received + vsw->sw->port[vsw->port].drops + dev[1]->read_ring.drops != ETH_TEST_WRITE_FRAMES)) {
+  sim_printf ("Eth: switch delivered %u of %u frames, %u dropped at the port, %u in the read queue, %d errors\n",
+              received, ETH_TEST_WRITE_FRAMES, vsw->sw->port[vsw->port].drops, dev[1]->read_ring.drops, errors);
+  ++errors;
+  }
+if (sim_switches & SWMASK('D')) {
+  uint32 start, trips;
+
+  sim_printf ("Virtual switch: %u of %u burst frames received, %u dropped at the port, %u in the read queue\n",
+              received, ETH_TEST_WRITE_FRAMES, vsw->sw->port[vsw->port].drops, dev[1]->read_ring.drops);
+  /* Time frames bouncing between 0 and 1 */
+  start = sim_os_msec ();
+  for (trips = 0; (trips < 1000) && (sim_os_msec () - start < 5000); ++trips) {
+    memcpy (packet.msg, mac[1], sizeof (ETH_MAC));
+    memcpy (&packet.msg[6], mac[0], sizeof (ETH_MAC));
+    eth_write (dev[0], &packet, NULL);
+    while (!eth_read (dev[1], &in, NULL) && (sim_os_msec () - start < 5000))
+      continue;
+    memcpy (packet.msg, mac[0], sizeof (ETH_MAC));
+    memcpy (&packet.msg[6], mac[1], sizeof (ETH_MAC));
+    eth_write (dev[1], &packet, NULL);
+    while (!eth_read (dev[0], &in, NULL) && (sim_os_msec () - start < 5000))
+      continue;
+    }
+  sim_printf ("Virtual switch: %u round trips, %u usec each\n", trips,
+              (uint32)((1000.0 * (sim_os_msec () - start)) / (trips ? trips : 1)));
+  }
+#if !defined (_WIN32)
+/* A port still claimed by a process which exited while queueing, with its
+   queue full and its lock held, costs one frame and is released; a full
+   queue on a live port only drops frames */
+vsw = (ETH_VSW_HANDLE *)dev[1]->handle;
+if (1) {
+  ETH_VSW_PORT *port = &vsw->sw->port[ETH_VSW_PORTS - 1];
+  pid_t gone = fork ();
+  uint32 drops;
+
+  if (gone == 0)
+    _exit (0);
+  if (gone > 0) {
+    waitpid (gone, NULL, 0);
+    port->pid = port->lock = (int32)gone;
+    port->in_use = 1;
+    ETH_RING_STORE (port->head, ETH_RING_LOAD (port->tail) + ETH_VSW_SLOTS);
+    memset (packet.msg, 0xFF, sizeof (ETH_MAC));
+    memcpy (&packet.msg[6], mac[1], sizeof (ETH_MAC));
+    eth_write (dev[1], &packet, NULL);
+    if ((port->in_use) || (port->lock) || (vsw->lock_drops != 1)) {
+      sim_printf ("Eth: port of an exited simulator wasn't released (in use %d, lock %d, %u lock timeouts)\n",
+                  port->in_use, port->lock, vsw->lock_drops);
+      ++errors;
+      }
+    port->pid = vsw->pid;
+    port->in_use = 1;
+    drops = port->drops;
+    eth_write (dev[1], &packet, NULL);
+    if ((!port->in_use) || (port->drops != drops + 1)) {
+      sim_printf ("Eth: full queue of a live port wasn't handled as a drop\n");
+      ++errors;
+      }
+    port->pid = 0;
+    port->in_use = 0;
+    }
+  }
+#endif
+/* Detach and reattach 0; it must rejoin the same switch */
+eth_close (dev[0]);
+if (eth_open (dev[0], name, dptr, 0) != SCPE_OK) {
+  sim_printf ("Eth: can't reattach to %s\n", name);
+  ++errors;
+  }
+else {
+  eth_filter_hash_ex (dev[0], 1, &mac[0], FALSE, FALSE, TRUE, NULL);
+  memset (packet.msg, 0xFF, sizeof (ETH_MAC));
+  memcpy (&packet.msg[6], mac[0], sizeof (ETH_MAC));
+  eth_write (dev[0], &packet, NULL);
+  if (!eth_test_vsw_read (dev[2], &in)) {
+    sim_printf ("Eth: reattached device isn't on the same switch\n");
+    ++errors;
+    }
+  eth_close (dev[0]);
+  }
+free (dev[0]);
+for (i = 1; i < 3; i++) {
+  eth_close (dev[i]);
+  free (dev[i]);
+  }
+sim_quiet = saved_quiet;
+return (errors == 0) ? SCPE_OK : SCPE_IERR;
+}
+#endif /* HAVE_VSW_NETWORK */
+
 #include <setjmp.h>
 
 t_stat sim_ether_test (DEVICE *dptr, const char *cptr)
@@ -4503,6 +6748,18 @@ sim_printf ("Testing %s device sim_ether APIs\n", dptr->name);
 
 SIM_TEST(eth_test_crc32 (dptr));
 SIM_TEST(eth_test_bpf (dptr));
+#if defined (USE_READER_THREAD)
+SIM_TEST(eth_test_ring (dptr));
+SIM_TEST(eth_test_write_batch (dptr));
+SIM_TEST(eth_test_filter (dptr));
+#endif
+#if defined (HAVE_PACKET_NETWORK)
+SIM_TEST(eth_test_packet_filter (dptr));
+SIM_TEST(eth_test_packet (dptr));
+#endif
+#if defined (HAVE_VSW_NETWORK)
+SIM_TEST(eth_test_vsw (dptr));
+#endif
 return stat;
 }
 #endif /* USE_NETWORK */
@@ -158,6 +158,7 @@ extern "C" {
 #define ETH_PROMISC            1                        /* promiscuous mode = true */
 #define ETH_TIMEOUT           -1                        /* read timeout in milliseconds (immediate) */
 #define ETH_FILTER_MAX        20                        /* maximum address filters */
+#define ETH_FILTER_TABLE_SIZE 64                        /* address filter hash slots (power of 2) */
 #define ETH_DEV_NAME_MAX     256                        /* maximum device name size */
 #define ETH_DEV_DESC_MAX     256                        /* maximum device description size */
 #define ETH_MIN_PACKET        60                        /* minimum ethernet packet size */
@@ -232,6 +233,23 @@ struct eth_queue {
   struct eth_item*    item;
 };
 
+struct eth_ring {                                       /* single producer, single consumer */
+  uint32              size;                             /* slots (power of 2) */
+  volatile uint32     head;                             /* frames inserted (producer only) */
+  volatile uint32     tail;                             /* frames removed (consumer only) */
+  uint32              high;                             /* peak frames queued */
+  uint32              drops;                            /* frames dropped while full */
+  uint32              overflows;                        /* times the ring filled */
+  int                 dropping;                         /* ring is full (producer only) */
+  struct eth_item*    item;
+};
+#define ETH_RING_MIN          16                        /* smallest receive ring */
+#define ETH_RING_DEFAULT    1024                        /* default receive ring */
+#define ETH_RING_MAX       16384                        /* largest receive ring */
+#define ETH_WRITE_QUEUE_DEFAULT 1024                    /* default transmit queue depth */
+#define ETH_WRITE_QUEUE_MAX 16384                       /* largest transmit queue depth */
+#define ETH_WRITE_BATCH       32                        /* most frames sent per writer pass */
+
 typedef unsigned char ETH_MAC[6];
 
 struct eth_list {
@@ -247,6 +265,7 @@ typedef void (*ETH_PCALLBACK)(int status);
 typedef struct eth_list ETH_LIST;
 typedef struct eth_queue ETH_QUE;
 typedef struct eth_item ETH_ITEM;
+typedef struct eth_ring ETH_RING;
 struct eth_write_request {
   struct eth_write_request *next;
   ETH_PACK packet;
@@ -265,11 +284,14 @@ struct eth_device {
 #define ETH_API_VDE  3                                  /* VDE API in use */
 #define ETH_API_UDP  4                                  /* UDP API in use */
 #define ETH_API_NAT  5                                  /* NAT (SLiRP) API in use */
+#define ETH_API_PACKET 6                                /* Linux AF_PACKET API in use */
+#define ETH_API_VSW  7                                  /* virtual switch API in use */
   ETH_PCALLBACK read_callback;                          /* read callback function */
   ETH_PCALLBACK write_callback;                         /* write callback function */
   ETH_PACK*     read_packet;                            /* read packet */
   ETH_MAC       filter_address[ETH_FILTER_MAX];         /* filtering addresses */
   int           addr_count;                             /* count of filtering addresses */
+  uint8         filter_table[ETH_FILTER_TABLE_SIZE];    /* hashed filter_address index + 1 (0 = empty) */
   ETH_BOOL      promiscuous;                            /* promiscuous mode flag */
   ETH_BOOL      all_multicast;                          /* receive all multicast messages */
   ETH_BOOL      hash_filter;                            /* filter using AUTODIN II multicast hash */
@@ -313,15 +335,23 @@ struct eth_device {
 #if defined (USE_READER_THREAD)
   int           asynch_io;                              /* Asynchronous Interrupt scheduling enabled */
   int           asynch_io_latency;                      /* instructions to delay pending interrupt */
-  ETH_QUE       read_queue;
+  ETH_RING      read_ring;                              /* frames from the reader thread */
+  volatile int  reader_pause;                           /* request reader thread to stop queueing */
+  volatile int  reader_paused;                          /* reader thread is stopped */
   pthread_mutex_t     lock;
   pthread_t     reader_thread;                          /* Reader Thread Id */
   pthread_t     writer_thread;                          /* Writer Thread Id */
   pthread_mutex_t     writer_lock;
   pthread_mutex_t     self_lock;
   pthread_cond_t      writer_cond;
+  pthread_cond_t      writer_space_cond;                /* transmit queue has room */
   ETH_WRITE_REQUEST *write_requests;
+  ETH_WRITE_REQUEST *write_requests_tail;
+  int write_queue_count;                                /* requests queued */
+  int write_queue_depth;                                /* most requests queued before eth_write waits */
   int write_queue_peak;
+  uint32 write_queue_waits;                             /* eth_write calls which waited for room */
+  uint32 write_batches;                                 /* writer passes which sent several frames */
   ETH_WRITE_REQUEST *write_buffers;
   t_stat write_status;
 #endif
@@ -339,6 +369,8 @@ t_stat eth_write  (ETH_DEV* dev, ETH_PACK* packet,      /* write synchronous pac
                    ETH_PCALLBACK routine);              /*  callback when done */
 int eth_read      (ETH_DEV* dev, ETH_PACK* packet,      /* read single packet; */
                    ETH_PCALLBACK routine);              /*  callback when done*/
+int eth_read_batch (ETH_DEV* dev, ETH_PACK* packets,    /* read up to max packets */
+                    int max);
 t_stat eth_filter (ETH_DEV* dev, int addr_count,        /* set filter on incoming packets */
                    ETH_MAC* const addresses,
                    ETH_BOOL all_multicast,
@@ -361,6 +393,8 @@ void eth_setcrc   (ETH_DEV* dev, int need_crc);         /* enable/disable CRC mo
 t_stat eth_set_async (ETH_DEV* dev, int latency);       /* set read behavior to be async */
 t_stat eth_clr_async (ETH_DEV* dev);                    /* set read behavior to be not async */
 t_stat eth_set_throttle (ETH_DEV* dev, uint32 time, uint32 burst, uint32 delay); /* set transmit throttle parameters */
+t_stat eth_set_rx_queue (ETH_DEV* dev, int depth);     /* set receive queue depth (0 = default) */
+t_stat eth_set_tx_queue (ETH_DEV* dev, int depth);     /* set transmit queue depth (0 = default) */
 uint32 eth_crc32(uint32 crc, const void* vbuf, size_t len); /* Compute Ethernet Autodin II CRC for buffer */
 
 void eth_packet_trace (ETH_DEV* dev, const uint8 *msg, int len, const char* txt); /* trace ethernet packet header+crc */
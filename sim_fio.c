@@ -799,6 +799,7 @@ return -1;
 
 #if defined (HAVE_SHM_OPEN)
 #include <sys/mman.h>
+#include <sys/file.h>
 #endif
 
 struct SHMEM {
@@ -864,6 +865,7 @@ if ((*shmem)->shm_base == MAP_FAILED) {
     *shmem = NULL;
     return sim_messagef (SCPE_OPENERR, "Shared Memory '%s' mmap() failed. errno=%d - %s\n", name, last_errno, strerror (last_errno));
     }
+flock ((*shmem)->shm_fd, LOCK_SH);      /* Count this user, see sim_shmem_close */
 *addr = (*shmem)->shm_base;
 return SCPE_OK;
 #else
@@ -880,7 +882,10 @@ if (shmem == NULL)
 if (shmem->shm_base != MAP_FAILED)
     munmap (shmem->shm_base, shmem->shm_size);
 if (shmem->shm_fd != -1) {
-    shm_unlink (shmem->shm_name);
+    /* Only the last user removes the name, so a process which attaches
+       later still finds the segment the others are using (as on Windows) */
+    if ((flock (shmem->shm_fd, LOCK_EX | LOCK_NB) == 0) || (errno != EWOULDBLOCK))
+        shm_unlink (shmem->shm_name);
     close (shmem->shm_fd);
     }
 free (shmem->shm_name);
@@ -96,6 +96,9 @@
 #include "sim_defs.h"
 #include "sim_tape.h"
 #include <ctype.h>
+#if defined(HAVE_ZLIB)
+#include <zlib.h>
+#endif
 
 #if defined SIM_ASYNCH_IO
 #include <pthread.h>
@@ -140,10 +143,32 @@ static void sim_tape_data_trace (UNIT *uptr, const uint8 *data, size_t len, cons
 static t_stat tape_erase_fwd (UNIT *uptr, t_mtrlnt gap_size);
 static t_stat tape_erase_rev (UNIT *uptr, t_mtrlnt gap_size);
 
+#define TAPE_RA_SIZE    (256 * 1024)        /* read-ahead buffer size */
+
+struct tape_z;
+
+struct tape_index_entry {
+    t_addr              start;              /* position of the object's metadata */
+    t_addr              end;                /* position following the object */
+    uint32              tmks;               /* tape marks up to and including this object */
+    };
+
 struct tape_context {
     DEVICE              *dptr;              /* Device for unit (access to debug flags) */
     uint32              dbit;               /* debugging bit for trace */
     uint32              auto_format;        /* Format determined dynamically */
+    uint8               *ra_buf;            /* read-ahead buffer */
+    t_addr              ra_base;            /* file offset of the first buffered byte */
+    size_t              ra_count;           /* count of valid bytes in ra_buf */
+    t_addr              ra_pos;             /* current read position */
+    t_addr              ra_next;            /* position following the last read */
+    t_bool              ra_eof;             /* last read reached the end of file */
+    t_bool              ra_err;             /* last read encountered an I/O error */
+    uint32              ra_fills;           /* host reads issued to satisfy reads */
+    struct tape_index_entry *idx;           /* record index */
+    uint32              idx_count;          /* count of indexed objects */
+    uint32              idx_size;           /* allocated index entries */
+    struct tape_z       *z;                 /* compressed image state */
 #if defined SIM_ASYNCH_IO
     t_bool              asynch_io;          /* Asynchronous Interrupt scheduling enabled */
     int                 asynch_io_latency;  /* instructions to delay pending interrupt */
@@ -533,6 +558,9 @@ static void sim_tape_add_dos11_entry (const char *directory,
                                       void *context);
 
 static t_stat sim_export_tape (UNIT *uptr, const char *export_file);
+static t_stat sim_tape_z_open (UNIT *uptr);
+static void sim_tape_z_free (struct tape_context *ctx);
+static t_offset sim_tape_size (UNIT *uptr);
 static FILE *tape_open_and_check_file(const char *filename);
 static int tape_classify_file_contents (FILE *f, size_t *max_record_size, t_bool *lf_line_endings, t_bool *crlf_line_endings);
 
@@ -927,6 +955,14 @@ ctx->dptr = dptr;                                       /* save DEVICE pointer *
 ctx->dbit = dbit;                                       /* save debug bit */
 ctx->auto_format = auto_format;                         /* save that we auto selected format */
 
+r = sim_tape_z_open (uptr);                             /* compressed image? */
+if (r != SCPE_OK) {
+    sim_tape_detach (uptr);
+    if ((sim_switches & SWMASK ('D')) && !had_debug)
+        sim_set_deboff (0, "");
+    return r;
+    }
+
 switch (MT_GET_FMT (uptr)) {                            /* case on format */
 
     case MTUF_F_TPC:                                    /* TPC */
@@ -945,7 +981,7 @@ switch (MT_GET_FMT (uptr)) {                            /* case on format */
         break;
 
     case MTUF_F_TAR:                                    /* TAR */
-        uptr->hwmark = (t_addr)sim_fsize (uptr->fileref);
+        uptr->hwmark = (t_addr)sim_tape_size (uptr);
         break;
 
     default:
@@ -1025,6 +1061,11 @@ uptr->tape_eom = 0;
 uptr->pos = 0;
 MT_CLR_PNU (uptr);
 MT_CLR_INMRK (uptr);                                    /* Not within a TAR tapemark */
+if (ctx) {
+    free (ctx->ra_buf);                                 /* release read-ahead buffer */
+    free (ctx->idx);                                    /*   and record index */
+    sim_tape_z_free (ctx);                              /*   and compressed image state */
+    }
 free (uptr->tape_ctx);
 uptr->tape_ctx = NULL;
 uptr->io_flush = NULL;
@@ -1075,7 +1116,9 @@ fprintf (st, "                while the tape image is scanned.\n");
 fprintf (st, "    -C          Causes FIXED format tape data sets derived from text files to\n");
 fprintf (st, "                be converted from ASCII to EBCDIC.\n");
 fprintf (st, "    -X          Extract a copy of the attached tape and convert it to a SIMH\n");
-fprintf (st, "                format tape image.\n\n");
+fprintf (st, "                format tape image.\n");
+fprintf (st, "    -Z          With -X, write the extracted copy as a compressed (blocked\n");
+fprintf (st, "                gzip) SIMH format tape image.\n\n");
 fprintf (st, "Notes:  ANSI-VMS, ANSI-RT11, ANSI-RSTS, ANSI-RSX11, ANSI-VAR formats allows\n");
 fprintf (st, "        one or several files to be presented to as a read only ANSI Level 3\n");
 fprintf (st, "        labeled tape with file labels that make each individual file\n");
@@ -1093,10 +1136,15 @@ fprintf (st, "        placed in an otherwise unused word in the header which som
 fprintf (st, "        operating systems will be able to process. If the resulting\n");
 fprintf (st, "        filename is NULL, a filename in the range 000000 - 999999 will be\n");
 fprintf (st, "        generated based of the file position on the tape.\n\n");
+fprintf (st, "        A SIMH, E11, TPC, P7B or AWS format tape image may be compressed in\n");
+fprintf (st, "        the blocked gzip (BGZF) form written by bgzip or by ATTACH -XZ.\n");
+fprintf (st, "        Such an image is recognized when attached, is read in place without\n");
+fprintf (st, "        being expanded, and is always attached read only.\n\n");
 fprintf (st, "Examples:\n\n");
 fprintf (st, "  sim> ATTACH %s -F ANSI-VMS Hobbyist-USE-ONLY-VA.TXT\n", dptr->name);
 fprintf (st, "  sim> ATTACH %s -F ANSI-RSX11 *.TXT,*.ini,*.exe\n", dptr->name);
 fprintf (st, "  sim> ATTACH %s -FX ANSI-RSTS RSTS.tap *.TXT,*.SAV\n", dptr->name);
+fprintf (st, "  sim> ATTACH %s -XZ BACKUP.tap.gz BACKUP.tap\n", dptr->name);
 fprintf (st, "  sim> ATTACH %s -F ANSI-RT11 *.TXT,*.TSK\n", dptr->name);
 fprintf (st, "  sim> ATTACH %s -FB FIXED 80 SOMEFILE.TXT\n", dptr->name);
 fprintf (st, "  sim> ATTACH %s -F DOS11 *.LDA,*.TXT\n\n", dptr->name);
@@ -1113,15 +1161,617 @@ if (sim_deb && ((uptr->dctrl | ctx->dptr->dctrl) & reason))
     sim_data_trace(ctx->dptr, uptr, (detail ? data : NULL), "", len, txt, reason);
 }
 
+/* Read-ahead buffering for on-disk tape images.
+
+   Reading an on-disk tape image costs a seek and a small read for each record
+   length word, another read for the record data, and for the SIMH, E11 and AWS
+   formats a seek back and forth to validate the trailing length.  To let
+   sequential positioning and reading run at host file bandwidth, reads are
+   satisfied from a per-unit read-ahead buffer that is refilled with one large
+   host read whenever the requested data is not already present.  Refills made
+   while moving backward end at the start of the previous buffer contents, so
+   reverse spacing and reading are buffered as well.  Transfers at least as
+   large as the buffer bypass it.
+
+   The record parsing routines use sim_tape_seek to establish the read
+   position and sim_tape_fread, sim_tape_feof, sim_tape_ferror and
+   sim_tape_ftell in place of the corresponding stdio routines.  Routines that
+   write the image position it with sim_tape_wrseek, which discards the
+   buffered data and seeks the host file.  Units without a tape context read
+   the host file directly.
+*/
+
 static int sim_tape_seek (UNIT *uptr, t_addr pos)
 {
-if (MT_GET_FMT (uptr) < MTUF_F_ANSI)
+struct tape_context *ctx = (struct tape_context *)uptr->tape_ctx;
+
+if (MT_GET_FMT (uptr) >= MTUF_F_ANSI)
+    return 0;
+if (ctx == NULL)
     return sim_fseek (uptr->fileref, pos, SEEK_SET);
+ctx->ra_pos = pos;                                      /* reads resume here */
+ctx->ra_eof = FALSE;                                    /* like fseek, clear end-of-file */
+return 0;
+}
+
+static int sim_tape_wrseek (UNIT *uptr, t_addr pos)
+{
+struct tape_context *ctx = (struct tape_context *)uptr->tape_ctx;
+
+if (MT_GET_FMT (uptr) >= MTUF_F_ANSI)
+    return 0;
+if (ctx != NULL) {
+    ctx->ra_count = 0;                                  /* image is about to change */
+    ctx->ra_pos = pos;
+    ctx->ra_eof = FALSE;
+    while ((ctx->idx_count > 0) &&                      /* drop index entries past the write */
+           (ctx->idx[ctx->idx_count - 1].end > pos))
+        --ctx->idx_count;
+    }
+return sim_fseek (uptr->fileref, pos, SEEK_SET);
+}
+
+static size_t sim_tape_z_read (UNIT *uptr, t_addr pos, uint8 *buf, size_t len);
+
+static size_t sim_tape_fread_host (UNIT *uptr, t_addr pos, uint8 *buf, size_t len)
+{
+struct tape_context *ctx = (struct tape_context *)uptr->tape_ctx;
+size_t xfer;
+
+++ctx->ra_fills;
+if (ctx->z != NULL)                                     /* compressed image? */
+    return sim_tape_z_read (uptr, pos, buf, len);
+if (sim_fseek (uptr->fileref, pos, SEEK_SET)) {
+    ctx->ra_err = TRUE;
+    return 0;
+    }
+xfer = fread (buf, 1, len, uptr->fileref);
+if (ferror (uptr->fileref))
+    ctx->ra_err = TRUE;
+return xfer;
+}
+
+static size_t sim_tape_fread (void *bptr, size_t size, size_t count, UNIT *uptr)
+{
+struct tape_context *ctx = (struct tape_context *)uptr->tape_ctx;
+uint8 *dptr = (uint8 *)bptr;
+size_t want = size * count;
+size_t got = 0;
+size_t xfer;
+t_addr start, end;
+
+if (ctx == NULL)
+    return sim_fread (bptr, size, count, uptr->fileref);
+if (want == 0)
+    return 0;
+if (ctx->ra_buf == NULL)                                /* allocate on first use */
+    ctx->ra_buf = (uint8 *)malloc (TAPE_RA_SIZE);
+while (got < want) {
+    if ((ctx->ra_pos >= ctx->ra_base) &&                /* buffered data at this position? */
+        (ctx->ra_pos < ctx->ra_base + ctx->ra_count)) {
+        xfer = (size_t)(ctx->ra_base + ctx->ra_count - ctx->ra_pos);
+        if (xfer > want - got)
+            xfer = want - got;
+        memcpy (dptr + got, ctx->ra_buf + (size_t)(ctx->ra_pos - ctx->ra_base), xfer);
+        got += xfer;
+        ctx->ra_pos += xfer;
+        continue;
+        }
+    if ((ctx->ra_buf == NULL) ||                        /* no buffer or large transfer? */
+        (want - got >= TAPE_RA_SIZE)) {
+        xfer = sim_tape_fread_host (uptr, ctx->ra_pos, dptr + got, want - got);
+        got += xfer;
+        ctx->ra_pos += xfer;
+        break;
+        }
+    start = ctx->ra_pos;
+    if ((ctx->ra_count > 0) &&                          /* moving backward over the image? */
+        (start < ctx->ra_base) &&
+        (ctx->ra_base - start < TAPE_RA_SIZE)) {
+        end = ctx->ra_base;                             /* end the refill where the buffer began */
+        if (end < start + (want - got))
+            end = start + (want - got);
+        start = (end > TAPE_RA_SIZE) ? end - TAPE_RA_SIZE : 0;
+        }
+    else if ((start > ctx->ra_next) &&                  /* looking ahead of the last read? */
+             (start - ctx->ra_next + (want - got) <= TAPE_RA_SIZE))
+        start = ctx->ra_next;                           /* keep the record being validated */
+    ctx->ra_base = start;
+    ctx->ra_count = sim_tape_fread_host (uptr, start, ctx->ra_buf, TAPE_RA_SIZE);
+    if ((ctx->ra_err) ||                                /* error or nothing at this position? */
+        (ctx->ra_pos >= ctx->ra_base + ctx->ra_count))
+        break;
+    }
+if ((got < want) && !ctx->ra_err)                       /* a short read means end-of-file */
+    ctx->ra_eof = TRUE;
+ctx->ra_next = ctx->ra_pos;
+if (!sim_end && (size > sizeof (char)) && (got >= size))/* match sim_fread's byte ordering */
+    sim_buf_swap_data (bptr, size, got / size);
+return got / size;
+}
+
+static int sim_tape_feof (UNIT *uptr)
+{
+struct tape_context *ctx = (struct tape_context *)uptr->tape_ctx;
+
+if (ctx == NULL)
+    return feof (uptr->fileref);
+return ctx->ra_eof;
+}
+
+static int sim_tape_ferror (UNIT *uptr)
+{
+struct tape_context *ctx = (struct tape_context *)uptr->tape_ctx;
+
+if (ctx == NULL)
+    return ferror (uptr->fileref);
+return ctx->ra_err;
+}
+
+static t_addr sim_tape_ftell (UNIT *uptr)
+{
+struct tape_context *ctx = (struct tape_context *)uptr->tape_ctx;
+
+if (ctx == NULL)
+    return (t_addr)sim_ftell (uptr->fileref);
+return ctx->ra_pos;
+}
+
+/* Record index for on-disk tape images.
+
+   Spacing over records and files examines one object at a time, so long
+   tapes take time proportional to the number of objects skipped.  Each unit
+   therefore keeps an index of the data records and tape marks it has read
+   forward from the beginning of the tape.  The index is built as a side
+   effect of forward reads and is normally complete once the attach time
+   validation pass has scanned the image.
+
+   An entry holds the position of the object's metadata (after any erase gap
+   that precedes it), the position following the object, and the running
+   count of tape marks.  With these, sim_tape_sprecsf and sim_tape_sprecsr
+   move across any number of indexed records, stopping at the next tape mark,
+   with binary searches instead of I/O.  File spacing and sim_tape_position
+   are built on those routines.  The index always covers a prefix of the
+   tape; writing the image drops the entries that extend past the write
+   position (see sim_tape_wrseek).  TAR and the in-memory formats are not
+   indexed.
+*/
+
+static void sim_tape_index_add (UNIT *uptr, t_addr from, t_addr start, t_bool tmk)
+{
+struct tape_context *ctx = (struct tape_context *)uptr->tape_ctx;
+struct tape_index_entry *e;
+
+if ((ctx == NULL) || (MT_GET_FMT (uptr) >= MTUF_F_TAR))
+    return;
+if (from != ((ctx->idx_count > 0) ? ctx->idx[ctx->idx_count - 1].end : 0))
+    return;                                             /* not extending the index */
+if (ctx->idx_count == ctx->idx_size) {
+    uint32 size = (ctx->idx_size > 0) ? 2 * ctx->idx_size : 1024;
+
+    e = (struct tape_index_entry *)realloc (ctx->idx, size * sizeof (*e));
+    if (e == NULL)
+        return;
+    ctx->idx = e;
+    ctx->idx_size = size;
+    }
+e = &ctx->idx[ctx->idx_count];
+e->start = start;
+e->end = uptr->pos;
+e->tmks = ((ctx->idx_count > 0) ? ctx->idx[ctx->idx_count - 1].tmks : 0) + (tmk ? 1 : 0);
+++ctx->idx_count;
+}
+
+/* Find the index entry k for an object boundary at pos.  Objects 0..k-1 precede
+   pos and object k (if k < idx_count) follows it. */
+
+static t_bool sim_tape_index_find (UNIT *uptr, t_addr pos, uint32 *k)
+{
+struct tape_context *ctx = (struct tape_context *)uptr->tape_ctx;
+uint32 lo = 0, hi = ctx->idx_count, mid;
+
+if ((ctx->idx_count == 0) || (MT_GET_FMT (uptr) >= MTUF_F_TAR))
+    return FALSE;
+while (lo < hi) {                                       /* find the first object ending after pos */
+    mid = lo + (hi - lo) / 2;
+    if (ctx->idx[mid].end > pos)
+        hi = mid;
+    else
+        lo = mid + 1;
+    }
+*k = lo;
+if ((lo < ctx->idx_count) && (ctx->idx[lo].start == pos))
+    return TRUE;
+return (pos == ((lo > 0) ? ctx->idx[lo - 1].end : 0));
+}
+
+/* Find the first object whose running tape mark count reaches tmks */
+
+static uint32 sim_tape_index_tmk (UNIT *uptr, uint32 tmks)
+{
+struct tape_context *ctx = (struct tape_context *)uptr->tape_ctx;
+uint32 lo = 0, hi = ctx->idx_count, mid;
+
+while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if (ctx->idx[mid].tmks >= tmks)
+        hi = mid;
+    else
+        lo = mid + 1;
+    }
+return lo;
+}
+
+/* Space records forward using the index.  Returns TRUE with the final status
+   in *st when the operation completed, or FALSE when the caller must continue
+   spacing from the end of the index. */
+
+static t_bool sim_tape_index_spacef (UNIT *uptr, uint32 count, uint32 *skipped, t_stat *st)
+{
+struct tape_context *ctx = (struct tape_context *)uptr->tape_ctx;
+uint32 k, limit, n, tmks;
+
+if (!sim_tape_index_find (uptr, uptr->pos, &k) || (k == ctx->idx_count))
+    return FALSE;
+tmks = (k > 0) ? ctx->idx[k - 1].tmks : 0;
+limit = sim_tape_index_tmk (uptr, tmks + 1);            /* next tape mark, or the index end */
+n = count - *skipped;
+if (n > limit - k)
+    n = limit - k;
+MT_CLR_PNU (uptr);
+if (n > 0) {
+    uptr->pos = ctx->idx[k + n - 1].end;
+    *skipped += n;
+    }
+sim_debug_unit (MTSE_DBG_POS, uptr, "index_spacef: skipped %u records, pos: %" T_ADDR_FMT "u\n", n, uptr->pos);
+*st = MTSE_OK;
+if (*skipped == count)
+    return TRUE;
+if (k + n == ctx->idx_count)                            /* index exhausted? */
+    return FALSE;
+uptr->pos = ctx->idx[k + n].end;                        /* space over the tape mark */
+*st = MTSE_TMK;
+return TRUE;
+}
+
+/* Space records reverse using the index, as above */
+
+static t_bool sim_tape_index_spacer (UNIT *uptr, uint32 count, uint32 *skipped, t_stat *st)
+{
+struct tape_context *ctx = (struct tape_context *)uptr->tape_ctx;
+uint32 k, lower, n, tmks;
+
+if (MT_TST_PNU (uptr) || !sim_tape_index_find (uptr, uptr->pos, &k) || (k == 0))
+    return FALSE;
+tmks = ctx->idx[k - 1].tmks;
+lower = (tmks > 0) ? sim_tape_index_tmk (uptr, tmks) + 1 : 0;  /* first record after the last tape mark */
+n = count - *skipped;
+if (n > k - lower)
+    n = k - lower;
+if (n > 0) {
+    uptr->pos = ctx->idx[k - n].start;
+    *skipped += n;
+    }
+sim_debug_unit (MTSE_DBG_POS, uptr, "index_spacer: skipped %u records, pos: %" T_ADDR_FMT "u\n", n, uptr->pos);
+*st = MTSE_OK;
+if (*skipped == count)
+    return TRUE;
+if (tmks == 0)                                          /* at the first object? */
+    return FALSE;
+uptr->pos = ctx->idx[k - n - 1].start;                  /* space over the tape mark */
+*st = MTSE_TMK;
+return TRUE;
+}
+
+/* Compressed tape images.
+
+   An on-disk tape image in any of the file based formats may be kept
+   compressed as a blocked gzip (BGZF) file.  Such a file is a series of
+   independently deflated gzip members of at most 64KB each, and each
+   member's gzip extra field ('BC' subfield) records the member's size.  The
+   file remains an ordinary gzip file, so gunzip expands it.  bgzip produces
+   one from an expanded image, as does ATTACH -XZ.
+
+   At attach the member headers and trailers are walked, without inflating
+   anything, to build a table of each member's file offset and the offset of
+   its data in the expanded image.  A read at any image position locates its
+   member with a binary search and inflates only that member, keeping the
+   most recent one.  Spacing and reading therefore position as efficiently as
+   they do on an expanded image, and the read-ahead buffer and record index
+   work unchanged above this layer.  Compressed images are attached read
+   only.
+*/
+
+#define TAPE_Z_BLOCK    0xFF00              /* data bytes per written member (as bgzip) */
+#define TAPE_Z_MAXMEM   65536               /* largest member */
+#define TAPE_Z_HDR      18                  /* size of a written member header */
+
+struct tape_z_block {
+    t_addr              coffset;            /* file offset of the member */
+    t_addr              uoffset;            /* image offset of its data */
+    uint32              csize;              /* member size */
+    uint32              usize;              /* data size */
+    };
+
+struct tape_z {
+    struct tape_z_block *blocks;            /* member table */
+    uint32              count;              /* members holding data */
+    t_addr              size;               /* expanded image size */
+    uint8               *cbuf;              /* member being inflated */
+    uint8               *ubuf;              /* most recently inflated data */
+    uint32              cached;             /* member in ubuf (count when none) */
+    uint32              inflates;           /* members inflated */
+    };
+
+struct tape_z_writer {
+    FILE                *f;                 /* output file */
+    size_t              used;               /* data bytes pending */
+    uint8               data[TAPE_Z_BLOCK]; /* pending data */
+    uint8               member[TAPE_Z_MAXMEM];  /* member being written */
+    };
+
+static const uint8 tape_z_magic[4] = {0x1F, 0x8B, 0x08, 0x04};  /* gzip, deflate, FEXTRA only */
+
+#define TAPE_Z_GET16(p) ((uint32)(p)[0] | ((uint32)(p)[1] << 8))
+#define TAPE_Z_GET32(p) (TAPE_Z_GET16(p) | (TAPE_Z_GET16((p) + 2) << 16))
+
+static void tape_z_put32 (uint8 *p, uint32 v)
+{
+p[0] = (uint8)v;
+p[1] = (uint8)(v >> 8);
+p[2] = (uint8)(v >> 16);
+p[3] = (uint8)(v >> 24);
+}
+
+/* Parse a member header: return the member size, or 0 if it is not a BGZF member */
+
+static uint32 sim_tape_z_member (const uint8 *hdr, size_t len, uint32 *hlen)
+{
+uint32 xlen, i, slen;
+
+if ((len < 12) || (memcmp (hdr, tape_z_magic, sizeof (tape_z_magic)) != 0))
+    return 0;
+xlen = TAPE_Z_GET16 (hdr + 10);
+if (12 + xlen > len)
+    return 0;
+for (i = 12; i + 4 <= 12 + xlen; i += 4 + slen) {      /* find the BC subfield */
+    slen = TAPE_Z_GET16 (hdr + i + 2);
+    if ((hdr[i] == 'B') && (hdr[i + 1] == 'C') && (slen == 2) && (i + 6 <= 12 + xlen)) {
+        *hlen = 12 + xlen;
+        return TAPE_Z_GET16 (hdr + i + 4) + 1;
+        }
+    }
 return 0;
 }
 
+static void sim_tape_z_free (struct tape_context *ctx)
+{
+if (ctx->z == NULL)
+    return;
+free (ctx->z->blocks);
+free (ctx->z->cbuf);
+free (ctx->z->ubuf);
+free (ctx->z);
+ctx->z = NULL;
+}
+
+/* Recognize a compressed image and build its member table */
+
+static t_stat sim_tape_z_open (UNIT *uptr)
+{
+struct tape_context *ctx = (struct tape_context *)uptr->tape_ctx;
+uint8 hdr[12 + 64];
+size_t got;
+
+if (MT_GET_FMT (uptr) >= MTUF_F_ANSI)
+    return SCPE_OK;
+if ((sim_fseek (uptr->fileref, 0, SEEK_SET) != 0) ||
+    (fread (hdr, 1, 2, uptr->fileref) != 2) ||
+    (hdr[0] != tape_z_magic[0]) || (hdr[1] != tape_z_magic[1]))
+    return SCPE_OK;                                     /* not compressed */
+#if !defined(HAVE_ZLIB)
+return sim_messagef (SCPE_NOFNC, "%s: Compressed tape images require zlib support\n", sim_uname (uptr));
+#else
+if (1) {
+    struct tape_z *z;
+    t_offset fsize = sim_fsize_ex (uptr->fileref);
+    t_addr coffset = 0;
+    uint32 csize, usize, hlen = 0, alloc = 0;
+    t_stat r = SCPE_OK;
+
+    z = ctx->z = (struct tape_z *)calloc (1, sizeof (*z));
+    if (z != NULL) {
+        z->cbuf = (uint8 *)malloc (TAPE_Z_MAXMEM);
+        z->ubuf = (uint8 *)malloc (TAPE_Z_MAXMEM);
+        }
+    if ((z == NULL) || (z->cbuf == NULL) || (z->ubuf == NULL)) {
+        sim_tape_z_free (ctx);
+        return SCPE_MEM;
+        }
+    while ((r == SCPE_OK) && ((t_offset)coffset < fsize)) {
+        csize = 0;
+        if (sim_fseek (uptr->fileref, coffset, SEEK_SET) == 0) {
+            got = fread (hdr, 1, sizeof (hdr), uptr->fileref);
+            csize = sim_tape_z_member (hdr, got, &hlen);
+            }
+        if ((csize < hlen + 8) || ((t_offset)(coffset + csize) > fsize) ||
+            (sim_fseek (uptr->fileref, coffset + csize - 4, SEEK_SET) != 0) ||
+            (fread (hdr, 1, 4, uptr->fileref) != 4) ||
+            ((usize = TAPE_Z_GET32 (hdr)) > TAPE_Z_MAXMEM)) {
+            r = sim_messagef (SCPE_FMT, "%s: '%s' is gzip compressed but is not a blocked (BGZF) image that can be read in place\n"
+                                        "Expand it, or recompress it with bgzip or ATTACH -XZ\n", sim_uname (uptr), uptr->filename);
+            break;
+            }
+        if (usize > 0) {                                /* skip empty (EOF marker) members */
+            if (z->count == alloc) {
+                struct tape_z_block *blocks;
+
+                alloc = (alloc > 0) ? 2 * alloc : 1024;
+                blocks = (struct tape_z_block *)realloc (z->blocks, alloc * sizeof (*blocks));
+                if (blocks == NULL) {
+                    r = SCPE_MEM;
+                    break;
+                    }
+                z->blocks = blocks;
+                }
+            z->blocks[z->count].coffset = coffset;
+            z->blocks[z->count].uoffset = z->size;
+            z->blocks[z->count].csize = csize;
+            z->blocks[z->count].usize = usize;
+            ++z->count;
+            z->size += usize;
+            }
+        coffset += csize;
+        }
+    if (r != SCPE_OK) {
+        sim_tape_z_free (ctx);
+        return r;
+        }
+    z->cached = z->count;
+    uptr->flags |= UNIT_RO;                             /* compressed images are read only */
+    return SCPE_OK;
+    }
+#endif
+}
+
+#if defined(HAVE_ZLIB)
+static t_bool sim_tape_z_inflate (UNIT *uptr, uint32 n)
+{
+struct tape_context *ctx = (struct tape_context *)uptr->tape_ctx;
+struct tape_z *z = ctx->z;
+struct tape_z_block *b = &z->blocks[n];
+z_stream strm;
+uint32 hlen;
+int zr;
+
+z->cached = z->count;
+if ((sim_fseek (uptr->fileref, b->coffset, SEEK_SET) != 0) ||
+    (fread (z->cbuf, 1, b->csize, uptr->fileref) != b->csize) ||
+    (sim_tape_z_member (z->cbuf, b->csize, &hlen) != b->csize))
+    return FALSE;
+memset (&strm, 0, sizeof (strm));
+if (inflateInit2 (&strm, -MAX_WBITS) != Z_OK)
+    return FALSE;
+strm.next_in = z->cbuf + hlen;
+strm.avail_in = b->csize - hlen - 8;
+strm.next_out = z->ubuf;
+strm.avail_out = b->usize;
+zr = inflate (&strm, Z_FINISH);
+inflateEnd (&strm);
+if ((zr != Z_STREAM_END) || (strm.total_out != b->usize) ||
+    (crc32 (crc32 (0L, Z_NULL, 0), z->ubuf, b->usize) != TAPE_Z_GET32 (z->cbuf + b->csize - 8))) {
+    sim_debug_unit (MTSE_DBG_STR, uptr, "z_inflate: corrupt member %u at %" T_ADDR_FMT "u\n", n, b->coffset);
+    return FALSE;
+    }
+++z->inflates;
+z->cached = n;
+return TRUE;
+}
+#endif
+
+static size_t sim_tape_z_read (UNIT *uptr, t_addr pos, uint8 *buf, size_t len)
+{
+size_t got = 0;
+#if defined(HAVE_ZLIB)
+struct tape_context *ctx = (struct tape_context *)uptr->tape_ctx;
+struct tape_z *z = ctx->z;
+struct tape_z_block *b;
+uint32 lo, hi, mid;
+size_t xfer;
+
+while ((got < len) && (pos < z->size)) {
+    lo = 0;                                             /* find the member holding pos */
+    hi = z->count;
+    while (hi - lo > 1) {
+        mid = lo + (hi - lo) / 2;
+        if (z->blocks[mid].uoffset <= pos)
+            lo = mid;
+        else
+            hi = mid;
+        }
+    if ((lo != z->cached) && !sim_tape_z_inflate (uptr, lo)) {
+        ctx->ra_err = TRUE;
+        break;
+        }
+    b = &z->blocks[lo];
+    xfer = (size_t)(b->uoffset + b->usize - pos);
+    if (xfer > len - got)
+        xfer = len - got;
+    memcpy (buf + got, z->ubuf + (size_t)(pos - b->uoffset), xfer);
+    got += xfer;
+    pos += xfer;
+    }
+#endif
+return got;
+}
+
+/* Write the pending data as one member (an empty member marks the end of file) */
+
+static t_bool sim_tape_z_flush (struct tape_z_writer *w)
+{
+#if defined(HAVE_ZLIB)
+z_stream strm;
+uint32 csize;
+int level, zr;
+
+for (level = Z_DEFAULT_COMPRESSION; ; level = Z_NO_COMPRESSION) {
+    memset (&strm, 0, sizeof (strm));
+    if (deflateInit2 (&strm, level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return FALSE;
+    strm.next_in = w->data;
+    strm.avail_in = (uInt)w->used;
+    strm.next_out = w->member + TAPE_Z_HDR;
+    strm.avail_out = TAPE_Z_MAXMEM - TAPE_Z_HDR - 8;
+    zr = deflate (&strm, Z_FINISH);
+    deflateEnd (&strm);
+    if (zr == Z_STREAM_END)
+        break;
+    if (level == Z_NO_COMPRESSION)                      /* stored data always fits */
+        return FALSE;
+    }
+csize = TAPE_Z_HDR + (uint32)strm.total_out + 8;
+memset (w->member, 0, TAPE_Z_HDR);
+memcpy (w->member, tape_z_magic, sizeof (tape_z_magic));
+w->member[9] = 0xFF;                                    /* OS: unknown */
+w->member[10] = 6;                                      /* XLEN */
+w->member[12] = 'B';
+w->member[13] = 'C';
+w->member[14] = 2;                                      /* SLEN */
+w->member[16] = (uint8)(csize - 1);                     /* BSIZE */
+w->member[17] = (uint8)((csize - 1) >> 8);
+tape_z_put32 (w->member + csize - 8, (uint32)crc32 (crc32 (0L, Z_NULL, 0), w->data, (uInt)w->used));
+tape_z_put32 (w->member + csize - 4, (uint32)w->used);
+w->used = 0;
+return (csize == fwrite (w->member, 1, csize, w->f));
+#else
+return FALSE;
+#endif
+}
+
+static t_bool sim_tape_z_fwrite (struct tape_z_writer *w, const uint8 *buf, size_t len)
+{
+size_t xfer;
+
+while (len > 0) {
+    xfer = sizeof (w->data) - w->used;
+    if (xfer > len)
+        xfer = len;
+    memcpy (w->data + w->used, buf, xfer);
+    w->used += xfer;
+    buf += xfer;
+    len -= xfer;
+    if ((w->used == sizeof (w->data)) && !sim_tape_z_flush (w))
+        return FALSE;
+    }
+return TRUE;
+}
+
 static t_offset sim_tape_size (UNIT *uptr)
 {
+struct tape_context *ctx = (struct tape_context *)uptr->tape_ctx;
+
+if ((ctx != NULL) && (ctx->z != NULL))
+    return (t_offset)ctx->z->size;                      /* Compressed images: expanded size */
 if (MT_GET_FMT (uptr) < MTUF_F_ANSI)
     return sim_fsize_ex (uptr->fileref); /* True on-disk tape images: file size  */
 return uptr->tape_eom;                   /* Virtual tape images: record/TM count */
@@ -1269,7 +1919,7 @@ switch (f) {                                       /* otherwise the read method
 
         do {                                            /* loop until a record, gap, or error is seen */
             if (bufcntr == bufcap) {                    /* if the buffer is empty then refill it */
-                if (feof (uptr->fileref)) {             /* if we hit the EOF while reading a gap */
+                if (sim_tape_feof (uptr)) {             /* if we hit the EOF while reading a gap */
                     if (sizeof_gap > 0)                 /*   then if detection is enabled */
                         status = MTSE_RUNAWAY;          /*     then report a tape runaway */
                     else                                /*   otherwise report the physical EOF */
@@ -1284,12 +1934,12 @@ switch (f) {                                       /* otherwise the read method
                     bufcap = sizeof (buffer)            /*   to the full size of the buffer */
                                / sizeof (buffer [0]);
 
-                bufcap = sim_fread (buffer,             /* fill the buffer */
-                                    sizeof (t_mtrlnt),  /*   with tape metadata */
-                                    bufcap,
-                                    uptr->fileref);
+                bufcap = sim_tape_fread (buffer,        /* fill the buffer */
+                                         sizeof (t_mtrlnt), /* with tape metadata */
+                                         bufcap,
+                                         uptr);
 
-                if (ferror (uptr->fileref)) {           /* if a file I/O error occurred */
+                if (sim_tape_ferror (uptr)) {           /* if a file I/O error occurred */
                     if (bufcntr == 0)                   /*   then if this is the initial read */
                         MT_SET_PNU (uptr);              /*     then set position not updated */
 
@@ -1372,12 +2022,12 @@ switch (f) {                                       /* otherwise the read method
                 break;
                 }
 
-            (void)sim_fread (&rev_lnt,                  /* get the reverse length */
-                             sizeof (t_mtrlnt),
-                             1,
-                             uptr->fileref);
+            (void)sim_tape_fread (&rev_lnt,             /* get the reverse length */
+                                  sizeof (t_mtrlnt),
+                                  1,
+                                  uptr);
 
-            if (ferror (uptr->fileref)) {               /* if a file I/O error occurred */
+            if (sim_tape_ferror (uptr)) {               /* if a file I/O error occurred */
                 status = sim_tape_ioerr (uptr);         /* report the error and quit */
                 break;
                 }
@@ -1393,17 +2043,17 @@ switch (f) {                                       /* otherwise the read method
         break;                                          /* otherwise the operation succeeded */
 
     case MTUF_F_TPC:
-        (void)sim_fread (&tpcbc, sizeof (t_tpclnt), 1, uptr->fileref);
+        (void)sim_tape_fread (&tpcbc, sizeof (t_tpclnt), 1, uptr);
         *bc = (t_mtrlnt)tpcbc;                          /* save rec lnt */
 
-        if (ferror (uptr->fileref)) {                   /* error? */
+        if (sim_tape_ferror (uptr)) {                   /* error? */
             MT_SET_PNU (uptr);                          /* pos not upd */
             status = sim_tape_ioerr (uptr);
             }
         else {
-            if ((feof (uptr->fileref)) ||               /* eof? */
+            if ((sim_tape_feof (uptr)) ||               /* eof? */
                 ((tpcbc == TPC_EOM) &&
-                 (sim_fsize (uptr->fileref) == (uint32)sim_ftell (uptr->fileref)))) {
+                 (sim_tape_size (uptr) == (t_offset)sim_tape_ftell (uptr)))) {
                 MT_SET_PNU (uptr);                      /* pos not upd */
                 status = MTSE_EOM;
                 }
@@ -1419,14 +2069,14 @@ switch (f) {                                       /* otherwise the read method
 
     case MTUF_F_P7B:
         for (sbc = 0, all_eof = 1; ; sbc++) {           /* loop thru record */
-            (void)sim_fread (&c, sizeof (uint8), 1, uptr->fileref);
+            (void)sim_tape_fread (&c, sizeof (uint8), 1, uptr);
 
-            if (ferror (uptr->fileref)) {               /* error? */
+            if (sim_tape_ferror (uptr)) {               /* error? */
                 MT_SET_PNU (uptr);                      /* pos not upd */
                 status = sim_tape_ioerr (uptr);
                 break;
                 }
-            else if (feof (uptr->fileref)) {            /* eof? */
+            else if (sim_tape_feof (uptr)) {            /* eof? */
                 if (sbc == 0)                           /* no data? eom */
                     status = MTSE_EOM;
                 break;                                  /* treat like eor */
@@ -1450,13 +2100,13 @@ switch (f) {                                       /* otherwise the read method
 
     case MTUF_F_AWS:
         memset (&awshdr, 0, sizeof (awshdr));
-        rdcnt = sim_fread (&awshdr, sizeof (t_awslnt), 3, uptr->fileref);
-        if (ferror (uptr->fileref)) {           /* error? */
+        rdcnt = sim_tape_fread (&awshdr, sizeof (t_awslnt), 3, uptr);
+        if (sim_tape_ferror (uptr)) {           /* error? */
             MT_SET_PNU (uptr);                  /* pos not upd */
             status = sim_tape_ioerr (uptr);
             break;
             }
-        if ((feof (uptr->fileref)) ||           /* eof? */
+        if ((sim_tape_feof (uptr)) ||           /* eof? */
             (rdcnt < 3)) {
             uptr->tape_eom = uptr->pos;
             MT_SET_PNU (uptr);                  /* pos not upd */
@@ -1480,9 +2130,9 @@ switch (f) {                                       /* otherwise the read method
         *bc = (t_mtrlnt)awshdr.nxtlen;          /* save rec lnt */
         uptr->pos += awshdr.nxtlen;             /* spc over record */
         memset (&awshdr, 0, sizeof (t_awslnt));
-        saved_pos = (t_addr)sim_ftell (uptr->fileref);/* save record data address */
+        saved_pos = (t_addr)sim_tape_ftell (uptr);/* save record data address */
         (void)sim_tape_seek (uptr, uptr->pos); /* for read */
-        rdcnt = sim_fread (&awshdr, sizeof (t_awslnt), 3, uptr->fileref);
+        rdcnt = sim_tape_fread (&awshdr, sizeof (t_awslnt), 3, uptr);
         if ((rdcnt == 3) &&
             ((awshdr.prelen != *bc) || ((awshdr.rectyp != AWS_REC) && (awshdr.rectyp != AWS_TMK)))) {
             status = MTSE_INVRL;
@@ -1542,6 +2192,7 @@ return status;
 static t_stat sim_tape_rdrlfwd (UNIT *uptr, t_mtrlnt *bc)
 {
 struct tape_context *ctx = (struct tape_context *)uptr->tape_ctx;
+t_addr from = uptr->pos;
 t_stat status;
 
 *bc = 0;
@@ -1552,6 +2203,18 @@ status = sim_tape_rdlntf (uptr, bc);                    /* read the record lengt
 
 sim_debug_unit (MTSE_DBG_STR, uptr, "rd_lntf: st: %d, lnt: %d, pos: %" T_ADDR_FMT "u\n", status, *bc, uptr->pos);
 
+if ((status == MTSE_OK) || (status == MTSE_TMK)) {      /* extend the record index */
+    t_addr start = from;
+
+    if (MT_GET_FMT (uptr) == MTUF_F_STD)                /* SIMH objects may follow an erase gap */
+        start = uptr->pos - ((status == MTSE_TMK) ? sizeof (t_mtrlnt) :
+                             2 * sizeof (t_mtrlnt) + ((MTR_L (*bc) + 1) & ~1));
+    else if (MT_GET_FMT (uptr) == MTUF_F_E11)           /*   as may E11 objects (unpadded) */
+        start = uptr->pos - ((status == MTSE_TMK) ? sizeof (t_mtrlnt) :
+                             2 * sizeof (t_mtrlnt) + MTR_L (*bc));
+    sim_tape_index_add (uptr, from, start, (status == MTSE_TMK));
+    }
+
 return status;
 }
 
@@ -1659,10 +2322,10 @@ switch (f) {                                            /* otherwise the read me
                     break;
                     }
 
-                bufcntr = sim_fread (buffer, sizeof (t_mtrlnt), /* fill the buffer */
-                                     bufcap, uptr->fileref);    /*   with tape metadata */
+                bufcntr = sim_tape_fread (buffer, sizeof (t_mtrlnt), /* fill the buffer */
+                                          bufcap, uptr);        /*   with tape metadata */
 
-                if (ferror (uptr->fileref)) {           /* if a file I/O error occurred */
+                if (sim_tape_ferror (uptr)) {           /* if a file I/O error occurred */
                     status = sim_tape_ioerr (uptr);     /*   then report the error and quit */
                     break;
                     }
@@ -1711,12 +2374,12 @@ switch (f) {                                            /* otherwise the read me
     case MTUF_F_TPC:
         ppos = sim_tape_tpc_fnd (uptr, (t_addr *) uptr->filebuf); /* find prev rec */
         (void)sim_tape_seek (uptr, ppos);               /* position */
-        (void)sim_fread (&tpcbc, sizeof (t_tpclnt), 1, uptr->fileref);
+        (void)sim_tape_fread (&tpcbc, sizeof (t_tpclnt), 1, uptr);
         *bc = (t_mtrlnt)tpcbc;                          /* save rec lnt */
 
-        if (ferror (uptr->fileref))                     /* error? */
+        if (sim_tape_ferror (uptr))                     /* error? */
             status = sim_tape_ioerr (uptr);
-        else if (feof (uptr->fileref))                  /* eof? */
+        else if (sim_tape_feof (uptr))                  /* eof? */
             status = MTSE_EOM;
         else {
             uptr->pos = ppos;                           /* spc over record */
@@ -1746,12 +2409,12 @@ switch (f) {                                            /* otherwise the read me
                         buf_offset -= BUF_SZ;
                         }
                     (void)sim_tape_seek (uptr, buf_offset);
-                    bytes_in_buf = sim_fread (buf, sizeof (uint8), read_size, uptr->fileref);
-                    if (ferror (uptr->fileref)) {       /* error? */
+                    bytes_in_buf = sim_tape_fread (buf, sizeof (uint8), read_size, uptr);
+                    if (sim_tape_ferror (uptr)) {       /* error? */
                         status = sim_tape_ioerr (uptr);
                         break;
                         }
-                    if (feof (uptr->fileref)) {         /* eof? */
+                    if (sim_tape_feof (uptr)) {         /* eof? */
                         status = MTSE_EOM;
                         break;
                         }
@@ -1783,14 +2446,14 @@ switch (f) {                                            /* otherwise the read me
                 break;
                 }
             memset (&awshdr, 0, sizeof (awshdr));
-            rdcnt = sim_fread (&awshdr, sizeof (t_awslnt), 3, uptr->fileref);
-            if (ferror (uptr->fileref)) {               /* error? */
+            rdcnt = sim_tape_fread (&awshdr, sizeof (t_awslnt), 3, uptr);
+            if (sim_tape_ferror (uptr)) {               /* error? */
                 status = sim_tape_ioerr (uptr);
                 break;
                 }
-            if (feof (uptr->fileref)) {                 /* eof? */
+            if (sim_tape_feof (uptr)) {                 /* eof? */
                 if ((uptr->pos > sizeof (t_awshdr)) &&
-                    (uptr->pos >= sim_fsize (uptr->fileref))) {
+                    (uptr->pos >= sim_tape_size (uptr))) {
                     uptr->tape_eom = uptr->pos;
                     (void)sim_tape_seek (uptr, uptr->pos - sizeof (t_awshdr));/* position */
                     continue;
@@ -1936,8 +2599,8 @@ if (rbc > max) {                                        /* rec out of range? */
     return MTSE_INVRL;
     }
 if (f < MTUF_F_ANSI) {
-    i = (t_mtrlnt) sim_fread (buf, sizeof (uint8), rbc, uptr->fileref); /* read record */
-    if (ferror (uptr->fileref)) {                           /* error? */
+    i = (t_mtrlnt) sim_tape_fread (buf, sizeof (uint8), rbc, uptr); /* read record */
+    if (sim_tape_ferror (uptr)) {                           /* error? */
         MT_SET_PNU (uptr);
         uptr->pos = opos;
         return sim_tape_ioerr (uptr);
@@ -2010,8 +2673,8 @@ if (st != MTSE_OK) {
 if (rbc > max)                                          /* rec out of range? */
     return MTSE_INVRL;
 if (f < MTUF_F_ANSI) {
-    i = (t_mtrlnt) sim_fread (buf, sizeof (uint8), rbc, uptr->fileref); /* read record */
-    if (ferror (uptr->fileref))                             /* error? */
+    i = (t_mtrlnt) sim_tape_fread (buf, sizeof (uint8), rbc, uptr); /* read record */
+    if (sim_tape_ferror (uptr))                             /* error? */
         return sim_tape_ioerr (uptr);
     }
 else {
@@ -2074,7 +2737,7 @@ if (sim_tape_wrp (uptr))                                /* write prot? */
     return MTSE_WRP;
 if (sbc == 0)                                           /* nothing to do? */
     return MTSE_OK;
-if (sim_tape_seek (uptr, uptr->pos))                    /* set pos */
+if (sim_tape_wrseek (uptr, uptr->pos))                  /* set pos */
     return MTSE_IOERR;
 switch (f) {                                            /* case on format */
 
@@ -2132,7 +2795,7 @@ size_t   rdcnt;
 t_bool   replacing_record;
 
 memset (&awshdr, 0, sizeof (t_awshdr));
-if (sim_tape_seek (uptr, uptr->pos))        /* set pos */
+if (sim_tape_wrseek (uptr, uptr->pos))      /* set pos */
     return MTSE_IOERR;
 rdcnt = sim_fread (&awshdr, sizeof (t_awslnt), 3, uptr->fileref);
 if (ferror (uptr->fileref)) {               /* error? */
@@ -2145,7 +2808,7 @@ if ((!sim_tape_bot (uptr)) &&
     MT_SET_PNU (uptr);                      /* pos not upd */
     return MTSE_INVRL;
     }
-if (sim_tape_seek (uptr, uptr->pos))        /* set pos */
+if (sim_tape_wrseek (uptr, uptr->pos))      /* set pos */
     return MTSE_IOERR;
 replacing_record = (awshdr.nxtlen == (t_awslnt)bc) && (awshdr.rectyp == (bc ? AWS_REC : AWS_TMK));
 awshdr.nxtlen = (t_awslnt)bc;
@@ -2180,7 +2843,7 @@ if (ctx == NULL)                                        /* if not properly attac
     return sim_messagef (SCPE_IERR, "Bad Attach\n");    /*   that's a problem */
 if (sim_tape_wrp (uptr))                                /* write prot? */
     return MTSE_WRP;
-(void)sim_tape_seek (uptr, uptr->pos);                  /* set pos */
+(void)sim_tape_wrseek (uptr, uptr->pos);                /* set pos */
 (void)sim_fwrite (&dat, sizeof (uint32), 1, uptr->fileref);
 if (ferror (uptr->fileref)) {                           /* error? */
     MT_SET_PNU (uptr);
@@ -2431,7 +3094,7 @@ else if (gap_size == 0 || format != MTUF_F_STD)         /* otherwise if zero len
 
 file_size = sim_fsize (uptr->fileref);                  /* get the file size */
 
-if (sim_tape_seek (uptr, uptr->pos)) {                  /* position the tape; if it fails */
+if (sim_tape_wrseek (uptr, uptr->pos)) {                /* position the tape; if it fails */
     MT_SET_PNU (uptr);                                  /*   then set position not updated */
     return sim_tape_ioerr (uptr);                       /*     and quit with I/O error status */
     }
@@ -2485,7 +3148,7 @@ do {
     else if (meta == MTR_FHGAP) {                       /* half gap? */
         uptr->pos = uptr->pos - meta_size / 2;          /* backup to resync */
 
-        if (sim_tape_seek (uptr, uptr->pos))            /* position the tape; if it fails */
+        if (sim_tape_wrseek (uptr, uptr->pos))          /* position the tape; if it fails */
             return sim_tape_ioerr (uptr);               /*   then quit with I/O error status */
 
         gap_alloc = gap_alloc + meta_size / 2;          /* allocate marker space */
@@ -2511,7 +3174,7 @@ do {
         if (rec_size < gap_needed + min_rec_size) {         /* rec too small? */
             uptr->pos = uptr->pos - meta_size + rec_size;   /* position past record */
 
-            if (sim_tape_seek (uptr, uptr->pos))            /* position the tape; if it fails */
+            if (sim_tape_wrseek (uptr, uptr->pos))          /* position the tape; if it fails */
                 return sim_tape_ioerr (uptr);               /*   then quit with I/O error status */
 
             gap_alloc = gap_alloc + rec_size;               /* allocate record */
@@ -2637,7 +3300,7 @@ if (gap_size == meta_size) {                            /* if the request is for
     else                                                /*   otherwise */
         uptr->pos -= meta_size;                         /*     back up the file pointer */
 
-    if (sim_tape_seek (uptr, uptr->pos))                /* position the tape; if it fails */
+    if (sim_tape_wrseek (uptr, uptr->pos))              /* position the tape; if it fails */
         return sim_tape_ioerr (uptr);                   /*   then quit with I/O error status */
 
     (void)sim_fread (&metadatum, meta_size, 1, uptr->fileref);/* read a metadatum */
@@ -2646,7 +3309,7 @@ if (gap_size == meta_size) {                            /* if the request is for
         return sim_tape_ioerr (uptr);                       /*   then report the error and quit */
 
     else if (metadatum == MTR_TMK)                          /* otherwise if a tape mark is present */
-        if (sim_tape_seek (uptr, uptr->pos))                /*   then reposition the tape; if it fails */
+        if (sim_tape_wrseek (uptr, uptr->pos))              /*   then reposition the tape; if it fails */
             return sim_tape_ioerr (uptr);                   /*     then quit with I/O error status */
 
         else {                                              /*   otherwise */
@@ -2870,6 +3533,8 @@ if (ctx == NULL)                                        /* if not properly attac
     return sim_messagef (SCPE_IERR, "Bad Attach\n");    /*   that's a problem */
 sim_debug_unit (ctx->dbit, uptr, "sim_tape_sprecsf(unit=%d, count=%d)\n", (int)(uptr-ctx->dptr->units), count);
 
+if (sim_tape_index_spacef (uptr, count, skipped, &st))  /* indexed? */
+    return st;
 while (*skipped < count) {                              /* loop */
     st = sim_tape_sprecf (uptr, &tbc);                  /* spc rec */
     if (st != MTSE_OK)
@@ -2967,6 +3632,8 @@ if (ctx == NULL)                                        /* if not properly attac
     return sim_messagef (SCPE_IERR, "Bad Attach\n");    /*   that's a problem */
 sim_debug_unit (ctx->dbit, uptr, "sim_tape_sprecsr(unit=%d, count=%d)\n", (int)(uptr-ctx->dptr->units), count);
 
+if (sim_tape_index_spacer (uptr, count, skipped, &st))  /* indexed? */
+    return st;
 while (*skipped < count) {                              /* loop */
     st = sim_tape_sprecr (uptr, &tbc);                  /* spc rec rev */
     if (st != MTSE_OK)
@@ -3341,6 +4008,8 @@ static t_stat sim_tape_ioerr (UNIT *uptr)
 {
 sim_printf ("%s: Magtape library I/O error: %s\n", sim_uname (uptr), strerror (errno));
 clearerr (uptr->fileref);
+if (uptr->tape_ctx)
+    ((struct tape_context *)uptr->tape_ctx)->ra_err = FALSE;
 return MTSE_IOERR;
 }
 
@@ -3383,7 +4052,11 @@ return sim_messagef (SCPE_ARG, "Unknown tape format: %s\n", cptr);
 
 t_stat sim_tape_show_fmt (FILE *st, UNIT *uptr, int32 val, CONST void *desc)
 {
+struct tape_context *ctx = (struct tape_context *)uptr->tape_ctx;
+
 fprintf (st, "%s format", _sim_tape_format_name (uptr));
+if ((ctx != NULL) && (ctx->z != NULL))
+    fprintf (st, ", compressed");
 return SCPE_OK;
 }
 
@@ -3405,11 +4078,11 @@ if ((uptr == NULL) || (uptr->fileref == NULL))
     return 0;
 countmap = (uint32 *)calloc (65536, sizeof(*countmap));
 recbuf = (uint8 *)malloc (65536);
-tape_size = (t_addr)sim_fsize (uptr->fileref);
+tape_size = (t_addr)sim_tape_size (uptr);
 sim_debug_unit (MTSE_DBG_STR, uptr, "tpc_map: tape_size: %" T_ADDR_FMT "u\n", tape_size);
 for (objc = 0, sizec = 0, tpos = 0;; ) {
     (void)sim_tape_seek (uptr, tpos);
-    i = sim_fread (&bc, sizeof (bc), 1, uptr->fileref);
+    i = sim_tape_fread (&bc, sizeof (bc), 1, uptr);
     if (i == 0)     /* past or at eof? */
         break;
     if (bc > 65535) /* Range check length value to satisfy Coverity */
@@ -3422,7 +4095,7 @@ for (objc = 0, sizec = 0, tpos = 0;; ) {
     if (bc) {
         sim_debug_unit (MTSE_DBG_STR, uptr, "tpc_map: %d byte count at pos: %" T_ADDR_FMT "u\n", bc, tpos);
         if (map && sim_deb && (dptr->dctrl & MTSE_DBG_STR)) {
-            (void)sim_fread (recbuf, 1, bc, uptr->fileref);
+            (void)sim_tape_fread (recbuf, 1, bc, uptr);
             sim_data_trace(dptr, uptr, (((uptr->dctrl | dptr->dctrl) & MTSE_DBG_DAT) ? recbuf : NULL), "", bc, "Data Record", MTSE_DBG_STR);
             }
         }
@@ -4210,6 +4883,241 @@ sprintf (name, "%s.aws.tape", filename);
 return SCPE_OK;
 }
 
+#define RA_TEST_RECORDS     2000
+#define RA_TEST_LARGE       1000                /* record that bypasses the buffer */
+
+static t_mtrlnt sim_tape_test_ra_size (uint32 rec)
+{
+if (rec == RA_TEST_LARGE)
+    return TAPE_RA_SIZE + 4096;
+return (t_mtrlnt)(((rec * 37) % 3000) + 1);
+}
+
+static t_stat sim_tape_test_ra_check (uint32 rec, const uint8 *buf, t_mtrlnt bc, uint8 fill)
+{
+t_mtrlnt i;
+
+if (bc != sim_tape_test_ra_size (rec))
+    return sim_messagef (SCPE_IERR, "Read-ahead record %u: length %u, expected %u\n", rec, bc, sim_tape_test_ra_size (rec));
+for (i = 0; i < bc; i++)
+    if (buf[i] != (uint8)(rec + i + fill))
+        return sim_messagef (SCPE_IERR, "Read-ahead record %u: data mismatch at byte %u\n", rec, i);
+return SCPE_OK;
+}
+
+static t_stat sim_tape_test_read_ahead (UNIT *uptr)
+{
+const char *filename = "TapeTestReadAhead.simh";
+char args[256];
+struct tape_context *ctx;
+uint8 *buf;
+t_mtrlnt bc, i;
+uint32 rec, skipped;
+t_stat stat = SCPE_OK;
+
+buf = (uint8 *)malloc (TAPE_RA_SIZE + 4096);
+if (buf == NULL)
+    return SCPE_MEM;
+sim_tape_detach (uptr);
+(void)remove (filename);
+sprintf (args, "SIMH %s", filename);
+sim_switches = SWMASK ('F') | SWMASK ('Q');
+stat = sim_tape_attach_ex (uptr, args, 0, 0);
+sim_switches = 0;
+if (stat != SCPE_OK) {
+    free (buf);
+    return stat;
+    }
+ctx = (struct tape_context *)uptr->tape_ctx;
+for (rec = 0; (stat == SCPE_OK) && (rec < RA_TEST_RECORDS); rec++) {
+    bc = sim_tape_test_ra_size (rec);
+    for (i = 0; i < bc; i++)
+        buf[i] = (uint8)(rec + i);
+    if (sim_tape_wrrecf (uptr, buf, bc) != MTSE_OK)
+        stat = sim_messagef (SCPE_IERR, "Read-ahead record %u: write failed\n", rec);
+    }
+if (stat == SCPE_OK)
+    (void)sim_tape_wrtmk (uptr);
+sim_tape_rewind (uptr);
+ctx->ra_fills = 0;
+for (rec = 0; (stat == SCPE_OK) && (rec < RA_TEST_RECORDS); rec++) {
+    if (sim_tape_rdrecf (uptr, buf, &bc, TAPE_RA_SIZE + 4096) != MTSE_OK)
+        stat = sim_messagef (SCPE_IERR, "Read-ahead record %u: forward read failed\n", rec);
+    else
+        stat = sim_tape_test_ra_check (rec, buf, bc, 0);
+    }
+if ((stat == SCPE_OK) && (sim_tape_rdrecf (uptr, buf, &bc, TAPE_RA_SIZE + 4096) != MTSE_TMK))
+    stat = sim_messagef (SCPE_IERR, "Read-ahead: tape mark not seen\n");
+if ((stat == SCPE_OK) && (ctx->ra_fills > 20))
+    stat = sim_messagef (SCPE_IERR, "Read-ahead: %u host reads for %u records\n", ctx->ra_fills, RA_TEST_RECORDS);
+if (stat == SCPE_OK)
+    (void)sim_tape_sprecr (uptr, &bc);                  /* back over the tape mark */
+ctx->ra_fills = 0;
+for (rec = RA_TEST_RECORDS; (stat == SCPE_OK) && (rec-- > 0); ) {
+    if (sim_tape_rdrecr (uptr, buf, &bc, TAPE_RA_SIZE + 4096) != MTSE_OK)
+        stat = sim_messagef (SCPE_IERR, "Read-ahead record %u: reverse read failed\n", rec);
+    else
+        stat = sim_tape_test_ra_check (rec, buf, bc, 0);
+    }
+if ((stat == SCPE_OK) && (ctx->ra_fills > 20))
+    stat = sim_messagef (SCPE_IERR, "Read-ahead: %u host reads for %u reversed records\n", ctx->ra_fills, RA_TEST_RECORDS);
+if (stat == SCPE_OK) {                                  /* rewrite a record that is buffered */
+    sim_tape_rewind (uptr);
+    (void)sim_tape_sprecsf (uptr, 5, &skipped);
+    bc = sim_tape_test_ra_size (5);
+    for (i = 0; i < bc; i++)
+        buf[i] = (uint8)(5 + i + 0x55);
+    if (sim_tape_wrrecf (uptr, buf, bc) != MTSE_OK)
+        stat = sim_messagef (SCPE_IERR, "Read-ahead record 5: rewrite failed\n");
+    }
+if (stat == SCPE_OK) {
+    sim_tape_rewind (uptr);
+    for (rec = 0; (stat == SCPE_OK) && (rec < 7); rec++) {
+        if (sim_tape_rdrecf (uptr, buf, &bc, TAPE_RA_SIZE + 4096) != MTSE_OK)
+            stat = sim_messagef (SCPE_IERR, "Read-ahead record %u: read after rewrite failed\n", rec);
+        else
+            stat = sim_tape_test_ra_check (rec, buf, bc, (rec == 5) ? 0x55 : 0);
+        }
+    }
+sim_tape_detach (uptr);
+(void)remove (filename);
+free (buf);
+return stat;
+}
+
+#define IDX_TEST_FILES      4
+#define IDX_TEST_RECORDS    300
+
+static const struct {
+    int                 op;
+    uint32              count;
+    } idx_test_ops[] = {
+    {0, 0},                                             /* rewind */
+    {1, 1000},                                          /* space records forward to a tape mark */
+    {1, 10},
+    {2, 5},                                             /* space records reverse */
+    {2, 1000},
+    {3, 2},                                             /* space files forward */
+    {1, 149},                                           /* up to the erase gap */
+    {1, 2},                                             /*   and across it */
+    {2, 3},
+    {4, 1},                                             /* space files reverse */
+    {3, 10},                                            /* to the end of the tape */
+    {4, 10},                                            /* back to BOT */
+    {5, 200},                                           /* position by file and record */
+    {2, 1000},
+    };
+
+static t_stat sim_tape_test_index_run (UNIT *uptr, t_bool indexed, t_stat *sts, uint32 *skips, t_addr *posns)
+{
+struct tape_context *ctx = (struct tape_context *)uptr->tape_ctx;
+uint32 saved_count = ctx->idx_count;
+uint32 i, files, recs, objs;
+
+for (i = 0; i < sizeof (idx_test_ops) / sizeof (idx_test_ops[0]); i++) {
+    if (!indexed)
+        ctx->idx_count = 0;
+    skips[i] = 0;
+    switch (idx_test_ops[i].op) {
+        case 0:
+            sts[i] = sim_tape_rewind (uptr);
+            break;
+        case 1:
+            sts[i] = sim_tape_sprecsf (uptr, idx_test_ops[i].count, &skips[i]);
+            break;
+        case 2:
+            sts[i] = sim_tape_sprecsr (uptr, idx_test_ops[i].count, &skips[i]);
+            break;
+        case 3:
+            sts[i] = sim_tape_spfilef (uptr, idx_test_ops[i].count, &skips[i]);
+            break;
+        case 4:
+            sts[i] = sim_tape_spfiler (uptr, idx_test_ops[i].count, &skips[i]);
+            break;
+        case 5:
+            sts[i] = sim_tape_position (uptr, MTPOS_M_REW, idx_test_ops[i].count, &recs, 1, &files, &objs);
+            skips[i] = objs;
+            break;
+        }
+    posns[i] = uptr->pos;
+    }
+if (!indexed)
+    ctx->idx_count = saved_count;
+return SCPE_OK;
+}
+
+static t_stat sim_tape_test_record_index (UNIT *uptr)
+{
+const char *filename = "TapeTestIndex.simh";
+char args[256];
+struct tape_context *ctx;
+uint8 buf[200];
+uint32 saved_dynflags = uptr->dynflags;
+uint32 f, rec, i, skipped, fills;
+t_stat sts[2][sizeof (idx_test_ops) / sizeof (idx_test_ops[0])];
+uint32 skips[2][sizeof (idx_test_ops) / sizeof (idx_test_ops[0])];
+t_addr posns[2][sizeof (idx_test_ops) / sizeof (idx_test_ops[0])];
+t_stat stat;
+
+sim_tape_detach (uptr);
+(void)remove (filename);
+sprintf (args, "SIMH %s", filename);
+sim_switches = SWMASK ('F') | SWMASK ('Q');
+stat = sim_tape_attach_ex (uptr, args, 0, 0);
+if (stat != SCPE_OK)
+    return stat;
+uptr->dynflags = (uptr->dynflags & ~MTVF_DENS_MASK) | (MT_DENS_1600 << UNIT_V_DF_TAPE);
+for (f = 0; (stat == SCPE_OK) && (f < IDX_TEST_FILES); f++) {
+    for (rec = 0; (stat == SCPE_OK) && (rec < IDX_TEST_RECORDS); rec++) {
+        if ((f == 2) && (rec == 150))                   /* an erase gap in the middle of a file */
+            (void)sim_tape_wrgap (uptr, 5);
+        memset (buf, (int)(f * IDX_TEST_RECORDS + rec), sizeof (buf));
+        if (sim_tape_wrrecf (uptr, buf, (t_mtrlnt)(100 + (rec % 50))) != MTSE_OK)
+            stat = sim_messagef (SCPE_IERR, "Index test: write of file %u record %u failed\n", f, rec);
+        }
+    (void)sim_tape_wrtmk (uptr);
+    }
+(void)sim_tape_wrtmk (uptr);
+sim_tape_detach (uptr);
+uptr->dynflags = saved_dynflags;
+if (stat != SCPE_OK)
+    return stat;
+sim_switches = SWMASK ('F') | SWMASK ('Q');             /* reattach: validation builds the index */
+stat = sim_tape_attach_ex (uptr, args, 0, 0);
+sim_switches = 0;
+if (stat != SCPE_OK)
+    return stat;
+ctx = (struct tape_context *)uptr->tape_ctx;
+if (ctx->idx_count != IDX_TEST_FILES * (IDX_TEST_RECORDS + 1) + 1)
+    stat = sim_messagef (SCPE_IERR, "Index test: %u objects indexed, expected %u\n",
+                                    ctx->idx_count, IDX_TEST_FILES * (IDX_TEST_RECORDS + 1) + 1);
+if (stat == SCPE_OK) {
+    sim_tape_test_index_run (uptr, TRUE, sts[0], skips[0], posns[0]);
+    sim_tape_test_index_run (uptr, FALSE, sts[1], skips[1], posns[1]);
+    for (i = 0; (stat == SCPE_OK) && (i < sizeof (idx_test_ops) / sizeof (idx_test_ops[0])); i++)
+        if ((sts[0][i] != sts[1][i]) || (skips[0][i] != skips[1][i]) || (posns[0][i] != posns[1][i]))
+            stat = sim_messagef (SCPE_IERR, "Index test: step %u indexed (%d, %u, %" T_ADDR_FMT "u) scanned (%d, %u, %" T_ADDR_FMT "u)\n",
+                                            i, sts[0][i], skips[0][i], posns[0][i], sts[1][i], skips[1][i], posns[1][i]);
+    }
+if (stat == SCPE_OK) {                                  /* indexed spacing needs no I/O */
+    sim_tape_rewind (uptr);
+    fills = ctx->ra_fills;
+    (void)sim_tape_spfilef (uptr, IDX_TEST_FILES, &skipped);
+    if ((skipped != IDX_TEST_FILES) || (ctx->ra_fills != fills))
+        stat = sim_messagef (SCPE_IERR, "Index test: spaced %u files with %u host reads\n", skipped, ctx->ra_fills - fills);
+    }
+if (stat == SCPE_OK) {                                  /* a write drops the entries beyond it */
+    sim_tape_rewind (uptr);
+    (void)sim_tape_spfilef (uptr, 1, &skipped);
+    (void)sim_tape_wrtmk (uptr);
+    if (ctx->idx_count != IDX_TEST_RECORDS + 1)
+        stat = sim_messagef (SCPE_IERR, "Index test: %u objects indexed after write, expected %u\n", ctx->idx_count, IDX_TEST_RECORDS + 1);
+    }
+sim_tape_detach (uptr);
+(void)remove (filename);
+return stat;
+}
+
 static t_stat sim_tape_test_density_string (void)
 {
 char buf[128];
@@ -4327,6 +5235,106 @@ for (t = classify_tests; t->testname != NULL; t++) {
 return SCPE_OK;
 }
 
+static t_stat sim_tape_test_compressed (UNIT *uptr)
+{
+#if defined(HAVE_ZLIB)
+const char *filename = "TapeTestCompressed.simh";
+const char *zfilename = "TapeTestCompressed.simh.gz";
+char args[256];
+struct tape_context *ctx;
+uint8 *buf;
+t_mtrlnt bc, i;
+uint32 rec, skipped, inflates;
+t_offset size, zsize;
+t_stat stat = SCPE_OK;
+
+buf = (uint8 *)malloc (TAPE_RA_SIZE + 4096);
+if (buf == NULL)
+    return SCPE_MEM;
+sim_tape_detach (uptr);
+(void)remove (filename);
+(void)remove (zfilename);
+sprintf (args, "SIMH %s", filename);
+sim_switches = SWMASK ('F') | SWMASK ('Q');
+stat = sim_tape_attach_ex (uptr, args, 0, 0);
+for (rec = 0; (stat == SCPE_OK) && (rec < RA_TEST_RECORDS); rec++) {
+    bc = sim_tape_test_ra_size (rec);
+    for (i = 0; i < bc; i++)
+        buf[i] = (uint8)(rec + i);
+    if (sim_tape_wrrecf (uptr, buf, bc) != MTSE_OK)
+        stat = sim_messagef (SCPE_IERR, "Compressed record %u: write failed\n", rec);
+    if ((stat == SCPE_OK) && (rec == RA_TEST_RECORDS / 2 - 1))
+        (void)sim_tape_wrtmk (uptr);
+    }
+if (stat == SCPE_OK)
+    (void)sim_tape_wrtmk (uptr);
+sim_tape_detach (uptr);
+if (stat == SCPE_OK) {                                  /* export a compressed copy */
+    sprintf (args, "SIMH %s %s", zfilename, filename);
+    sim_switches = SWMASK ('F') | SWMASK ('Q') | SWMASK ('X') | SWMASK ('Z');
+    stat = sim_tape_attach_ex (uptr, args, 0, 0);
+    sim_tape_detach (uptr);
+    }
+if (stat == SCPE_OK) {
+    sprintf (args, "SIMH %s", zfilename);
+    sim_switches = SWMASK ('F') | SWMASK ('Q');
+    stat = sim_tape_attach_ex (uptr, args, 0, 0);
+    }
+sim_switches = 0;
+if (stat != SCPE_OK) {
+    free (buf);
+    (void)remove (filename);
+    (void)remove (zfilename);
+    return stat;
+    }
+ctx = (struct tape_context *)uptr->tape_ctx;
+size = sim_fsize_name_ex (filename);
+zsize = sim_fsize_ex (uptr->fileref);
+if ((ctx->z == NULL) || !sim_tape_wrp (uptr))
+    stat = sim_messagef (SCPE_IERR, "Compressed: image not recognized or not read only\n");
+else if ((sim_tape_size (uptr) != size) || (zsize >= size))
+    stat = sim_messagef (SCPE_IERR, "Compressed: %u byte image, expected %u, compressed to %u\n",
+                                    (uint32)sim_tape_size (uptr), (uint32)size, (uint32)zsize);
+inflates = (stat == SCPE_OK) ? ctx->z->inflates : 0;
+for (rec = 0; (stat == SCPE_OK) && (rec < RA_TEST_RECORDS); rec++) {
+    if ((rec == RA_TEST_RECORDS / 2) && (sim_tape_rdrecf (uptr, buf, &bc, TAPE_RA_SIZE + 4096) != MTSE_TMK))
+        stat = sim_messagef (SCPE_IERR, "Compressed: tape mark not seen\n");
+    else if (sim_tape_rdrecf (uptr, buf, &bc, TAPE_RA_SIZE + 4096) != MTSE_OK)
+        stat = sim_messagef (SCPE_IERR, "Compressed record %u: forward read failed\n", rec);
+    else
+        stat = sim_tape_test_ra_check (rec, buf, bc, 0);
+    }
+if ((stat == SCPE_OK) && (ctx->z->inflates - inflates > 2 * ctx->z->count))
+    stat = sim_messagef (SCPE_IERR, "Compressed: %u members inflated reading %u\n", ctx->z->inflates - inflates, ctx->z->count);
+for (rec = RA_TEST_RECORDS; (stat == SCPE_OK) && (rec-- > 0); ) {
+    if (sim_tape_rdrecr (uptr, buf, &bc, TAPE_RA_SIZE + 4096) != MTSE_OK)
+        stat = sim_messagef (SCPE_IERR, "Compressed record %u: reverse read failed\n", rec);
+    else
+        stat = sim_tape_test_ra_check (rec, buf, bc, 0);
+    if ((stat == SCPE_OK) && (rec == RA_TEST_RECORDS / 2) && (sim_tape_rdrecr (uptr, buf, &bc, TAPE_RA_SIZE + 4096) != MTSE_TMK))
+        stat = sim_messagef (SCPE_IERR, "Compressed: tape mark not seen in reverse\n");
+    }
+if (stat == SCPE_OK) {                                  /* position directly into the second file */
+    sim_tape_rewind (uptr);
+    if ((sim_tape_spfilef (uptr, 1, &skipped) != MTSE_OK) ||
+        (sim_tape_sprecsf (uptr, 10, &skipped) != MTSE_OK) ||
+        (sim_tape_rdrecf (uptr, buf, &bc, TAPE_RA_SIZE + 4096) != MTSE_OK))
+        stat = sim_messagef (SCPE_IERR, "Compressed: spacing failed\n");
+    else
+        stat = sim_tape_test_ra_check (RA_TEST_RECORDS / 2 + 10, buf, bc, 0);
+    }
+if ((stat == SCPE_OK) && (sim_tape_wrrecf (uptr, buf, bc) != MTSE_WRP))
+    stat = sim_messagef (SCPE_IERR, "Compressed: write was not rejected\n");
+sim_tape_detach (uptr);
+(void)remove (filename);
+(void)remove (zfilename);
+free (buf);
+return stat;
+#else
+return SCPE_OK;
+#endif
+}
+
 
 #include <setjmp.h>
 
@@ -4345,6 +5353,16 @@ SIM_TEST(sim_tape_test_density_string ());
 
 SIM_TEST(sim_tape_test_classify_file_contents (dptr->units));
 
+SIM_TEST(sim_tape_test_read_ahead (dptr->units));
+
+sim_switches = saved_switches;
+SIM_TEST(sim_tape_test_record_index (dptr->units));
+
+sim_switches = saved_switches;
+SIM_TEST(sim_tape_test_compressed (dptr->units));
+
+sim_switches = saved_switches;
+
 SIM_TEST(sim_tape_test_remove_tape_files (dptr->units, "TapeTestFile1"));
 
 SIM_TEST(sim_tape_test_create_tape_files (dptr->units, "TapeTestFile1", 2, 5, 4096));
@@ -5063,11 +6081,30 @@ sprintf (FullPath, "%s%s", directory, filename);
 (void)ansi_add_file_to_tape (tape, FullPath);
 }
 
+/* Write export data, byte swapped as sim_fwrite would, to the file or compressor */
+
+static size_t sim_export_fwrite (const void *bptr, size_t size, size_t count, FILE *f, struct tape_z_writer *zw)
+{
+if (zw == NULL)
+    return sim_fwrite (bptr, size, count, f);
+if ((size > 1) && !sim_end) {
+    uint8 swapped[sizeof (t_mtrlnt)];
+
+    if ((count != 1) || (size > sizeof (swapped)))
+        return 0;
+    memcpy (swapped, bptr, size);
+    sim_buf_swap_data (swapped, size, 1);
+    return sim_tape_z_fwrite (zw, swapped, size) ? count : 0;
+    }
+return sim_tape_z_fwrite (zw, (const uint8 *)bptr, size * count) ? count : 0;
+}
+
 /* export an existing tape to a SIMH tape image */
 static t_stat sim_export_tape (UNIT *uptr, const char *export_file)
 {
 t_stat r;
 FILE *f;
+struct tape_z_writer *zw = NULL;
 t_addr saved_pos = uptr->pos;
 uint8 *buf = NULL;
 t_mtrlnt bc, sbc;
@@ -5078,9 +6115,24 @@ if ((export_file == NULL) || (*export_file == '\0'))
 f = fopen (export_file, "wb");
 if (f == NULL)
     return sim_messagef (SCPE_OPENERR, "Can't open SIMH tape image file: %s - %s\n", export_file, strerror (errno));
+if (sim_switches & SWMASK ('Z')) {                      /* compressed copy? */
+#if defined(HAVE_ZLIB)
+    zw = (struct tape_z_writer *)calloc (1, sizeof (*zw));
+    if (zw == NULL) {
+        fclose (f);
+        return SCPE_MEM;
+        }
+    zw->f = f;
+#else
+    fclose (f);
+    remove (export_file);
+    return sim_messagef (SCPE_NOFNC, "Compressed tape images require zlib support\n");
+#endif
+    }
 
 buf = (uint8 *)calloc (max, 1);
 if (buf == NULL) {
+    free (zw);
     fclose (f);
     return SCPE_MEM;
     }
@@ -5090,9 +6142,9 @@ while (r == SCPE_OK) {
     switch (r) {
         case MTSE_OK:
             sbc = ((bc + 1) & ~1);              /* word alignment for SIMH format data */
-            if ((1   != sim_fwrite (&bc, sizeof (bc),   1, f)) ||
-                (sbc != sim_fwrite (buf, 1,           sbc, f))         ||
-                (1   != sim_fwrite (&bc, sizeof (bc),   1, f)))
+            if ((1   != sim_export_fwrite (&bc, sizeof (bc),   1, f, zw)) ||
+                (sbc != sim_export_fwrite (buf, 1,           sbc, f, zw))         ||
+                (1   != sim_export_fwrite (&bc, sizeof (bc),   1, f, zw)))
                 r = sim_messagef (SCPE_IOERR, "Error writing file: %s - %s\n", export_file, strerror (errno));
             else
                 r = SCPE_OK;
@@ -5100,7 +6152,7 @@ while (r == SCPE_OK) {
 
         case MTSE_TMK:
             bc = 0;
-            if (1 != sim_fwrite (&bc, sizeof (bc), 1, f))
+            if (1 != sim_export_fwrite (&bc, sizeof (bc), 1, f, zw))
                 r = sim_messagef (SCPE_IOERR, "Error writing file: %s - %s\n", export_file, strerror (errno));
             else
                 r = SCPE_OK;
@@ -5112,6 +6164,13 @@ while (r == SCPE_OK) {
     }
 if (r == MTSE_EOM)
     r = SCPE_OK;
+if (zw != NULL) {                                       /* compressed? */
+    if ((r == SCPE_OK) &&                               /*   flush the remaining data */
+        (((zw->used > 0) && !sim_tape_z_flush (zw)) ||
+         !sim_tape_z_flush (zw)))                       /*   and write the EOF marker */
+        r = sim_messagef (SCPE_IOERR, "Error writing file: %s - %s\n", export_file, strerror (errno));
+    free (zw);
+    }
 free (buf);
 fclose (f);
 uptr->pos = saved_pos;
@@ -2282,6 +2282,21 @@ clock_gettime (CLOCK_REALTIME, &now);
 return _timespec_to_double (&now);
 }
 
+/* sim_os_nsec - host time in nanoseconds for measuring short intervals.
+   A monotonic clock is used where the host provides one. */
+
+double sim_os_nsec (void)
+{
+struct timespec now;
+
+#if defined (CLOCK_MONOTONIC) && !defined (_WIN32)
+clock_gettime (CLOCK_MONOTONIC, &now);
+#else
+clock_gettime (CLOCK_REALTIME, &now);
+#endif
+return (((double)now.tv_sec) * 1000000000.0) + now.tv_nsec;
+}
+
 #if defined(SIM_ASYNCH_CLOCKS)
 
 pthread_t           sim_timer_thread;           /* Wall Clock Timing Thread Id */